@@ -0,0 +1,137 @@
+#!/bin/bash
+# Released under MIT License.
+# Copyright (c) 2022 Ladislav Bartos
+
+# Benchmark of scramblyzer modules on synthetic membranes.
+# Usage: bench.sh PATH_TO_SCRAMBLYZER PATH_TO_GENERATOR
+#
+# Environment variables:
+#   SIZES       numbers of lipids of the generated membranes (default: "1000 4000 16000")
+#   FRAMES      number of frames of the generated trajectories (default: 501)
+#   FLIPS       number of flip-flop events in the generated trajectories (default: 10)
+#   BENCH_DIR   directory for the generated files (default: bench_data)
+
+scramblyzer=$(realpath "$1")
+generator=$(realpath "$2")
+sizes=${SIZES:-"1000 4000 16000"}
+frames=${FRAMES:-501}
+flips=${FLIPS:-10}
+bench_dir=${BENCH_DIR:-bench_data}
+
+# tolerance for the comparison of the scrambling rate with the ground truth [%]
+rate_tolerance=1.0
+
+mkdir -p "${bench_dir}" || exit 1
+cd "${bench_dir}" || exit 1
+
+# peak memory usage is only available with GNU time
+gnu_time=""
+if /usr/bin/time -f "%M" true > /dev/null 2>&1; then
+    gnu_time="/usr/bin/time"
+fi
+
+failed=0
+
+# runs a module and prints its performance; arguments: label, n_atoms, command...
+run_module() {
+    local label=$1
+    local n_atoms=$2
+    shift 2
+
+    local start end seconds rss
+    start=$(date +%s.%N)
+    if [ -n "${gnu_time}" ]; then
+        ${gnu_time} -f "%M" -o time.log "$@" > "${label}.log" 2>&1
+    else
+        "$@" > "${label}.log" 2>&1
+    fi
+    local status=$?
+    end=$(date +%s.%N)
+
+    if [ ${status} -ne 0 ]; then
+        printf "%-12s %8s   FAILED (see %s/%s.log)\n" "${label}" "${lipids}" "${bench_dir}" "${label}"
+        failed=1
+        return
+    fi
+
+    seconds=$(awk -v start="${start}" -v end="${end}" 'BEGIN { print end - start }')
+    rss="n/a"
+    [ -n "${gnu_time}" ] && rss=$(awk '{printf "%.1f", $1 / 1024}' time.log)
+
+    awk -v label="${label}" -v lipids="${lipids}" -v atoms="${n_atoms}" -v frames="${frames}" -v seconds="${seconds}" -v rss="${rss}" \
+        'BEGIN { printf "%-12s %8d %10d %8d %10.2f %12.1f %14.0f %10s\n", label, lipids, atoms, frames, seconds, frames / seconds, atoms * frames / seconds, rss }'
+}
+
+# compares the flip-flop table in the log with the ground truth
+check_flipflops() {
+    awk -F'|' '
+        FNR == NR && /^[A-Z0-9]+ *\|/ && $1 !~ /Lipid|TOTAL/ { gsub(/ /, "", $1); truth[$1] = $2 + 0 " " $3 + 0; next }
+        FNR != NR && /^[A-Z0-9]+ *\|/ && $1 !~ /Lipid|TOTAL/ { gsub(/ /, "", $1); found[$1] = $2 + 0 " " $3 + 0 }
+        END {
+            ok = 1
+            for (lipid in truth) {
+                if (found[lipid] != truth[lipid]) {
+                    printf "    %s: detected %s, expected %s (U->L L->U)\n", lipid, found[lipid], truth[lipid]
+                    ok = 0
+                }
+            }
+            exit !ok
+        }' "$1" "$2"
+}
+
+# compares the total percentage of scrambled lipids with the ground truth
+check_rate() {
+    awk -v tolerance="${rate_tolerance}" '
+        /^[#@]/ { next }
+        FNR == NR { truth[sprintf("%.3f", $1)] = $2; next }
+        {
+            time = sprintf("%.3f", $1)
+            if (!(time in truth)) next
+            difference = $NF - truth[time]
+            if (difference < 0) difference = -difference
+            if (difference > tolerance) {
+                printf "    time %s ns: detected %f %%, expected %f %%\n", time, $NF, truth[time]
+                mismatch = 1
+            }
+        }
+        END { exit mismatch }' "$1" "$2"
+}
+
+printf "%-12s %8s %10s %8s %10s %12s %14s %10s\n" "module" "lipids" "atoms" "frames" "time [s]" "frames/s" "atoms/s" "RSS [MB]"
+
+for lipids in ${sizes}; do
+    system="membrane_${lipids}"
+    "${generator}" -o "${system}" -n "${lipids}" -f "${frames}" -x "${flips}" > generate.log 2>&1 || { echo "Generation of ${system} failed."; exit 1; }
+    n_atoms=$(sed -n 2p "${system}.gro" | tr -d ' ')
+
+    run_module composition "${n_atoms}" "${scramblyzer}" composition -c "${system}.gro" -f "${system}.xtc" -o composition.xvg
+    run_module positions "${n_atoms}" "${scramblyzer}" positions -c "${system}.gro" -f "${system}.xtc" -o positions.xvg
+    run_module rate "${n_atoms}" "${scramblyzer}" rate -c "${system}.gro" -f "${system}.xtc" -o rate.xvg -t 1
+    run_module flipflops "${n_atoms}" "${scramblyzer}" flipflops -c "${system}.gro" -f "${system}.xtc"
+    run_module multi "${n_atoms}" "${scramblyzer}" multi -c "${system}.gro" -f "${system}.xtc" -m composition:1:multi_composition.xvg,rate:1:multi_rate.xvg,flipflops
+
+    if ! check_flipflops "${system}_flipflops_truth.txt" flipflops.log; then
+        echo "    flipflops: results do not match the ground truth"
+        failed=1
+    fi
+
+    if ! check_rate "${system}_rate_truth.xvg" rate.xvg; then
+        echo "    rate: results do not match the ground truth"
+        failed=1
+    fi
+
+    # xtc decoding throughput and bit-exactness with xdrfile (including frames with large coordinates)
+    if ! "${scramblyzer}" xtccheck "${system}.xtc" "${system}_xtc_stress.xtc" > xtccheck.log 2>&1; then
+        echo "    xtccheck: decoded frames do not match xdrfile"
+        failed=1
+    fi
+    # throughput is reported for the membrane trajectory only (the first file in the log)
+    awk '/^File/ { n_files++ } n_files == 1 && /MB\/s|speedup/' xtccheck.log | sed 's/^>>> */    xtc decoding, /'
+done
+
+if [ ${failed} -ne 0 ]; then
+    echo "Benchmark FAILED."
+    exit 1
+fi
+
+echo "All results match the ground truth."
@@ -0,0 +1,449 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+// Generator of synthetic membrane trajectories with a known schedule of flip-flop events.
+// Used by the benchmark suite (make bench) to measure the performance of scramblyzer and to check its results.
+
+#include <groan.h>
+#include <unistd.h>
+
+/*! @brief Number of beads of every generated lipid */
+#define LIPID_BEADS 12
+/*! @brief Maximal number of lipid types in the mixture */
+#define MAX_LIPID_TYPES 16
+
+/*! @brief Names of the lipid beads (Martini-like) */
+static const char BEAD_NAMES[LIPID_BEADS][5] = {"NC3", "PO4", "GL1", "GL2", "C1A", "D2A", "C3A", "C4A", "C1B", "C2B", "C3B", "C4B"};
+/*! @brief Distance of the lipid beads from the membrane center in the upper leaflet [nm] */
+static const float BEAD_Z[LIPID_BEADS] = {2.3, 2.0, 1.7, 1.7, 1.4, 1.1, 0.8, 0.5, 1.4, 1.1, 0.8, 0.5};
+/*! @brief Lateral offset of the lipid beads from the lipid position (x-axis) [nm] */
+static const float BEAD_X[LIPID_BEADS] = {0.0, 0.0, -0.1, 0.1, -0.15, -0.15, -0.15, -0.15, 0.15, 0.15, 0.15, 0.15};
+/*! @brief Index of the head bead (PO4) */
+static const int HEAD_BEAD = 1;
+
+/*! @brief Area per lipid [nm^2] */
+static const float AREA_PER_LIPID = 0.64;
+/*! @brief Number density of solvent beads [nm^-3] */
+static const float SOLVENT_DENSITY = 8.3;
+/*! @brief Minimal thickness of the box (membrane and a layer of solvent) [nm] */
+static const float MIN_BOX_HEIGHT = 8.0;
+/*! @brief Solvent is only placed further from the membrane center than this [nm] */
+static const float SOLVENT_EXCLUSION = 2.8;
+/*! @brief Amplitude of the random displacement of beads in every frame [nm] */
+static const float NOISE = 0.05;
+/*! @brief Flip-flops are completed at least this long before the end of the trajectory [ps] */
+static const float FLIP_MARGIN = 20000.0;
+/*! @brief Precision of the written xtc file */
+static const float XTC_PRECISION = 100.0;
+/*! @brief Number of atoms in the frames of the xtc stress trajectory */
+#define STRESS_ATOMS 3000
+/*! @brief Precision of the xtc stress trajectory */
+static const float STRESS_PRECISION = 1000.0;
+
+/*! @brief Single scheduled flip-flop event */
+typedef struct flip {
+    size_t lipid;
+    float start;                // time at which the lipid starts to move [ps]
+    float end;                  // time at which the lipid reaches the other leaflet [ps]
+} flip_t;
+
+/*! @brief Returns a random number from the interval [0, 1). */
+static inline float random_uniform(void)
+{
+    return (float) rand() / ((float) RAND_MAX + 1.0f);
+}
+
+/*! @brief Returns a random number from the interval [-amplitude, amplitude). */
+static inline float random_noise(const float amplitude)
+{
+    return (2.0f * random_uniform() - 1.0f) * amplitude;
+}
+
+/*! @brief Wraps a coordinate into the box. */
+static inline float wrap(float coordinate, const float box)
+{
+    while (coordinate < 0) coordinate += box;
+    while (coordinate >= box) coordinate -= box;
+    return coordinate;
+}
+
+void print_usage(const char *program_name)
+{
+    printf("Usage: %s OPTIONS\n", program_name);
+    printf("\nValid OPTIONS:\n");
+    printf("-h               print this message and exit\n");
+    printf("-o STRING        prefix of the output files (default: synthetic)\n");
+    printf("-n INTEGER       number of lipids (default: 1000)\n");
+    printf("-m STRING        lipid mixture as 'NAME:FRACTION,...' (default: POPC:0.7,POPE:0.3)\n");
+    printf("-w FLOAT         fraction of atoms that are solvent (default: 0.5)\n");
+    printf("-f INTEGER       number of frames (default: 501)\n");
+    printf("-d FLOAT         time between frames in ps (default: 100)\n");
+    printf("-x INTEGER       number of flip-flop events (default: 10)\n");
+    printf("-r FLOAT         duration of a single flip-flop event in ps (default: 4000)\n");
+    printf("-s INTEGER       seed of the random number generator (default: 42)\n");
+    printf("\n");
+}
+
+/*! @brief Writes a short trajectory whose frames exercise the rarely used paths of xtc compression.
+ *
+ * @paragraph Frames
+ * The coordinates of the generated membranes span only a few nm, so their compressed frames never contain
+ * large integers. The stress trajectory therefore contains (with precision of 0.001 nm):
+ * (0) a frame spanning more than 2^24 integer units along x, so that every coordinate is stored separately,
+ * (1) a frame spanning almost 2^24 units along each axis, so that each atom is packed into more than 64 bits,
+ * (2) a frame of tight clusters of 4 atoms 1 unit apart, so that runs of small differences use the smallest magic integer,
+ * (3) a random walk with steps of 0.8-2.5 million units along each axis; the first step is the shortest one, so that
+ * runs start at the ninth largest magic integer and grow to the largest one (xdrfile itself can not start higher).
+ * Atoms in frames 0 and 1 come in pairs, so that these frames also contain runs of small differences.
+ *
+ * @return Zero, if successful. Else non-zero.
+ */
+static int write_stress_trajectory(const char *filename)
+{
+    XDRFILE *xtc = xdrfile_open(filename, "w");
+    if (xtc == NULL) return 1;
+
+    rvec *coordinates = calloc(STRESS_ATOMS, sizeof(rvec));
+    const float extent[2][3] = {{20000.0, 50.0, 50.0}, {16000.0, 16000.0, 16000.0}};
+    int failed = 0;
+
+    for (int frame = 0; frame < 4 && !failed; ++frame) {
+        float box_size = 10.0;
+
+        for (size_t i = 0; i < STRESS_ATOMS; ++i) {
+            for (size_t d = 0; d < 3; ++d) {
+                switch (frame) {
+                // pairs of atoms at random positions in a huge box
+                case 0:
+                case 1:
+                    coordinates[i][d] = i % 2 ? coordinates[i - 1][d] + random_noise(0.1) : extent[frame][d] * random_uniform();
+                    box_size = extent[frame][0];
+                    break;
+                // clusters of 4 atoms with spacing of 0.001 nm
+                case 2:
+                    coordinates[i][d] = i % 4 ? coordinates[i - 1][d] + 0.001f * (rand() % 2) : box_size * random_uniform();
+                    break;
+                // random walk with steps of 0.8-2.5 um along each axis inside a box of 15 um
+                case 3: {
+                    box_size = 15000.0;
+                    if (i == 0) {
+                        coordinates[i][d] = box_size / 2;
+                        break;
+                    }
+
+                    float step = i == 1 ? 800.0f : 800.0f + 1700.0f * random_uniform();
+                    float previous = coordinates[i - 1][d];
+                    int forward = previous + step > box_size ? 0 : (previous - step < 0 ? 1 : rand() % 2);
+                    coordinates[i][d] = forward ? previous + step : previous - step;
+                    break;
+                }
+                }
+            }
+        }
+
+        matrix box = {{box_size, 0.0, 0.0}, {0.0, box_size, 0.0}, {0.0, 0.0, box_size}};
+        failed = write_xtc(xtc, STRESS_ATOMS, frame, frame, box, coordinates, STRESS_PRECISION) != 0;
+    }
+
+    xdrfile_close(xtc);
+    free(coordinates);
+    return failed;
+}
+
+/*! @brief Parses the lipid mixture. Returns the number of lipid types or zero in case of an error. */
+static size_t parse_mixture(const char *mixture, char names[MAX_LIPID_TYPES][6], float *fractions)
+{
+    char *copy = strdup(mixture);
+    size_t n_types = 0;
+    float sum = 0.0;
+
+    char *saveptr = NULL;
+    for (char *item = strtok_r(copy, ",", &saveptr); item != NULL; item = strtok_r(NULL, ",", &saveptr)) {
+        char *fraction = strchr(item, ':');
+        if (fraction == NULL || n_types >= MAX_LIPID_TYPES || strlen(item) - strlen(fraction) > 4 ||
+            sscanf(fraction + 1, "%f", &fractions[n_types]) != 1 || fractions[n_types] <= 0) {
+            fprintf(stderr, "Could not parse lipid mixture '%s'.\n", mixture);
+            free(copy);
+            return 0;
+        }
+
+        *fraction = '\0';
+        strcpy(names[n_types], item);
+        sum += fractions[n_types];
+        ++n_types;
+    }
+
+    for (size_t i = 0; i < n_types; ++i) fractions[i] /= sum;
+
+    free(copy);
+    return n_types;
+}
+
+/*! @brief Assigns lipid types to n_lipids lipids according to the fractions. The types are randomly shuffled. */
+static void assign_types(size_t *types, const size_t n_lipids, const float *fractions, const size_t n_types)
+{
+    size_t assigned = 0;
+    float cumulative = 0.0;
+    for (size_t i = 0; i < n_types; ++i) {
+        cumulative += fractions[i];
+        size_t until = (i == n_types - 1) ? n_lipids : (size_t) roundf(cumulative * n_lipids);
+        for (; assigned < until && assigned < n_lipids; ++assigned) types[assigned] = i;
+    }
+
+    for (size_t i = n_lipids - 1; i > 0; --i) {
+        size_t j = (size_t) (random_uniform() * (i + 1));
+        size_t tmp = types[i];
+        types[i] = types[j];
+        types[j] = tmp;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    char *prefix = "synthetic";
+    size_t n_lipids = 1000;
+    char *mixture = "POPC:0.7,POPE:0.3";
+    float solvent_fraction = 0.5;
+    int n_frames = 501;
+    float dt = 100.0;
+    size_t n_flips = 10;
+    float flip_duration = 4000.0;
+    unsigned int seed = 42;
+
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "o:n:m:w:f:d:x:r:s:h")) != -1) {
+        switch (opt) {
+        case 'o':
+            prefix = optarg;
+            break;
+        case 'n':
+            sscanf(optarg, "%zu", &n_lipids);
+            break;
+        case 'm':
+            mixture = optarg;
+            break;
+        case 'w':
+            sscanf(optarg, "%f", &solvent_fraction);
+            break;
+        case 'f':
+            sscanf(optarg, "%d", &n_frames);
+            break;
+        case 'd':
+            sscanf(optarg, "%f", &dt);
+            break;
+        case 'x':
+            sscanf(optarg, "%zu", &n_flips);
+            break;
+        case 'r':
+            sscanf(optarg, "%f", &flip_duration);
+            break;
+        case 's':
+            sscanf(optarg, "%u", &seed);
+            break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (n_lipids < 2 || n_frames < 1 || dt <= 0 || solvent_fraction < 0 || solvent_fraction >= 1 || flip_duration <= 0 || n_flips > n_lipids) {
+        fprintf(stderr, "Invalid options.\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    char names[MAX_LIPID_TYPES][6] = {{0}};
+    float fractions[MAX_LIPID_TYPES] = {0.0};
+    size_t n_types = parse_mixture(mixture, names, fractions);
+    if (n_types == 0) return 1;
+
+    float total_time = (n_frames - 1) * dt;
+    if (n_flips > 0 && total_time < flip_duration + 2 * FLIP_MARGIN) {
+        fprintf(stderr, "Trajectory is too short for flip-flops (at least %.0f ps needed).\n", flip_duration + 2 * FLIP_MARGIN);
+        return 1;
+    }
+
+    srand(seed);
+
+    // prepare the membrane: first half of the lipids is in the upper leaflet, second half in the lower leaflet
+    size_t n_upper = n_lipids / 2;
+    size_t n_lower = n_lipids - n_upper;
+    size_t *types = calloc(n_lipids, sizeof(size_t));
+    assign_types(types, n_upper, fractions, n_types);
+    assign_types(types + n_upper, n_lower, fractions, n_types);
+
+    float box_xy = sqrtf(n_lower * AREA_PER_LIPID);
+    size_t n_lipid_atoms = n_lipids * LIPID_BEADS;
+    size_t n_solvent = (size_t) roundf(solvent_fraction / (1.0f - solvent_fraction) * n_lipid_atoms);
+    float box_z = n_solvent / SOLVENT_DENSITY / (box_xy * box_xy) + 2 * SOLVENT_EXCLUSION;
+    if (box_z < MIN_BOX_HEIGHT) box_z = MIN_BOX_HEIGHT;
+    float center = box_z / 2.0f;
+    size_t n_atoms = n_lipid_atoms + n_solvent;
+
+    // lateral positions of the lipids on a square grid of each leaflet
+    vec_t *lipid_xy = calloc(n_lipids, sizeof(vec_t));
+    float *side = calloc(n_lipids, sizeof(float));     // +1 for the upper leaflet, -1 for the lower leaflet
+    for (size_t leaflet = 0; leaflet < 2; ++leaflet) {
+        size_t first = leaflet == 0 ? 0 : n_upper;
+        size_t count = leaflet == 0 ? n_upper : n_lower;
+        size_t grid = (size_t) ceilf(sqrtf((float) count));
+        float spacing = box_xy / grid;
+        for (size_t i = 0; i < count; ++i) {
+            lipid_xy[first + i][0] = (i % grid + 0.5f + 0.5f * leaflet) * spacing;
+            lipid_xy[first + i][1] = (i / grid + 0.5f + 0.5f * leaflet) * spacing;
+            side[first + i] = leaflet == 0 ? 1.0f : -1.0f;
+        }
+    }
+
+    // initial positions of solvent beads
+    rvec *solvent = calloc(n_solvent, sizeof(rvec));
+    float water_height = box_z - 2 * SOLVENT_EXCLUSION;
+    for (size_t i = 0; i < n_solvent; ++i) {
+        solvent[i][0] = random_uniform() * box_xy;
+        solvent[i][1] = random_uniform() * box_xy;
+        solvent[i][2] = wrap(center + SOLVENT_EXCLUSION + random_uniform() * water_height, box_z);
+    }
+
+    // schedule the flip-flops (every lipid flips at most once)
+    flip_t *flips = calloc(n_flips, sizeof(flip_t));
+    int *flipping = calloc(n_lipids, sizeof(int));
+    for (size_t i = 0; i < n_flips; ++i) {
+        size_t lipid = 0;
+        do {
+            lipid = (size_t) (random_uniform() * n_lipids);
+        } while (flipping[lipid]);
+
+        flipping[lipid] = 1;
+        flips[i].lipid = lipid;
+        flips[i].start = FLIP_MARGIN / 2 + random_uniform() * (total_time - flip_duration - 1.5f * FLIP_MARGIN);
+        flips[i].end = flips[i].start + flip_duration;
+    }
+
+    // write the ground truth for flip-flops
+    char filename[4096] = {0};
+    snprintf(filename, sizeof(filename), "%s_flipflops_truth.txt", prefix);
+    FILE *truth = fopen(filename, "w");
+    if (truth == NULL) {
+        fprintf(stderr, "Could not open output file %s\n", filename);
+        return 1;
+    }
+
+    fprintf(truth, "# Flip-flops scheduled by the generator (valid for temporal limits up to %.0f ns)\n", FLIP_MARGIN / 1000.0);
+    for (size_t i = 0; i < n_flips; ++i) {
+        fprintf(truth, "# lipid %zu (%s): %s, %.0f-%.0f ps\n", flips[i].lipid + 1, names[types[flips[i].lipid]],
+                side[flips[i].lipid] > 0 ? "U->L" : "L->U", flips[i].start, flips[i].end);
+    }
+    fprintf(truth, "Lipid | U->L | L->U | All \n");
+    for (size_t t = 0; t < n_types; ++t) {
+        size_t upper_lower = 0, lower_upper = 0;
+        for (size_t i = 0; i < n_flips; ++i) {
+            if (types[flips[i].lipid] != t) continue;
+            if (side[flips[i].lipid] > 0) ++upper_lower;
+            else ++lower_upper;
+        }
+        fprintf(truth, "%-5s | %-4zu | %-4zu | %-4zu\n", names[t], upper_lower, lower_upper, upper_lower + lower_upper);
+    }
+    fclose(truth);
+
+    // write the gro file
+    snprintf(filename, sizeof(filename), "%s.gro", prefix);
+    FILE *gro = fopen(filename, "w");
+    if (gro == NULL) {
+        fprintf(stderr, "Could not open output file %s\n", filename);
+        return 1;
+    }
+
+    fprintf(gro, "Synthetic membrane generated for scramblyzer benchmarks\n");
+    fprintf(gro, "%zu\n", n_atoms);
+    size_t atom = 0;
+    for (size_t i = 0; i < n_lipids; ++i) {
+        for (size_t b = 0; b < LIPID_BEADS; ++b, ++atom) {
+            fprintf(gro, "%5zu%-5s%5s%5zu%8.3f%8.3f%8.3f\n", (i + 1) % 100000, names[types[i]], BEAD_NAMES[b], (atom + 1) % 100000,
+                    wrap(lipid_xy[i][0] + BEAD_X[b], box_xy), lipid_xy[i][1], wrap(center + side[i] * BEAD_Z[b], box_z));
+        }
+    }
+    for (size_t i = 0; i < n_solvent; ++i, ++atom) {
+        fprintf(gro, "%5zu%-5s%5s%5zu%8.3f%8.3f%8.3f\n", (n_lipids + i + 1) % 100000, "W", "W", (atom + 1) % 100000,
+                solvent[i][0], solvent[i][1], solvent[i][2]);
+    }
+    fprintf(gro, "%10.5f%10.5f%10.5f\n", box_xy, box_xy, box_z);
+    fclose(gro);
+
+    // write the trajectory and the ground truth for the scrambling rate
+    snprintf(filename, sizeof(filename), "%s.xtc", prefix);
+    XDRFILE *xtc = xdrfile_open(filename, "w");
+    snprintf(filename, sizeof(filename), "%s_rate_truth.xvg", prefix);
+    FILE *rate = fopen(filename, "w");
+    if (xtc == NULL || rate == NULL) {
+        fprintf(stderr, "Could not open output files.\n");
+        return 1;
+    }
+
+    fprintf(rate, "# Percentage of scrambled lipids (all lipid types) scheduled by the generator\n");
+
+    matrix box = {{box_xy, 0.0, 0.0}, {0.0, box_xy, 0.0}, {0.0, 0.0, box_z}};
+    rvec *coordinates = calloc(n_atoms, sizeof(rvec));
+    float *orientation = calloc(n_lipids, sizeof(float));
+    for (int frame = 0; frame < n_frames; ++frame) {
+        float time = frame * dt;
+
+        // orientation of each lipid: +1 in the upper leaflet, -1 in the lower leaflet, in between while flipping
+        for (size_t i = 0; i < n_lipids; ++i) orientation[i] = side[i];
+        for (size_t i = 0; i < n_flips; ++i) {
+            float progress = (time - flips[i].start) / (flips[i].end - flips[i].start);
+            if (progress < 0) continue;
+            if (progress > 1) progress = 1;
+            orientation[flips[i].lipid] = side[flips[i].lipid] * (1.0f - 2.0f * progress);
+        }
+
+        size_t scrambled = 0;
+        atom = 0;
+        for (size_t i = 0; i < n_lipids; ++i) {
+            for (size_t b = 0; b < LIPID_BEADS; ++b, ++atom) {
+                coordinates[atom][0] = wrap(lipid_xy[i][0] + BEAD_X[b] + random_noise(NOISE), box_xy);
+                coordinates[atom][1] = wrap(lipid_xy[i][1] + random_noise(NOISE), box_xy);
+                coordinates[atom][2] = wrap(center + orientation[i] * BEAD_Z[b] + random_noise(NOISE), box_z);
+            }
+
+            // the lipid is scrambled once its head crosses the membrane center
+            float head = coordinates[atom - LIPID_BEADS + HEAD_BEAD][2] - center;
+            if (head * side[i] < 0) ++scrambled;
+        }
+
+        for (size_t i = 0; i < n_solvent; ++i, ++atom) {
+            coordinates[atom][0] = wrap(solvent[i][0] + random_noise(2 * NOISE), box_xy);
+            coordinates[atom][1] = wrap(solvent[i][1] + random_noise(2 * NOISE), box_xy);
+            coordinates[atom][2] = wrap(solvent[i][2] + random_noise(2 * NOISE), box_z);
+        }
+
+        if (write_xtc(xtc, (int) n_atoms, frame, time, box, coordinates, XTC_PRECISION) != 0) {
+            fprintf(stderr, "Could not write frame %d.\n", frame);
+            return 1;
+        }
+
+        fprintf(rate, "%f     %f\n", time / 1000.0, 100.0 * (float) scrambled / n_lipids);
+    }
+
+    xdrfile_close(xtc);
+    fclose(rate);
+
+    // trajectory for checking the xtc decoder of scramblyzer (module xtccheck)
+    snprintf(filename, sizeof(filename), "%s_xtc_stress.xtc", prefix);
+    if (write_stress_trajectory(filename) != 0) {
+        fprintf(stderr, "Could not write %s.\n", filename);
+        return 1;
+    }
+
+    printf("Generated %s: %zu lipids, %zu solvent beads, %zu atoms, %d frames, %zu flip-flops.\n",
+            prefix, n_lipids, n_solvent, n_atoms, n_frames, n_flips);
+
+    free(types);
+    free(lipid_xy);
+    free(side);
+    free(solvent);
+    free(flips);
+    free(flipping);
+    free(coordinates);
+    free(orientation);
+    return 0;
+}
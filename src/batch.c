@@ -0,0 +1,719 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#include <pthread.h>
+#include <sys/stat.h>
+#include "general.h"
+#include "batch.h"
+#include "rate.h"
+#include "flipflops.h"
+#include "leaflets.h"
+#include "trajectory.h"
+#include "threadpool.h"
+#include "topology.h"
+
+/*! @brief Maximal length of a line in the manifest file */
+#define MANIFEST_LINE_LENGTH 4096
+
+/*! @brief Results of the analysis of a single replica. */
+typedef struct replica {
+    char *gro_file;
+    char *xtc_file;
+    char *ndx_file;
+    size_t size;                // size of the xtc file in bytes (used for scheduling)
+    int failed;
+    size_t n_lipid_types;
+    char **lipid_types;
+    size_t n_frames;            // number of frames analyzed by the rate analysis
+    size_t allocated_frames;
+    float *times;               // time of each frame analyzed by the rate analysis [ps]
+    float *scrambled;           // percentage of scrambled lipids in each frame (n_lipid_types + 1 values per frame)
+    size_t *upper_lower;        // flip-flops of each lipid type
+    size_t *lower_upper;
+} replica_t;
+
+/*! @brief Data shared by all tasks of the batch analysis. */
+typedef struct batch {
+    replica_t *replicas;
+    const char *output_prefix;
+    const char *head_identifier;
+    float dt;
+    float spatial_limit;
+    int temporal_limit;
+    float leaflet_cutoff;
+    profile_t *profile;             // summed profile of all replicas
+    pthread_mutex_t setup_lock;     // groan functions used for reading input files are not guaranteed to be thread-safe
+    pthread_mutex_t print_lock;     // also protects the summed profile
+} batch_t;
+
+
+/*! @brief Reads the manifest file.
+ *
+ * @return Array of replicas. NULL in case of an error.
+ */
+static replica_t *read_manifest(const char *manifest_file, size_t *n_replicas)
+{
+    FILE *file = fopen(manifest_file, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open manifest file %s.\n", manifest_file);
+        return NULL;
+    }
+
+    *n_replicas = 0;
+    replica_t *replicas = NULL;
+
+    char line[MANIFEST_LINE_LENGTH];
+    size_t line_number = 0;
+    while (fgets(line, MANIFEST_LINE_LENGTH, file) != NULL) {
+        ++line_number;
+
+        // remove comments
+        char *comment = strchr(line, '#');
+        if (comment != NULL) *comment = '\0';
+
+        char *saveptr = NULL;
+        char *gro_file = strtok_r(line, " \t\n", &saveptr);
+        if (gro_file == NULL) continue;
+        char *xtc_file = strtok_r(NULL, " \t\n", &saveptr);
+        char *ndx_file = strtok_r(NULL, " \t\n", &saveptr);
+
+        if (xtc_file == NULL || strtok_r(NULL, " \t\n", &saveptr) != NULL) {
+            fprintf(stderr, "Could not parse line %zu of manifest file %s (expected 'gro_file xtc_file [ndx_file]').\n", line_number, manifest_file);
+            for (size_t i = 0; i < *n_replicas; ++i) {
+                free(replicas[i].gro_file);
+                free(replicas[i].xtc_file);
+                free(replicas[i].ndx_file);
+            }
+            free(replicas);
+            fclose(file);
+            return NULL;
+        }
+
+        replicas = realloc(replicas, (*n_replicas + 1) * sizeof(replica_t));
+        replica_t *replica = &replicas[*n_replicas];
+        memset(replica, 0, sizeof(replica_t));
+        replica->gro_file = strdup(gro_file);
+        replica->xtc_file = strdup(xtc_file);
+        replica->ndx_file = strdup(ndx_file == NULL ? "index.ndx" : ndx_file);
+
+        // the analysis of a replica takes time roughly proportional to the size of its trajectory
+        struct stat xtc_stat;
+        if (stat(xtc_file, &xtc_stat) == 0) replica->size = (size_t) xtc_stat.st_size;
+
+        ++(*n_replicas);
+    }
+
+    fclose(file);
+
+    if (*n_replicas == 0) {
+        fprintf(stderr, "No replicas found in manifest file %s.\n", manifest_file);
+        return NULL;
+    }
+
+    return replicas;
+}
+
+/*! @brief Deallocates memory for all replicas. */
+static void destroy_replicas(replica_t *replicas, const size_t n_replicas)
+{
+    for (size_t i = 0; i < n_replicas; ++i) {
+        free(replicas[i].gro_file);
+        free(replicas[i].xtc_file);
+        free(replicas[i].ndx_file);
+        lipid_names_destroy(replicas[i].lipid_types, replicas[i].n_lipid_types);
+        free(replicas[i].times);
+        free(replicas[i].scrambled);
+        free(replicas[i].upper_lower);
+        free(replicas[i].lower_upper);
+    }
+
+    free(replicas);
+}
+
+/*! @brief Stores the results of the rate analysis for the current frame. */
+static void replica_add_frame(replica_t *replica, const rate_analysis_t *analysis)
+{
+    size_t n_values = replica->n_lipid_types + 1;
+
+    if (replica->n_frames >= replica->allocated_frames) {
+        replica->allocated_frames = replica->allocated_frames == 0 ? 64 : 2 * replica->allocated_frames;
+        replica->times = realloc(replica->times, replica->allocated_frames * sizeof(float));
+        replica->scrambled = realloc(replica->scrambled, replica->allocated_frames * n_values * sizeof(float));
+    }
+
+    replica->times[replica->n_frames] = analysis->time;
+    memcpy(replica->scrambled + replica->n_frames * n_values, analysis->scrambled, n_values * sizeof(float));
+    ++replica->n_frames;
+}
+
+/*! @brief Analyzes the trajectory of a single replica. Returns zero if successful, else non-zero. */
+static int analyze_replica(batch_t *batch, replica_t *replica, const size_t index)
+{
+    // read input files
+    pthread_mutex_lock(&batch->setup_lock);
+
+    system_t *system = NULL;
+    lipid_composition_t *composition = topology_load(replica->gro_file, replica->ndx_file, batch->head_identifier, &system);
+
+    pthread_mutex_unlock(&batch->setup_lock);
+
+    if (composition == NULL) return 1;
+
+    if (composition->n_lipid_types < 1) {
+        fprintf(stderr, "No usable lipids detected in %s.\n", replica->gro_file);
+        lipid_composition_destroy(composition);
+        free(system);
+        return 1;
+    }
+
+    // remember the lipid composition for the aggregation of results
+    replica->n_lipid_types = composition->n_lipid_types;
+    replica->lipid_types = calloc(composition->n_lipid_types, sizeof(char *));
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        replica->lipid_types[i] = strdup(composition->lipid_types[i]);
+    }
+
+    // prepare output file for the rate analysis
+    size_t name_length = strlen(batch->output_prefix) + 32;
+    char *output_file = calloc(name_length, 1);
+    snprintf(output_file, name_length, "%s_rate_%03zu.xvg", batch->output_prefix, index + 1);
+
+    FILE *output = fopen(output_file, "w");
+    if (output == NULL) {
+        fprintf(stderr, "Could not open output file %s\n", output_file);
+        free(output_file);
+        lipid_composition_destroy(composition);
+        free(system);
+        return 1;
+    }
+
+    rate_analysis_t *rate = rate_analysis_create(composition);
+    rate_write_header(output, rate, replica->xtc_file);
+    flipflops_analysis_t *flipflops = flipflops_analysis_create(composition, batch->spatial_limit, batch->temporal_limit);
+
+    // the clustering classifier carries leaflet labels from one classified frame to the next,
+    // so the rate and flipflops analyses only share it if they analyze the same frames (see assign_classifiers() in multi.c)
+    const int rate_step = (int) roundf(batch->dt * 1000);
+    const int shared = batch->leaflet_cutoff <= 0 || rate_step == 1000;
+    leaflet_classifier_t *rate_leaflets = leaflet_classifier_create(composition, batch->leaflet_cutoff);
+    leaflet_classifier_t *flipflops_leaflets = shared ? rate_leaflets : leaflet_classifier_create(composition, batch->leaflet_cutoff);
+    if (rate_leaflets == NULL || flipflops_leaflets == NULL) {
+        leaflet_classifier_destroy(rate_leaflets);
+        if (!shared) leaflet_classifier_destroy(flipflops_leaflets);
+        rate_analysis_destroy(rate);
+        flipflops_analysis_destroy(flipflops);
+        lipid_composition_destroy(composition);
+        free(system);
+        free(output_file);
+        fclose(output);
+        return 1;
+    }
+
+    trajectory_t *traj = trajectory_open(replica->xtc_file, system->n_atoms);
+    if (traj == NULL || !trajectory_validate(traj)) {
+        fprintf(stderr, "File %s could not be read as an xtc file or does not match %s.\n", replica->xtc_file, replica->gro_file);
+        rate_analysis_destroy(rate);
+        flipflops_analysis_destroy(flipflops);
+        leaflet_classifier_destroy(rate_leaflets);
+        if (!shared) leaflet_classifier_destroy(flipflops_leaflets);
+        lipid_composition_destroy(composition);
+        free(system);
+        free(output_file);
+        fclose(output);
+        trajectory_close(traj);
+        return 1;
+    }
+
+    // each replica is profiled separately and merged into the summed profile at the end
+    profile_t *profile = NULL;
+    if (batch->profile != NULL && batch->profile->enabled) {
+        profile = profile_create(1, NULL);
+        profile->progress = 0;
+    }
+
+    int return_code = 0;
+    while (return_code == 0 && trajectory_next(traj) == 0) {
+        int rate_due = ((int) traj->time % rate_step == 0);
+        // flip-flops are always analyzed every nanosecond
+        int flipflops_due = ((int) traj->time % 1000 == 0);
+
+        // frames that are not analyzed are skipped without decompression
+        if (!rate_due && !flipflops_due) {
+            if (profile_skip(profile, traj) != 0) break;
+            continue;
+        }
+
+        if (profile_read(profile, traj, system) != 0) break;
+
+        vec_t membrane_center = {0.0};
+        profile_begin(profile);
+        lipid_composition_update(composition, system->box);
+        center_of_geometry(composition->all_lipid_atoms, membrane_center, system->box);
+        profile_end(profile, PROFILE_CENTER);
+
+        // each classifier only classifies the frames of its own analysis;
+        // if clustering fails before the leaflets have ever been identified, the analysis is not performed for this frame
+        int rate_unavailable = 0, flipflops_unavailable = 0;
+        profile_begin(profile);
+        if (rate_due) {
+            int unassigned = leaflet_classifier_classify(rate_leaflets, membrane_center, system->box);
+            rate_unavailable = unassigned && !rate_leaflets->initialized;
+        }
+        if (flipflops_due) {
+            if (shared && rate_due) {
+                flipflops_unavailable = rate_unavailable;
+            } else {
+                int unassigned = leaflet_classifier_classify(flipflops_leaflets, membrane_center, system->box);
+                flipflops_unavailable = unassigned && !flipflops_leaflets->initialized;
+            }
+        }
+        profile_end(profile, PROFILE_LEAFLETS);
+
+        // the reference frame of the rate analysis must be classified
+        if (rate_due && rate_unavailable && rate->frame == 0) {
+            fprintf(stderr, "Could not identify membrane leaflets in the first analyzed frame of %s.\n", replica->xtc_file);
+            return_code = 1;
+            continue;
+        }
+
+        rate_due &= !rate_unavailable;
+        flipflops_due &= !flipflops_unavailable;
+
+        profile_begin(profile);
+        if (rate_due) {
+            rate_analysis_frame(rate, rate_leaflets, system->box, system->time);
+            replica_add_frame(replica, rate);
+        }
+
+        if (flipflops_due) return_code = flipflops_analysis_frame(flipflops, flipflops_leaflets, membrane_center, system->box, system->time);
+        profile_end(profile, PROFILE_ANALYSIS);
+
+        if (rate_due) {
+            profile_begin(profile);
+            rate_write_frame(output, rate);
+            profile_end(profile, PROFILE_OUTPUT);
+        }
+    }
+
+    if (profile != NULL) {
+        pthread_mutex_lock(&batch->print_lock);
+        profile_merge(batch->profile, profile);
+        pthread_mutex_unlock(&batch->print_lock);
+        profile_destroy(profile);
+    }
+
+    fclose(output);
+
+    // write table of flip-flops
+    snprintf(output_file, name_length, "%s_flipflops_%03zu.txt", batch->output_prefix, index + 1);
+    if (return_code == 0) {
+        if ((output = fopen(output_file, "w")) == NULL) {
+            fprintf(stderr, "Could not open output file %s\n", output_file);
+            return_code = 1;
+        } else {
+            fprintf(output, "# Generated with Scramblyzer Batch from file %s\n", replica->xtc_file);
+            flipflops_write_table(output, flipflops);
+            fclose(output);
+        }
+    }
+
+    // remember the flip-flop counters for the aggregation of results
+    replica->upper_lower = calloc(composition->n_lipid_types, sizeof(size_t));
+    replica->lower_upper = calloc(composition->n_lipid_types, sizeof(size_t));
+    memcpy(replica->upper_lower, flipflops->upper_lower, composition->n_lipid_types * sizeof(size_t));
+    memcpy(replica->lower_upper, flipflops->lower_upper, composition->n_lipid_types * sizeof(size_t));
+
+    free(output_file);
+    rate_analysis_destroy(rate);
+    flipflops_analysis_destroy(flipflops);
+    leaflet_classifier_destroy(rate_leaflets);
+    if (!shared) leaflet_classifier_destroy(flipflops_leaflets);
+    lipid_composition_destroy(composition);
+    free(system);
+    trajectory_close(traj);
+
+    return return_code;
+}
+
+/*! @brief Task of the thread pool: analyzes a single replica. */
+static void replica_task(size_t index, size_t thread, void *data)
+{
+    batch_t *batch = (batch_t *) data;
+    replica_t *replica = &batch->replicas[index];
+
+    replica->failed = analyze_replica(batch, replica, index);
+
+    pthread_mutex_lock(&batch->print_lock);
+    if (replica->failed) {
+        printf("Replica %03zu (%s) could not be analyzed.\n", index + 1, replica->xtc_file);
+    } else {
+        printf("Replica %03zu (%s) analyzed by thread %zu.\n", index + 1, replica->xtc_file, thread);
+    }
+    fflush(stdout);
+    pthread_mutex_unlock(&batch->print_lock);
+}
+
+/*! @brief Checks whether two replicas contain the same lipid types. */
+static int same_composition(const replica_t *a, const replica_t *b)
+{
+    if (a->n_lipid_types != b->n_lipid_types) return 0;
+
+    for (size_t i = 0; i < a->n_lipid_types; ++i) {
+        if (strcmp(a->lipid_types[i], b->lipid_types[i])) return 0;
+    }
+
+    return 1;
+}
+
+/*! @brief Calculates the mean and the standard error of the mean. */
+static void mean_and_error(const float *values, const size_t n_values, float *mean, float *error)
+{
+    double sum = 0.0;
+    for (size_t i = 0; i < n_values; ++i) sum += values[i];
+    *mean = (float) (sum / n_values);
+
+    if (n_values < 2) {
+        *error = 0.0;
+        return;
+    }
+
+    double sum_squares = 0.0;
+    for (size_t i = 0; i < n_values; ++i) sum_squares += (values[i] - *mean) * (values[i] - *mean);
+    *error = (float) sqrt(sum_squares / (n_values - 1) / n_values);
+}
+
+/*! @brief Writes the scrambling rate averaged over all included replicas. */
+static int write_aggregated_rate(const char *output_file, const replica_t *replicas, const size_t n_replicas, const int *included)
+{
+    FILE *output = fopen(output_file, "w");
+    if (output == NULL) {
+        fprintf(stderr, "Could not open output file %s\n", output_file);
+        return 1;
+    }
+
+    // the longest included replica defines the time axis
+    const replica_t *reference = NULL;
+    for (size_t i = 0; i < n_replicas; ++i) {
+        if (included[i] && (reference == NULL || replicas[i].n_frames > reference->n_frames)) reference = &replicas[i];
+    }
+
+    size_t n_lipid_types = reference->n_lipid_types;
+
+    fprintf(output, "# Generated with Scramblyzer Batch\n");
+    fprintf(output, "@    title \"Percentage of scrambled lipids in time (mean over replicas)\"\n");
+    fprintf(output, "@    xaxis label \"time [ns]\"\n");
+    fprintf(output, "@    yaxis label \"scrambled lipids [%%]\"\n");
+    size_t set = 0;
+    for (size_t i = 0; i < n_lipid_types + 1; ++i) {
+        // don't print TOTAL if there is only one lipid species
+        if (n_lipid_types < 2 && i == n_lipid_types) break;
+
+        const char *name = i < n_lipid_types ? reference->lipid_types[i] : "TOTAL";
+        fprintf(output, "@    s%zu legend \"%s_mean\"\n", set++, name);
+        fprintf(output, "@    s%zu legend \"%s_error\"\n", set++, name);
+    }
+    fprintf(output, "@    s%zu legend \"replicas\"\n", set);
+    fprintf(output, "@TYPE xy\n");
+
+    float *values = calloc(n_replicas, sizeof(float));
+    for (size_t frame = 0; frame < reference->n_frames; ++frame) {
+        float time = reference->times[frame];
+
+        fprintf(output, "%f     ", time / 1000.0);
+
+        size_t n_values = 0;
+        for (size_t i = 0; i < n_lipid_types + 1; ++i) {
+            if (n_lipid_types < 2 && i == n_lipid_types) break;
+
+            // only replicas containing a frame with the same time are used
+            n_values = 0;
+            for (size_t r = 0; r < n_replicas; ++r) {
+                if (!included[r] || replicas[r].n_frames <= frame || replicas[r].times[frame] != time) continue;
+                values[n_values++] = replicas[r].scrambled[frame * (n_lipid_types + 1) + i];
+            }
+
+            float mean = 0.0, error = 0.0;
+            mean_and_error(values, n_values, &mean, &error);
+            fprintf(output, "%f     %f     ", mean, error);
+        }
+
+        fprintf(output, "%zu\n", n_values);
+    }
+
+    free(values);
+    fclose(output);
+    return 0;
+}
+
+/*! @brief Writes the table of flip-flops aggregated over all included replicas. */
+static void write_aggregated_flipflops(FILE *output, const replica_t *replicas, const size_t n_replicas, const int *included)
+{
+    const replica_t *reference = NULL;
+    size_t n_included = 0;
+    for (size_t i = 0; i < n_replicas; ++i) {
+        if (!included[i]) continue;
+        if (reference == NULL) reference = &replicas[i];
+        ++n_included;
+    }
+
+    size_t n_lipid_types = reference->n_lipid_types;
+    float *values = calloc(n_replicas, sizeof(float));
+
+    fprintf(output, "Flip-flops aggregated over %zu replicas (sums; mean and standard error of All per replica):\n", n_included);
+    fprintf(output, "Lipid | U->L | L->U | All  | Mean     | Error    \n");
+    for (size_t i = 0; i < n_lipid_types + 1; ++i) {
+        if (n_lipid_types < 2 && i == n_lipid_types) break;
+        if (i == n_lipid_types) fprintf(output, "-----------------------------------------------\n");
+
+        size_t upper_lower = 0, lower_upper = 0, n_values = 0;
+        for (size_t r = 0; r < n_replicas; ++r) {
+            if (!included[r]) continue;
+
+            size_t replica_upper_lower = 0, replica_lower_upper = 0;
+            for (size_t j = 0; j < n_lipid_types; ++j) {
+                // TOTAL sums all lipid types
+                if (i < n_lipid_types && j != i) continue;
+                replica_upper_lower += replicas[r].upper_lower[j];
+                replica_lower_upper += replicas[r].lower_upper[j];
+            }
+
+            upper_lower += replica_upper_lower;
+            lower_upper += replica_lower_upper;
+            values[n_values++] = (float) (replica_upper_lower + replica_lower_upper);
+        }
+
+        float mean = 0.0, error = 0.0;
+        mean_and_error(values, n_values, &mean, &error);
+        fprintf(output, "%-5s | %-4zu | %-4zu | %-4zu | %-8.3f | %-8.3f\n",
+                i < n_lipid_types ? reference->lipid_types[i] : "TOTAL",
+                upper_lower, lower_upper, upper_lower + lower_upper, mean, error);
+    }
+
+    free(values);
+}
+
+/*! @brief Prints supported flags and arguments of this module */
+void print_usage_batch(void)
+{
+    printf("\nValid OPTIONS for the batch module:\n");
+    printf("-h               print this message and exit\n");
+    printf("-m STRING        manifest file with one replica per line ('gro_file xtc_file [ndx_file]')\n");
+    printf("-o STRING        prefix of the output files (default: batch)\n");
+    printf("-p STRING        selection of lipid head identifiers (default: name PO4)\n");
+    printf("-t FLOAT         time interval between frames analyzed by the rate analysis in ns (default: 10.0)\n");
+    printf("-s FLOAT         spatial limit for the flip-flop analysis in nm (default: 1.5)\n");
+    printf("-e INTEGER       temporal limit for the flip-flop analysis in ns (default: 10)\n");
+    printf("-l FLOAT         identify leaflets by clustering lipid heads closer than FLOAT nm (optional)\n");
+    printf("-j INTEGER       number of threads to use (default: number of processors)\n");
+    printf("\n");
+}
+
+int get_arguments_batch(
+        const int argc,
+        char **argv,
+        char **manifest_file,
+        char **output_prefix,
+        char **phosphates,
+        float *dt,
+        float *spatial_limit,
+        int *temporal_limit,
+        float *leaflet_cutoff,
+        size_t *n_threads)
+{
+    int manifest_specified = 0;
+
+    int opt = 0;
+    while((opt = getopt(argc - 1, argv + 1, "m:o:p:t:s:e:l:j:h")) != -1) {
+        switch (opt) {
+        // help
+        case 'h':
+            return 1;
+        // manifest file
+        case 'm':
+            *manifest_file = optarg;
+            manifest_specified = 1;
+            break;
+        // prefix of output files
+        case 'o':
+            *output_prefix = optarg;
+            break;
+        // phosphates identifier
+        case 'p':
+            *phosphates = optarg;
+            break;
+        // dt of the rate analysis
+        case 't':
+            if (sscanf(optarg, "%f", dt) != 1 || *dt <= 0) {
+                fprintf(stderr, "dt must be positive.\n");
+                return 1;
+            }
+            break;
+        // spatial limit for flipflops
+        case 's':
+            sscanf(optarg, "%f", spatial_limit);
+            if (*spatial_limit < 0) {
+                fprintf(stderr, "Spatial limit must be non-negative.\n");
+                return 1;
+            }
+            break;
+        // temporal limit for flipflops
+        case 'e':
+            sscanf(optarg, "%d", temporal_limit);
+            if (*temporal_limit <= 0) {
+                fprintf(stderr, "Temporal limit must be positive.\n");
+                return 1;
+            }
+            break;
+        // leaflet clustering cutoff
+        case 'l':
+            if (sscanf(optarg, "%f", leaflet_cutoff) != 1 || *leaflet_cutoff <= 0) {
+                fprintf(stderr, "Leaflet clustering cutoff must be a positive number.\n");
+                return 1;
+            }
+            break;
+        // number of threads
+        case 'j':
+            if (sscanf(optarg, "%zu", n_threads) != 1 || *n_threads < 1) {
+                fprintf(stderr, "Number of threads must be a positive integer.\n");
+                return 1;
+            }
+            break;
+        default:
+            return 1;
+        }
+    }
+
+    if (!manifest_specified) {
+        fprintf(stderr, "Manifest file must always be supplied.\n");
+        return 1;
+    }
+
+    // frames are selected by their time in ps
+    if (roundf(*dt * 1000) < 1) {
+        fprintf(stderr, "dt must be at least 0.001 ns.\n");
+        return 1;
+    }
+    return 0;
+}
+
+/* Prints arguments that the program will use for the calculation. */
+static void print_arguments_batch(
+        const char *manifest_file,
+        const size_t n_replicas,
+        const char *output_prefix,
+        const char *phosphates,
+        const float dt,
+        const float spatial_limit,
+        const int temporal_limit,
+        const float leaflet_cutoff,
+        const size_t n_threads)
+{
+    printf("Parameters for Batch Analysis:\n");
+    printf(">>> manifest file:    %s (%zu replicas)\n", manifest_file, n_replicas);
+    printf(">>> output prefix:    %s\n", output_prefix);
+    printf(">>> lipid heads:      %s\n", phosphates);
+    printf(">>> time step:        %f ns\n", dt);
+    printf(">>> spatial limit:    %f nm\n", spatial_limit);
+    printf(">>> temporal limit:   %d ns\n", temporal_limit);
+    if (leaflet_cutoff > 0) printf(">>> leaflet cutoff:   %f nm\n", leaflet_cutoff);
+    printf(">>> threads:          %zu\n", n_threads);
+    printf("\n");
+}
+
+int calc_batch(
+        const char *manifest_file,
+        const char *output_prefix,
+        const char *head_identifier,
+        const float dt,
+        const float spatial_limit,
+        const int temporal_limit,
+        const float leaflet_cutoff,
+        const size_t n_threads,
+        profile_t *profile)
+{
+    size_t n_replicas = 0;
+    replica_t *replicas = read_manifest(manifest_file, &n_replicas);
+    if (replicas == NULL) return 1;
+
+    print_arguments_batch(manifest_file, n_replicas, output_prefix, head_identifier, dt, spatial_limit, temporal_limit, leaflet_cutoff, n_threads);
+
+    batch_t batch = {
+        .replicas = replicas,
+        .output_prefix = output_prefix,
+        .head_identifier = head_identifier,
+        .dt = dt,
+        .spatial_limit = spatial_limit,
+        .temporal_limit = temporal_limit,
+        .leaflet_cutoff = leaflet_cutoff,
+        .profile = profile,
+    };
+    pthread_mutex_init(&batch.setup_lock, NULL);
+    pthread_mutex_init(&batch.print_lock, NULL);
+
+    // balance the work by the size of the trajectories
+    size_t *weights = calloc(n_replicas, sizeof(size_t));
+    for (size_t i = 0; i < n_replicas; ++i) weights[i] = replicas[i].size;
+
+    thread_pool_run(n_threads, n_replicas, weights, replica_task, &batch);
+
+    free(weights);
+    pthread_mutex_destroy(&batch.setup_lock);
+    pthread_mutex_destroy(&batch.print_lock);
+
+    // select replicas for aggregation; all must have the same lipid composition as the first successfully analyzed replica
+    int return_code = 0;
+    int *included = calloc(n_replicas, sizeof(int));
+    const replica_t *reference = NULL;
+    size_t n_included = 0;
+    for (size_t i = 0; i < n_replicas; ++i) {
+        if (replicas[i].failed) {
+            return_code = 1;
+            continue;
+        }
+
+        if (reference == NULL) reference = &replicas[i];
+        if (!same_composition(reference, &replicas[i])) {
+            fprintf(stderr, "Warning. Lipid composition of replica %03zu (%s) differs from replica %03zu. It will not be included in the aggregated results.\n",
+                    i + 1, replicas[i].xtc_file, (size_t) (reference - replicas) + 1);
+            continue;
+        }
+
+        included[i] = 1;
+        ++n_included;
+    }
+
+    if (n_included == 0) {
+        fprintf(stderr, "No replica has been successfully analyzed.\n");
+        free(included);
+        destroy_replicas(replicas, n_replicas);
+        return 1;
+    }
+
+    size_t name_length = strlen(output_prefix) + 32;
+    char *output_file = calloc(name_length, 1);
+
+    snprintf(output_file, name_length, "%s_rate.xvg", output_prefix);
+    if (write_aggregated_rate(output_file, replicas, n_replicas, included) != 0) return_code = 1;
+    else printf("\nOutput file %s written.\n", output_file);
+
+    snprintf(output_file, name_length, "%s_flipflops.txt", output_prefix);
+    FILE *output = fopen(output_file, "w");
+    if (output == NULL) {
+        fprintf(stderr, "Could not open output file %s\n", output_file);
+        return_code = 1;
+    } else {
+        write_aggregated_flipflops(output, replicas, n_replicas, included);
+        fclose(output);
+        printf("Output file %s written.\n", output_file);
+    }
+
+    printf("\n");
+    write_aggregated_flipflops(stdout, replicas, n_replicas, included);
+    profile_report(profile);
+
+    free(output_file);
+    free(included);
+    destroy_replicas(replicas, n_replicas);
+
+    return return_code;
+}
@@ -0,0 +1,68 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <groan.h>
+#include <unistd.h>
+#include "profile.h"
+
+/*! @brief Prints supported flags and arguments of this module */
+void print_usage_batch(void);
+
+
+/*! @brief Parses command line arguments for the batch module.
+ *
+ * @return Zero, if parsing has been successful. Else returns non-zero.
+ */
+int get_arguments_batch(
+        const int argc,
+        char **argv,
+        char **manifest_file,
+        char **output_prefix,
+        char **phosphates,
+        float *dt,
+        float *spatial_limit,
+        int *temporal_limit,
+        float *leaflet_cutoff,
+        size_t *n_threads);
+
+
+/*! @brief Calculates scrambling rate and flip-flops for many replicas of the same system and aggregates the results.
+ *
+ * @paragraph Manifest
+ * The manifest file contains one replica per line in format 'gro_file xtc_file [ndx_file]'. If the ndx file
+ * is not provided, 'index.ndx' is used. Empty lines and comments starting with '#' are ignored.
+ *
+ * @paragraph Scheduling
+ * Replicas are analyzed in parallel using a work-stealing thread pool (see thread_pool_run()).
+ * The work is balanced by the size of the xtc files, not by the number of replicas.
+ *
+ * @paragraph Output
+ * For each replica, the scrambling rate is written into '{output_prefix}_rate_{NNN}.xvg' and the table of flip-flops
+ * into '{output_prefix}_flipflops_{NNN}.txt', where NNN is the (1-based) position of the replica in the manifest.
+ * The scrambling rate averaged over all replicas (mean and standard error) is written into '{output_prefix}_rate.xvg'
+ * and the table of flip-flops aggregated over all replicas is written into '{output_prefix}_flipflops.txt' and into stdout.
+ * The results are aggregated in memory. Replicas with a lipid composition different from the first successfully analyzed
+ * replica are not included in the aggregated results.
+ *
+ * @paragraph Profiling
+ * If profiling is enabled in 'profile', each replica is profiled separately and the stage times, frame counts
+ * and bytes read are summed over all replicas in the final report. Progress of individual replicas and per-frame
+ * traces are not reported in batch mode.
+ *
+ * @return Zero, if all replicas have been successfully analyzed. Else non-zero.
+ */
+int calc_batch(
+        const char *manifest_file,
+        const char *output_prefix,
+        const char *head_identifier,
+        const float dt,
+        const float spatial_limit,
+        const int temporal_limit,
+        const float leaflet_cutoff,
+        const size_t n_threads,
+        profile_t *profile);
+
+#endif /* BATCH_H */
@@ -0,0 +1,80 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#include <math.h>
+#include "blocking.h"
+
+/*! @brief Minimal number of blocks for the standard error of a block size to be considered */
+static const uint64_t BLOCKING_MIN_BLOCKS = 16;
+
+void blocking_add(blocking_t *blocking, const double value)
+{
+    double block = value;
+
+    for (size_t k = 0; k < BLOCKING_MAX_LEVELS; ++k) {
+        blocking_level_t *level = &blocking->levels[k];
+
+        // Welford's update of the mean and of the sum of squared deviations
+        level->n_blocks += 1;
+        double delta = block - level->mean;
+        level->mean += delta / level->n_blocks;
+        level->m2 += delta * (block - level->mean);
+
+        // the first block of a pair waits for its neighbor
+        if (!level->has_pending) {
+            level->pending = block;
+            level->has_pending = 1;
+            return;
+        }
+
+        block = 0.5 * (level->pending + block);
+        level->has_pending = 0;
+    }
+}
+
+/*! @brief Calculates the standard error of the mean from the block averages of a single level. */
+static inline double level_error(const blocking_level_t *level)
+{
+    if (level->n_blocks < 2) return 0.0;
+    return sqrt(level->m2 / (level->n_blocks - 1) / level->n_blocks);
+}
+
+blocking_estimate_t blocking_estimate(const blocking_t *blocking)
+{
+    const blocking_level_t *values = &blocking->levels[0];
+    blocking_estimate_t estimate = {0};
+
+    estimate.n_samples = values->n_blocks;
+    estimate.mean = values->mean;
+    estimate.inefficiency = 1.0;
+    estimate.block_size = 1;
+    if (values->n_blocks < 2) return estimate;
+
+    estimate.std_dev = sqrt(values->m2 / (values->n_blocks - 1));
+    double naive_error = level_error(values);
+    estimate.std_error = naive_error;
+
+    // levels with too few blocks are too noisy to be used
+    size_t n_levels = 0;
+    while (n_levels < BLOCKING_MAX_LEVELS && blocking->levels[n_levels].n_blocks >= BLOCKING_MIN_BLOCKS) ++n_levels;
+
+    for (size_t k = 0; k < n_levels; ++k) {
+        const blocking_level_t *level = &blocking->levels[k];
+        double error = level_error(level);
+        estimate.std_error = error;
+        estimate.block_size = (uint64_t) 1 << k;
+
+        if (k + 1 < n_levels) {
+            double uncertainty = error / sqrt(2.0 * (level->n_blocks - 1));
+            if (level_error(&blocking->levels[k + 1]) - error <= uncertainty) {
+                estimate.converged = 1;
+                break;
+            }
+        }
+    }
+
+    // constant series are trivially uncorrelated
+    if (naive_error > 0.0) estimate.inefficiency = (estimate.std_error * estimate.std_error) / (naive_error * naive_error);
+
+    return estimate;
+}
@@ -0,0 +1,68 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef BLOCKING_H
+#define BLOCKING_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*! @brief Maximal number of blocking levels (series of up to 2^BLOCKING_MAX_LEVELS values can be analyzed) */
+#define BLOCKING_MAX_LEVELS 40
+
+/*! @brief Running statistics of block averages of a single block size. */
+typedef struct blocking_level {
+    uint64_t n_blocks;          // number of completed blocks
+    double mean;                // mean of the block averages
+    double m2;                  // sum of squared deviations of the block averages from their mean
+    double pending;             // average of the last block that has not been paired with the next block yet
+    int has_pending;            // is there a pending block?
+} blocking_level_t;
+
+/*! @brief Streaming statistics of a time series. See blocking_add() for more details.
+ * Contains no pointers, so it can be copied and stored in checkpoints as it is. Zero-initialized structure is empty.
+ */
+typedef struct blocking {
+    blocking_level_t levels[BLOCKING_MAX_LEVELS];   // level k contains averages of blocks of 2^k consecutive values
+} blocking_t;
+
+/*! @brief Result of the blocking analysis. See blocking_estimate() for more details. */
+typedef struct blocking_estimate {
+    uint64_t n_samples;         // number of values in the series
+    double mean;                // mean of the series
+    double std_dev;             // standard deviation of the series
+    double std_error;           // standard error of the mean corrected for correlations
+    double inefficiency;        // statistical inefficiency (number of consecutive values equivalent to one independent value)
+    uint64_t block_size;        // size of the blocks the standard error was obtained from
+    int converged;              // non-zero, if the standard error reached a plateau
+} blocking_estimate_t;
+
+
+/*! @brief Adds a value of the time series.
+ *
+ * @paragraph Algorithm
+ * Mean and variance of the values are accumulated using Welford's algorithm (level 0). Every two consecutive
+ * values are averaged and passed as a single value to the next level, where the same is repeated for blocks
+ * of 2, 4, 8, ... values (hierarchical blocking of Flyvbjerg and Petersen). Only the running statistics and
+ * at most one pending block of every level are kept, so the series is never stored and the memory does not
+ * depend on the length of the series. Adding a value is O(1) amortized.
+ */
+void blocking_add(blocking_t *blocking, const double value);
+
+
+/*! @brief Estimates the standard error of the mean of the series.
+ *
+ * @paragraph Plateau
+ * For correlated values, the standard error calculated from blocks grows with the block size until the blocks
+ * become independent. The standard error is taken from the smallest block size for which doubling the block size
+ * does not increase the standard error by more than its own uncertainty (SE / sqrt(2 (n - 1)), n being the number
+ * of blocks). Only block sizes with at least 16 blocks are considered. If no plateau is reached, the standard error
+ * of the largest considered block size is reported (as a lower bound) and 'converged' is zero.
+ *
+ * @paragraph Statistical inefficiency
+ * Statistical inefficiency is the ratio of the squared standard error to the squared standard error expected
+ * for uncorrelated values (n_samples / inefficiency is the number of effectively independent values).
+ */
+blocking_estimate_t blocking_estimate(const blocking_t *blocking);
+
+#endif /* BLOCKING_H */
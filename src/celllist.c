@@ -0,0 +1,144 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#include "celllist.h"
+
+cell_list_t *cell_list_create(void)
+{
+    return calloc(1, sizeof(cell_list_t));
+}
+
+/*! @brief Converts position along a single dimension into a cell index (wrapping the position into the box). */
+static inline size_t cell_index_1D(const float position, const float box_length, const float cell_size, const size_t n_cells)
+{
+    float wrapped = position - box_length * floorf(position / box_length);
+    size_t index = (size_t) (wrapped / cell_size);
+    // protects against rounding errors at the edge of the box
+    if (index >= n_cells) index = n_cells - 1;
+    return index;
+}
+
+size_t cell_list_locate(const cell_list_t *list, const vec_t position, const box_t box)
+{
+    size_t ix = cell_index_1D(position[0], box[0], list->cell_size[0], list->n_cells[0]);
+    size_t iy = cell_index_1D(position[1], box[1], list->cell_size[1], list->n_cells[1]);
+    size_t iz = 0;
+    if (list->n_cells[2] > 1) iz = cell_index_1D(position[2], box[2], list->cell_size[2], list->n_cells[2]);
+
+    return (iz * list->n_cells[1] + iy) * list->n_cells[0] + ix;
+}
+
+int cell_list_build(
+        cell_list_t *list,
+        const vec_t *positions,
+        const size_t n_points,
+        const box_t box,
+        const float cutoff,
+        const int planar)
+{
+    if (cutoff <= 0.0f || box[0] <= 0.0f || box[1] <= 0.0f || (!planar && box[2] <= 0.0f)) {
+        fprintf(stderr, "Cell list could not be constructed (invalid cutoff or simulation box).\n");
+        return 1;
+    }
+
+    for (int d = 0; d < 3; ++d) {
+        if (d == 2 && planar) {
+            list->n_cells[d] = 1;
+            list->cell_size[d] = box[d];
+            continue;
+        }
+
+        list->n_cells[d] = (size_t) floorf(box[d] / cutoff);
+        if (list->n_cells[d] < 1) list->n_cells[d] = 1;
+        list->cell_size[d] = box[d] / list->n_cells[d];
+    }
+
+    size_t n_cells = list->n_cells[0] * list->n_cells[1] * list->n_cells[2];
+
+    // (re)allocate memory only if the current arrays are too small
+    if (n_cells + 1 > list->allocated_cells) {
+        free(list->cell_start);
+        list->allocated_cells = n_cells + 1;
+        list->cell_start = malloc(list->allocated_cells * sizeof(size_t));
+    }
+
+    if (n_points > list->allocated_points) {
+        free(list->sorted);
+        free(list->point_cell);
+        list->allocated_points = n_points;
+        list->sorted = malloc(n_points * sizeof(size_t));
+        list->point_cell = malloc(n_points * sizeof(size_t));
+    }
+
+    if (list->cell_start == NULL || (n_points > 0 && (list->sorted == NULL || list->point_cell == NULL))) {
+        fprintf(stderr, "Could not allocate memory for the cell list.\n");
+        return 1;
+    }
+
+    list->n_points = n_points;
+
+    // counting sort: count points in each cell
+    memset(list->cell_start, 0, (n_cells + 1) * sizeof(size_t));
+    for (size_t i = 0; i < n_points; ++i) {
+        list->point_cell[i] = cell_list_locate(list, positions[i], box);
+        list->cell_start[list->point_cell[i] + 1]++;
+    }
+
+    // prefix sum
+    for (size_t c = 0; c < n_cells; ++c) {
+        list->cell_start[c + 1] += list->cell_start[c];
+    }
+
+    // scatter points into cells (cell_start is temporarily shifted and then restored)
+    for (size_t i = 0; i < n_points; ++i) {
+        list->sorted[list->cell_start[list->point_cell[i]]++] = i;
+    }
+
+    for (size_t c = n_cells; c > 0; --c) {
+        list->cell_start[c] = list->cell_start[c - 1];
+    }
+    list->cell_start[0] = 0;
+
+    return 0;
+}
+
+size_t cell_list_neighbors(const cell_list_t *list, const size_t cell, size_t *neighbors)
+{
+    size_t ix = cell % list->n_cells[0];
+    size_t iy = (cell / list->n_cells[0]) % list->n_cells[1];
+    size_t iz = cell / (list->n_cells[0] * list->n_cells[1]);
+
+    size_t n_neighbors = 0;
+    for (int dz = -1; dz <= 1; ++dz) {
+        for (int dy = -1; dy <= 1; ++dy) {
+            for (int dx = -1; dx <= 1; ++dx) {
+                size_t nx = (ix + list->n_cells[0] + dx) % list->n_cells[0];
+                size_t ny = (iy + list->n_cells[1] + dy) % list->n_cells[1];
+                size_t nz = (iz + list->n_cells[2] + dz) % list->n_cells[2];
+                size_t neighbor = (nz * list->n_cells[1] + ny) * list->n_cells[0] + nx;
+
+                // in small boxes, the same cell can be reached multiple times
+                int duplicate = 0;
+                for (size_t k = 0; k < n_neighbors; ++k) {
+                    if (neighbors[k] == neighbor) {
+                        duplicate = 1;
+                        break;
+                    }
+                }
+
+                if (!duplicate) neighbors[n_neighbors++] = neighbor;
+            }
+        }
+    }
+
+    return n_neighbors;
+}
+
+void cell_list_destroy(cell_list_t *list)
+{
+    if (list == NULL) return;
+    free(list->cell_start);
+    free(list->sorted);
+    free(list->point_cell);
+    free(list);
+}
@@ -0,0 +1,97 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef CELLLIST_H
+#define CELLLIST_H
+
+#include <groan.h>
+
+/*! @brief Cell list of points in a rectangular periodic box. See cell_list_build() for more details. */
+typedef struct cell_list {
+    size_t n_cells[3];          // number of cells along x, y and z
+    float cell_size[3];         // size of a single cell along x, y and z [nm]
+    size_t *cell_start;         // index of the first point of each cell in 'sorted' (n_cells + 1 items)
+    size_t *sorted;             // indices of points sorted by cells
+    size_t *point_cell;         // index of the cell of each point
+    size_t allocated_cells;
+    size_t allocated_points;
+    size_t n_points;
+} cell_list_t;
+
+
+/*! @brief Creates an empty cell list. Must be deallocated using cell_list_destroy(). */
+cell_list_t *cell_list_create(void);
+
+
+/*! @brief Sorts points into cells of a periodic rectangular box.
+ *
+ * @paragraph Cell size
+ * The number of cells along each dimension is chosen so that each cell is at least 'cutoff' large.
+ * Any pair of points closer than 'cutoff' is therefore always located in the same or in neighboring cells.
+ *
+ * @paragraph Planar cell list
+ * If 'planar' is non-zero, only one cell is used along the z-axis so the cell list can be used
+ * for searching neighbors in the xy-plane.
+ *
+ * @paragraph Complexity
+ * Sorting is done using counting sort, i.e. in linear time. The allocated memory is reused between calls.
+ *
+ * @param list          cell list to (re)build
+ * @param positions     positions of the points
+ * @param n_points      number of points
+ * @param box           simulation box
+ * @param cutoff        minimal size of a cell [nm]
+ * @param planar        use only one cell along the z-axis
+ *
+ * @return Zero, if successful. Else non-zero.
+ */
+int cell_list_build(
+        cell_list_t *list,
+        const vec_t *positions,
+        const size_t n_points,
+        const box_t box,
+        const float cutoff,
+        const int planar);
+
+
+/*! @brief Gets the index of the cell containing the provided position. */
+size_t cell_list_locate(const cell_list_t *list, const vec_t position, const box_t box);
+
+
+/*! @brief Writes indices of all (unique) cells neighboring the target cell, including the target cell itself.
+ *
+ * @paragraph Small boxes
+ * If the box contains fewer than 3 cells along some dimension, the periodic neighbors coincide
+ * and every cell is only written once.
+ *
+ * @param list          cell list
+ * @param cell          index of the target cell
+ * @param neighbors     array of at least 27 items into which the indices are written
+ *
+ * @return Number of neighboring cells.
+ */
+size_t cell_list_neighbors(const cell_list_t *list, const size_t cell, size_t *neighbors);
+
+
+/*! @brief Calculates squared distance between two points using the minimum image convention.
+ *
+ * @paragraph Planar distance
+ * If 'planar' is non-zero, distance in the xy-plane is calculated.
+ */
+static inline float distance_squared_pbc(const vec_t a, const vec_t b, const box_t box, const int planar)
+{
+    float sum = 0.0f;
+    for (int d = 0; d < (planar ? 2 : 3); ++d) {
+        float diff = a[d] - b[d];
+        diff -= box[d] * rintf(diff / box[d]);
+        sum += diff * diff;
+    }
+
+    return sum;
+}
+
+
+/*! @brief Deallocates memory for the cell list. */
+void cell_list_destroy(cell_list_t *list);
+
+#endif /* CELLLIST_H */
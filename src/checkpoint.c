@@ -0,0 +1,157 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#include "checkpoint.h"
+
+/*! @brief Identifier at the start of every checkpoint file */
+static const char CHECKPOINT_MAGIC[8] = "SCRMBCPT";
+/*! @brief Version of the checkpoint format */
+static const int CHECKPOINT_VERSION = 2;
+/*! @brief Length of the module name and lipid names in the checkpoint header */
+#define CHECKPOINT_NAME_LENGTH 16
+/*! @brief Suffix of the temporary checkpoint file */
+static const char CHECKPOINT_TMP_SUFFIX[] = ".tmp";
+
+int checkpoint_exists(const char *filename)
+{
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) return 0;
+
+    fclose(file);
+    return 1;
+}
+
+int checkpoint_write(FILE *file, const void *data, const size_t size, const size_t count)
+{
+    return fwrite(data, size, count, file) != count;
+}
+
+int checkpoint_read(FILE *file, void *data, const size_t size, const size_t count)
+{
+    return fread(data, size, count, file) != count;
+}
+
+/*! @brief Gets the number of lipids of the given lipid type. */
+static size_t get_n_lipids(const lipid_composition_t *composition, const size_t type)
+{
+    atom_selection_t *selection = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[type]));
+    return selection->n_atoms;
+}
+
+FILE *checkpoint_open_write(const char *filename, const char *module, const lipid_composition_t *composition)
+{
+    char *tmp_name = calloc(strlen(filename) + sizeof(CHECKPOINT_TMP_SUFFIX), 1);
+    strcpy(tmp_name, filename);
+    strcat(tmp_name, CHECKPOINT_TMP_SUFFIX);
+
+    FILE *file = fopen(tmp_name, "wb");
+    free(tmp_name);
+    if (file == NULL) {
+        fprintf(stderr, "Could not open checkpoint file %s for writing.\n", filename);
+        return NULL;
+    }
+
+    char name[CHECKPOINT_NAME_LENGTH] = {0};
+    strncpy(name, module, CHECKPOINT_NAME_LENGTH - 1);
+
+    int failed = checkpoint_write(file, CHECKPOINT_MAGIC, 1, sizeof(CHECKPOINT_MAGIC));
+    failed |= checkpoint_write(file, &CHECKPOINT_VERSION, sizeof(int), 1);
+    failed |= checkpoint_write(file, name, 1, CHECKPOINT_NAME_LENGTH);
+    failed |= checkpoint_write(file, &composition->n_lipid_types, sizeof(size_t), 1);
+
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        char lipid_name[CHECKPOINT_NAME_LENGTH] = {0};
+        strncpy(lipid_name, composition->lipid_types[i], CHECKPOINT_NAME_LENGTH - 1);
+        size_t n_lipids = get_n_lipids(composition, i);
+
+        failed |= checkpoint_write(file, lipid_name, 1, CHECKPOINT_NAME_LENGTH);
+        failed |= checkpoint_write(file, &n_lipids, sizeof(size_t), 1);
+    }
+
+    if (failed) {
+        fprintf(stderr, "Could not write header of checkpoint file %s.\n", filename);
+        checkpoint_close_write(file, filename, 1);
+        return NULL;
+    }
+
+    return file;
+}
+
+int checkpoint_close_write(FILE *file, const char *filename, int failed)
+{
+    char *tmp_name = calloc(strlen(filename) + sizeof(CHECKPOINT_TMP_SUFFIX), 1);
+    strcpy(tmp_name, filename);
+    strcat(tmp_name, CHECKPOINT_TMP_SUFFIX);
+
+    failed |= (fclose(file) != 0);
+
+    if (failed) {
+        fprintf(stderr, "Could not write checkpoint file %s.\n", filename);
+        remove(tmp_name);
+        free(tmp_name);
+        return 1;
+    }
+
+    if (rename(tmp_name, filename) != 0) {
+        fprintf(stderr, "Could not move checkpoint %s to %s.\n", tmp_name, filename);
+        free(tmp_name);
+        return 1;
+    }
+
+    free(tmp_name);
+    return 0;
+}
+
+FILE *checkpoint_open_read(const char *filename, const char *module, const lipid_composition_t *composition)
+{
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open checkpoint file %s.\n", filename);
+        return NULL;
+    }
+
+    char magic[sizeof(CHECKPOINT_MAGIC)] = {0};
+    int version = 0;
+    char name[CHECKPOINT_NAME_LENGTH] = {0};
+    size_t n_lipid_types = 0;
+
+    if (checkpoint_read(file, magic, 1, sizeof(CHECKPOINT_MAGIC)) || memcmp(magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) ||
+        checkpoint_read(file, &version, sizeof(int), 1)) {
+        fprintf(stderr, "File %s is not a valid scramblyzer checkpoint.\n", filename);
+        fclose(file);
+        return NULL;
+    }
+
+    // data layout of the modules differs between versions
+    if (version != CHECKPOINT_VERSION) {
+        fprintf(stderr, "Checkpoint file %s has format version %d, but version %d is required.\n", filename, version, CHECKPOINT_VERSION);
+        fclose(file);
+        return NULL;
+    }
+
+    if (checkpoint_read(file, name, 1, CHECKPOINT_NAME_LENGTH) || strncmp(name, module, CHECKPOINT_NAME_LENGTH - 1)) {
+        fprintf(stderr, "Checkpoint file %s was not written by module %s.\n", filename, module);
+        fclose(file);
+        return NULL;
+    }
+
+    if (checkpoint_read(file, &n_lipid_types, sizeof(size_t), 1) || n_lipid_types != composition->n_lipid_types) {
+        fprintf(stderr, "Lipid composition in checkpoint file %s does not match the analyzed system.\n", filename);
+        fclose(file);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < n_lipid_types; ++i) {
+        char lipid_name[CHECKPOINT_NAME_LENGTH] = {0};
+        size_t n_lipids = 0;
+
+        if (checkpoint_read(file, lipid_name, 1, CHECKPOINT_NAME_LENGTH) || checkpoint_read(file, &n_lipids, sizeof(size_t), 1) ||
+            strncmp(lipid_name, composition->lipid_types[i], CHECKPOINT_NAME_LENGTH - 1) || n_lipids != get_n_lipids(composition, i)) {
+            fprintf(stderr, "Lipid composition in checkpoint file %s does not match the analyzed system.\n", filename);
+            fclose(file);
+            return NULL;
+        }
+    }
+
+    return file;
+}
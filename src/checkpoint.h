@@ -0,0 +1,58 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <groan.h>
+#include "general.h"
+
+/*! @brief Checks whether the checkpoint file exists. Returns 1 if it does, else 0. */
+int checkpoint_exists(const char *filename);
+
+
+/*! @brief Opens a checkpoint file for writing and writes its header.
+ *
+ * @paragraph Checkpoint header
+ * The header contains the name of the module which wrote the checkpoint and the lipid composition
+ * of the analyzed membrane (lipid types and numbers of lipids). The header is validated when the checkpoint is read.
+ *
+ * @paragraph Atomic writing
+ * The data are written into a temporary file which replaces the checkpoint file in checkpoint_close_write().
+ * An existing checkpoint is therefore never left in an inconsistent state.
+ *
+ * @param filename          checkpoint file to write
+ * @param module            name of the module writing the checkpoint
+ * @param composition       lipid composition of the membrane
+ *
+ * @return File handle or NULL in case of an error.
+ */
+FILE *checkpoint_open_write(const char *filename, const char *module, const lipid_composition_t *composition);
+
+
+/*! @brief Closes the checkpoint file opened by checkpoint_open_write() and moves it to its final location.
+ *
+ * @param file              handle of the checkpoint file
+ * @param filename          checkpoint file name
+ * @param failed            non-zero if writing of any data has failed (the checkpoint is then discarded)
+ *
+ * @return Zero, if successful. Else non-zero.
+ */
+int checkpoint_close_write(FILE *file, const char *filename, int failed);
+
+
+/*! @brief Opens a checkpoint file for reading and validates its header against the current analysis.
+ *
+ * @return File handle or NULL in case of an error.
+ */
+FILE *checkpoint_open_read(const char *filename, const char *module, const lipid_composition_t *composition);
+
+
+/*! @brief Writes 'count' items of 'size' bytes into the checkpoint. Returns zero if successful, else non-zero. */
+int checkpoint_write(FILE *file, const void *data, const size_t size, const size_t count);
+
+
+/*! @brief Reads 'count' items of 'size' bytes from the checkpoint. Returns zero if successful, else non-zero. */
+int checkpoint_read(FILE *file, void *data, const size_t size, const size_t count);
+
+#endif /* CHECKPOINT_H */
@@ -3,49 +3,149 @@
 
 #include "general.h"
 #include "composition.h"
+#include "trajectory.h"
+#include "profile.h"
+#include "topology.h"
+#include "membranes.h"
+#include "sample.h"
 
-// frequency of printing during the calculation
-static const int PROGRESS_FREQ = 10000;
-
-/*! @brief Identifier for all lipids in the classify_lipids() dictionaries
- * 
- * @paragraph Details
- * @@ is used to avoid any potential overlap with real lipid name.
- */
-static const char ALL_LIPIDS_IDENTIFIER[50] = "@@TOTAL@@";
-
-/*! @brief Assigns all lipids from the lipids dictionary into upper and lower leaflets. */
-static void classify_lipids(
-        lipid_composition_t *composition,
-        vec_t membrane_center,
-        box_t box,
-        dict_t *upper_leaflet,
-        dict_t *lower_leaflet)
+composition_analysis_t *composition_analysis_create(const lipid_composition_t *composition)
 {
+    composition_analysis_t *analysis = calloc(1, sizeof(composition_analysis_t));
+    analysis->composition = composition;
+    analysis->upper = calloc(composition->n_lipid_types + 1, sizeof(size_t));
+    analysis->lower = calloc(composition->n_lipid_types + 1, sizeof(size_t));
+    analysis->upper_statistics = calloc(composition->n_lipid_types + 1, sizeof(blocking_t));
+    analysis->lower_statistics = calloc(composition->n_lipid_types + 1, sizeof(blocking_t));
+
+    return analysis;
+}
+
+void composition_analysis_frame(
+        composition_analysis_t *analysis,
+        const leaflet_classifier_t *leaflets,
+        const float time)
+{
+    const lipid_composition_t *composition = analysis->composition;
+    analysis->time = time;
+
     size_t total_upper = 0, total_lower = 0;
+    size_t head_index = 0;
     // loop through all available lipid names
     for (size_t i = 0; i < composition->n_lipid_types; ++i) {
         atom_selection_t *selection = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
         
-        size_t upper = 0, lower = 0;
+        size_t upper = 0;
         // loop through the heads of the selection
-        for (size_t j = 0; j < selection->n_atoms; ++j) {
-            if (distance1D(selection->atoms[j]->position, membrane_center, z, box) > 0) {
-                ++upper;
-            } else {
-                ++lower;
-            }
+        for (size_t j = 0; j < selection->n_atoms; ++j, ++head_index) {
+            upper += leaflets->leaflet[head_index];
         }
+        size_t lower = selection->n_atoms - upper;
 
         total_upper += upper;
         total_lower += lower;
-        // add the calculated numbers to the dictionaries
-        dict_set(upper_leaflet, composition->lipid_types[i], &upper, sizeof(size_t));
-        dict_set(lower_leaflet, composition->lipid_types[i], &lower, sizeof(size_t));
+        analysis->upper[i] = upper;
+        analysis->lower[i] = lower;
     }
 
-    dict_set(upper_leaflet, ALL_LIPIDS_IDENTIFIER, &total_upper, sizeof(size_t));
-    dict_set(lower_leaflet, ALL_LIPIDS_IDENTIFIER, &total_lower, sizeof(size_t));
+    analysis->upper[composition->n_lipid_types] = total_upper;
+    analysis->lower[composition->n_lipid_types] = total_lower;
+
+    for (size_t i = 0; i < composition->n_lipid_types + 1; ++i) {
+        blocking_add(&analysis->upper_statistics[i], (double) analysis->upper[i]);
+        blocking_add(&analysis->lower_statistics[i], (double) analysis->lower[i]);
+    }
+}
+
+void composition_write_header(FILE *output, const lipid_composition_t *composition, const char *input_xtc_file)
+{
+    fprintf(output, "# Generated with Scramblyzer Composition from file %s\n", input_xtc_file);
+    fprintf(output, "@    title \"Membrane composition in time\"\n");
+    fprintf(output, "@    xaxis label \"time [ns]\"\n");
+    fprintf(output, "@    yaxis label \"number of lipids\"\n");
+    for (size_t i = 0; i < composition->n_lipid_types + 1; ++i) {
+        // don't print TOTAL if there is only one lipid species
+        if (composition->n_lipid_types < 2 && i == composition->n_lipid_types) break; 
+
+        char *name = NULL;
+        if (i < composition->n_lipid_types) {
+            name = composition->lipid_types[i];
+        } else {
+            name = "TOTAL";
+        }
+
+        fprintf(output, "@    s%zu legend \"%s_upper\"\n", i * 3, name);
+        fprintf(output, "@    s%zu legend \"%s_lower\"\n", i * 3 + 1, name);
+        fprintf(output, "@    s%zu legend \"%s_full\"\n", i * 3 + 2, name);
+    }
+
+    fprintf(output, "@TYPE xy\n");
+}
+
+void composition_write_frame(FILE *output, const composition_analysis_t *analysis)
+{
+    size_t n_lipid_types = analysis->composition->n_lipid_types;
+
+    fprintf(output, "%f     ", analysis->time / 1000.0);
+    for (size_t i = 0; i < n_lipid_types; ++i) {
+        fprintf(output, "%zu      %zu      %zu      ", analysis->upper[i], analysis->lower[i], analysis->upper[i] + analysis->lower[i]);
+    }
+
+    if (n_lipid_types > 1) {
+        size_t total_upper = analysis->upper[n_lipid_types];
+        size_t total_lower = analysis->lower[n_lipid_types];
+        fprintf(output, "%zu      %zu      %zu      ", total_upper, total_lower, total_upper + total_lower);
+    }
+    fprintf(output, "\n");
+}
+
+void composition_write_statistics(FILE *output, const composition_analysis_t *analysis)
+{
+    size_t n_lipid_types = analysis->composition->n_lipid_types;
+    int converged = 1;
+
+    fprintf(output, "Lipid | Upper (error, inefficiency)    | Lower (error, inefficiency)   \n");
+    for (size_t i = 0; i < n_lipid_types + 1; ++i) {
+        // don't print TOTAL if there is only one lipid species
+        if (n_lipid_types < 2 && i == n_lipid_types) break;
+        if (i == n_lipid_types) fprintf(output, "----------------------------------------------------------------------\n");
+
+        blocking_estimate_t upper = blocking_estimate(&analysis->upper_statistics[i]);
+        blocking_estimate_t lower = blocking_estimate(&analysis->lower_statistics[i]);
+        converged &= upper.converged & lower.converged;
+        fprintf(output, "%-5s | %9.2f (%7.3f%s, %8.1f) | %9.2f (%7.3f%s, %8.1f)\n", i < n_lipid_types ? analysis->composition->lipid_types[i] : "TOTAL",
+                upper.mean, upper.std_error, upper.converged ? "" : "*", upper.inefficiency,
+                lower.mean, lower.std_error, lower.converged ? "" : "*", lower.inefficiency);
+    }
+
+    if (!converged) fprintf(output, "* the trajectory is too short for a reliable error estimate; the standard error is a lower bound\n");
+}
+
+void composition_write_sampled(FILE *output, const composition_analysis_t *analysis)
+{
+    size_t n_lipid_types = analysis->composition->n_lipid_types;
+
+    fprintf(output, "Lipid | Upper (95%% CI)        | Lower (95%% CI)       \n");
+    for (size_t i = 0; i < n_lipid_types + 1; ++i) {
+        // don't print TOTAL if there is only one lipid species
+        if (n_lipid_types < 2 && i == n_lipid_types) break;
+        if (i == n_lipid_types) fprintf(output, "------------------------------------------------------\n");
+
+        fprintf(output, "%-5s | %9.2f +- %-8.2f | %9.2f +- %-8.2f\n", i < n_lipid_types ? analysis->composition->lipid_types[i] : "TOTAL",
+                analysis->upper_statistics[i].levels[0].mean, sample_mean_interval(&analysis->upper_statistics[i]),
+                analysis->lower_statistics[i].levels[0].mean, sample_mean_interval(&analysis->lower_statistics[i]));
+    }
+}
+
+void composition_analysis_destroy(composition_analysis_t *analysis)
+{
+    if (analysis == NULL) return;
+
+    free(analysis->upper);
+    free(analysis->lower);
+    free(analysis->upper_statistics);
+    free(analysis->lower_statistics);
+    free(analysis);
 }
 
 /*! @brief Prints supported flags and arguments of this module */
@@ -54,11 +154,13 @@ void print_usage_composition(void)
     printf("\nValid OPTIONS for the composition module:\n");
     printf("-h               print this message and exit\n");
     printf("-c STRING        gro file to read\n");
-    printf("-f STRING        xtc file to read (optional)\n");
+    printf("-f STRING        xtc file to read (optional, '-' for stdin)\n");
     printf("-n STRING        ndx file to read (optional, default: index.ndx)\n");
     printf("-o STRING        output file name (default: composition.xvg)\n");
     printf("-p STRING        selection of lipid head identifiers (default: name PO4)\n");
     printf("-t FLOAT         time interval between analyzed trajectory frames in ns (default: 1.0)\n");
+    printf("--follow         wait for new frames of a trajectory that is still being written (stop with Ctrl+C)\n");
+    printf("--sample INTEGER analyze only INTEGER frames sampled randomly from the whole trajectory (optional)\n");
     printf("\n");
 }
 
@@ -129,7 +231,9 @@ void print_arguments_composition(
         const char *ndx_file,
         const char *output_file,
         const char *phosphates,
-        const float timestep)
+        const float timestep,
+        const size_t n_samples,
+        const int follow)
 {
     printf("Parameters for Composition Analysis:\n");
     printf(">>> gro file:         %s\n", gro_file);
@@ -138,37 +242,54 @@ void print_arguments_composition(
     printf(">>> output file:      %s\n", output_file);
     printf(">>> lipid heads:      %s\n", phosphates);
     printf(">>> time step:        %f ns\n", timestep);
+    if (n_samples > 0) printf(">>> sampled frames:   %zu (time step is not used)\n", n_samples);
+    if (follow) printf(">>> following trajectory (stop with Ctrl+C)\n");
     printf("\n");
 }
 
+/*! @brief Closes output files and deallocates the analyses of all membranes. */
+static void composition_close_outputs(FILE **outputs, composition_analysis_t **analyses, leaflet_classifier_t **classifiers, const size_t n_membranes)
+{
+    for (size_t m = 0; m < n_membranes; ++m) {
+        if (outputs[m] != NULL) fclose(outputs[m]);
+        composition_analysis_destroy(analyses[m]);
+        leaflet_classifier_destroy(classifiers[m]);
+    }
+
+    free(outputs);
+    free(analyses);
+    free(classifiers);
+}
+
 int calc_lipid_composition(
         const char *input_gro_file,
         const char *input_xtc_file,
         const char *ndx_file,
         const char *output_file,
         const char *head_identifier,
-        const float dt)
+        const float dt,
+        const size_t n_samples,
+        const int single_membrane,
+        const int follow,
+        profile_t *profile)
 {
     if (input_xtc_file != NULL) {
-        print_arguments_composition(input_gro_file, input_xtc_file, ndx_file, output_file, head_identifier, dt);
+        print_arguments_composition(input_gro_file, input_xtc_file, ndx_file, output_file, head_identifier, dt, n_samples, follow);
+    } else if (follow || n_samples > 0) {
+        fprintf(stderr, "Xtc file must be supplied in follow mode and for sampling.\n");
+        return 1;
     }
 
-    // read gro file
-    system_t *system = load_gro(input_gro_file);
-    if (system == NULL) return 1;
-
-    // read ndx file
-    dict_t *ndx_groups = read_ndx(ndx_file, system);
-
-    // get lipids present in the system
-    lipid_composition_t *composition = get_lipid_composition(system, head_identifier, ndx_groups);
-    if (composition == NULL) {
-        free(system);
-        dict_destroy(ndx_groups);
+    // sampled frames are located using their offsets in the file
+    if (n_samples > 0 && (follow || !strcmp(input_xtc_file, "-"))) {
+        fprintf(stderr, "Sampling can not be combined with follow mode or streamed trajectories.\n");
         return 1;
     }
 
-    dict_destroy(ndx_groups);
+    // read gro file and get lipids present in the system (possibly from the topology cache)
+    system_t *system = NULL;
+    lipid_composition_t *composition = topology_load(input_gro_file, ndx_file, head_identifier, &system);
+    if (composition == NULL) return 1;
 
     // if there are no lipids
     if (composition->n_lipid_types < 1) {
@@ -178,135 +299,176 @@ int calc_lipid_composition(
         return 1;
     }
 
+    // split the lipids into separate membranes, if there are several of them
+    membranes_t *membranes = membranes_detect(composition, system->box, single_membrane);
+
     // if there is no xtc file, just analyze gro file and print to stdout
     if (input_xtc_file == NULL) {
-        // get center of geometry of the membrane
-        vec_t membrane_center = {0.0};
-        center_of_geometry(composition->all_lipid_atoms, membrane_center, system->box);
-
-        dict_t *upper_leaflet = dict_create();
-        dict_t *lower_leaflet = dict_create();
-        classify_lipids(composition, membrane_center, system->box, upper_leaflet, lower_leaflet);
-
-        printf("Lipid | Upper | Lower | Full \n");
-        for (size_t i = 0; i < composition->n_lipid_types; ++i) {
-            size_t upper = *((size_t *) dict_get(upper_leaflet, composition->lipid_types[i]));
-            size_t lower = *((size_t *) dict_get(lower_leaflet, composition->lipid_types[i]));
-            printf("%-5s | %-5zu | %-5zu | %-5zu\n", composition->lipid_types[i], upper, lower, upper + lower);
-        }
-        // if there are 2 or more lipid types, also print TOTAL number of lipids
-        if (composition->n_lipid_types > 1) {
-            size_t total_upper = *((size_t *) dict_get(upper_leaflet, ALL_LIPIDS_IDENTIFIER));
-            size_t total_lower = *((size_t *) dict_get(lower_leaflet, ALL_LIPIDS_IDENTIFIER));
-            printf("-----------------------------\n");
-            printf("%-5s | %-5zu | %-5zu | %-5zu\n", "TOTAL", total_upper, total_lower, total_upper + total_lower);
+        // get center of geometry of each membrane
+        membranes_update(membranes, system->box);
+
+        for (size_t m = 0; m < membranes->n_membranes; ++m) {
+            const lipid_composition_t *membrane = membranes->compositions[m];
+            composition_analysis_t *analysis = composition_analysis_create(membrane);
+            leaflet_classifier_t *leaflets = leaflet_classifier_create(membrane, 0.0);
+            leaflet_classifier_classify(leaflets, membranes->centers[m], system->box);
+            composition_analysis_frame(analysis, leaflets, system->time);
+
+            if (membranes->n_membranes > 1) printf("%sMembrane %zu\n", m > 0 ? "\n" : "", m + 1);
+            printf("Lipid | Upper | Lower | Full \n");
+            for (size_t i = 0; i < membrane->n_lipid_types; ++i) {
+                size_t upper = analysis->upper[i];
+                size_t lower = analysis->lower[i];
+                printf("%-5s | %-5zu | %-5zu | %-5zu\n", membrane->lipid_types[i], upper, lower, upper + lower);
+            }
+            // if there are 2 or more lipid types, also print TOTAL number of lipids
+            if (membrane->n_lipid_types > 1) {
+                size_t total_upper = analysis->upper[membrane->n_lipid_types];
+                size_t total_lower = analysis->lower[membrane->n_lipid_types];
+                printf("-----------------------------\n");
+                printf("%-5s | %-5zu | %-5zu | %-5zu\n", "TOTAL", total_upper, total_lower, total_upper + total_lower);
+            }
+
+            composition_analysis_destroy(analysis);
+            leaflet_classifier_destroy(leaflets);
         }
-        
+
+        membranes_destroy(membranes);
         lipid_composition_destroy(composition);
-        dict_destroy(upper_leaflet);
-        dict_destroy(lower_leaflet);
         free(system);
 
         return 0;
     }
 
-    // open output file
-    FILE *output = fopen(output_file, "w");
-    if (output == NULL) {
-        fprintf(stderr, "Could not open output file %s\n", output_file);
-        lipid_composition_destroy(composition);
-        free(system);
-        return 1;
-    }
-
-    // write header for the output file
-    fprintf(output, "# Generated with Scramblyzer Composition from file %s\n", input_xtc_file);
-    fprintf(output, "@    title \"Membrane composition in time\"\n");
-    fprintf(output, "@    xaxis label \"time [ns]\"\n");
-    fprintf(output, "@    yaxis label \"number of lipids\"\n");
-    for (size_t i = 0; i < composition->n_lipid_types + 1; ++i) {
-        // don't print TOTAL if there is only one lipid species
-        if (composition->n_lipid_types < 2 && i == composition->n_lipid_types) break; 
-
-        char *name = NULL;
-        if (i < composition->n_lipid_types) {
-            name = composition->lipid_types[i];
-        } else {
-            name = "TOTAL";
+    // open output files (one for each membrane), write their headers and prepare the analyses
+    const size_t n_membranes = membranes->n_membranes;
+    FILE **outputs = calloc(n_membranes, sizeof(FILE *));
+    composition_analysis_t **analyses = calloc(n_membranes, sizeof(composition_analysis_t *));
+    leaflet_classifier_t **classifiers = calloc(n_membranes, sizeof(leaflet_classifier_t *));
+    for (size_t m = 0; m < n_membranes; ++m) {
+        char *membrane_file = membranes_file_name(membranes, output_file, m);
+        outputs[m] = fopen(membrane_file, "w");
+        if (outputs[m] == NULL) {
+            fprintf(stderr, "Could not open output file %s\n", membrane_file);
+            free(membrane_file);
+            composition_close_outputs(outputs, analyses, classifiers, n_membranes);
+            membranes_destroy(membranes);
+            lipid_composition_destroy(composition);
+            free(system);
+            return 1;
         }
+        free(membrane_file);
 
-        fprintf(output, "@    s%zu legend \"%s_upper\"\n", i * 3, name);
-        fprintf(output, "@    s%zu legend \"%s_lower\"\n", i * 3 + 1, name);
-        fprintf(output, "@    s%zu legend \"%s_full\"\n", i * 3 + 2, name);
+        composition_write_header(outputs[m], membranes->compositions[m], input_xtc_file);
+        analyses[m] = composition_analysis_create(membranes->compositions[m]);
+        classifiers[m] = leaflet_classifier_create(membranes->compositions[m], 0.0);
     }
 
-    fprintf(output, "@TYPE xy\n");
-
     // open xtc file for reading
-    XDRFILE *xtc = xdrfile_open(input_xtc_file, "r");
-    if (xtc == NULL) {
+    trajectory_t *traj = trajectory_open(input_xtc_file, system->n_atoms);
+    if (traj == NULL) {
         fprintf(stderr, "File %s could not be read as an xtc file.\n", input_xtc_file);
+        composition_close_outputs(outputs, analyses, classifiers, n_membranes);
+        membranes_destroy(membranes);
         lipid_composition_destroy(composition);
         free(system);
-        fclose(output);
         return 1;
     }
 
     // check that the gro file and the xtc file match each other
-    if (!validate_xtc(input_xtc_file, (int) system->n_atoms)) {
+    if (!trajectory_validate(traj)) {
         fprintf(stderr, "Number of atoms in %s does not match %s.\n", input_xtc_file, input_gro_file);
+        composition_close_outputs(outputs, analyses, classifiers, n_membranes);
+        membranes_destroy(membranes);
         lipid_composition_destroy(composition);
         free(system);
-        xdrfile_close(xtc);
-        fclose(output);
+        trajectory_close(traj);
         return 1;
     }
 
-    while (read_xtc_step(xtc, system) == 0) {
-        // print info about the progress of reading and writing
-        if ((int) system->time % PROGRESS_FREQ == 0) {
-            printf("Step: %d. Time: %.0f ps\r", system->step, system->time);
-            fflush(stdout);
-        }
+    // wait for new frames at the end of the trajectory, if requested
+    if (follow && trajectory_follow(traj, input_xtc_file) != 0) {
+        composition_close_outputs(outputs, analyses, classifiers, n_membranes);
+        membranes_destroy(membranes);
+        lipid_composition_destroy(composition);
+        free(system);
+        trajectory_close(traj);
+        return 1;
+    }
+
+    // select frames by stratified sampling, if requested
+    frame_sampler_t *sampler = NULL;
+    if (n_samples > 0 && (sampler = frame_sampler_create(traj, n_samples, 0)) == NULL) {
+        composition_close_outputs(outputs, analyses, classifiers, n_membranes);
+        membranes_destroy(membranes);
+        lipid_composition_destroy(composition);
+        free(system);
+        trajectory_close(traj);
+        return 1;
+    }
 
-        if ((int) system->time % (int) roundf((dt * 1000)) != 0) {
+    while ((sampler != NULL ? frame_sampler_next(sampler, traj) : trajectory_next(traj)) == 0) {
+        // frames that are not analyzed are skipped without decompression
+        if (sampler == NULL && (int) traj->time % (int) roundf((dt * 1000)) != 0) {
+            if (profile_skip(profile, traj) != 0) break;
             continue;
         }
 
-        // get center of geometry of the membrane
-        vec_t membrane_center = {0.0};
-        center_of_geometry(composition->all_lipid_atoms, membrane_center, system->box);
+        if (profile_read(profile, traj, system) != 0) break;
 
-        dict_t *upper_leaflet = dict_create();
-        dict_t *lower_leaflet = dict_create();
-        classify_lipids(composition, membrane_center, system->box, upper_leaflet, lower_leaflet);
+        // get center of geometry of each membrane
+        profile_begin(profile);
+        lipid_composition_update(composition, system->box);
+        membranes_update(membranes, system->box);
+        profile_end(profile, PROFILE_CENTER);
 
-        fprintf(output, "%f     ", system->time / 1000.0);
-        for (size_t i = 0; i < composition->n_lipid_types; ++i) {
-            size_t upper = *((size_t *) dict_get(upper_leaflet, composition->lipid_types[i]));
-            size_t lower = *((size_t *) dict_get(lower_leaflet, composition->lipid_types[i]));
-            fprintf(output, "%zu      %zu      %zu      ", upper, lower, upper + lower);
+        // assign lipids to leaflets
+        profile_begin(profile);
+        for (size_t m = 0; m < n_membranes; ++m) {
+            leaflet_classifier_classify(classifiers[m], membranes->centers[m], system->box);
         }
+        profile_end(profile, PROFILE_LEAFLETS);
 
-        if (composition->n_lipid_types > 1) {
-            size_t total_upper = *((size_t *) dict_get(upper_leaflet, ALL_LIPIDS_IDENTIFIER));
-            size_t total_lower = *((size_t *) dict_get(lower_leaflet, ALL_LIPIDS_IDENTIFIER));
-            fprintf(output, "%zu      %zu      %zu      ", total_upper, total_lower, total_upper + total_lower);
+        profile_begin(profile);
+        for (size_t m = 0; m < n_membranes; ++m) {
+            composition_analysis_frame(analyses[m], classifiers[m], system->time);
         }
-        fprintf(output, "\n");
+        profile_end(profile, PROFILE_ANALYSIS);
 
+        profile_begin(profile);
+        for (size_t m = 0; m < n_membranes; ++m) {
+            composition_write_frame(outputs[m], analyses[m]);
+            // when following a running simulation, results should be available immediately
+            if (follow) fflush(outputs[m]);
+        }
+        profile_end(profile, PROFILE_OUTPUT);
+    }
 
-        dict_destroy(upper_leaflet);
-        dict_destroy(lower_leaflet);
-
+    // mean numbers of lipids with error estimates (confidence intervals for sampled frames)
+    for (size_t m = 0; m < n_membranes; ++m) {
+        if (n_membranes > 1) printf("\nMembrane %zu", m + 1);
+        if (sampler != NULL) {
+            printf("\nMean composition (%zu of %zu requested frames sampled):\n", sampler->n_sampled, n_samples);
+            composition_write_sampled(stdout, analyses[m]);
+        } else {
+            printf("\nMean composition (%llu frames):\n", (unsigned long long) analyses[m]->upper_statistics[0].levels[0].n_blocks);
+            composition_write_statistics(stdout, analyses[m]);
+        }
     }
 
-    printf("\nOutput file %s written.\n", output_file);
+    for (size_t m = 0; m < n_membranes; ++m) {
+        char *membrane_file = membranes_file_name(membranes, output_file, m);
+        printf("%sOutput file %s written.\n", m == 0 ? "\n" : "", membrane_file);
+        free(membrane_file);
+    }
+    profile_report(profile);
 
+    composition_close_outputs(outputs, analyses, classifiers, n_membranes);
+    membranes_destroy(membranes);
     lipid_composition_destroy(composition);
     free(system);
-    fclose(output);
-    xdrfile_close(xtc);
+    trajectory_close(traj);
+    free(sampler);
 
     return 0;
-}
+}
\ No newline at end of file
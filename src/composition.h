@@ -6,6 +6,20 @@
 
 #include <groan.h>
 #include <unistd.h>
+#include "general.h"
+#include "blocking.h"
+#include "profile.h"
+#include "leaflets.h"
+
+/*! @brief State of the composition analysis. See composition_analysis_frame() for more details. */
+typedef struct composition_analysis {
+    const lipid_composition_t *composition;
+    float time;                 // time of the last analyzed frame [ps]
+    size_t *upper;              // number of lipids of each lipid type (and of all lipids at index n_lipid_types) in the upper leaflet
+    size_t *lower;              // number of lipids of each lipid type (and of all lipids at index n_lipid_types) in the lower leaflet
+    blocking_t *upper_statistics;   // streaming statistics of the numbers of lipids in the upper leaflet (same order as upper)
+    blocking_t *lower_statistics;   // streaming statistics of the numbers of lipids in the lower leaflet (same order as lower)
+} composition_analysis_t;
 
 /*! @brief Prints information about the supported command line arguments for this module.*/
 void print_usage_composition(void);
@@ -26,6 +40,47 @@ int get_arguments_composition(
         float *dt);
 
 
+/*! @brief Prepares the composition analysis. Must be deallocated using composition_analysis_destroy(). */
+composition_analysis_t *composition_analysis_create(const lipid_composition_t *composition);
+
+
+/*! @brief Counts lipids of individual lipid types in the upper and lower leaflet of a single trajectory frame.
+ * The numbers of lipids are also added into the streaming statistics (see blocking_add()).
+ *
+ * @param analysis          state of the analysis
+ * @param leaflets          leaflet assignment of lipid heads in the current frame (see leaflet_classifier_classify())
+ * @param time              time of the frame [ps]
+ */
+void composition_analysis_frame(
+        composition_analysis_t *analysis,
+        const leaflet_classifier_t *leaflets,
+        const float time);
+
+
+/*! @brief Writes header of the xvg output file. */
+void composition_write_header(FILE *output, const lipid_composition_t *composition, const char *input_xtc_file);
+
+
+/*! @brief Writes results for the last analyzed frame into the xvg output file. */
+void composition_write_frame(FILE *output, const composition_analysis_t *analysis);
+
+
+/*! @brief Writes the mean numbers of lipids of each lipid type in each leaflet with their standard errors
+ * and statistical inefficiencies (see blocking_estimate()) into output.
+ */
+void composition_write_statistics(FILE *output, const composition_analysis_t *analysis);
+
+
+/*! @brief Writes the mean numbers of lipids of each lipid type in each leaflet with their 95% confidence intervals
+ * calculated from sampled frames (see sample_mean_interval()) into output.
+ */
+void composition_write_sampled(FILE *output, const composition_analysis_t *analysis);
+
+
+/*! @brief Deallocates memory for the composition_analysis_t structure. */
+void composition_analysis_destroy(composition_analysis_t *analysis);
+
+
 /*! @brief Calculates number of lipids of different types either in a gro file or in an xtc trajectory (if provided).
  *
  * @paragraph xtc file is optional
@@ -37,6 +92,15 @@ int get_arguments_composition(
  * Only some frames will be analyzed based on the value of dt. For instance, if the dt is 10.0 (ns), only frames
  * every 10 ns will be analyzed.
  * 
+ * @paragraph Follow mode
+ * If follow is non-zero, the function waits for new frames at the end of the xtc trajectory (see trajectory_follow())
+ * and the composition in each new frame is immediately written into the output file. The analysis is stopped using Ctrl+C.
+ * 
+ * @paragraph Sampling
+ * If n_samples is positive, dt is ignored and only n_samples frames selected by stratified random sampling
+ * (see frame_sampler_next()) are read. The mean composition is then reported with 95% confidence intervals
+ * (see composition_write_sampled()). Can not be combined with follow mode or streamed trajectories.
+ * 
  * @paragraph What lipids can scramblyzer recognize?
  * Be default scramblyzer is able to recognize all standard lipids of CG force-field Martini 2 (and probably also Martini 3).
  * That includes over a 200 lipid types. Scramblyzer also allows the user to add additional lipid types by writing them
@@ -48,6 +112,10 @@ int get_arguments_composition(
  * @param output_file           output file (not used if input_xtc_file is NULL)
  * @param head_identifier       name of the atom identifying lipid phosphate/head
  * @param dt                    time interval between analyzed trajectory frames in ns
+ * @param n_samples             number of frames to sample (all frames every dt are analyzed if zero)
+ * @param single_membrane       analyze all lipids as a single membrane even if several membranes are detected (see membranes_detect())
+ * @param follow                wait for new frames at the end of the trajectory
+ * @param profile               progress reporting and profiling of the analysis (see profile_read())
  * 
  * @return Zero, if the analysis was successful. Else non-zero.
  * 
@@ -58,7 +126,11 @@ int calc_lipid_composition(
         const char *ndx_file,
         const char *output_file,
         const char *head_identifier,
-        const float dt);
+        const float dt,
+        const size_t n_samples,
+        const int single_membrane,
+        const int follow,
+        profile_t *profile);
 
 
 #endif /* COMPOSITION_H */
\ No newline at end of file
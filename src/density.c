@@ -0,0 +1,520 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#include <stdint.h>
+#include "general.h"
+#include "density.h"
+#include "leaflets.h"
+#include "trajectory.h"
+#include "profile.h"
+#include "threadpool.h"
+#include "topology.h"
+#include "membranes.h"
+
+/*! @brief Number of chunks of lipid atoms per thread (smaller chunks balance the work of the threads better) */
+static const size_t DENSITY_CHUNKS_PER_THREAD = 4;
+
+/*! @brief Data shared by all binning tasks of a single frame. */
+typedef struct density_frame {
+    density_analysis_t *analysis;
+    float center;               // z-coordinate of the membrane center [nm]
+    float box_z;                // size of the box along the z-axis [nm]
+    double weight;              // contribution of a single atom to the density [nm^-3]
+    size_t chunk;               // number of lipid atoms binned by a single task
+} density_frame_t;
+
+/*! @brief Adds 'weight' to the bin of the histogram corresponding to the position. Positions outside the histogram are ignored. */
+static inline void bin_position(double *histogram, const density_analysis_t *analysis, const float position, const double weight)
+{
+    float shifted = (position + analysis->range) / analysis->bin_width;
+    if (shifted < 0) return;
+
+    size_t bin = (size_t) shifted;
+    if (bin >= analysis->n_bins) return;
+
+    histogram[bin] += weight;
+}
+
+density_analysis_t *density_analysis_create(
+        const lipid_composition_t *composition,
+        const float bin_width,
+        const float range,
+        const size_t n_threads,
+        thread_pool_t *pool)
+{
+    density_analysis_t *analysis = calloc(1, sizeof(density_analysis_t));
+    analysis->composition = composition;
+    analysis->bin_width = bin_width;
+    analysis->range = range;
+    analysis->n_bins = (size_t) ceilf(2 * range / bin_width);
+    analysis->n_threads = n_threads > 0 ? n_threads : 1;
+    analysis->pool = pool;
+    analysis->n_atoms = composition->all_lipid_atoms->n_atoms;
+
+    // index of the first head of each lipid type
+    size_t *head_offset = calloc(composition->n_lipid_types + 1, sizeof(size_t));
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        atom_selection_t *selection = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
+        head_offset[i + 1] = head_offset[i] + selection->n_atoms;
+    }
+    analysis->n_heads = head_offset[composition->n_lipid_types];
+
+    analysis->head_type = malloc(analysis->n_heads * sizeof(size_t));
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        for (size_t j = head_offset[i]; j < head_offset[i + 1]; ++j) analysis->head_type[j] = i;
+    }
+
+    // assign lipid atoms to heads; atoms and heads of each lipid type are both ordered as in the system,
+    // so a single cursor per lipid type is sufficient
+    analysis->atom_head = malloc(analysis->n_atoms * sizeof(size_t));
+    size_t *cursor = calloc(composition->n_lipid_types, sizeof(size_t));
+    for (size_t a = 0; a < analysis->n_atoms; ++a) {
+        const atom_t *atom = composition->all_lipid_atoms->atoms[a];
+        analysis->atom_head[a] = SIZE_MAX;
+
+        for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+            if (strcmp(atom->residue_name, composition->lipid_types[i])) continue;
+
+            atom_selection_t *heads = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
+            if (heads->n_atoms == 0) break;
+
+            // move to the next lipid of this type
+            if (heads->atoms[cursor[i]]->residue_number != atom->residue_number &&
+                cursor[i] + 1 < heads->n_atoms && heads->atoms[cursor[i] + 1]->residue_number == atom->residue_number) {
+                ++cursor[i];
+            }
+
+            if (heads->atoms[cursor[i]]->residue_number == atom->residue_number) {
+                analysis->atom_head[a] = head_offset[i] + cursor[i];
+            }
+            break;
+        }
+    }
+    free(cursor);
+    free(head_offset);
+
+    analysis->reference = calloc(analysis->n_heads, sizeof(short));
+    analysis->atom_histogram = malloc(analysis->n_atoms * sizeof(int));
+    analysis->atom_z = malloc(analysis->n_atoms * sizeof(float));
+
+    size_t histogram_size = composition->n_lipid_types * DENSITY_N_LEAFLETS * analysis->n_bins;
+    analysis->heads = calloc(histogram_size, sizeof(double));
+    analysis->atoms = calloc(analysis->n_threads * histogram_size, sizeof(double));
+
+    return analysis;
+}
+
+/*! @brief Gathers z-coordinates of a chunk of lipid atoms relative to the membrane center and bins them into the histograms of the thread. */
+static void density_task(size_t index, size_t thread, void *data)
+{
+    density_frame_t *frame = (density_frame_t *) data;
+    density_analysis_t *analysis = frame->analysis;
+    const atom_selection_t *atoms = analysis->composition->all_lipid_atoms;
+
+    size_t first = index * frame->chunk;
+    size_t last = first + frame->chunk < analysis->n_atoms ? first + frame->chunk : analysis->n_atoms;
+
+    // gather positions relative to the membrane center (minimum image convention)
+    float *atom_z = analysis->atom_z;
+    const float center = frame->center;
+    const float box_z = frame->box_z;
+    for (size_t a = first; a < last; ++a) {
+        float dz = atoms->atoms[a]->position[2] - center;
+        if (box_z > 0) dz -= box_z * rintf(dz / box_z);
+        atom_z[a] = dz;
+    }
+
+    size_t histogram_size = analysis->composition->n_lipid_types * DENSITY_N_LEAFLETS * analysis->n_bins;
+    double *histograms = analysis->atoms + thread * histogram_size;
+    for (size_t a = first; a < last; ++a) {
+        int histogram = analysis->atom_histogram[a];
+        if (histogram < 0) continue;
+        bin_position(histograms + (size_t) histogram * analysis->n_bins, analysis, atom_z[a], frame->weight);
+    }
+}
+
+void density_analysis_frame(
+        density_analysis_t *analysis,
+        const leaflet_classifier_t *leaflets,
+        const vec_t membrane_center,
+        const box_t box)
+{
+    const lipid_composition_t *composition = analysis->composition;
+
+    // assign lipids to reference leaflets in the first analyzed frame
+    if (analysis->frames == 0) {
+        size_t head_index = 0;
+        for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+            atom_selection_t *selection = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
+            for (size_t j = 0; j < selection->n_atoms; ++j, ++head_index) {
+                analysis->reference[head_index] = leaflets->leaflet[head_index] ? DENSITY_UPPER : DENSITY_LOWER;
+            }
+        }
+
+        for (size_t a = 0; a < analysis->n_atoms; ++a) {
+            size_t head = analysis->atom_head[a];
+            if (head == SIZE_MAX) analysis->atom_histogram[a] = -1;
+            else analysis->atom_histogram[a] = (int) (analysis->head_type[head] * DENSITY_N_LEAFLETS + analysis->reference[head]);
+        }
+    }
+
+    const double weight = 1.0 / ((double) box[0] * box[1] * analysis->bin_width);
+
+    // lipid heads
+    size_t head_index = 0;
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        atom_selection_t *selection = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
+        for (size_t j = 0; j < selection->n_atoms; ++j, ++head_index) {
+            double *histogram = analysis->heads + (i * DENSITY_N_LEAFLETS + analysis->reference[head_index]) * analysis->n_bins;
+            bin_position(histogram, analysis, distance1D(selection->atoms[j]->position, membrane_center, z, box), weight);
+        }
+    }
+
+    // all lipid atoms
+    density_frame_t frame = {0};
+    frame.analysis = analysis;
+    frame.center = membrane_center[2];
+    frame.box_z = box[2];
+    frame.weight = weight;
+
+    size_t n_tasks = analysis->n_threads > 1 ? analysis->n_threads * DENSITY_CHUNKS_PER_THREAD : 1;
+    frame.chunk = (analysis->n_atoms + n_tasks - 1) / n_tasks;
+    if (frame.chunk == 0) frame.chunk = 1;
+    n_tasks = (analysis->n_atoms + frame.chunk - 1) / frame.chunk;
+
+    thread_pool_execute(analysis->pool, n_tasks, NULL, density_task, &frame);
+
+    analysis->frames++;
+}
+
+void density_write_profiles(FILE *output, const density_analysis_t *analysis, const char *input_xtc_file)
+{
+    const lipid_composition_t *composition = analysis->composition;
+    const size_t n_histograms = composition->n_lipid_types * DENSITY_N_LEAFLETS;
+    const size_t histogram_size = n_histograms * analysis->n_bins;
+
+    // merge histograms of all threads
+    double *atoms = calloc(histogram_size, sizeof(double));
+    for (size_t t = 0; t < analysis->n_threads; ++t) {
+        for (size_t i = 0; i < histogram_size; ++i) atoms[i] += analysis->atoms[t * histogram_size + i];
+    }
+
+    fprintf(output, "# Generated with Scramblyzer Density from file %s\n", input_xtc_file);
+    fprintf(output, "# Leaflets are assigned in the first analyzed frame. Analyzed frames: %zu\n", analysis->frames);
+    fprintf(output, "@    title \"Density profiles of lipids along the membrane normal\"\n");
+    fprintf(output, "@    xaxis label \"z relative to the membrane center [nm]\"\n");
+    fprintf(output, "@    yaxis label \"number density [nm^-3]\"\n");
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        fprintf(output, "@    s%zu legend \"%s heads (upper)\"\n", i * 4, composition->lipid_types[i]);
+        fprintf(output, "@    s%zu legend \"%s heads (lower)\"\n", i * 4 + 1, composition->lipid_types[i]);
+        fprintf(output, "@    s%zu legend \"%s atoms (upper)\"\n", i * 4 + 2, composition->lipid_types[i]);
+        fprintf(output, "@    s%zu legend \"%s atoms (lower)\"\n", i * 4 + 3, composition->lipid_types[i]);
+    }
+    fprintf(output, "@TYPE xy\n");
+
+    double frames = analysis->frames > 0 ? (double) analysis->frames : 1.0;
+    for (size_t b = 0; b < analysis->n_bins; ++b) {
+        fprintf(output, "%f     ", -analysis->range + (b + 0.5) * analysis->bin_width);
+
+        for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+            for (size_t l = 0; l < DENSITY_N_LEAFLETS; ++l) {
+                fprintf(output, "%f     ", analysis->heads[(i * DENSITY_N_LEAFLETS + l) * analysis->n_bins + b] / frames);
+            }
+            for (size_t l = 0; l < DENSITY_N_LEAFLETS; ++l) {
+                fprintf(output, "%f     ", atoms[(i * DENSITY_N_LEAFLETS + l) * analysis->n_bins + b] / frames);
+            }
+        }
+
+        fprintf(output, "\n");
+    }
+
+    free(atoms);
+}
+
+void density_analysis_destroy(density_analysis_t *analysis)
+{
+    if (analysis == NULL) return;
+
+    free(analysis->head_type);
+    free(analysis->atom_head);
+    free(analysis->reference);
+    free(analysis->atom_histogram);
+    free(analysis->atom_z);
+    free(analysis->heads);
+    free(analysis->atoms);
+    free(analysis);
+}
+
+void print_usage_density(void)
+{
+    printf("\nValid OPTIONS for the density module:\n");
+    printf("-h               print this message and exit\n");
+    printf("-c STRING        gro file to read\n");
+    printf("-f STRING        xtc file to read ('-' for stdin)\n");
+    printf("-n STRING        ndx file to read (optional, default: index.ndx)\n");
+    printf("-o STRING        output file name (default: density.xvg)\n");
+    printf("-p STRING        selection of lipid head identifiers (default: name PO4)\n");
+    printf("-t FLOAT         time interval between analyzed trajectory frames in ns (default: 1.0)\n");
+    printf("-l FLOAT         identify leaflets by clustering lipid heads closer than FLOAT nm (optional)\n");
+    printf("-w FLOAT         width of a histogram bin [in nm] (default: 0.1)\n");
+    printf("-m FLOAT         calculate the profiles up to FLOAT nm from the membrane center (default: 5.0)\n");
+    printf("-j INTEGER       number of threads used for binning lipid atoms (default: 1)\n");
+    printf("\n");
+}
+
+int get_arguments_density(
+        const int argc,
+        char **argv,
+        char **gro_file,
+        char **xtc_file,
+        char **ndx_file,
+        char **output_file,
+        char **phosphates,
+        float *dt,
+        float *leaflet_cutoff,
+        float *bin_width,
+        float *range,
+        size_t *n_threads)
+{
+    int gro_specified = 0, xtc_specified = 0;
+
+    int opt = 0;
+    while((opt = getopt(argc - 1, argv + 1, "c:f:n:o:p:t:l:w:m:j:h")) != -1) {
+        switch (opt) {
+        // help
+        case 'h':
+            return 1;
+        // gro file to read
+        case 'c':
+            *gro_file = optarg;
+            gro_specified = 1;
+            break;
+        // xtc file to read
+        case 'f':
+            *xtc_file = optarg;
+            xtc_specified = 1;
+            break;
+        // ndx file
+        case 'n':
+            *ndx_file = optarg;
+            break;
+        // output file name
+        case 'o':
+            *output_file = optarg;
+            break;
+        // phosphates identifier
+        case 'p':
+            *phosphates = optarg;
+            break;
+        // dt (time precision of the analysis)
+        case 't':
+            if (sscanf(optarg, "%f", dt) != 1 || *dt <= 0) {
+                fprintf(stderr, "dt must be positive.\n");
+                return 1;
+            }
+            break;
+        // leaflet clustering cutoff
+        case 'l':
+            if (sscanf(optarg, "%f", leaflet_cutoff) != 1 || *leaflet_cutoff <= 0) {
+                fprintf(stderr, "Leaflet clustering cutoff must be a positive number.\n");
+                return 1;
+            }
+            break;
+        // histogram bin width
+        case 'w':
+            if (sscanf(optarg, "%f", bin_width) != 1 || *bin_width <= 0) {
+                fprintf(stderr, "Bin width must be positive.\n");
+                return 1;
+            }
+            break;
+        // histogram range
+        case 'm':
+            if (sscanf(optarg, "%f", range) != 1 || *range <= 0) {
+                fprintf(stderr, "Histogram range must be positive.\n");
+                return 1;
+            }
+            break;
+        // number of threads
+        case 'j':
+            if (sscanf(optarg, "%zu", n_threads) != 1 || *n_threads < 1 || optarg[0] == '-') {
+                fprintf(stderr, "Number of threads must be a positive integer.\n");
+                return 1;
+            }
+            break;
+        default:
+            return 1;
+        }
+    }
+
+    if (!gro_specified || !xtc_specified) {
+        fprintf(stderr, "Gro file and xtc file must always be supplied.\n");
+        return 1;
+    }
+    return 0;
+}
+
+/*! @brief Prints arguments that the program will use for the calculation. */
+static void print_arguments_density(
+        const char *gro_file,
+        const char *xtc_file,
+        const char *ndx_file,
+        const char *output_file,
+        const char *phosphates,
+        const float dt,
+        const float leaflet_cutoff,
+        const float bin_width,
+        const float range,
+        const size_t n_threads)
+{
+    printf("Parameters for Density Analysis:\n");
+    printf(">>> gro file:         %s\n", gro_file);
+    printf(">>> xtc file:         %s\n", xtc_file);
+    printf(">>> ndx file:         %s\n", ndx_file);
+    printf(">>> output file:      %s\n", output_file);
+    printf(">>> lipid heads:      %s\n", phosphates);
+    printf(">>> time step:        %f ns\n", dt);
+    if (leaflet_cutoff > 0) printf(">>> leaflet cutoff:   %f nm\n", leaflet_cutoff);
+    printf(">>> bin width:        %f nm\n", bin_width);
+    printf(">>> range:            %f nm\n", range);
+    printf(">>> threads:          %zu\n", n_threads);
+    printf("\n");
+}
+
+/*! @brief Deallocates the analyses and leaflet classifiers of all membranes and the membranes themselves. */
+static void density_destroy_membranes(density_analysis_t **analyses, leaflet_classifier_t **classifiers, membranes_t *membranes)
+{
+    for (size_t m = 0; m < membranes->n_membranes; ++m) {
+        density_analysis_destroy(analyses[m]);
+        leaflet_classifier_destroy(classifiers[m]);
+    }
+
+    free(analyses);
+    free(classifiers);
+    membranes_destroy(membranes);
+}
+
+int calc_density_profiles(
+        const char *input_gro_file,
+        const char *input_xtc_file,
+        const char *ndx_file,
+        const char *output_file,
+        const char *head_identifier,
+        const float dt,
+        const float leaflet_cutoff,
+        const float bin_width,
+        const float range,
+        const size_t n_threads,
+        const int single_membrane,
+        profile_t *profile)
+{
+    print_arguments_density(input_gro_file, input_xtc_file, ndx_file, output_file, head_identifier, dt, leaflet_cutoff, bin_width, range, n_threads);
+
+    // read gro file and get lipids present in the system (possibly from the topology cache)
+    system_t *system = NULL;
+    lipid_composition_t *composition = topology_load(input_gro_file, ndx_file, head_identifier, &system);
+    if (composition == NULL) return 1;
+
+    // if there are no lipids
+    if (composition->n_lipid_types < 1) {
+        fprintf(stderr, "No usable lipids detected.\n");
+        lipid_composition_destroy(composition);
+        free(system);
+        return 1;
+    }
+
+    // open xtc file for reading
+    trajectory_t *traj = trajectory_open(input_xtc_file, system->n_atoms);
+    if (traj == NULL) {
+        fprintf(stderr, "File %s could not be read as an xtc file.\n", input_xtc_file);
+        lipid_composition_destroy(composition);
+        free(system);
+        return 1;
+    }
+
+    // check that the gro file and the xtc file match each other
+    if (!trajectory_validate(traj)) {
+        fprintf(stderr, "Number of atoms in %s does not match %s.\n", input_xtc_file, input_gro_file);
+        lipid_composition_destroy(composition);
+        free(system);
+        trajectory_close(traj);
+        return 1;
+    }
+
+    // split the lipids into separate membranes, if there are several of them; each membrane is analyzed separately
+    membranes_t *membranes = membranes_detect(composition, system->box, single_membrane);
+    const size_t n_membranes = membranes->n_membranes;
+
+    // membranes are analyzed one after another, so they all share the same threads
+    thread_pool_t *pool = thread_pool_create(n_threads);
+
+    density_analysis_t **analyses = calloc(n_membranes, sizeof(density_analysis_t *));
+    leaflet_classifier_t **classifiers = calloc(n_membranes, sizeof(leaflet_classifier_t *));
+    for (size_t m = 0; m < n_membranes; ++m) {
+        analyses[m] = density_analysis_create(membranes->compositions[m], bin_width, range, n_threads, pool);
+
+        // prepare leaflet classification (clustering, if requested)
+        if ((classifiers[m] = leaflet_classifier_create(membranes->compositions[m], leaflet_cutoff)) == NULL) {
+            density_destroy_membranes(analyses, classifiers, membranes);
+            thread_pool_destroy(pool);
+            lipid_composition_destroy(composition);
+            free(system);
+            trajectory_close(traj);
+            return 1;
+        }
+    }
+
+    while (trajectory_next(traj) == 0) {
+        // frames that are not analyzed are skipped without decompression
+        if ((int) traj->time % (int) roundf((dt * 1000)) != 0) {
+            if (profile_skip(profile, traj) != 0) break;
+            continue;
+        }
+
+        if (profile_read(profile, traj, system) != 0) break;
+
+        // get center of geometry of each membrane
+        profile_begin(profile);
+        lipid_composition_update(composition, system->box);
+        membranes_update(membranes, system->box);
+        profile_end(profile, PROFILE_CENTER);
+
+        for (size_t m = 0; m < n_membranes; ++m) {
+            // assign lipids to leaflets; reference leaflets can not be assigned before the clustering succeeds
+            profile_begin(profile);
+            int unassigned = leaflet_classifier_classify(classifiers[m], membranes->centers[m], system->box);
+            profile_end(profile, PROFILE_LEAFLETS);
+            if (unassigned && !classifiers[m]->initialized) continue;
+
+            profile_begin(profile);
+            density_analysis_frame(analyses[m], classifiers[m], membranes->centers[m], system->box);
+            profile_end(profile, PROFILE_ANALYSIS);
+        }
+    }
+
+    int return_code = 0;
+
+    printf("\n");
+    for (size_t m = 0; m < n_membranes; ++m) {
+        char *membrane_file = membranes_file_name(membranes, output_file, m);
+        FILE *output = fopen(membrane_file, "w");
+        if (output == NULL) {
+            fprintf(stderr, "Could not open output file %s\n", membrane_file);
+            return_code = 1;
+        } else {
+            density_write_profiles(output, analyses[m], input_xtc_file);
+            fclose(output);
+            printf("Output file %s written.\n", membrane_file);
+        }
+        free(membrane_file);
+    }
+
+    profile_report(profile);
+
+    density_destroy_membranes(analyses, classifiers, membranes);
+    thread_pool_destroy(pool);
+    lipid_composition_destroy(composition);
+    free(system);
+    trajectory_close(traj);
+
+    return return_code;
+}
@@ -0,0 +1,147 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef DENSITY_H
+#define DENSITY_H
+
+#include <groan.h>
+#include <unistd.h>
+#include "general.h"
+#include "profile.h"
+#include "leaflets.h"
+#include "threadpool.h"
+
+/*! @brief Reference leaflets of lipids in the density profiles */
+typedef enum density_leaflet {
+    DENSITY_UPPER,              // lipids located in the upper leaflet in the first analyzed frame
+    DENSITY_LOWER,              // lipids located in the lower leaflet in the first analyzed frame
+    DENSITY_N_LEAFLETS
+} density_leaflet_t;
+
+/*! @brief State of the density profile analysis. See density_analysis_frame() for more details. */
+typedef struct density_analysis {
+    const lipid_composition_t *composition;
+    float bin_width;            // width of a histogram bin [nm]
+    float range;                // the histograms span from -range to +range relative to the membrane center [nm]
+    size_t n_bins;              // number of histogram bins
+    size_t n_threads;           // number of threads used for binning lipid atoms
+    thread_pool_t *pool;        // threads used for binning lipid atoms, reused by all frames (not owned by the analysis)
+    size_t n_heads;             // number of lipid heads
+    size_t n_atoms;             // number of lipid atoms
+    size_t *head_type;          // lipid type of each lipid head
+    size_t *atom_head;          // index of the lipid head of each lipid atom (SIZE_MAX if the atom belongs to no analyzed lipid)
+    short *reference;           // leaflet of each lipid head in the first analyzed frame (see density_leaflet_t)
+    int *atom_histogram;        // histogram of each lipid atom (type * DENSITY_N_LEAFLETS + leaflet, -1 if not analyzed)
+    float *atom_z;              // z-coordinates of lipid atoms relative to the membrane center in the current frame [nm]
+    double *heads;              // density of lipid heads summed over frames ([type][leaflet][bin])
+    double *atoms;              // density of lipid atoms summed over frames, for each thread ([thread][type][leaflet][bin])
+    size_t frames;              // number of analyzed frames
+} density_analysis_t;
+
+/*! @brief Prints supported flags and arguments of this module */
+void print_usage_density(void);
+
+
+/*! @brief Parses command line arguments for the density module.
+ *
+ * @return Zero, if parsing has been successful. Else returns non-zero.
+ */
+int get_arguments_density(
+        const int argc,
+        char **argv,
+        char **gro_file,
+        char **xtc_file,
+        char **ndx_file,
+        char **output_file,
+        char **phosphates,
+        float *dt,
+        float *leaflet_cutoff,
+        float *bin_width,
+        float *range,
+        size_t *n_threads);
+
+
+/*! @brief Prepares the density profile analysis. Must be deallocated using density_analysis_destroy().
+ *
+ * @paragraph Lipid atoms
+ * Every atom of composition->all_lipid_atoms is assigned to the lipid head of the same residue. Atoms of lipids
+ * which have no head are not analyzed.
+ *
+ * @param composition       lipid composition of the membrane
+ * @param bin_width         width of a histogram bin [nm]
+ * @param range             the histograms span from -range to +range relative to the membrane center [nm]
+ * @param n_threads         number of threads used for binning lipid atoms
+ * @param pool              thread pool of n_threads threads performing the binning in all frames; it may be shared
+ *                          by several analyses and must be destroyed by the caller after density_analysis_destroy()
+ */
+density_analysis_t *density_analysis_create(
+        const lipid_composition_t *composition,
+        const float bin_width,
+        const float range,
+        const size_t n_threads,
+        thread_pool_t *pool);
+
+
+/*! @brief Analyzes a single trajectory frame and adds its contribution to the density profiles.
+ *
+ * @paragraph Reference leaflets
+ * In the first analyzed frame, every lipid is assigned to a leaflet. This assignment is kept for the whole analysis,
+ * so the profiles show where lipids that started in each leaflet are located, i.e. scrambled lipids appear
+ * on the opposite side of the membrane center.
+ *
+ * @paragraph Binning
+ * Positions of lipid heads and of all lipid atoms along the z-axis relative to the membrane center are binned
+ * separately for each lipid type and reference leaflet. The z-coordinates of lipid atoms are first gathered
+ * into a contiguous array and then binned. Lipid atoms are split into chunks processed by a thread pool
+ * (see thread_pool_execute()); every thread bins into its own histograms which are merged in density_write_profiles().
+ *
+ * @paragraph Units
+ * Every binned atom contributes 1 / (box_x * box_y * bin_width), so the profiles are number densities in nm^-3.
+ *
+ * @param analysis          state of the analysis
+ * @param leaflets          leaflet assignment of lipid heads in the current frame (see leaflet_classifier_classify())
+ * @param membrane_center   center of geometry of the membrane
+ * @param box               simulation box
+ */
+void density_analysis_frame(
+        density_analysis_t *analysis,
+        const leaflet_classifier_t *leaflets,
+        const vec_t membrane_center,
+        const box_t box);
+
+
+/*! @brief Writes the density profiles averaged over all analyzed frames into an xvg file. */
+void density_write_profiles(FILE *output, const density_analysis_t *analysis, const char *input_xtc_file);
+
+
+/*! @brief Deallocates memory for the density_analysis_t structure. */
+void density_analysis_destroy(density_analysis_t *analysis);
+
+
+/*! @brief Calculates density profiles of lipid heads and lipid atoms along the membrane normal.
+ *
+ * @paragraph Output
+ * Profiles of lipid heads and of all lipid atoms are written for each lipid type and reference leaflet
+ * (see density_analysis_frame()) into output_file.
+ *
+ * @paragraph Leaflet clustering
+ * If leaflet_cutoff is positive, the reference leaflets are identified by clustering lipid heads
+ * (see leaflet_clustering_assign()) instead of comparing their position with the membrane center.
+ *
+ * @return Zero, if the analysis was successful. Else non-zero.
+ */
+int calc_density_profiles(
+        const char *input_gro_file,
+        const char *input_xtc_file,
+        const char *ndx_file,
+        const char *output_file,
+        const char *head_identifier,
+        const float dt,
+        const float leaflet_cutoff,
+        const float bin_width,
+        const float range,
+        const size_t n_threads,
+        const int single_membrane,
+        profile_t *profile);
+
+#endif /* DENSITY_H */
@@ -0,0 +1,482 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#include <float.h>
+#include "general.h"
+#include "dwell.h"
+#include "flipflops.h"
+#include "leaflets.h"
+#include "trajectory.h"
+#include "profile.h"
+#include "topology.h"
+#include "membranes.h"
+
+/*! @brief Names of the leaflets used in the output files */
+static const char *LEAFLET_NAMES[DWELL_N_LEAFLETS] = {"upper", "lower"};
+
+dwell_analysis_t *dwell_analysis_create(
+        const lipid_composition_t *composition,
+        const float spatial_limit,
+        const int temporal_limit,
+        const float bin_width,
+        const float max_dwell)
+{
+    dwell_analysis_t *analysis = calloc(1, sizeof(dwell_analysis_t));
+    analysis->composition = composition;
+    analysis->spatial_limit = spatial_limit;
+    analysis->temporal_limit = temporal_limit;
+    analysis->start_time = -1.0;
+    analysis->prevtime = -1.0;
+
+    size_t n_heads = 0;
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        atom_selection_t *selection = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
+        n_heads += selection->n_atoms;
+    }
+
+    analysis->classified = calloc(n_heads, sizeof(int));
+    analysis->initial = malloc(n_heads * sizeof(short));
+    analysis->last_change = calloc(n_heads, sizeof(float));
+    analysis->first_passage = malloc(n_heads * sizeof(float));
+    for (size_t i = 0; i < n_heads; ++i) {
+        analysis->initial[i] = -1;
+        analysis->first_passage[i] = -1.0;
+    }
+
+    // histograms are kept in picoseconds internally
+    analysis->bin_width = bin_width * 1000;
+    analysis->n_bins = (size_t) ceilf(max_dwell / bin_width);
+    if (analysis->n_bins < 1) analysis->n_bins = 1;
+
+    analysis->histogram = calloc(composition->n_lipid_types * DWELL_N_LEAFLETS * analysis->n_bins, sizeof(size_t));
+    analysis->overflow = calloc(composition->n_lipid_types * DWELL_N_LEAFLETS, sizeof(size_t));
+
+    return analysis;
+}
+
+int dwell_analysis_frame(
+        dwell_analysis_t *analysis,
+        const leaflet_classifier_t *leaflets,
+        const float time)
+{
+    // sanity check of the trajectory
+    if (analysis->prevtime >= 0 && time - analysis->prevtime > 1000) {
+        fprintf(stderr, "Scramblyzer dwell expects trajectory time step not to be higher than 1 ns.\n");
+        fprintf(stderr, "Times of concern: %f (current), %f (previous)\n", time, analysis->prevtime);
+        return 1;
+    }
+
+    analysis->prevtime = time;
+    if (analysis->start_time < 0) analysis->start_time = time;
+
+    const lipid_composition_t *composition = analysis->composition;
+
+    // a leaflet change is confirmed (temporal_limit - 1) frames after the lipid crossed the spatial limit
+    const float confirmation_delay = (analysis->temporal_limit - 1) * 1000.0f;
+
+    size_t head_index = 0;
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        atom_selection_t *selection = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
+        size_t *histogram = analysis->histogram + i * DWELL_N_LEAFLETS * analysis->n_bins;
+        size_t *overflow = analysis->overflow + i * DWELL_N_LEAFLETS;
+
+        for (size_t j = 0; j < selection->n_atoms; ++j, ++head_index) {
+            int flipflop = flipflops_classify_lipid(&analysis->classified[head_index], leaflets->distance[head_index], analysis->spatial_limit, analysis->temporal_limit);
+
+            // the leaflet of the lipid is known once it has been classified for the first time
+            if (analysis->initial[head_index] < 0 && analysis->classified[head_index] != 0) {
+                analysis->initial[head_index] = analysis->classified[head_index] > 0;
+            }
+
+            if (flipflop == 0) continue;
+
+            float change = time - confirmation_delay;
+            // lower->upper flip-flop ends a dwell in the lower leaflet and vice versa
+            dwell_leaflet_t leaflet = flipflop > 0 ? DWELL_LOWER : DWELL_UPPER;
+
+            if (analysis->first_passage[head_index] < 0) {
+                // the time spent in the leaflet before the start of the analysis is unknown, so this is not a dwell time
+                analysis->first_passage[head_index] = change - analysis->start_time;
+            } else {
+                size_t bin = (size_t) ((change - analysis->last_change[head_index]) / analysis->bin_width);
+                if (bin < analysis->n_bins) histogram[leaflet * analysis->n_bins + bin]++;
+                else overflow[leaflet]++;
+            }
+
+            analysis->last_change[head_index] = change;
+        }
+    }
+
+    return 0;
+}
+
+void dwell_write_histograms(FILE *output, const dwell_analysis_t *analysis, const char *input_xtc_file)
+{
+    const lipid_composition_t *composition = analysis->composition;
+
+    fprintf(output, "# Generated with Scramblyzer Dwell from file %s\n", input_xtc_file);
+    fprintf(output, "# Dwell times between consecutive leaflet changes (spatial limit: %f nm, temporal limit: %d ns).\n",
+            analysis->spatial_limit, analysis->temporal_limit);
+    fprintf(output, "# Dwell times longer than the histogram range:");
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        for (int k = 0; k < DWELL_N_LEAFLETS; ++k) {
+            fprintf(output, " %s %s: %zu", composition->lipid_types[i], LEAFLET_NAMES[k], analysis->overflow[i * DWELL_N_LEAFLETS + k]);
+        }
+    }
+    fprintf(output, "\n");
+    fprintf(output, "@    title \"Distribution of leaflet dwell times\"\n");
+    fprintf(output, "@    xaxis label \"dwell time [ns]\"\n");
+    fprintf(output, "@    yaxis label \"count\"\n");
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        for (int k = 0; k < DWELL_N_LEAFLETS; ++k) {
+            fprintf(output, "@    s%zu legend \"%s %s\"\n", i * DWELL_N_LEAFLETS + k, composition->lipid_types[i], LEAFLET_NAMES[k]);
+        }
+    }
+    fprintf(output, "@TYPE xy\n");
+
+    for (size_t bin = 0; bin < analysis->n_bins; ++bin) {
+        // center of the bin
+        fprintf(output, "%f     ", (bin + 0.5) * analysis->bin_width / 1000.0);
+
+        for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+            for (int k = 0; k < DWELL_N_LEAFLETS; ++k) {
+                fprintf(output, "%-8zu ", analysis->histogram[(i * DWELL_N_LEAFLETS + k) * analysis->n_bins + bin]);
+            }
+        }
+        fprintf(output, "\n");
+    }
+}
+
+void dwell_write_first_passage(FILE *output, const dwell_analysis_t *analysis, const char *input_xtc_file)
+{
+    const lipid_composition_t *composition = analysis->composition;
+
+    fprintf(output, "# Generated with Scramblyzer Dwell from file %s\n", input_xtc_file);
+    fprintf(output, "# First-passage time is the time between the start of the analysis and the first leaflet change (nan if the lipid never changed leaflet).\n");
+    fprintf(output, "# resname    resid  initial  first_passage_time [ns]\n");
+
+    size_t head_index = 0;
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        atom_selection_t *selection = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
+
+        for (size_t j = 0; j < selection->n_atoms; ++j, ++head_index) {
+            const char *initial = analysis->initial[head_index] < 0 ? "none" : LEAFLET_NAMES[analysis->initial[head_index] ? DWELL_UPPER : DWELL_LOWER];
+            fprintf(output, "%-8s %8d  %-7s  ", composition->lipid_types[i], selection->atoms[j]->residue_number, initial);
+
+            if (analysis->first_passage[head_index] < 0) fprintf(output, "nan\n");
+            else fprintf(output, "%f\n", analysis->first_passage[head_index] / 1000.0);
+        }
+    }
+}
+
+void dwell_analysis_destroy(dwell_analysis_t *analysis)
+{
+    if (analysis == NULL) return;
+
+    free(analysis->classified);
+    free(analysis->initial);
+    free(analysis->last_change);
+    free(analysis->first_passage);
+    free(analysis->histogram);
+    free(analysis->overflow);
+    free(analysis);
+}
+
+void print_usage_dwell(void)
+{
+    printf("\nValid OPTIONS for the dwell module:\n");
+    printf("-h               print this message and exit\n");
+    printf("-c STRING        gro file to read\n");
+    printf("-f STRING        xtc file to read ('-' for stdin)\n");
+    printf("-n STRING        ndx file to read (optional, default: index.ndx)\n");
+    printf("-o STRING        output file for the dwell-time histograms (default: dwell.xvg)\n");
+    printf("-x STRING        output file for the first-passage times (default: first_passage.dat)\n");
+    printf("-p STRING        selection of lipid head identifiers (default: name PO4)\n");
+    printf("-s FLOAT         how far into a leaflet must the head of the lipid move to count as leaflet change [in nm] (default: 1.5)\n");
+    printf("-t INTEGER       how long must the lipid stay in a leaflet to count as leaflet change [in ns] (default: 10)\n");
+    printf("-l FLOAT         identify leaflets by clustering lipid heads closer than FLOAT nm (optional)\n");
+    printf("-w FLOAT         width of a histogram bin [in ns] (default: 10.0)\n");
+    printf("-m FLOAT         range of the histograms [in ns] (default: 1000.0)\n");
+    printf("\n");
+}
+
+int get_arguments_dwell(
+        const int argc,
+        char **argv,
+        char **gro_file,
+        char **xtc_file,
+        char **ndx_file,
+        char **output_file,
+        char **passage_file,
+        char **phosphates,
+        float *spatial_limit,
+        int *temporal_limit,
+        float *leaflet_cutoff,
+        float *bin_width,
+        float *max_dwell)
+{
+    int gro_specified = 0, xtc_specified = 0;
+
+    int opt = 0;
+    while((opt = getopt(argc - 1, argv + 1, "c:f:n:o:x:p:s:t:l:w:m:h")) != -1) {
+        switch (opt) {
+        // help
+        case 'h':
+            return 1;
+        // gro file to read
+        case 'c':
+            *gro_file = optarg;
+            gro_specified = 1;
+            break;
+        // xtc file to read
+        case 'f':
+            *xtc_file = optarg;
+            xtc_specified = 1;
+            break;
+        // ndx file
+        case 'n':
+            *ndx_file = optarg;
+            break;
+        // output file for histograms
+        case 'o':
+            *output_file = optarg;
+            break;
+        // output file for first-passage times
+        case 'x':
+            *passage_file = optarg;
+            break;
+        // phosphates identifier
+        case 'p':
+            *phosphates = optarg;
+            break;
+        // spatial limit
+        case 's':
+            if (sscanf(optarg, "%f", spatial_limit) != 1 || *spatial_limit < 0) {
+                fprintf(stderr, "Spatial limit must be non-negative.\n");
+                return 1;
+            }
+            break;
+        // time limit
+        case 't':
+            if (sscanf(optarg, "%d", temporal_limit) != 1 || *temporal_limit < 1) {
+                fprintf(stderr, "Temporal limit cannot be lower than 1 ns.\n");
+                return 1;
+            }
+            break;
+        // leaflet clustering cutoff
+        case 'l':
+            if (sscanf(optarg, "%f", leaflet_cutoff) != 1 || *leaflet_cutoff <= 0) {
+                fprintf(stderr, "Leaflet clustering cutoff must be a positive number.\n");
+                return 1;
+            }
+            break;
+        // histogram bin width
+        case 'w':
+            if (sscanf(optarg, "%f", bin_width) != 1 || *bin_width <= 0) {
+                fprintf(stderr, "Bin width must be positive.\n");
+                return 1;
+            }
+            break;
+        // histogram range
+        case 'm':
+            if (sscanf(optarg, "%f", max_dwell) != 1 || *max_dwell <= 0) {
+                fprintf(stderr, "Histogram range must be positive.\n");
+                return 1;
+            }
+            break;
+        default:
+            return 1;
+        }
+    }
+
+    if (!gro_specified || !xtc_specified) {
+        fprintf(stderr, "Gro file and xtc file must always be supplied.\n");
+        return 1;
+    }
+    return 0;
+}
+
+/*! @brief Prints arguments that the program will use for the calculation. */
+static void print_arguments_dwell(
+        const char *gro_file,
+        const char *xtc_file,
+        const char *ndx_file,
+        const char *output_file,
+        const char *passage_file,
+        const char *phosphates,
+        const float spatial_limit,
+        const int temporal_limit,
+        const float leaflet_cutoff,
+        const float bin_width,
+        const float max_dwell)
+{
+    printf("Parameters for Dwell Time Analysis:\n");
+    printf(">>> gro file:         %s\n", gro_file);
+    printf(">>> xtc file:         %s\n", xtc_file);
+    printf(">>> ndx file:         %s\n", ndx_file);
+    printf(">>> output file:      %s\n", output_file);
+    printf(">>> passage file:     %s\n", passage_file);
+    printf(">>> lipid heads:      %s\n", phosphates);
+    printf(">>> spatial limit:    %f nm\n", spatial_limit);
+    printf(">>> temporal limit:   %d ns\n", temporal_limit);
+    if (leaflet_cutoff > 0) printf(">>> leaflet cutoff:   %f nm (spatial limit not used)\n", leaflet_cutoff);
+    printf(">>> bin width:        %f ns\n", bin_width);
+    printf(">>> histogram range:  %f ns\n", max_dwell);
+    printf("\n");
+}
+
+/*! @brief Deallocates the analyses and leaflet classifiers of all membranes and the membranes themselves. */
+static void dwell_destroy_membranes(dwell_analysis_t **analyses, leaflet_classifier_t **classifiers, membranes_t *membranes)
+{
+    for (size_t m = 0; m < membranes->n_membranes; ++m) {
+        dwell_analysis_destroy(analyses[m]);
+        leaflet_classifier_destroy(classifiers[m]);
+    }
+
+    free(analyses);
+    free(classifiers);
+    membranes_destroy(membranes);
+}
+
+int calc_dwell_times(
+        const char *input_gro_file,
+        const char *input_xtc_file,
+        const char *ndx_file,
+        const char *output_file,
+        const char *passage_file,
+        const char *head_identifier,
+        const float spatial_limit,
+        const int temporal_limit,
+        const float leaflet_cutoff,
+        const float bin_width,
+        const float max_dwell,
+        const int single_membrane,
+        profile_t *profile)
+{
+    print_arguments_dwell(input_gro_file, input_xtc_file, ndx_file, output_file, passage_file, head_identifier,
+            spatial_limit, temporal_limit, leaflet_cutoff, bin_width, max_dwell);
+
+    // read gro file and get lipids present in the system (possibly from the topology cache)
+    system_t *system = NULL;
+    lipid_composition_t *composition = topology_load(input_gro_file, ndx_file, head_identifier, &system);
+    if (composition == NULL) return 1;
+
+    // if there are no lipids
+    if (composition->n_lipid_types < 1) {
+        fprintf(stderr, "No usable lipids detected.\n");
+        lipid_composition_destroy(composition);
+        free(system);
+        return 1;
+    }
+
+    // open xtc file for reading
+    trajectory_t *traj = trajectory_open(input_xtc_file, system->n_atoms);
+    if (traj == NULL) {
+        fprintf(stderr, "File %s could not be read as an xtc file.\n", input_xtc_file);
+        lipid_composition_destroy(composition);
+        free(system);
+        return 1;
+    }
+
+    // check that the gro file and the xtc file match each other
+    if (!trajectory_validate(traj)) {
+        fprintf(stderr, "Number of atoms in %s does not match %s.\n", input_xtc_file, input_gro_file);
+        lipid_composition_destroy(composition);
+        free(system);
+        trajectory_close(traj);
+        return 1;
+    }
+
+    // split the lipids into separate membranes, if there are several of them; each membrane is analyzed separately
+    membranes_t *membranes = membranes_detect(composition, system->box, single_membrane);
+    const size_t n_membranes = membranes->n_membranes;
+
+    dwell_analysis_t **analyses = calloc(n_membranes, sizeof(dwell_analysis_t *));
+    leaflet_classifier_t **classifiers = calloc(n_membranes, sizeof(leaflet_classifier_t *));
+    for (size_t m = 0; m < n_membranes; ++m) {
+        analyses[m] = dwell_analysis_create(membranes->compositions[m], spatial_limit, temporal_limit, bin_width, max_dwell);
+
+        // prepare leaflet classification (clustering, if requested)
+        if ((classifiers[m] = leaflet_classifier_create(membranes->compositions[m], leaflet_cutoff)) == NULL) {
+            dwell_destroy_membranes(analyses, classifiers, membranes);
+            lipid_composition_destroy(composition);
+            free(system);
+            trajectory_close(traj);
+            return 1;
+        }
+    }
+
+    while (trajectory_next(traj) == 0) {
+        // only analyze every nanosecond
+        if ((int) traj->time % 1000 != 0) {
+            if (profile_skip(profile, traj) != 0) break;
+            continue;
+        }
+
+        if (profile_read(profile, traj, system) != 0) break;
+
+        // get center of geometry of each membrane
+        profile_begin(profile);
+        lipid_composition_update(composition, system->box);
+        membranes_update(membranes, system->box);
+        profile_end(profile, PROFILE_CENTER);
+
+        for (size_t m = 0; m < n_membranes; ++m) {
+            // assign lipids to leaflets; if clustering fails in the very first frame, lipids are not classified in this frame
+            profile_begin(profile);
+            int unassigned = leaflet_classifier_classify(classifiers[m], membranes->centers[m], system->box);
+            profile_end(profile, PROFILE_LEAFLETS);
+            if (unassigned && !classifiers[m]->initialized) continue;
+
+            profile_begin(profile);
+            int failed = dwell_analysis_frame(analyses[m], classifiers[m], system->time);
+            profile_end(profile, PROFILE_ANALYSIS);
+
+            if (failed) {
+                dwell_destroy_membranes(analyses, classifiers, membranes);
+                lipid_composition_destroy(composition);
+                free(system);
+                trajectory_close(traj);
+                return 1;
+            }
+        }
+    }
+
+    int return_code = 0;
+
+    printf("\n");
+    for (size_t m = 0; m < n_membranes; ++m) {
+        char *membrane_file = membranes_file_name(membranes, output_file, m);
+        FILE *output = fopen(membrane_file, "w");
+        if (output == NULL) {
+            fprintf(stderr, "Could not open output file %s\n", membrane_file);
+            return_code = 1;
+        } else {
+            dwell_write_histograms(output, analyses[m], input_xtc_file);
+            fclose(output);
+            printf("Output file %s written.\n", membrane_file);
+        }
+        free(membrane_file);
+
+        membrane_file = membranes_file_name(membranes, passage_file, m);
+        output = fopen(membrane_file, "w");
+        if (output == NULL) {
+            fprintf(stderr, "Could not open output file %s\n", membrane_file);
+            return_code = 1;
+        } else {
+            dwell_write_first_passage(output, analyses[m], input_xtc_file);
+            fclose(output);
+            printf("Output file %s written.\n", membrane_file);
+        }
+        free(membrane_file);
+    }
+
+    profile_report(profile);
+
+    dwell_destroy_membranes(analyses, classifiers, membranes);
+    lipid_composition_destroy(composition);
+    free(system);
+    trajectory_close(traj);
+
+    return return_code;
+}
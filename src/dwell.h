@@ -0,0 +1,144 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef DWELL_H
+#define DWELL_H
+
+#include <groan.h>
+#include <unistd.h>
+#include "general.h"
+#include "profile.h"
+#include "leaflets.h"
+
+/*! @brief Leaflets in which lipids dwell (direction of the flip-flop ending the dwell) */
+typedef enum dwell_leaflet {
+    DWELL_UPPER,                // dwell in the upper leaflet ended by an upper->lower flip-flop
+    DWELL_LOWER,                // dwell in the lower leaflet ended by a lower->upper flip-flop
+    DWELL_N_LEAFLETS
+} dwell_leaflet_t;
+
+/*! @brief State of the dwell-time analysis. See dwell_analysis_frame() for more details. */
+typedef struct dwell_analysis {
+    const lipid_composition_t *composition;
+    float spatial_limit;        // distance from the membrane center a lipid has to reach to be considered in a leaflet [nm]
+    int temporal_limit;         // number of frames (ns) a lipid has to stay in a leaflet to be considered stable in it
+    int *classified;            // state of each lipid (see flipflops_classify_lipid()), one item per lipid head
+    short *initial;             // leaflet of each lipid in the first analyzed frame (1 = upper, 0 = lower, -1 = not yet classified)
+    float *last_change;         // time of the last confirmed leaflet change of each lipid [ps] (negative if none)
+    float *first_passage;       // time between the start of the analysis and the first confirmed leaflet change of each lipid [ps] (negative if none)
+    float start_time;           // time of the first analyzed frame [ps] (negative if no frame has been analyzed)
+    float prevtime;             // time of the previous analyzed frame [ps] (negative if no frame has been analyzed)
+    float bin_width;            // width of a histogram bin [ps]
+    size_t n_bins;              // number of histogram bins
+    size_t *histogram;          // dwell times of each lipid type and leaflet ([type][leaflet][bin])
+    size_t *overflow;           // number of dwell times longer than the histogram range ([type][leaflet])
+} dwell_analysis_t;
+
+/*! @brief Prints supported flags and arguments of this module */
+void print_usage_dwell(void);
+
+
+/*! @brief Parses command line arguments for the dwell module.
+ *
+ * @return Zero, if parsing has been successful. Else returns non-zero.
+ */
+int get_arguments_dwell(
+        const int argc,
+        char **argv,
+        char **gro_file,
+        char **xtc_file,
+        char **ndx_file,
+        char **output_file,
+        char **passage_file,
+        char **phosphates,
+        float *spatial_limit,
+        int *temporal_limit,
+        float *leaflet_cutoff,
+        float *bin_width,
+        float *max_dwell);
+
+
+/*! @brief Prepares the dwell-time analysis. Must be deallocated using dwell_analysis_destroy().
+ *
+ * @param composition       lipid composition of the membrane
+ * @param spatial_limit     spatial limit for flip-flops [nm]
+ * @param temporal_limit    temporal limit for flip-flops [ns]
+ * @param bin_width         width of a histogram bin [ns]
+ * @param max_dwell         range of the histograms [ns]
+ */
+dwell_analysis_t *dwell_analysis_create(
+        const lipid_composition_t *composition,
+        const float spatial_limit,
+        const int temporal_limit,
+        const float bin_width,
+        const float max_dwell);
+
+
+/*! @brief Analyzes a single trajectory frame and updates the dwell-time histograms.
+ *
+ * @paragraph Leaflet changes
+ * Leaflet changes are identified using the same spatial and temporal rules as flip-flops (see flipflops_classify_lipid()).
+ * The time of a change is the time at which the lipid crossed the spatial limit of the new leaflet, not the time
+ * at which the change was confirmed.
+ *
+ * @paragraph Dwell times
+ * A dwell time is the time between two consecutive leaflet changes of the same lipid. Dwell times are binned into
+ * histograms for each lipid type and leaflet. The time between the start of the analysis and the first change
+ * of a lipid is its first-passage time; it is not included in the dwell histograms. Memory requirements
+ * are thus O(lipids + bins) independently of the length of the trajectory.
+ *
+ * @paragraph Analyzed frames
+ * As for the flip-flop analysis, frames must be provided every 1 ns.
+ *
+ * @param analysis          state of the analysis
+ * @param leaflets          leaflet assignment of lipid heads in the current frame (see leaflet_classifier_classify())
+ * @param time              time of the frame [ps]
+ *
+ * @return Zero, if successful. Else non-zero.
+ */
+int dwell_analysis_frame(
+        dwell_analysis_t *analysis,
+        const leaflet_classifier_t *leaflets,
+        const float time);
+
+
+/*! @brief Writes the dwell-time histograms into an xvg file. */
+void dwell_write_histograms(FILE *output, const dwell_analysis_t *analysis, const char *input_xtc_file);
+
+
+/*! @brief Writes the initial leaflet and the first-passage time of every lipid. */
+void dwell_write_first_passage(FILE *output, const dwell_analysis_t *analysis, const char *input_xtc_file);
+
+
+/*! @brief Deallocates memory for the dwell_analysis_t structure. */
+void dwell_analysis_destroy(dwell_analysis_t *analysis);
+
+
+/*! @brief Calculates distributions of leaflet dwell times and first-passage times of lipids.
+ *
+ * @paragraph Output
+ * Histograms of dwell times (for each lipid type and leaflet) are written into output_file. The initial leaflet
+ * and the first-passage time of every lipid are written into passage_file.
+ *
+ * @paragraph Leaflet clustering
+ * If leaflet_cutoff is positive, lipids are assigned to leaflets by clustering their heads (see leaflet_clustering_assign())
+ * instead of comparing their position with the membrane center. In such case, the spatial limit is not used.
+ *
+ * @return Zero, if the analysis was successful. Else non-zero.
+ */
+int calc_dwell_times(
+        const char *input_gro_file,
+        const char *input_xtc_file,
+        const char *ndx_file,
+        const char *output_file,
+        const char *passage_file,
+        const char *head_identifier,
+        const float spatial_limit,
+        const int temporal_limit,
+        const float leaflet_cutoff,
+        const float bin_width,
+        const float max_dwell,
+        const int single_membrane,
+        profile_t *profile);
+
+#endif /* DWELL_H */
@@ -1,109 +1,585 @@
 // Released under MIT License.
 // Copyright (c) 2022 Ladislav Bartos
 
+#include <float.h>
+#include <stdint.h>
 #include "general.h"
 #include "flipflops.h"
+#include "leaflets.h"
+#include "trajectory.h"
+#include "profile.h"
+#include "topology.h"
+#include "membranes.h"
+#include "checkpoint.h"
+
+int flipflops_classify_lipid(int *assignment, const float dist, const float spatial_limit, const int time_frames)
+{
+    // UPPER LEAFLET
+    if (dist > spatial_limit) {
+        // this means that the lipid is stable in the upper leaflet; don't do anything
+        if (*assignment > time_frames);
+        // this means that the lipid flipped recently from the lower leaflet but has not yet stabilized in the upper leaflet
+        else if (*assignment > 0) (*assignment)++; 
+        // this means that the lipid just now flipped from the lower leaflet in which it was stable
+        else if (*assignment <= -time_frames) *assignment = 1;
+        // this means that the lipid moved here from the lower leaflet but it was not stable in it (no flip-flop)
+        else if (*assignment < 0) *assignment = time_frames + 1;
+        // at the start of the analysis
+        else if (*assignment == 0) *assignment = time_frames + 1;
+
+    // INTERMEDIATE UPPER LEAFLET
+    } else if (dist > 0) {
+        // this means that the lipid is stable in the upper leaflet; don't do anything
+        if (*assignment > time_frames);
+        // this means that the lipid flipped recently from the lower leaflet but has not yet stabilized in the upper leaflet
+        else if (*assignment > 0) (*assignment)++;
+        // this means that the lipid just now flipped from the lower leaflet in which it was stable
+        // don't do anything because the lipid must flip to the true UPPER LEAFLET as defined by spatial limit
+        else if (*assignment <= -time_frames);
+        // this means that the lipid moved here from the lower leaflet but it was not stable in it (no flip-flop)
+        else if (*assignment < 0) *assignment = time_frames + 1;
+        // at the start of the analysis
+        else if (*assignment == 0) *assignment = time_frames + 1;
+
+    // LOWER LEAFLET
+    } else if (dist < -spatial_limit) {
+        // this means that the lipid just now flipped from the upper leaflet in which it was stable
+        if (*assignment >= time_frames) *assignment = -1;
+        // this means that the lipid moved here from the upper leaflet but it was not stable in it (no flip-flop)
+        else if (*assignment > 0) *assignment = -time_frames - 1;
+        // this means that the lipid is stable in the lower leaflet; don't do anything
+        else if (*assignment < -time_frames);
+         // this means that the lipid flipped recently from the upper leaflet but has not yet stabilized in the lower leaflet
+        else if (*assignment < 0) (*assignment)--;
+        // at the start of the analysis
+        else if (*assignment == 0) *assignment = -time_frames - 1;
+
+    // INTERMEDIATE LOWER LEAFLET
+    } else if (dist < 0) {
+        // this means that the lipid just now flipped from the upper leaflet in which it was stable
+        // don't do anything because the lipid must flip to the true LOWER LEAFLET as defined by spatial limit
+        if (*assignment >= time_frames);
+        // this means that the lipid moved here from the upper leaflet but it was not stable in it (no flip-flop)
+        else if (*assignment > 0) *assignment = -time_frames - 1;
+        // this means that the lipid is stable in the lower leaflet; don't do anything
+        else if (*assignment < -time_frames);
+         // this means that the lipid flipped recently from the upper leaflet but has not yet stabilized in the lower leaflet
+        else if (*assignment < 0) (*assignment)--;
+        // at the start of the analysis
+        else if (*assignment == 0) *assignment = -time_frames - 1;
+    }
+
+    // if the time_frames number is reached, the flip-flop is confirmed
+    if (*assignment == time_frames && dist > 0) return 1;
+    if (*assignment == -time_frames && dist < 0) return -1;
+    return 0;
+}
+
+/*! @brief Gets the index of the grid cell of the map containing the xy position. */
+static size_t map_cell(const flipflops_map_t *map, const vec_t position, const vec_t reference_center, const box_t box)
+{
+    size_t index[2] = {0};
+    for (int d = 0; d < 2; ++d) {
+        float coordinate = position[d];
+        // reference is placed in the middle of the map
+        if (map->reference != NULL) coordinate -= reference_center[d] - box[d] / 2;
+
+        // fractional coordinate wrapped into [0, 1)
+        float fraction = coordinate / box[d];
+        fraction -= floorf(fraction);
+
+        index[d] = (size_t) (fraction * map->n_cells[d]);
+        if (index[d] >= map->n_cells[d]) index[d] = map->n_cells[d] - 1;
+    }
+
+    return index[1] * map->n_cells[0] + index[0];
+}
+
+/*! @brief Updates the map of crossing positions for a single lipid. See flipflops_map_create() for more details.
+ *
+ * @param before    state of the lipid before the current frame
+ * @param after     state of the lipid after the current frame
+ * @param flipflop  flip-flop completed in the current frame (see flipflops_classify_lipid())
+ */
+static void map_lipid(
+        flipflops_map_t *map,
+        const size_t head_index,
+        const vec_t position,
+        const vec_t membrane_center,
+        const vec_t reference_center,
+        const box_t box,
+        const int before,
+        const int after,
+        const int flipflop)
+{
+    // lipid head in the hydrophobic core of the membrane
+    int in_core = fabsf(distance1D(position, membrane_center, z, box)) < map->core;
+    if (in_core) {
+        size_t cell = map_cell(map, position, reference_center, box);
+        map->occupancy[cell]++;
+        map->last_cell[head_index] = cell;
+    }
+
+    // lipid just crossed the spatial limit of the other leaflet; remember where it crossed the core
+    if ((after == 1 || after == -1) && after != before) {
+        if (map->last_cell[head_index] != SIZE_MAX) map->crossing_cell[head_index] = map->last_cell[head_index];
+        else map->crossing_cell[head_index] = map_cell(map, position, reference_center, box);
+    }
+
+    // lipid left the core into one of the leaflets; its next crossing must not be credited to this core visit
+    if (!in_core) map->last_cell[head_index] = SIZE_MAX;
+
+    if (flipflop != 0 && map->crossing_cell[head_index] != SIZE_MAX) {
+        map->crossings[map->crossing_cell[head_index]]++;
+        map->crossing_cell[head_index] = SIZE_MAX;
+    }
+}
+
+/*! @brief Updates the shell of the potential flip-flop of a single lipid. See flipflops_proximity_attach() for more details.
+ *
+ * @param before    state of the lipid before the current frame
+ * @param after     state of the lipid after the current frame
+ * @param flipflop  flip-flop completed in the current frame (see flipflops_classify_lipid())
+ */
+static void shell_lipid(
+        flipflops_analysis_t *analysis,
+        const size_t head_index,
+        const vec_t position,
+        const vec_t membrane_center,
+        const box_t box,
+        const int before,
+        const int after,
+        const int flipflop)
+{
+    short shell = analysis->proximity->shell[head_index];
+
+    // lipid head in the hydrophobic core of the membrane
+    int in_core = fabsf(distance1D(position, membrane_center, z, box)) < analysis->spatial_limit;
+    if (in_core) analysis->last_shell[head_index] = shell;
+
+    // lipid just crossed the spatial limit of the other leaflet
+    if ((after == 1 || after == -1) && after != before) {
+        analysis->crossing_shell[head_index] = analysis->last_shell[head_index] >= 0 ? analysis->last_shell[head_index] : shell;
+    }
 
-// frequency of printing during the calculation
-static const int PROGRESS_FREQ = 10000;
+    // lipid left the core into one of the leaflets (as in map_lipid())
+    if (!in_core) analysis->last_shell[head_index] = -1;
 
-/*! @brief Assigns all lipids into membrane leaflets and search for flipflops.*/
+    if (flipflop != 0 && analysis->crossing_shell[head_index] >= 0) {
+        if (flipflop == 1) analysis->shell_lower_upper[analysis->crossing_shell[head_index]]++;
+        else analysis->shell_upper_lower[analysis->crossing_shell[head_index]]++;
+        analysis->crossing_shell[head_index] = -1;
+    }
+}
+
+/*! @brief Assigns all lipids into membrane leaflets and search for flipflops.
+ *
+ * @paragraph Leaflets
+ * The distance of each lipid from the membrane center is taken from the leaflet classifier. For leaflets
+ * from clustering, the lipid is thus always considered to be located beyond the spatial limit.
+ *
+ * @paragraph Crossing map and distance shells
+ * If 'analysis->map' is not NULL, positions of lipids crossing the membrane are mapped (see map_lipid()).
+ * If 'analysis->proximity' is not NULL, flip-flops are counted in distance shells (see shell_lipid()).
+ */
 static void find_flipflops(
-        const lipid_composition_t *composition,
-        int **classified_lipids,
-        size_t *flipflops_upper_lower,
-        size_t *flipflops_lower_upper,
+        flipflops_analysis_t *analysis,
+        const leaflet_classifier_t *leaflets,
         const vec_t membrane_center,
         const box_t box,
-        const float spatial_limit,
-        const int time_frames)
+        const vec_t reference_center)
 { 
+    const lipid_composition_t *composition = analysis->composition;
+    size_t head_index = 0;
     // loop through all available lipid names
     for (size_t i = 0; i < composition->n_lipid_types; ++i) {
         atom_selection_t *selection = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
 
-        int *assignment = classified_lipids[i];
+        int *assignment = analysis->classified[i];
 
         // loop through the heads of the selection
-        for (size_t j = 0; j < selection->n_atoms; ++j) {
-            float dist = distance1D(selection->atoms[j]->position, membrane_center, z, box);
-
-            // UPPER LEAFLET
-            if (dist > spatial_limit) {
-                // this means that the lipid is stable in the upper leaflet; don't do anything
-                if (assignment[j] > time_frames);
-                // this means that the lipid flipped recently from the lower leaflet but has not yet stabilized in the upper leaflet
-                else if (assignment[j] > 0) assignment[j]++; 
-                // this means that the lipid just now flipped from the lower leaflet in which it was stable
-                else if (assignment[j] <= -time_frames) assignment[j] = 1;
-                // this means that the lipid moved here from the lower leaflet but it was not stable in it (no flip-flop)
-                else if (assignment[j] < 0) assignment[j] = time_frames + 1;
-                // at the start of the analysis
-                else if (assignment[j] == 0) assignment[j] = time_frames + 1;
-
-            // INTERMEDIATE UPPER LEAFLET
-            } else if (dist > 0) {
-                // this means that the lipid is stable in the upper leaflet; don't do anything
-                if (assignment[j] > time_frames);
-                // this means that the lipid flipped recently from the lower leaflet but has not yet stabilized in the upper leaflet
-                else if (assignment[j] > 0) assignment[j]++;
-                // this means that the lipid just now flipped from the lower leaflet in which it was stable
-                // don't do anything because the lipid must flip to the true UPPER LEAFLET as defined by spatial limit
-                else if (assignment[j] <= -time_frames);
-                // this means that the lipid moved here from the lower leaflet but it was not stable in it (no flip-flop)
-                else if (assignment[j] < 0) assignment[j] = time_frames + 1;
-                // at the start of the analysis
-                else if (assignment[j] == 0) assignment[j] = time_frames + 1;
-
-            // LOWER LEAFLET
-            } else if (dist < -spatial_limit) {
-                // this means that the lipid just now flipped from the upper leaflet in which it was stable
-                if (assignment[j] >= time_frames) assignment[j] = -1;
-                // this means that the lipid moved here from the upper leaflet but it was not stable in it (no flip-flop)
-                else if (assignment[j] > 0) assignment[j] = -time_frames - 1;
-                // this means that the lipid is stable in the lower leaflet; don't do anything
-                else if (assignment[j] < -time_frames);
-                 // this means that the lipid flipped recently from the upper leaflet but has not yet stabilized in the lower leaflet
-                else if (assignment[j] < 0) assignment[j]--;
-                // at the start of the analysis
-                else if (assignment[j] == 0) assignment[j] = -time_frames - 1;
-
-            // INTERMEDIATE LOWER LEAFLET
-            } else if (dist < 0) {
-                // this means that the lipid just now flipped from the upper leaflet in which it was stable
-                // don't do anything because the lipid must flip to the true LOWER LEAFLET as defined by spatial limit
-                if (assignment[j] >= time_frames);
-                // this means that the lipid moved here from the upper leaflet but it was not stable in it (no flip-flop)
-                else if (assignment[j] > 0) assignment[j] = -time_frames - 1;
-                // this means that the lipid is stable in the lower leaflet; don't do anything
-                else if (assignment[j] < -time_frames);
-                 // this means that the lipid flipped recently from the upper leaflet but has not yet stabilized in the lower leaflet
-                else if (assignment[j] < 0) assignment[j]--;
-                // at the start of the analysis
-                else if (assignment[j] == 0) assignment[j] = -time_frames - 1;
+        for (size_t j = 0; j < selection->n_atoms; ++j, ++head_index) {
+            float dist = leaflets->distance[head_index];
+
+            int before = assignment[j];
+            int flipflop = flipflops_classify_lipid(&assignment[j], dist, analysis->spatial_limit, analysis->temporal_limit);
+
+            if (analysis->map != NULL) {
+                map_lipid(analysis->map, head_index, selection->atoms[j]->position, membrane_center, reference_center, box, before, assignment[j], flipflop);
+            }
+
+            if (analysis->proximity != NULL) {
+                shell_lipid(analysis, head_index, selection->atoms[j]->position, membrane_center, box, before, assignment[j], flipflop);
             }
 
-            // if the time_frames number is reached, increase the flip-flop counter
-            if (assignment[j] == time_frames && dist > 0) {
-                flipflops_lower_upper[i]++;
-            } else if (assignment[j] == -time_frames && dist < 0) {
-                flipflops_upper_lower[i]++;
+            switch (flipflop) {
+            case 1:
+                analysis->lower_upper[i]++;
+                break;
+            case -1:
+                analysis->upper_lower[i]++;
+                break;
+            default:
+                break;
             }
         }
     }
 }
 
+flipflops_analysis_t *flipflops_analysis_create(
+        const lipid_composition_t *composition,
+        const float spatial_limit,
+        const int temporal_limit)
+{
+    flipflops_analysis_t *analysis = calloc(1, sizeof(flipflops_analysis_t));
+    analysis->composition = composition;
+    analysis->spatial_limit = spatial_limit;
+    analysis->temporal_limit = temporal_limit;
+    analysis->prevtime = -1.0;
+
+    // create an array for lipid classificiation
+    analysis->classified = calloc(composition->n_lipid_types, sizeof(int *));
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        atom_selection_t *selection = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
+        analysis->classified[i] = calloc(selection->n_atoms, sizeof(int));
+    }
+    // create arrays for flip-flop
+    analysis->upper_lower = calloc(composition->n_lipid_types, sizeof(size_t));
+    analysis->lower_upper = calloc(composition->n_lipid_types, sizeof(size_t));
+
+    return analysis;
+}
+
+int flipflops_analysis_frame(
+        flipflops_analysis_t *analysis,
+        const leaflet_classifier_t *leaflets,
+        const vec_t membrane_center,
+        const box_t box,
+        const float time)
+{
+    // sanity check of the trajectory
+    if (analysis->prevtime >= 0 && time - analysis->prevtime > 1000) {
+        fprintf(stderr, "Scramblyzer flipflops expects trajectory time step not to be higher than 1 ns.\n");
+        fprintf(stderr, "Times of concern: %f (current), %f (previous)\n", time, analysis->prevtime);
+        return 1;
+    }
+
+    analysis->prevtime = time;
+
+    vec_t reference_center = {0.0};
+    if (analysis->map != NULL) {
+        if (analysis->map->reference != NULL) center_of_geometry(analysis->map->reference, reference_center, (float *) box);
+        analysis->map->frames++;
+    }
+
+    // if the shells could not be calculated, all lipids are in the bulk shell (reported by proximity_update())
+    if (analysis->proximity != NULL) proximity_update(analysis->proximity, box);
+
+    find_flipflops(analysis, leaflets, membrane_center, box, reference_center);
+
+    return 0;
+}
+
+void flipflops_proximity_attach(flipflops_analysis_t *analysis, proximity_t *proximity)
+{
+    analysis->proximity = proximity;
+    analysis->last_shell = malloc(proximity->n_heads * sizeof(short));
+    analysis->crossing_shell = malloc(proximity->n_heads * sizeof(short));
+    for (size_t i = 0; i < proximity->n_heads; ++i) {
+        analysis->last_shell[i] = -1;
+        analysis->crossing_shell[i] = -1;
+    }
+
+    analysis->shell_upper_lower = calloc(proximity->n_shells, sizeof(size_t));
+    analysis->shell_lower_upper = calloc(proximity->n_shells, sizeof(size_t));
+}
+
+void flipflops_map_create(
+        flipflops_analysis_t *analysis,
+        const float spacing,
+        const box_t box,
+        atom_selection_t *reference)
+{
+    const lipid_composition_t *composition = analysis->composition;
+    size_t n_heads = 0;
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        atom_selection_t *selection = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
+        n_heads += selection->n_atoms;
+    }
+
+    flipflops_map_t *map = calloc(1, sizeof(flipflops_map_t));
+    map->core = analysis->spatial_limit;
+    map->spacing = spacing;
+    map->reference = reference;
+
+    for (int d = 0; d < 2; ++d) {
+        map->n_cells[d] = (size_t) roundf(box[d] / spacing);
+        if (map->n_cells[d] < 1) map->n_cells[d] = 1;
+    }
+
+    map->occupancy = calloc(map->n_cells[0] * map->n_cells[1], sizeof(size_t));
+    map->crossings = calloc(map->n_cells[0] * map->n_cells[1], sizeof(size_t));
+    map->last_cell = malloc(n_heads * sizeof(size_t));
+    map->crossing_cell = malloc(n_heads * sizeof(size_t));
+    for (size_t i = 0; i < n_heads; ++i) {
+        map->last_cell[i] = SIZE_MAX;
+        map->crossing_cell[i] = SIZE_MAX;
+    }
+
+    analysis->map = map;
+}
+
+/*! @brief Writes a single grid of the map as a matrix (rows correspond to y, columns to x). */
+static int write_map_grid(
+        const flipflops_map_t *map,
+        const size_t *grid,
+        const char *output_file,
+        const char *description,
+        const char *input_xtc_file)
+{
+    FILE *output = fopen(output_file, "w");
+    if (output == NULL) {
+        fprintf(stderr, "Could not open output file %s\n", output_file);
+        return 1;
+    }
+
+    fprintf(output, "# Generated with Scramblyzer FlipFlops from file %s\n", input_xtc_file);
+    fprintf(output, "# %s\n", description);
+    fprintf(output, "# grid: %zu x %zu cells (x, y), cell size in the first frame: %f x %f nm\n",
+            map->n_cells[0], map->n_cells[1], map->spacing, map->spacing);
+    if (map->reference != NULL) fprintf(output, "# positions relative to the reference selection located in the middle of the grid\n");
+    else fprintf(output, "# absolute positions; the first cell starts at the origin of the box\n");
+    fprintf(output, "# hydrophobic core: |z - membrane center| < %f nm, mapped frames: %zu\n", map->core, map->frames);
+    fprintf(output, "# rows: y (increasing), columns: x (increasing)\n");
+
+    for (size_t y = 0; y < map->n_cells[1]; ++y) {
+        for (size_t x = 0; x < map->n_cells[0]; ++x) {
+            fprintf(output, x == 0 ? "%zu" : " %zu", grid[y * map->n_cells[0] + x]);
+        }
+        fprintf(output, "\n");
+    }
+
+    fclose(output);
+    printf("Output file %s written.\n", output_file);
+    return 0;
+}
+
+int flipflops_map_write(const flipflops_map_t *map, const char *prefix, const char *input_xtc_file)
+{
+    size_t name_length = strlen(prefix) + 32;
+    char *output_file = calloc(name_length, 1);
+
+    snprintf(output_file, name_length, "%s_occupancy.dat", prefix);
+    int return_code = write_map_grid(map, map->occupancy, output_file, "number of frames a lipid head was located in the hydrophobic core", input_xtc_file);
+
+    snprintf(output_file, name_length, "%s_crossings.dat", prefix);
+    return_code |= write_map_grid(map, map->crossings, output_file, "number of flip-flops crossing the hydrophobic core", input_xtc_file);
+
+    free(output_file);
+    return return_code;
+}
+
+void flipflops_write_table(FILE *output, const flipflops_analysis_t *analysis)
+{
+    const lipid_composition_t *composition = analysis->composition;
+
+    fprintf(output, "Lipid | U->L | L->U | All \n");
+    size_t total_upper_lower = 0, total_lower_upper = 0;
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        total_upper_lower += analysis->upper_lower[i];
+        total_lower_upper += analysis->lower_upper[i];
+
+        fprintf(output, "%-5s | %-4zu | %-4zu | %-4zu\n", 
+            composition->lipid_types[i], 
+            analysis->upper_lower[i], 
+            analysis->lower_upper[i],
+            analysis->upper_lower[i] + analysis->lower_upper[i]);
+    }
+    
+    // if there are 2 or more lipid types, also print TOTAL number of lipids
+    if (composition->n_lipid_types > 1) {
+        fprintf(output, "-----------------------------\n");
+        fprintf(output, "TOTAL | %-4zu | %-4zu | %-4zu\n", total_upper_lower, total_lower_upper, total_upper_lower + total_lower_upper);
+    }
+
+    if (analysis->proximity == NULL) return;
+
+    fprintf(output, "\nShell        | U->L | L->U | All \n");
+    for (size_t s = 0; s < analysis->proximity->n_shells; ++s) {
+        char label[64] = {0};
+        proximity_shell_label(analysis->proximity, s, label, sizeof(label));
+
+        fprintf(output, "%-12s | %-4zu | %-4zu | %-4zu\n",
+            label,
+            analysis->shell_upper_lower[s],
+            analysis->shell_lower_upper[s],
+            analysis->shell_upper_lower[s] + analysis->shell_lower_upper[s]);
+    }
+}
+
+void flipflops_analysis_destroy(flipflops_analysis_t *analysis)
+{
+    if (analysis == NULL) return;
+
+    for (size_t i = 0; i < analysis->composition->n_lipid_types; ++i) {
+        free(analysis->classified[i]);
+    }
+    free(analysis->classified);
+    free(analysis->upper_lower);
+    free(analysis->lower_upper);
+
+    if (analysis->map != NULL) {
+        free(analysis->map->reference);
+        free(analysis->map->occupancy);
+        free(analysis->map->crossings);
+        free(analysis->map->last_cell);
+        free(analysis->map->crossing_cell);
+        free(analysis->map);
+    }
+
+    proximity_destroy(analysis->proximity);
+    free(analysis->last_shell);
+    free(analysis->crossing_shell);
+    free(analysis->shell_upper_lower);
+    free(analysis->shell_lower_upper);
+
+    free(analysis);
+}
+
+/*! @brief Saves the state of the analysis (classification of lipids, flip-flop counters and time of the last frame) into a checkpoint. */
+static int save_checkpoint_flipflops(
+        const char *checkpoint_file,
+        const flipflops_analysis_t *analysis,
+        const leaflet_clustering_t *clustering,
+        const float last_time)
+{
+    const lipid_composition_t *composition = analysis->composition;
+
+    FILE *file = checkpoint_open_write(checkpoint_file, "flipflops", composition);
+    if (file == NULL) return 1;
+
+    int failed = checkpoint_write(file, &analysis->spatial_limit, sizeof(float), 1);
+    failed |= checkpoint_write(file, &analysis->temporal_limit, sizeof(int), 1);
+    failed |= checkpoint_write(file, &analysis->prevtime, sizeof(float), 1);
+    failed |= checkpoint_write(file, &last_time, sizeof(float), 1);
+    failed |= checkpoint_write(file, analysis->upper_lower, sizeof(size_t), composition->n_lipid_types);
+    failed |= checkpoint_write(file, analysis->lower_upper, sizeof(size_t), composition->n_lipid_types);
+
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        atom_selection_t *selection = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
+        failed |= checkpoint_write(file, analysis->classified[i], sizeof(int), selection->n_atoms);
+    }
+
+    // leaflet assignment from clustering
+    int clustered = (clustering != NULL);
+    failed |= checkpoint_write(file, &clustered, sizeof(int), 1);
+    if (clustered) {
+        failed |= checkpoint_write(file, &clustering->initialized, sizeof(int), 1);
+        failed |= checkpoint_write(file, clustering->leaflet, sizeof(short), clustering->n_heads);
+    }
+
+    return checkpoint_close_write(file, checkpoint_file, failed);
+}
+
+/*! @brief Loads the state of the analysis from a checkpoint written by save_checkpoint_flipflops(). */
+static int load_checkpoint_flipflops(
+        const char *checkpoint_file,
+        flipflops_analysis_t *analysis,
+        leaflet_clustering_t *clustering,
+        float *last_time)
+{
+    const lipid_composition_t *composition = analysis->composition;
+
+    FILE *file = checkpoint_open_read(checkpoint_file, "flipflops", composition);
+    if (file == NULL) return 1;
+
+    float checkpoint_spatial_limit = 0.0;
+    int checkpoint_temporal_limit = 0;
+    int failed = checkpoint_read(file, &checkpoint_spatial_limit, sizeof(float), 1);
+    failed |= checkpoint_read(file, &checkpoint_temporal_limit, sizeof(int), 1);
+
+    if (!failed && (checkpoint_spatial_limit != analysis->spatial_limit || checkpoint_temporal_limit != analysis->temporal_limit)) {
+        fprintf(stderr, "Spatial and temporal limits (%f nm, %d ns) do not match the limits used in checkpoint %s (%f nm, %d ns).\n",
+                analysis->spatial_limit, analysis->temporal_limit, checkpoint_file, checkpoint_spatial_limit, checkpoint_temporal_limit);
+        fclose(file);
+        return 1;
+    }
+
+    failed |= checkpoint_read(file, &analysis->prevtime, sizeof(float), 1);
+    failed |= checkpoint_read(file, last_time, sizeof(float), 1);
+    failed |= checkpoint_read(file, analysis->upper_lower, sizeof(size_t), composition->n_lipid_types);
+    failed |= checkpoint_read(file, analysis->lower_upper, sizeof(size_t), composition->n_lipid_types);
+
+    for (size_t i = 0; !failed && i < composition->n_lipid_types; ++i) {
+        atom_selection_t *selection = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
+        failed |= checkpoint_read(file, analysis->classified[i], sizeof(int), selection->n_atoms);
+    }
+
+    int clustered = 0;
+    failed |= checkpoint_read(file, &clustered, sizeof(int), 1);
+    if (!failed && clustered != (clustering != NULL)) {
+        fprintf(stderr, "Leaflet identification method does not match the method used in checkpoint %s.\n", checkpoint_file);
+        fclose(file);
+        return 1;
+    }
+
+    if (!failed && clustered) {
+        failed |= checkpoint_read(file, &clustering->initialized, sizeof(int), 1);
+        failed |= checkpoint_read(file, clustering->leaflet, sizeof(short), clustering->n_heads);
+    }
+
+    fclose(file);
+
+    if (failed) {
+        fprintf(stderr, "Could not read checkpoint file %s.\n", checkpoint_file);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*! @brief Prints the current number of flip-flop events if new events have been detected since the last report. */
+static void report_new_flipflops(
+        const flipflops_analysis_t *analysis,
+        size_t *reported,
+        const float time,
+        const size_t membrane,
+        const size_t n_membranes)
+{
+    size_t total_upper_lower = 0, total_lower_upper = 0;
+    for (size_t i = 0; i < analysis->composition->n_lipid_types; ++i) {
+        total_upper_lower += analysis->upper_lower[i];
+        total_lower_upper += analysis->lower_upper[i];
+    }
+
+    if (total_upper_lower + total_lower_upper == *reported) return;
+
+    *reported = total_upper_lower + total_lower_upper;
+    if (n_membranes > 1) printf("Membrane %zu. ", membrane + 1);
+    printf("Time: %.0f ps. Flip-flops detected so far: %zu (U->L: %zu, L->U: %zu)\n", 
+            time, *reported, total_upper_lower, total_lower_upper);
+    fflush(stdout);
+}
+
 void print_usage_flipflops(void)
 {
     printf("\nValid OPTIONS for the flipflops module:\n");
     printf("-h               print this message and exit\n");
     printf("-c STRING        gro file to read\n");
-    printf("-f STRING        xtc file to read\n");
+    printf("-f STRING        xtc file to read ('-' for stdin)\n");
     printf("-n STRING        ndx file to read (optional, default: index.ndx)\n");
     printf("-o STRING        output file (default: positions.xvg)\n");
     printf("-p STRING        selection of lipid head identifiers (default: name PO4)\n");
     printf("-s FLOAT         how far into a leaflet must the head of the lipid move to count as flip-flop [in nm] (default: 1.5)\n");
     printf("-t INTEGER       how long must the lipid stay in a leaflet to count as flip-flop [in ns] (default: 10)\n");
+    printf("-l FLOAT         identify leaflets by clustering lipid heads closer than FLOAT nm (optional)\n");
+    printf("-k STRING        checkpoint file to resume the analysis from and to save its state into (optional)\n");
+    printf("-x STRING        map xy positions of lipids crossing the membrane into files with this prefix (optional)\n");
+    printf("-g FLOAT         spacing of the grid of the map [in nm] (default: 0.5)\n");
+    printf("-r STRING        center the map at the center of this selection, e.g. a protein (optional)\n");
+    printf("-P STRING        count flip-flops in shells by the xy distance from this selection, e.g. a protein (optional)\n");
+    printf("-d STRING        comma-separated outer edges of the distance shells [in nm] (default: 1.5)\n");
+    printf("--follow         wait for new frames of a trajectory that is still being written (stop with Ctrl+C)\n");
     printf("\n");
 }
 
@@ -115,12 +591,19 @@ int get_arguments_flipflops(
         char **ndx_file,
         char **phosphates,
         float *spatial_limit,
-        int *temporal_limit) 
+        int *temporal_limit,
+        float *leaflet_cutoff,
+        char **checkpoint_file,
+        char **map_prefix,
+        float *grid_spacing,
+        char **reference,
+        char **protein,
+        char **shells) 
 {
     int gro_specified = 0, xtc_specified = 0;
 
     int opt = 0;
-    while((opt = getopt(argc - 1, argv + 1, "c:f:n:p:s:t:h")) != -1) {
+    while((opt = getopt(argc - 1, argv + 1, "c:f:n:p:s:t:l:k:x:g:r:P:d:h")) != -1) {
         switch (opt) {
         // help
         case 'h':
@@ -167,6 +650,40 @@ int get_arguments_flipflops(
                 return 1;
             }
             break;
+        // leaflet clustering cutoff
+        case 'l':
+            if (sscanf(optarg, "%f", leaflet_cutoff) != 1 || *leaflet_cutoff <= 0) {
+                fprintf(stderr, "Leaflet clustering cutoff must be a positive number.\n");
+                return 1;
+            }
+            break;
+        // checkpoint file
+        case 'k':
+            *checkpoint_file = optarg;
+            break;
+        // prefix of the crossing map files
+        case 'x':
+            *map_prefix = optarg;
+            break;
+        // grid spacing of the crossing map
+        case 'g':
+            if (sscanf(optarg, "%f", grid_spacing) != 1 || *grid_spacing <= 0) {
+                fprintf(stderr, "Grid spacing must be positive.\n");
+                return 1;
+            }
+            break;
+        // reference selection for the crossing map
+        case 'r':
+            *reference = optarg;
+            break;
+        // selection for the distance shells
+        case 'P':
+            *protein = optarg;
+            break;
+        // edges of the distance shells
+        case 'd':
+            *shells = optarg;
+            break;
         default:
             //fprintf(stderr, "Unknown command line option: %c.\n", opt);
             return 1;
@@ -177,6 +694,16 @@ int get_arguments_flipflops(
         fprintf(stderr, "Gro file and xtc file must always be supplied.\n");
         return 1;
     }
+
+    if (*map_prefix != NULL && *checkpoint_file != NULL) {
+        fprintf(stderr, "Crossing maps can not be combined with checkpoints.\n");
+        return 1;
+    }
+
+    if (*protein != NULL && *checkpoint_file != NULL) {
+        fprintf(stderr, "Distance shells can not be combined with checkpoints.\n");
+        return 1;
+    }
     return 0;
 }
 
@@ -187,7 +714,15 @@ void print_arguments_flipflops(
         const char *ndx_file,
         const char *phosphates,
         const float spatial_limit,
-        const int temporal_limit)
+        const int temporal_limit,
+        const float leaflet_cutoff,
+        const char *checkpoint_file,
+        const char *map_prefix,
+        const float grid_spacing,
+        const char *reference,
+        const char *protein,
+        const char *shells,
+        const int follow)
 {
     printf("Parameters for FlipFlops Analysis:\n");
     printf(">>> gro file:         %s\n", gro_file);
@@ -196,32 +731,97 @@ void print_arguments_flipflops(
     printf(">>> lipid heads:      %s\n", phosphates);
     printf(">>> spatial limit:    %f nm\n", spatial_limit);
     printf(">>> temporal limit:   %d ns\n", temporal_limit);
+    if (leaflet_cutoff > 0) printf(">>> leaflet cutoff:   %f nm (spatial limit not used)\n", leaflet_cutoff);
+    if (checkpoint_file != NULL) printf(">>> checkpoint file:  %s\n", checkpoint_file);
+    if (map_prefix != NULL) {
+        printf(">>> crossing map:     %s_occupancy.dat, %s_crossings.dat\n", map_prefix, map_prefix);
+        printf(">>> grid spacing:     %f nm\n", grid_spacing);
+        if (reference != NULL) printf(">>> map reference:    %s\n", reference);
+    }
+    if (protein != NULL) {
+        printf(">>> protein:          %s\n", protein);
+        printf(">>> distance shells:  %s nm\n", shells);
+    }
+    if (follow) printf(">>> following trajectory (stop with Ctrl+C)\n");
     printf("\n");
 }
 
+/*! @brief Deallocates the analyses and leaflet classifiers of all membranes and the membranes themselves. */
+static void flipflops_destroy_membranes(flipflops_analysis_t **analyses, leaflet_classifier_t **classifiers, membranes_t *membranes)
+{
+    for (size_t m = 0; m < membranes->n_membranes; ++m) {
+        flipflops_analysis_destroy(analyses[m]);
+        leaflet_classifier_destroy(classifiers[m]);
+    }
+
+    free(analyses);
+    free(classifiers);
+    membranes_destroy(membranes);
+}
+
 int calc_lipid_flipflops(
         const char *input_gro_file,
         const char *input_xtc_file,
         const char *ndx_file,
         const char *head_identifier,
         const float spatial_limit,
-        const int temporal_limit)
+        const int temporal_limit,
+        const float leaflet_cutoff,
+        const char *checkpoint_file,
+        const char *map_prefix,
+        const float grid_spacing,
+        const char *reference,
+        const char *protein,
+        const char *shells,
+        const int single_membrane,
+        const int follow,
+        profile_t *profile)
 {
-    print_arguments_flipflops(input_gro_file, input_xtc_file, ndx_file, head_identifier, spatial_limit, temporal_limit);
-
-    // read gro file
-    system_t *system = load_gro(input_gro_file);
-    if (system == NULL) return 1;
-
-    // read ndx file
-    dict_t *ndx_groups = read_ndx(ndx_file, system);
+    print_arguments_flipflops(input_gro_file, input_xtc_file, ndx_file, head_identifier, spatial_limit, temporal_limit, leaflet_cutoff,
+            checkpoint_file, map_prefix, grid_spacing, reference, protein, shells, follow);
+
+    // read gro file and get lipids present in the system (possibly from the topology cache)
+    system_t *system = NULL;
+    lipid_composition_t *composition = topology_load(input_gro_file, ndx_file, head_identifier, &system);
+    if (composition == NULL) return 1;
+
+    // read ndx file (only needed for further selections)
+    dict_t *ndx_groups = NULL;
+    if ((map_prefix != NULL && reference != NULL) || protein != NULL) ndx_groups = read_ndx(ndx_file, system);
+
+    // select the reference of the crossing map, if requested
+    atom_selection_t *map_reference = NULL;
+    if (map_prefix != NULL && reference != NULL) {
+        atom_selection_t *all = select_system(system);
+        map_reference = smart_select(all, reference, ndx_groups);
+        free(all);
+
+        if (map_reference == NULL || map_reference->n_atoms == 0) {
+            fprintf(stderr, "No atoms corresponding to reference selection ('%s') found.\n", reference);
+            free(map_reference);
+            lipid_composition_destroy(composition);
+            free(system);
+            dict_destroy(ndx_groups);
+            return 1;
+        }
+    }
 
-    // get lipids present in the system
-    lipid_composition_t *composition = get_lipid_composition(system, head_identifier, ndx_groups);
-    if (composition == NULL) {
-        free(system);
-        dict_destroy(ndx_groups);
-        return 1;
+    // select the protein for the distance shells, if requested
+    atom_selection_t *protein_atoms = NULL;
+    if (protein != NULL) {
+        atom_selection_t *all = select_system(system);
+        protein_atoms = smart_select(all, protein, ndx_groups);
+        free(all);
+
+        if (protein_atoms == NULL || protein_atoms->n_atoms == 0) {
+            fprintf(stderr, "No atoms corresponding to protein selection ('%s') found.\n", protein);
+            free(protein_atoms);
+            free(map_reference);
+            lipid_composition_destroy(composition);
+            free(system);
+            dict_destroy(ndx_groups);
+            return 1;
+        }
     }
 
     dict_destroy(ndx_groups);
@@ -229,111 +829,186 @@ int calc_lipid_flipflops(
     // if there are no lipids
     if (composition->n_lipid_types < 1) {
         fprintf(stderr, "No usable lipids detected.\n");
+        free(protein_atoms);
+        free(map_reference);
         lipid_composition_destroy(composition);
         free(system);
         return 1;
     }
 
     // open xtc file for reading
-    XDRFILE *xtc = xdrfile_open(input_xtc_file, "r");
-    if (xtc == NULL) {
+    trajectory_t *traj = trajectory_open(input_xtc_file, system->n_atoms);
+    if (traj == NULL) {
         fprintf(stderr, "File %s could not be read as an xtc file.\n", input_xtc_file);
+        free(protein_atoms);
+        free(map_reference);
         lipid_composition_destroy(composition);
         free(system);
         return 1;
     }
 
     // check that the gro file and the xtc file match each other
-    if (!validate_xtc(input_xtc_file, (int) system->n_atoms)) {
+    if (!trajectory_validate(traj)) {
         fprintf(stderr, "Number of atoms in %s does not match %s.\n", input_xtc_file, input_gro_file);
+        free(protein_atoms);
+        free(map_reference);
         lipid_composition_destroy(composition);
         free(system);
-        xdrfile_close(xtc);
+        trajectory_close(traj);
         return 1;
     }
 
-    // create an array for lipid classificiation
-    int **classified = calloc(composition->n_lipid_types, sizeof(int *));
-    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
-        atom_selection_t *selection = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
-        classified[i] = calloc(selection->n_atoms, sizeof(int));
+    // wait for new frames at the end of the trajectory, if requested
+    if (follow && trajectory_follow(traj, input_xtc_file) != 0) {
+        free(protein_atoms);
+        free(map_reference);
+        lipid_composition_destroy(composition);
+        free(system);
+        trajectory_close(traj);
+        return 1;
     }
-    // create arrays for flip-flop
-    size_t *flipflops_upper_lower = calloc(composition->n_lipid_types, sizeof(size_t));
-    size_t *flipflops_lower_upper = calloc(composition->n_lipid_types, sizeof(size_t));
-
-    float prevtime = -1.0;
-    while (read_xtc_step(xtc, system) == 0) {
-        // print info about the progress of reading and writing
-        if ((int) system->time % PROGRESS_FREQ == 0) {
-            printf("Step: %d. Time: %.0f ps\r", system->step, system->time);
-            fflush(stdout);
+
+    // split the lipids into separate membranes, if there are several of them; each membrane is analyzed separately
+    membranes_t *membranes = membranes_detect(composition, system->box, single_membrane);
+    const size_t n_membranes = membranes->n_membranes;
+
+    if (n_membranes > 1 && (checkpoint_file != NULL || map_prefix != NULL || protein_atoms != NULL)) {
+        fprintf(stderr, "Checkpoints, crossing maps and distance shells are not supported for systems with multiple membranes.\n");
+        fprintf(stderr, "Use --single-membrane to analyze all lipids as a single membrane.\n");
+        free(protein_atoms);
+        free(map_reference);
+        membranes_destroy(membranes);
+        lipid_composition_destroy(composition);
+        free(system);
+        trajectory_close(traj);
+        return 1;
+    }
+
+    flipflops_analysis_t **analyses = calloc(n_membranes, sizeof(flipflops_analysis_t *));
+    leaflet_classifier_t **classifiers = calloc(n_membranes, sizeof(leaflet_classifier_t *));
+    for (size_t m = 0; m < n_membranes; ++m) {
+        analyses[m] = flipflops_analysis_create(membranes->compositions[m], spatial_limit, temporal_limit);
+    }
+
+    // the reference selection is now owned by the map
+    if (map_prefix != NULL) flipflops_map_create(analyses[0], grid_spacing, system->box, map_reference);
+
+    // prepare distance shells, if requested; the protein selection is then owned by the shells
+    if (protein_atoms != NULL) {
+        proximity_t *proximity = proximity_create(composition, protein_atoms, shells);
+        if (proximity == NULL) {
+            free(protein_atoms);
+            flipflops_destroy_membranes(analyses, classifiers, membranes);
+            lipid_composition_destroy(composition);
+            free(system);
+            trajectory_close(traj);
+            return 1;
         }
 
-        // only analyze every nanosecond
-        if ((int) system->time % 1000 != 0) {
-            continue;
+        flipflops_proximity_attach(analyses[0], proximity);
+    }
+
+    // prepare leaflet classification (clustering, if requested)
+    for (size_t m = 0; m < n_membranes; ++m) {
+        if ((classifiers[m] = leaflet_classifier_create(membranes->compositions[m], leaflet_cutoff)) == NULL) {
+            flipflops_destroy_membranes(analyses, classifiers, membranes);
+            lipid_composition_destroy(composition);
+            free(system);
+            trajectory_close(traj);
+            return 1;
         }
+    }
 
-        // sanity check of the trajectory
-        if (prevtime >= 0 && system->time - prevtime > 1000) {
-            fprintf(stderr, "Scramblyzer flipflops expects trajectory time step not to be higher than 1 ns.\n");
-            fprintf(stderr, "Times of concern: %f (current), %f (previous)\n", system->time, prevtime);
-            for (size_t i = 0; i < composition->n_lipid_types; ++i) {
-                free(classified[i]);
-            }
-            free(classified);
+    float last_time = -1.0;
+    size_t *reported = calloc(n_membranes, sizeof(size_t));
 
+    // resume the analysis from checkpoint, if it exists (only available for a single membrane)
+    if (checkpoint_file != NULL && checkpoint_exists(checkpoint_file)) {
+        if (load_checkpoint_flipflops(checkpoint_file, analyses[0], leaflet_classifier_clustering(classifiers[0]), &last_time) != 0) {
+            free(reported);
+            flipflops_destroy_membranes(analyses, classifiers, membranes);
             lipid_composition_destroy(composition);
             free(system);
-            free(flipflops_upper_lower);
-            free(flipflops_lower_upper);
-            xdrfile_close(xtc);
+            trajectory_close(traj);
             return 1;
+        }
+
+        printf("Resuming analysis from checkpoint %s (last frame: %.0f ps).\n\n", checkpoint_file, last_time);
+    }
+
+    // flip-flops loaded from the checkpoint are not reported again in follow mode
+    for (size_t i = 0; i < composition->n_lipid_types && n_membranes == 1; ++i) {
+        reported[0] += analyses[0]->upper_lower[i] + analyses[0]->lower_upper[i];
+    }
 
-        } else {
-            prevtime = system->time;
+    while (trajectory_next(traj) == 0) {
+        // only analyze every nanosecond; frames analyzed before the checkpoint are skipped
+        if ((int) traj->time % 1000 != 0 || traj->time <= last_time) {
+            if (profile_skip(profile, traj) != 0) break;
+            continue;
         }
 
-        // get center of geometry of the membrane
-        vec_t membrane_center = {0.0};
-        center_of_geometry(composition->all_lipid_atoms, membrane_center, system->box);
+        if (profile_read(profile, traj, system) != 0) break;
+        last_time = system->time;
+
+        // get center of geometry of each membrane
+        profile_begin(profile);
+        lipid_composition_update(composition, system->box);
+        membranes_update(membranes, system->box);
+        profile_end(profile, PROFILE_CENTER);
+
+        for (size_t m = 0; m < n_membranes; ++m) {
+            // assign lipids to leaflets; if clustering fails in the very first frame, lipids are not classified in this frame
+            profile_begin(profile);
+            int unassigned = leaflet_classifier_classify(classifiers[m], membranes->centers[m], system->box);
+            profile_end(profile, PROFILE_LEAFLETS);
+            if (unassigned && !classifiers[m]->initialized) continue;
+
+            profile_begin(profile);
+            int failed = flipflops_analysis_frame(analyses[m], classifiers[m], membranes->centers[m], system->box, system->time);
+            profile_end(profile, PROFILE_ANALYSIS);
+
+            if (failed) {
+                free(reported);
+                flipflops_destroy_membranes(analyses, classifiers, membranes);
+                lipid_composition_destroy(composition);
+                free(system);
+                trajectory_close(traj);
+                return 1;
+            }
 
-        find_flipflops(composition, classified, flipflops_upper_lower, flipflops_lower_upper, membrane_center, system->box, spatial_limit, temporal_limit);
+            // when following a running simulation, report newly detected flip-flops immediately
+            if (follow) report_new_flipflops(analyses[m], &reported[m], system->time, m, n_membranes);
+        }
     }
 
     // printing output
     //printf("Detected flip-flops with spatial limit = %f nm and temporal limit = %d ns:\n", spatial_limit, temporal_limit);
-    printf("\n\nLipid | U->L | L->U | All \n");
-    size_t total_upper_lower = 0, total_lower_upper = 0;
-    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
-        total_upper_lower += flipflops_upper_lower[i];
-        total_lower_upper += flipflops_lower_upper[i];
-
-        printf("%-5s | %-4zu | %-4zu | %-4zu\n", 
-            composition->lipid_types[i], 
-            flipflops_upper_lower[i], 
-            flipflops_lower_upper[i],
-            flipflops_upper_lower[i] + flipflops_lower_upper[i]);
+    printf("\n");
+    for (size_t m = 0; m < n_membranes; ++m) {
+        printf("\n");
+        if (n_membranes > 1) printf("Membrane %zu\n", m + 1);
+        flipflops_write_table(stdout, analyses[m]);
     }
-    
-    // if there are 2 or more lipid types, also print TOTAL number of lipids
-    if (composition->n_lipid_types > 1) {
-        printf("-----------------------------\n");
-        printf("TOTAL | %-4zu | %-4zu | %-4zu\n", total_upper_lower, total_lower_upper, total_upper_lower + total_lower_upper);
+
+    int return_code = 0;
+    if (map_prefix != NULL) {
+        printf("\n");
+        return_code = flipflops_map_write(analyses[0]->map, map_prefix, input_xtc_file);
     }
 
+    profile_report(profile);
 
-    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
-        free(classified[i]);
+    if (checkpoint_file != NULL) {
+        return_code |= save_checkpoint_flipflops(checkpoint_file, analyses[0], leaflet_classifier_clustering(classifiers[0]), last_time);
+        if (return_code == 0) printf("\nCheckpoint file %s written.\n", checkpoint_file);
     }
-    free(classified);
 
+    free(reported);
+    flipflops_destroy_membranes(analyses, classifiers, membranes);
     lipid_composition_destroy(composition);
     free(system);
-    free(flipflops_upper_lower);
-    free(flipflops_lower_upper);
-    xdrfile_close(xtc);
+    trajectory_close(traj);
 
-    return 0;
-}
\ No newline at end of file
+    return return_code;
+}
@@ -6,6 +6,40 @@
 
 #include <groan.h>
 #include <unistd.h>
+#include "general.h"
+#include "profile.h"
+#include "leaflets.h"
+#include "proximity.h"
+
+/*! @brief Map of the xy positions at which lipids cross the membrane. See flipflops_map_create() for more details. */
+typedef struct flipflops_map {
+    float core;                 // half-thickness of the hydrophobic core of the membrane [nm]
+    float spacing;              // spacing of the grid in the first frame [nm]
+    size_t n_cells[2];          // number of grid cells along x and y
+    atom_selection_t *reference;    // the map is centered at the center of this selection (NULL: absolute positions)
+    size_t *occupancy;          // number of frames a lipid head was located in the core, for each grid cell
+    size_t *crossings;          // number of flip-flops that crossed the core in each grid cell
+    size_t *last_cell;          // grid cell in which each lipid head was last located during its current visit of the core (SIZE_MAX if outside)
+    size_t *crossing_cell;      // grid cell of the potential flip-flop of each lipid that has not been confirmed yet
+    size_t frames;              // number of mapped frames
+} flipflops_map_t;
+
+/*! @brief State of the flip-flop analysis. See flipflops_analysis_frame() for more details. */
+typedef struct flipflops_analysis {
+    const lipid_composition_t *composition;
+    float spatial_limit;        // distance from the membrane center a lipid has to reach to be considered in a leaflet [nm]
+    int temporal_limit;         // number of frames (ns) a lipid has to stay in a leaflet to be considered stable in it
+    int **classified;           // state of each lipid of each lipid type (see find_flipflops())
+    size_t *upper_lower;        // number of upper->lower flip-flops of each lipid type
+    size_t *lower_upper;        // number of lower->upper flip-flops of each lipid type
+    float prevtime;             // time of the previous analyzed frame [ps] (negative if no frame has been analyzed)
+    flipflops_map_t *map;       // map of the crossing positions (NULL if not requested)
+    proximity_t *proximity;     // distance shells around a protein (NULL if not requested)
+    short *last_shell;          // shell in which each lipid head was last located during its current visit of the core (-1 if outside)
+    short *crossing_shell;      // shell of the potential flip-flop of each lipid that has not been confirmed yet (-1 if none)
+    size_t *shell_upper_lower;  // number of upper->lower flip-flops in each shell
+    size_t *shell_lower_upper;  // number of lower->upper flip-flops in each shell
+} flipflops_analysis_t;
 
 /*! @brief Prints supported flags and arguments of this module */
 void print_usage_flipflops(void);
@@ -23,14 +57,163 @@ int get_arguments_flipflops(
         char **ndx_file,
         char **phosphates,
         float *spatial_limit,
-        int *temporal_limit);
+        int *temporal_limit,
+        float *leaflet_cutoff,
+        char **checkpoint_file,
+        char **map_prefix,
+        float *grid_spacing,
+        char **reference,
+        char **protein,
+        char **shells);
+
+/*! @brief Updates the state of a single lipid and decides whether a flip-flop has been completed.
+ *
+ * @paragraph State of the lipid
+ * Positive values of 'assignment' correspond to the upper leaflet, negative values to the lower leaflet.
+ * Values with magnitude higher than time_frames mean that the lipid is stable in the leaflet. Smaller values
+ * count the frames the lipid has spent in the leaflet since it crossed the spatial limit. Zero means that the lipid
+ * has not been classified yet. A flip-flop is completed once the lipid has spent time_frames frames in the new leaflet,
+ * i.e. the lipid crossed the spatial limit (time_frames - 1) frames before the frame in which the flip-flop is reported.
+ *
+ * @param assignment        state of the lipid (updated)
+ * @param dist              distance of the lipid head from the membrane center along the z-axis
+ * @param spatial_limit     distance from the membrane center a lipid has to reach to be considered in a leaflet
+ * @param time_frames       number of frames a lipid has to stay in a leaflet to be considered stable in it
+ *
+ * @return 1 for a completed lower->upper flip-flop, -1 for a completed upper->lower flip-flop, else 0.
+ */
+int flipflops_classify_lipid(int *assignment, const float dist, const float spatial_limit, const int time_frames);
+
+
+/*! @brief Prepares the flip-flop analysis. Must be deallocated using flipflops_analysis_destroy(). */
+flipflops_analysis_t *flipflops_analysis_create(
+        const lipid_composition_t *composition,
+        const float spatial_limit,
+        const int temporal_limit);
+
+
+/*! @brief Prepares the map of crossing positions. The map is deallocated by flipflops_analysis_destroy().
+ *
+ * @paragraph Occupancy and crossings
+ * In every analyzed frame, lipid heads located in the hydrophobic core of the membrane (closer than the spatial limit
+ * to the membrane center along the z-axis) are added to the occupancy grid at their xy position. When a flip-flop
+ * is confirmed, the position at which the lipid was last located in the core before it crossed into the new leaflet
+ * is added to the crossing grid (if the lipid was not seen in the core since it last left a leaflet, its position
+ * in the first frame beyond the spatial limit is used).
+ *
+ * @paragraph Grid
+ * The xy plane is divided into cells of approximately 'spacing' nm (based on the provided box). Positions are mapped
+ * using fractional coordinates, so the grid follows the fluctuations of the box. If 'reference' is not NULL,
+ * positions are taken relative to the center of geometry of the reference selection, which is placed
+ * in the middle of the grid.
+ *
+ * @param analysis          flip-flop analysis to which the map is attached
+ * @param spacing           approximate size of a grid cell [nm]
+ * @param box               simulation box used to determine the number of grid cells
+ * @param reference         reference selection (may be NULL); the selection is owned by the map
+ */
+void flipflops_map_create(
+        flipflops_analysis_t *analysis,
+        const float spacing,
+        const box_t box,
+        atom_selection_t *reference);
+
+
+/*! @brief Resolves the flip-flops by the distance of lipids from a protein. The proximity is deallocated by flipflops_analysis_destroy().
+ *
+ * @paragraph Distance shells
+ * In every analyzed frame, lipids are assigned into distance shells (see proximity_update()). A flip-flop is counted
+ * in the shell in which the lipid was last located in the hydrophobic core of the membrane before it crossed into
+ * the new leaflet (as for the crossing map, see flipflops_map_create()). If the lipid was not seen in the core since
+ * it last left a leaflet, its shell in the first frame beyond the spatial limit is used.
+ */
+void flipflops_proximity_attach(flipflops_analysis_t *analysis, proximity_t *proximity);
 
+
+/*! @brief Writes the occupancy grid into '{prefix}_occupancy.dat' and the crossing grid into '{prefix}_crossings.dat'.
+ *
+ * @return Zero, if successful. Else non-zero.
+ */
+int flipflops_map_write(const flipflops_map_t *map, const char *prefix, const char *input_xtc_file);
+
+
+/*! @brief Analyzes a single trajectory frame and updates the flip-flop counters.
+ *
+ * @paragraph Analyzed frames
+ * The analysis expects to be provided with frames every 1 ns. If the time between two consecutive frames
+ * is higher than 1 ns, an error is reported.
+ *
+ * @param analysis          state of the analysis
+ * @param leaflets          leaflet assignment of lipid heads in the current frame (see leaflet_classifier_classify())
+ * @param membrane_center   center of geometry of the membrane
+ * @param box               simulation box
+ * @param time              time of the frame [ps]
+ *
+ * @return Zero, if successful. Else non-zero.
+ */
+int flipflops_analysis_frame(
+        flipflops_analysis_t *analysis,
+        const leaflet_classifier_t *leaflets,
+        const vec_t membrane_center,
+        const box_t box,
+        const float time);
+
+
+/*! @brief Writes the table of detected flip-flops (and of flip-flops in each distance shell, if requested). */
+void flipflops_write_table(FILE *output, const flipflops_analysis_t *analysis);
+
+
+/*! @brief Deallocates memory for the flipflops_analysis_t structure. */
+void flipflops_analysis_destroy(flipflops_analysis_t *analysis);
+
+
+/*! @brief Calculates the number of flip-flop events for different lipid types.
+ *
+ * @paragraph Leaflet clustering
+ * If leaflet_cutoff is positive, lipids are assigned to leaflets by clustering their heads (see leaflet_clustering_assign())
+ * instead of comparing their position with the membrane center. In such case, the spatial limit is not used.
+ *
+ * @paragraph Checkpoints
+ * If checkpoint_file is not NULL, the state of the analysis (classification of all lipids and flip-flop counters)
+ * is saved into this file at the end of the run. If the checkpoint file already exists, the analysis is resumed from it
+ * and trajectory frames up to the time of the last analyzed frame are skipped. The reported numbers of flip-flops
+ * are then cumulative and identical to analyzing the full trajectory at once.
+ *
+ * @paragraph Crossing map
+ * If map_prefix is not NULL, the xy positions at which lipids cross the membrane are mapped (see flipflops_map_create())
+ * and written at the end of the analysis. The hydrophobic core is defined by the spatial limit, also when leaflet
+ * clustering is used. Maps can not be combined with checkpoints.
+ *
+ * @paragraph Distance shells
+ * If protein is not NULL, flip-flops are additionally counted in distance shells around the selected atoms
+ * (see flipflops_proximity_attach()). Distance shells can not be combined with checkpoints.
+ *
+ * @paragraph Follow mode
+ * If follow is non-zero, the function waits for new frames at the end of the trajectory (see trajectory_follow()).
+ * Newly detected flip-flop events are reported as they are found; the full table is printed once the analysis is stopped using Ctrl+C.
+ *
+ * @paragraph Profiling
+ * Progress of the analysis is reported using 'profile' (see profile_read()). If profiling is enabled,
+ * the time spent in the individual stages of the analysis is printed after the table.
+ *
+ * @return Zero, if the analysis was successful. Else non-zero.
+ */
 int calc_lipid_flipflops(
         const char *input_gro_file,
         const char *input_xtc_file,
         const char *ndx_file,
         const char *head_identifier,
         const float spatial_limit,
-        const int temporal_limit);
+        const int temporal_limit,
+        const float leaflet_cutoff,
+        const char *checkpoint_file,
+        const char *map_prefix,
+        const float grid_spacing,
+        const char *reference,
+        const char *protein,
+        const char *shells,
+        const int single_membrane,
+        const int follow,
+        profile_t *profile);
 
 #endif /* FLIPFLOPS_H */
\ No newline at end of file
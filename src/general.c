@@ -7,6 +7,8 @@
 static const size_t MAX_LINE_LENGTH = 1024;
 /*! @brief File to read user-defined lipid names/types from */
 static const char LIPIDS_TXT[] = "lipids.txt";
+/*! @brief File to read lipid-specific head identifiers from */
+static const char HEADS_TXT[] = "heads.txt";
 
 void lipid_names_destroy(char **lipid_names, const size_t n_lipid_names)
 {
@@ -100,6 +102,107 @@ void deallocate_lipid_types(dict_t *lipids_dictionary, char **lipid_names, size_
 }
 
 
+/*! @brief Counts lipids in a selection of head atoms. Consecutive atoms of the same residue belong to the same lipid. */
+static size_t count_lipids(const atom_selection_t *heads)
+{
+    size_t n_lipids = 0;
+    for (size_t i = 0; i < heads->n_atoms; ++i) {
+        if (i == 0 || heads->atoms[i]->residue_number != heads->atoms[i - 1]->residue_number) ++n_lipids;
+    }
+
+    return n_lipids;
+}
+
+void lipid_composition_prepare_centers(lipid_composition_t *composition, const box_t box)
+{
+    size_t n_atoms = 0, n_lipids = 0;
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        atom_selection_t *heads = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
+        n_atoms += heads->n_atoms;
+        n_lipids += count_lipids(heads);
+    }
+
+    if (n_lipids == n_atoms) return;
+
+    composition->n_centers = n_lipids;
+    composition->centers = calloc(n_lipids, sizeof(atom_t));
+    composition->center_start = malloc((n_lipids + 1) * sizeof(size_t));
+    composition->center_atoms = malloc(n_atoms * sizeof(atom_t *));
+
+    size_t center = 0, atom = 0;
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        atom_selection_t *heads = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
+
+        size_t allocated = count_lipids(heads);
+        atom_selection_t *centers = selection_create(allocated);
+
+        for (size_t j = 0; j < heads->n_atoms; ++j) {
+            // first head atom of a new lipid; the pseudo-atom takes over its names and numbers
+            if (j == 0 || heads->atoms[j]->residue_number != heads->atoms[j - 1]->residue_number) {
+                composition->center_start[center] = atom;
+                memcpy(&composition->centers[center], heads->atoms[j], sizeof(atom_t));
+                selection_add_atom(&centers, &allocated, &composition->centers[center]);
+                ++center;
+            }
+
+            composition->center_atoms[atom++] = heads->atoms[j];
+        }
+
+        free(heads);
+        dict_set(composition->lipids_dictionary, composition->lipid_types[i], &centers, sizeof(atom_selection_t *));
+    }
+    composition->center_start[n_lipids] = n_atoms;
+
+    // written into stderr as this is also called by the library interface which must not write into stdout
+    fprintf(stderr, "Note. Lipid heads consist of multiple atoms (%zu atoms for %zu lipids). Centers of geometry of the head atoms of each lipid will be used.\n\n",
+            n_atoms, n_lipids);
+
+    lipid_composition_update(composition, box);
+}
+
+dict_t *read_head_identifiers(size_t *n_identifiers)
+{
+    dict_t *identifiers = dict_create();
+    *n_identifiers = 0;
+
+    FILE *file = fopen(HEADS_TXT, "r");
+    if (file == NULL) {
+        return identifiers;
+    }
+
+    char line[MAX_LINE_LENGTH];
+    while (fgets(line, MAX_LINE_LENGTH, file) != NULL) {
+        // remove comments
+        line[strcspn(line, "#")] = 0;
+        // strip line
+        strstrip(line);
+
+        if (strlen(line) == 0) continue;
+
+        // the lipid name is followed by the head identifier
+        size_t name_length = strcspn(line, " \t");
+        char *selection = line + name_length;
+        if (*selection != '\0') *selection++ = '\0';
+        selection += strspn(selection, " \t");
+
+        if (strlen(selection) == 0) {
+            fprintf(stderr, "Warning. No head identifier provided for lipid type %s in %s.\n\n", line, HEADS_TXT);
+            continue;
+        }
+
+        if (dict_get(identifiers, line) != NULL) {
+            fprintf(stderr, "Warning. Head identifier of lipid type %s is defined multiple times in %s. Using the last definition.\n\n", line, HEADS_TXT);
+        } else {
+            (*n_identifiers)++;
+        }
+
+        dict_set(identifiers, line, selection, strlen(selection) + 1);
+    }
+
+    fclose(file);
+    return identifiers;
+}
+
 lipid_composition_t *get_lipid_composition(
         system_t *system,
         const char *head_identifier,
@@ -108,19 +211,25 @@ lipid_composition_t *get_lipid_composition(
     // create lipid composition structure
     lipid_composition_t *composition = calloc(1, sizeof(lipid_composition_t));
 
+    // load lipid-specific head identifiers from heads.txt
+    size_t n_identifiers = 0;
+    dict_t *head_identifiers = read_head_identifiers(&n_identifiers);
+
     // select all atoms
     atom_selection_t *all = select_system(system);
     // select all head identifiers of lipids
     atom_selection_t *heads = smart_select(all, head_identifier, ndx_groups);
 
-    // sanity check that heads were selected
-    if (heads == NULL || heads->n_atoms == 0) {
+    // sanity check that heads were selected (unless the heads are defined in heads.txt)
+    if ((heads == NULL || heads->n_atoms == 0) && n_identifiers == 0) {
         fprintf(stderr, "No atoms corresponding to head identifier ('%s') found.\n", head_identifier);
+        dict_destroy(head_identifiers);
         free(all);
         free(heads);
         free(composition);
         return NULL;
     }
+    if (heads == NULL) heads = selection_create(1);
 
 
     // load lipid names from default and from lipids.txt
@@ -128,6 +237,7 @@ lipid_composition_t *get_lipid_composition(
     char **lipid_names = read_lipid_names(&n_lipid_names);
     if (lipid_names == NULL) {
         fprintf(stderr, "Error obtaining lipid names.\n");
+        dict_destroy(head_identifiers);
         free(all);
         free(heads);
         free(composition);
@@ -150,13 +260,24 @@ lipid_composition_t *get_lipid_composition(
         // add the selection to all lipid atoms
         selection_add(&composition->all_lipid_atoms, &all_lipids_allocated, lipid_type);
 
-        // get only lipid heads of these lipids
-        atom_selection_t *lipid_type_heads = selection_intersect(lipid_type, heads);
+        // get only lipid heads of these lipids; head identifier from heads.txt takes precedence
+        const char *type_identifier = dict_get(head_identifiers, lipid_names[i]);
+        atom_selection_t *lipid_type_heads = NULL;
+        if (type_identifier == NULL) {
+            type_identifier = head_identifier;
+            lipid_type_heads = selection_intersect(lipid_type, heads);
+        } else if ((lipid_type_heads = smart_select(lipid_type, type_identifier, ndx_groups)) == NULL) {
+            fprintf(stderr, "Warning. Could not understand head identifier '%s' of %s lipids from %s.\n",
+                type_identifier, lipid_names[i], HEADS_TXT);
+            fprintf(stderr, "Lipids of type %s will not be included in the analysis.\n\n", lipid_names[i]);
+            free(lipid_type);
+            continue;
+        }
 
         // check that this selection is not empty
         if (lipid_type_heads->n_atoms == 0) {
             fprintf(stderr, "Warning. %zu atoms were found for %s lipids but none of these atoms was lipid head identifier %s.\n",
-                lipid_type->n_atoms, lipid_names[i], head_identifier);
+                lipid_type->n_atoms, lipid_names[i], type_identifier);
             fprintf(stderr, "Lipids of type %s will not be included in the analysis.\n\n", lipid_names[i]);
             free(lipid_type);
             free(lipid_type_heads);
@@ -172,19 +293,91 @@ lipid_composition_t *get_lipid_composition(
     // deallocate unneeded selections
     free(all);
     free(heads);
+    dict_destroy(head_identifiers);
     lipid_names_destroy(lipid_names, n_lipid_names);
 
     // get lipid types that are actually present in the system
     composition->n_lipid_types = dict_keys(composition->lipids_dictionary, &composition->lipid_types);
 
+    // lipid heads consisting of multiple atoms are replaced with their centers
+    lipid_composition_prepare_centers(composition, system->box);
+
     return composition;
 }
 
+void lipid_composition_update(lipid_composition_t *composition, const box_t box)
+{
+    for (size_t c = 0; c < composition->n_centers; ++c) {
+        const size_t first = composition->center_start[c];
+        const size_t last = composition->center_start[c + 1];
+        const float *origin = composition->center_atoms[first]->position;
+
+        // sum of displacements of the head atoms from the first head atom (minimum image convention)
+        float sum[3] = {0.0f};
+        for (size_t a = first + 1; a < last; ++a) {
+            const float *position = composition->center_atoms[a]->position;
+            for (int d = 0; d < 3; ++d) {
+                float diff = position[d] - origin[d];
+                if (box[d] > 0) diff -= box[d] * rintf(diff / box[d]);
+                sum[d] += diff;
+            }
+        }
+
+        float *center = composition->centers[c].position;
+        for (int d = 0; d < 3; ++d) {
+            center[d] = origin[d] + sum[d] / (float) (last - first);
+            if (box[d] > 0) center[d] -= box[d] * floorf(center[d] / box[d]);
+        }
+    }
+}
+
 void lipid_composition_destroy(lipid_composition_t *composition)
 {
     free(composition->all_lipid_atoms);
     deallocate_lipid_types(composition->lipids_dictionary, composition->lipid_types, composition->n_lipid_types);
     dict_destroy(composition->lipids_dictionary);
     free(composition->lipid_types);
+    free(composition->centers);
+    free(composition->center_start);
+    free(composition->center_atoms);
     free(composition);
-}
\ No newline at end of file
+}
+
+int extract_flag(int *argc, char **argv, const char *flag)
+{
+    int found = 0;
+    int write = 0;
+    for (int read = 0; read < *argc; ++read) {
+        if (!strcmp(argv[read], flag)) {
+            found = 1;
+            continue;
+        }
+
+        argv[write++] = argv[read];
+    }
+
+    *argc = write;
+    return found;
+}
+
+char *extract_option(int *argc, char **argv, const char *option)
+{
+    char *value = NULL;
+    int write = 0;
+    for (int read = 0; read < *argc; ++read) {
+        if (!strcmp(argv[read], option)) {
+            // option without a value at the end of the command line
+            if (read + 1 >= *argc) {
+                value = NULL;
+                continue;
+            }
+            value = argv[++read];
+            continue;
+        }
+
+        argv[write++] = argv[read];
+    }
+
+    *argc = write;
+    return value;
+}
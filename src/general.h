@@ -12,6 +12,10 @@ typedef struct lipid_composition {
     dict_t *lipids_dictionary;
     char **lipid_types;
     size_t n_lipid_types;
+    size_t n_centers;           // number of lipid heads calculated as centers of geometry (0 if every head is a single atom)
+    atom_t *centers;            // pseudo-atoms representing the centers of lipid heads
+    size_t *center_start;       // index of the first atom of each center in center_atoms (n_centers + 1 items)
+    atom_t **center_atoms;      // head atoms of all lipids, grouped by lipids
 } lipid_composition_t;
 
 
@@ -42,6 +46,21 @@ char **read_lipid_names(size_t *n_lipid_names);
 void deallocate_lipid_types(dict_t *lipids_dictionary, char **lipid_names, size_t n_lipid_names);
 
 
+/*! @brief Reads lipid-specific head identifiers from the file heads.txt (if present).
+ *
+ * @paragraph Format
+ * Every line of heads.txt contains a lipid type (residue name) followed by the selection of its head identifier(s),
+ * e.g. 'CHOL name ROH' or 'DPG1 name GM1 GM2'. Comments must start with '#'. If a lipid type is defined
+ * multiple times, the last definition is used.
+ *
+ * @param n_identifiers     pointer to which the number of lipid types with a head identifier is saved
+ *
+ * @return Dictionary of lipid type -> head identifier (string). Empty dictionary, if heads.txt does not exist.
+ * Must be deallocated using dict_destroy().
+ */
+dict_t *read_head_identifiers(size_t *n_identifiers);
+
+
 /*! @brief Get lipid composition of a membrane. 
  *
  * @paragraph Lipid composition structure
@@ -51,6 +70,18 @@ void deallocate_lipid_types(dict_t *lipids_dictionary, char **lipid_names, size_
  * c) an array of lipid types present in the system (lipid_types)
  * d) number of lipid types present in the system (n_lipid_types)
  * 
+ * @paragraph Lipid-specific head identifiers
+ * Lipid types listed in heads.txt (see read_head_identifiers()) use their own head identifier instead of head_identifier,
+ * so e.g. phospholipids (PO4) and cholesterol (ROH) can be analyzed together. The head atoms of every lipid type
+ * are resolved once, so the analysis of the individual frames does not depend on the number of head identifiers.
+ * head_identifier may select no atoms, if heads.txt is present.
+ *
+ * @paragraph Heads consisting of multiple atoms
+ * If the head identifier selects more than one atom of some lipid (e.g. all atoms of the headgroup of an atomistic lipid),
+ * the head of every lipid is represented by a pseudo-atom located at the center of geometry of the selected atoms
+ * of the lipid (residue). The atoms of each lipid are located once; positions of the pseudo-atoms
+ * must be updated in every analyzed frame using lipid_composition_update().
+ * 
  * @paragraph Note on deallocation
  * The memory pointed at by the returned pointer must be deallocated using lipid_composition_destroy().
  * 
@@ -65,7 +96,58 @@ lipid_composition_t *get_lipid_composition(
         dict_t *ndx_groups);
 
 
+/*! @brief Replaces lipid heads consisting of multiple atoms with pseudo-atoms located at their centers of geometry.
+ *
+ * @paragraph Details
+ * Consecutive head atoms of the same residue belong to the same lipid. If every lipid has exactly one head atom,
+ * the composition is not changed. Otherwise, the head selection of every lipid type is replaced with a selection
+ * of pseudo-atoms (one per lipid) and the head atoms of each lipid are stored as a contiguous range of center_atoms.
+ * Called by get_lipid_composition(). A note about the use of centers of geometry is written into stderr.
+ */
+void lipid_composition_prepare_centers(lipid_composition_t *composition, const box_t box);
+
+
+/*! @brief Updates positions of lipid heads that are calculated as centers of geometry. See get_lipid_composition().
+ *
+ * @paragraph Details
+ * Positions of the head atoms of each lipid are taken relative to the first head atom of the lipid using
+ * the minimum image convention, so lipids split by the periodic boundary are handled correctly. The resulting center
+ * is wrapped into the box. Does nothing if every lipid head is a single atom.
+ */
+void lipid_composition_update(lipid_composition_t *composition, const box_t box);
+
+
 /*! @brief Deallocates memory for lipid_composition_t strucutre */
 void lipid_composition_destroy(lipid_composition_t *composition);
 
+
+/*! @brief Removes all occurrences of a long command line flag (e.g. "--follow") from the command line arguments.
+ *
+ * @paragraph Details
+ * Long flags are not supported by getopt. This function must therefore be called before the arguments are parsed.
+ * argc is decreased by the number of removed arguments.
+ *
+ * @param argc          pointer to the number of command line arguments
+ * @param argv          command line arguments
+ * @param flag          flag to search for
+ *
+ * @return One, if the flag was present. Else zero.
+ */
+int extract_flag(int *argc, char **argv, const char *flag);
+
+
+/*! @brief Removes a long command line option with a value (e.g. "--profile-trace FILE") from the command line arguments.
+ *
+ * @paragraph Details
+ * Works like extract_flag(), but also removes the argument following the option. If the option is present
+ * multiple times, the value of the last occurrence is returned.
+ *
+ * @param argc          pointer to the number of command line arguments
+ * @param argv          command line arguments
+ * @param option        option to search for
+ *
+ * @return Pointer to the value of the option (part of argv). NULL, if the option was not present or has no value.
+ */
+char *extract_option(int *argc, char **argv, const char *option);
+
 #endif /* GENERAL_H */
\ No newline at end of file
@@ -0,0 +1,285 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "gro.h"
+#include "threadpool.h"
+
+/*! @brief Number of atoms parsed by a single task */
+static const size_t GRO_BLOCK_ATOMS = 65536;
+/*! @brief Systems with fewer atoms are parsed in a single thread */
+static const size_t GRO_PARALLEL_LIMIT = 200000;
+
+/*! @brief Columns of the residue number, residue name, atom name, atom number and of the first coordinate in an atom line */
+static const size_t GRO_RESIDUE_NUMBER_COLUMN = 0;
+static const size_t GRO_RESIDUE_NAME_COLUMN = 5;
+static const size_t GRO_ATOM_NAME_COLUMN = 10;
+static const size_t GRO_ATOM_NUMBER_COLUMN = 15;
+static const size_t GRO_COORDINATES_COLUMN = 20;
+/*! @brief Width of the integer and name fields of an atom line */
+#define GRO_FIELD_WIDTH 5
+/*! @brief Longest supported coordinate field (for parsing using strtof) */
+#define GRO_MAX_COORDINATE_WIDTH 31
+/*! @brief Longest supported header or box line */
+#define GRO_MAX_LINE 256
+
+/*! @brief Exact powers of ten for converting fixed-point coordinates */
+static const float POWERS_OF_TEN[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+
+/*! @brief Layout of the atom lines and the system being filled in. */
+typedef struct gro_parse {
+    const char *atoms;          // start of the first atom line
+    size_t line_length;         // length of every atom line including the line break
+    size_t width;               // width of every coordinate (and velocity) field
+    int velocities;             // do the atom lines contain velocities?
+    system_t *system;
+    int *failed;                // non-zero for every block of atoms that could not be parsed
+} gro_parse_t;
+
+/*! @brief Parses a right-aligned integer field. Returns zero if successful, else non-zero. */
+static int parse_integer(const char *field, const size_t width, int *value)
+{
+    size_t i = 0;
+    while (i < width && field[i] == ' ') ++i;
+
+    int negative = 0;
+    if (i < width && field[i] == '-') {
+        negative = 1;
+        ++i;
+    }
+
+    if (i == width) return 1;
+
+    int result = 0;
+    for (; i < width; ++i) {
+        if (field[i] < '0' || field[i] > '9') return 1;
+        result = 10 * result + (field[i] - '0');
+    }
+
+    *value = negative ? -result : result;
+    return 0;
+}
+
+/*! @brief Parses a name field (surrounding spaces are removed). Returns zero if successful, else non-zero. */
+static int parse_name(const char *field, const size_t width, char *name)
+{
+    size_t i = 0;
+    while (i < width && field[i] == ' ') ++i;
+
+    size_t length = 0;
+    while (i < width && field[i] != ' ') name[length++] = field[i++];
+    name[length] = '\0';
+
+    // names containing spaces can not be read back by load_gro() either
+    while (i < width) {
+        if (field[i++] != ' ') return 1;
+    }
+
+    return length == 0;
+}
+
+/*! @brief Parses a fixed-point coordinate field. Returns zero if successful, else non-zero.
+ *
+ * @paragraph Exactness
+ * The digits are accumulated into an integer which is then divided by an exact power of ten. As long as the integer
+ * is exactly representable as a float (below 2^24), the single rounded division gives the correctly rounded value,
+ * i.e. the same value as strtof(). Longer numbers are parsed using strtof().
+ */
+static int parse_coordinate(const char *field, const size_t width, float *value)
+{
+    size_t i = 0;
+    while (i < width && field[i] == ' ') ++i;
+
+    int negative = 0;
+    if (i < width && field[i] == '-') {
+        negative = 1;
+        ++i;
+    }
+
+    uint32_t digits = 0;
+    int n_digits = 0, decimals = -1;
+    for (; i < width; ++i) {
+        char c = field[i];
+        if (c == '.' && decimals < 0) {
+            decimals = 0;
+        } else if (c >= '0' && c <= '9') {
+            // too many digits for an exact conversion
+            if (++n_digits > 9) break;
+            digits = 10 * digits + (uint32_t) (c - '0');
+            if (decimals >= 0) ++decimals;
+        } else {
+            return 1;
+        }
+    }
+
+    if (i < width || digits >= (1u << 24)) {
+        char copy[GRO_MAX_COORDINATE_WIDTH + 1] = {0};
+        memcpy(copy, field, width);
+        char *end = NULL;
+        *value = strtof(copy, &end);
+        return end != copy + width;
+    }
+
+    if (n_digits == 0) return 1;
+    if (decimals < 0) decimals = 0;
+
+    float result = (float) digits / POWERS_OF_TEN[decimals];
+    *value = negative ? -result : result;
+    return 0;
+}
+
+/*! @brief Parses a single block of atom lines (task of the thread pool). */
+static void parse_block(size_t index, size_t thread, void *data)
+{
+    (void) thread;
+    gro_parse_t *parse = data;
+
+    size_t first = index * GRO_BLOCK_ATOMS;
+    size_t last = first + GRO_BLOCK_ATOMS;
+    if (last > parse->system->n_atoms) last = parse->system->n_atoms;
+
+    const size_t width = parse->width;
+    int failed = 0;
+
+    for (size_t i = first; i < last && !failed; ++i) {
+        const char *line = parse->atoms + i * parse->line_length;
+        atom_t *atom = &parse->system->atoms[i];
+
+        // every atom line must end exactly where the fixed layout says
+        if (line[parse->line_length - 1] != '\n') {
+            failed = 1;
+            break;
+        }
+
+        failed |= parse_integer(line + GRO_RESIDUE_NUMBER_COLUMN, GRO_FIELD_WIDTH, &atom->residue_number);
+        failed |= parse_name(line + GRO_RESIDUE_NAME_COLUMN, GRO_FIELD_WIDTH, atom->residue_name);
+        failed |= parse_name(line + GRO_ATOM_NAME_COLUMN, GRO_FIELD_WIDTH, atom->atom_name);
+        failed |= parse_integer(line + GRO_ATOM_NUMBER_COLUMN, GRO_FIELD_WIDTH, &atom->atom_number);
+
+        const char *coordinates = line + GRO_COORDINATES_COLUMN;
+        for (int dim = 0; dim < 3; ++dim) {
+            failed |= parse_coordinate(coordinates + dim * width, width, &atom->position[dim]);
+            if (parse->velocities) failed |= parse_coordinate(coordinates + (3 + dim) * width, width, &atom->velocity[dim]);
+            else atom->velocity[dim] = 0.0f;
+        }
+    }
+
+    parse->failed[index] = failed;
+}
+
+/*! @brief Copies the line starting at 'start' into 'line' (without the line break). Returns pointer to the next line or NULL. */
+static const char *copy_line(const char *start, const char *end, char *line)
+{
+    const char *newline = memchr(start, '\n', (size_t) (end - start));
+    size_t length = (size_t) ((newline != NULL ? newline : end) - start);
+    if (length >= GRO_MAX_LINE) return NULL;
+
+    memcpy(line, start, length);
+    line[length] = '\0';
+    return newline != NULL ? newline + 1 : end;
+}
+
+/*! @brief Parses the memory-mapped gro file. Returns NULL if the file does not follow the fixed-column format. */
+static system_t *parse_mapped(const char *data, const size_t size)
+{
+    const char *end = data + size;
+    char line[GRO_MAX_LINE] = {0};
+
+    // title and number of atoms
+    const char *current = memchr(data, '\n', size);
+    if (current == NULL) return NULL;
+    if ((current = copy_line(current + 1, end, line)) == NULL) return NULL;
+
+    char *number_end = NULL;
+    long long n_atoms = strtoll(line, &number_end, 10);
+    if (number_end == line || n_atoms <= 0) return NULL;
+    while (*number_end == ' ' || *number_end == '\r') ++number_end;
+    if (*number_end != '\0') return NULL;
+
+    // the first atom line defines the layout of all atom lines
+    const char *first_end = memchr(current, '\n', (size_t) (end - current));
+    if (first_end == NULL) return NULL;
+    size_t line_length = (size_t) (first_end - current) + 1;
+    size_t content = line_length - 1;
+    if (content > 0 && current[content - 1] == '\r') --content;
+    if (content < GRO_COORDINATES_COLUMN + 3) return NULL;
+
+    // width of the coordinate fields is the distance between the decimal points of x and y (the same as Gromacs reads it)
+    const char *x_point = memchr(current + GRO_COORDINATES_COLUMN, '.', content - GRO_COORDINATES_COLUMN);
+    if (x_point == NULL) return NULL;
+    const char *y_point = memchr(x_point + 1, '.', (size_t) (current + content - x_point - 1));
+    if (y_point == NULL) return NULL;
+    size_t width = (size_t) (y_point - x_point);
+    if (width > GRO_MAX_COORDINATE_WIDTH) return NULL;
+
+    int velocities = 0;
+    if (content == GRO_COORDINATES_COLUMN + 6 * width) velocities = 1;
+    else if (content != GRO_COORDINATES_COLUMN + 3 * width) return NULL;
+
+    if ((size_t) (end - current) / line_length < (size_t) n_atoms) return NULL;
+
+    system_t *system = malloc(sizeof(system_t) + (size_t) n_atoms * sizeof(atom_t));
+    if (system == NULL) return NULL;
+    memset(system, 0, sizeof(system_t));
+    system->n_atoms = (size_t) n_atoms;
+
+    size_t n_blocks = (system->n_atoms + GRO_BLOCK_ATOMS - 1) / GRO_BLOCK_ATOMS;
+    gro_parse_t parse = { .atoms = current, .line_length = line_length, .width = width, .velocities = velocities,
+                          .system = system, .failed = calloc(n_blocks, sizeof(int)) };
+
+    size_t n_threads = system->n_atoms < GRO_PARALLEL_LIMIT ? 1 : thread_pool_default_threads();
+    thread_pool_run(n_threads, n_blocks, NULL, parse_block, &parse);
+
+    int failed = 0;
+    for (size_t i = 0; i < n_blocks; ++i) failed |= parse.failed[i];
+    free(parse.failed);
+
+    // box (only the first three values are used, but triclinic boxes are read as well)
+    current += system->n_atoms * line_length;
+    if (!failed && (current == end || copy_line(current, end, line) == NULL)) failed = 1;
+
+    if (!failed) {
+        int n_values = sscanf(line, "%f %f %f %f %f %f %f %f %f", &system->box[0], &system->box[1], &system->box[2],
+                &system->box[3], &system->box[4], &system->box[5], &system->box[6], &system->box[7], &system->box[8]);
+        if (n_values != 3 && n_values != 9) failed = 1;
+    }
+
+    if (failed) {
+        free(system);
+        return NULL;
+    }
+
+    return system;
+}
+
+system_t *gro_load(const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return load_gro(filename);
+
+    struct stat file_stat = {0};
+    if (fstat(fd, &file_stat) != 0 || !S_ISREG(file_stat.st_mode) || file_stat.st_size == 0) {
+        close(fd);
+        return load_gro(filename);
+    }
+
+    size_t size = (size_t) file_stat.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return load_gro(filename);
+
+    // all pages are needed, the sooner the better
+    posix_madvise(map, size, POSIX_MADV_WILLNEED);
+
+    system_t *system = parse_mapped(map, size);
+    munmap(map, size);
+
+    // anything unusual is left to the generic parser
+    if (system == NULL) return load_gro(filename);
+
+    return system;
+}
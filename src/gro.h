@@ -0,0 +1,25 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef GRO_H
+#define GRO_H
+
+#include <groan.h>
+
+/*! @brief Reads a system from a gro file. Equivalent to load_gro() but much faster for large systems.
+ *
+ * @paragraph Algorithm
+ * The file is memory-mapped. All atom lines of a gro file written by Gromacs have the same length and fixed columns,
+ * so the position of every atom line is calculated directly from its index and the atom lines are parsed in parallel
+ * (in blocks of atoms, using all available processors) straight into the system_t structure.
+ *
+ * @paragraph Fallback
+ * If the file can not be memory-mapped (e.g. it is a pipe) or does not follow the fixed-column format
+ * (atom lines of different lengths, coordinates written with a different precision, missing fields),
+ * the file is read using load_gro() instead. The result is the same in both cases.
+ *
+ * @return Pointer to system_t structure (must be deallocated using free()). NULL in case of an error.
+ */
+system_t *gro_load(const char *filename);
+
+#endif /* GRO_H */
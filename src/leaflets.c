@@ -0,0 +1,394 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#include <float.h>
+#include "leaflets.h"
+
+/*! @brief Minimal fraction of all lipid heads that must be part of a cluster for it to be considered a leaflet. */
+static const float MIN_LEAFLET_FRACTION = 0.1f;
+
+/*! @brief Finds root of the union-find tree (with path halving). */
+static inline size_t uf_find(size_t *parent, size_t i)
+{
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+
+    return i;
+}
+
+/*! @brief Merges union-find trees of the two items (union by size). */
+static inline void uf_union(size_t *parent, size_t *rank, const size_t i, const size_t j)
+{
+    size_t root_i = uf_find(parent, i);
+    size_t root_j = uf_find(parent, j);
+    if (root_i == root_j) return;
+
+    if (rank[root_i] < rank[root_j]) {
+        parent[root_i] = root_j;
+        rank[root_j] += rank[root_i];
+    } else {
+        parent[root_j] = root_i;
+        rank[root_i] += rank[root_j];
+    }
+}
+
+leaflet_clustering_t *leaflet_clustering_create(const lipid_composition_t *composition, const float cutoff)
+{
+    if (cutoff <= 0) {
+        fprintf(stderr, "Leaflet clustering cutoff must be positive.\n");
+        return NULL;
+    }
+
+    leaflet_clustering_t *clustering = calloc(1, sizeof(leaflet_clustering_t));
+    clustering->cutoff = cutoff;
+
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        atom_selection_t *selection = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
+        clustering->n_heads += selection->n_atoms;
+    }
+
+    clustering->heads = malloc(clustering->n_heads * sizeof(atom_t *));
+    clustering->positions = malloc(clustering->n_heads * sizeof(vec_t));
+    clustering->parent = malloc(clustering->n_heads * sizeof(size_t));
+    clustering->rank = malloc(clustering->n_heads * sizeof(size_t));
+    clustering->leaflet = calloc(clustering->n_heads, sizeof(short));
+    clustering->cells = cell_list_create();
+
+    if (clustering->heads == NULL || clustering->positions == NULL || clustering->parent == NULL ||
+        clustering->rank == NULL || clustering->leaflet == NULL || clustering->cells == NULL) {
+        fprintf(stderr, "Could not allocate memory for leaflet clustering.\n");
+        leaflet_clustering_destroy(clustering);
+        return NULL;
+    }
+
+    // flatten heads of all lipid types into a single array
+    size_t index = 0;
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        atom_selection_t *selection = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
+        for (size_t j = 0; j < selection->n_atoms; ++j) {
+            clustering->heads[index++] = selection->atoms[j];
+        }
+    }
+
+    return clustering;
+}
+
+/*! @brief Decides which of the two leaflet clusters should be labeled as the upper (outer) leaflet in the first frame.
+ *
+ * @paragraph Details
+ * For planar membranes, the leaflets differ mostly in their z-position relative to the membrane center.
+ * For vesicles, the leaflets differ mostly in their distance from the center.
+ * The criterion which better separates the two clusters is used.
+ *
+ * @return 1, if the first cluster is the upper (outer) leaflet. Else 0.
+ */
+static short first_cluster_is_upper(
+        const leaflet_clustering_t *clustering,
+        const size_t root_first,
+        const size_t root_second,
+        const vec_t membrane_center,
+        const box_t box)
+{
+    double z_first = 0.0, z_second = 0.0, r_first = 0.0, r_second = 0.0;
+    for (size_t i = 0; i < clustering->n_heads; ++i) {
+        size_t root = uf_find(clustering->parent, i);
+        if (root != root_first && root != root_second) continue;
+
+        float dz = distance1D(clustering->positions[i], membrane_center, z, box);
+        float dr = sqrtf(distance_squared_pbc(clustering->positions[i], membrane_center, box, 0));
+
+        if (root == root_first) {
+            z_first += dz;
+            r_first += dr;
+        } else {
+            z_second += dz;
+            r_second += dr;
+        }
+    }
+
+    z_first /= clustering->rank[root_first];
+    r_first /= clustering->rank[root_first];
+    z_second /= clustering->rank[root_second];
+    r_second /= clustering->rank[root_second];
+
+    if (fabs(z_first - z_second) >= fabs(r_first - r_second)) return z_first > z_second;
+    else return r_first > r_second;
+}
+
+int leaflet_clustering_assign(
+        leaflet_clustering_t *clustering,
+        const vec_t membrane_center,
+        const box_t box)
+{
+    size_t n_heads = clustering->n_heads;
+    if (n_heads == 0) return 1;
+
+    // gather head positions into a contiguous array
+    for (size_t i = 0; i < n_heads; ++i) {
+        memcpy(clustering->positions[i], clustering->heads[i]->position, sizeof(vec_t));
+        clustering->parent[i] = i;
+        clustering->rank[i] = 1;
+    }
+
+    if (cell_list_build(clustering->cells, (const vec_t *) clustering->positions, n_heads, box, clustering->cutoff, 0) != 0) {
+        return 1;
+    }
+
+    // connect all heads closer than cutoff
+    const cell_list_t *cells = clustering->cells;
+    const float cutoff2 = clustering->cutoff * clustering->cutoff;
+    size_t n_cells = cells->n_cells[0] * cells->n_cells[1] * cells->n_cells[2];
+    size_t neighbors[27] = {0};
+
+    for (size_t c = 0; c < n_cells; ++c) {
+        if (cells->cell_start[c] == cells->cell_start[c + 1]) continue;
+
+        size_t n_neighbors = cell_list_neighbors(cells, c, neighbors);
+        for (size_t a = cells->cell_start[c]; a < cells->cell_start[c + 1]; ++a) {
+            size_t i = cells->sorted[a];
+
+            for (size_t n = 0; n < n_neighbors; ++n) {
+                for (size_t b = cells->cell_start[neighbors[n]]; b < cells->cell_start[neighbors[n] + 1]; ++b) {
+                    size_t j = cells->sorted[b];
+                    // every pair is only checked once
+                    if (j <= i) continue;
+
+                    if (distance_squared_pbc(clustering->positions[i], clustering->positions[j], box, 0) < cutoff2) {
+                        uf_union(clustering->parent, clustering->rank, i, j);
+                    }
+                }
+            }
+        }
+    }
+
+    // find the two largest clusters
+    size_t root_first = n_heads, root_second = n_heads;
+    for (size_t i = 0; i < n_heads; ++i) {
+        if (clustering->parent[i] != i) continue;
+
+        if (root_first == n_heads || clustering->rank[i] > clustering->rank[root_first]) {
+            root_second = root_first;
+            root_first = i;
+        } else if (root_second == n_heads || clustering->rank[i] > clustering->rank[root_second]) {
+            root_second = i;
+        }
+    }
+
+    if (root_second == n_heads || clustering->rank[root_second] < MIN_LEAFLET_FRACTION * n_heads) {
+        if (!clustering->warned) {
+            fprintf(stderr, "\nWarning. Membrane leaflets could not be separated using cutoff of %f nm. ", clustering->cutoff);
+            fprintf(stderr, "Leaflet assignment from the previous frame will be used.\n");
+            clustering->warned = 1;
+        }
+        return 1;
+    }
+
+    short first_label = 0;
+    if (!clustering->initialized) {
+        first_label = first_cluster_is_upper(clustering, root_first, root_second, membrane_center, box);
+    } else {
+        // reuse labels from the previous frame: the first cluster obtains the majority label of its heads
+        size_t upper_votes = 0;
+        for (size_t i = 0; i < n_heads; ++i) {
+            if (uf_find(clustering->parent, i) == root_first && clustering->leaflet[i]) ++upper_votes;
+        }
+
+        first_label = (2 * upper_votes >= clustering->rank[root_first]);
+    }
+
+    for (size_t i = 0; i < n_heads; ++i) {
+        size_t root = uf_find(clustering->parent, i);
+
+        if (root == root_first) clustering->leaflet[i] = first_label;
+        else if (root == root_second) clustering->leaflet[i] = !first_label;
+        // heads outside of the leaflets keep their previous assignment; in the first frame, they are assigned based on their position
+        else if (!clustering->initialized) {
+            clustering->leaflet[i] = (distance1D(clustering->positions[i], membrane_center, z, box) > 0);
+        }
+    }
+
+    clustering->initialized = 1;
+    return 0;
+}
+
+void leaflet_clustering_destroy(leaflet_clustering_t *clustering)
+{
+    if (clustering == NULL) return;
+
+    free(clustering->heads);
+    free(clustering->positions);
+    free(clustering->parent);
+    free(clustering->rank);
+    free(clustering->leaflet);
+    cell_list_destroy(clustering->cells);
+    free(clustering);
+}
+
+/*! @brief State of the midplane leaflet classifier. */
+typedef struct midplane_state {
+    size_t n_heads;
+    atom_t **heads;             // all lipid heads ordered by lipid types
+    float *z;                   // z-coordinates of the heads in the current frame
+    float center;               // z-coordinate of the membrane center in the current frame
+    float box_z;                // size of the box along the z-axis in the current frame
+} midplane_state_t;
+
+/*! @brief Collects all lipid heads of the composition ordered by lipid types. */
+static atom_t **collect_heads(const lipid_composition_t *composition, size_t *n_heads)
+{
+    *n_heads = 0;
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        atom_selection_t *selection = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
+        *n_heads += selection->n_atoms;
+    }
+
+    atom_t **heads = malloc((*n_heads + 1) * sizeof(atom_t *));
+    size_t head_index = 0;
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        atom_selection_t *selection = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
+        for (size_t j = 0; j < selection->n_atoms; ++j) heads[head_index++] = selection->atoms[j];
+    }
+
+    return heads;
+}
+
+static void *midplane_init(const lipid_composition_t *composition, const float parameter)
+{
+    (void) parameter;
+
+    midplane_state_t *state = calloc(1, sizeof(midplane_state_t));
+    state->heads = collect_heads(composition, &state->n_heads);
+    state->z = malloc((state->n_heads + 1) * sizeof(float));
+
+    return state;
+}
+
+static int midplane_prepare(void *data, const vec_t membrane_center, const box_t box)
+{
+    midplane_state_t *state = data;
+    state->center = membrane_center[2];
+    state->box_z = box[2];
+
+    for (size_t i = 0; i < state->n_heads; ++i) state->z[i] = state->heads[i]->position[2];
+
+    return 0;
+}
+
+static void midplane_classify(const void *data, const size_t first, const size_t last, short *leaflet, float *distance)
+{
+    const midplane_state_t *state = data;
+    const float *restrict z = state->z;
+    const float center = state->center;
+    const float box_z = state->box_z;
+    const float half_box = box_z / 2;
+
+    // same result as distance1D(), written without branches so that the loop is vectorized
+    for (size_t i = first; i < last; ++i) {
+        float dist = z[i] - center;
+        dist = dist > half_box ? dist - box_z : dist;
+        dist = dist < -half_box ? dist + box_z : dist;
+        distance[i] = dist;
+        leaflet[i] = dist > 0;
+    }
+}
+
+static void midplane_destroy(void *data)
+{
+    midplane_state_t *state = data;
+    if (state == NULL) return;
+
+    free(state->heads);
+    free(state->z);
+    free(state);
+}
+
+static void *clustering_init(const lipid_composition_t *composition, const float parameter)
+{
+    return leaflet_clustering_create(composition, parameter);
+}
+
+static int clustering_prepare(void *data, const vec_t membrane_center, const box_t box)
+{
+    return leaflet_clustering_assign(data, membrane_center, box);
+}
+
+static void clustering_classify(const void *data, const size_t first, const size_t last, short *leaflet, float *distance)
+{
+    const leaflet_clustering_t *clustering = data;
+    for (size_t i = first; i < last; ++i) {
+        leaflet[i] = clustering->leaflet[i];
+        distance[i] = leaflet[i] ? FLT_MAX : -FLT_MAX;
+    }
+}
+
+static void clustering_destroy(void *data)
+{
+    leaflet_clustering_destroy(data);
+}
+
+const leaflet_classifier_ops_t LEAFLET_CLASSIFIER_MIDPLANE = {
+    "midplane", midplane_init, midplane_prepare, midplane_classify, midplane_destroy
+};
+
+const leaflet_classifier_ops_t LEAFLET_CLASSIFIER_CLUSTERING = {
+    "clustering", clustering_init, clustering_prepare, clustering_classify, clustering_destroy
+};
+
+leaflet_classifier_t *leaflet_classifier_create(const lipid_composition_t *composition, const float leaflet_cutoff)
+{
+    leaflet_classifier_t *classifier = calloc(1, sizeof(leaflet_classifier_t));
+    classifier->ops = leaflet_cutoff > 0 ? &LEAFLET_CLASSIFIER_CLUSTERING : &LEAFLET_CLASSIFIER_MIDPLANE;
+
+    if ((classifier->state = classifier->ops->init(composition, leaflet_cutoff)) == NULL) {
+        free(classifier);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        atom_selection_t *selection = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
+        classifier->n_heads += selection->n_atoms;
+    }
+
+    classifier->leaflet = calloc(classifier->n_heads + 1, sizeof(short));
+    classifier->distance = calloc(classifier->n_heads + 1, sizeof(float));
+
+    return classifier;
+}
+
+int leaflet_classifier_classify(
+        leaflet_classifier_t *classifier,
+        const vec_t membrane_center,
+        const box_t box)
+{
+    int failed = classifier->ops->prepare(classifier->state, membrane_center, box);
+
+    // leaflets of a clustering restored from a checkpoint are available before the first successful clustering
+    const leaflet_clustering_t *clustering = leaflet_classifier_clustering(classifier);
+    if (clustering != NULL && clustering->initialized) classifier->initialized = 1;
+
+    // the leaflets have never been identified, so there is nothing to report
+    if (failed && !classifier->initialized) return 1;
+
+    classifier->ops->classify(classifier->state, 0, classifier->n_heads, classifier->leaflet, classifier->distance);
+    classifier->initialized = 1;
+
+    return failed;
+}
+
+leaflet_clustering_t *leaflet_classifier_clustering(const leaflet_classifier_t *classifier)
+{
+    if (classifier == NULL || classifier->ops != &LEAFLET_CLASSIFIER_CLUSTERING) return NULL;
+    return classifier->state;
+}
+
+void leaflet_classifier_destroy(leaflet_classifier_t *classifier)
+{
+    if (classifier == NULL) return;
+
+    classifier->ops->destroy(classifier->state);
+    free(classifier->leaflet);
+    free(classifier->distance);
+    free(classifier);
+}
@@ -0,0 +1,152 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef LEAFLETS_H
+#define LEAFLETS_H
+
+#include <groan.h>
+#include "general.h"
+#include "celllist.h"
+
+/*! @brief Leaflet identification by clustering lipid heads. See leaflet_clustering_assign() for more details. */
+typedef struct leaflet_clustering {
+    float cutoff;               // maximal distance between two heads of the same leaflet [nm]
+    size_t n_heads;             // total number of lipid heads
+    atom_t **heads;             // all lipid heads ordered by lipid types (same order as in lipid_composition_t)
+    vec_t *positions;           // positions of the heads in the current frame
+    size_t *parent;             // union-find: parent of each head
+    size_t *rank;               // union-find: size of the tree rooted in each head
+    short *leaflet;             // leaflet of each head: 1 = upper (outer) leaflet, 0 = lower (inner) leaflet
+    int initialized;            // has the leaflet assignment been performed at least once?
+    int warned;                 // has the user been warned about unseparable leaflets?
+    cell_list_t *cells;
+} leaflet_clustering_t;
+
+
+/*! @brief Prepares leaflet clustering for all lipid heads of the provided lipid composition.
+ *
+ * @paragraph Note on deallocation
+ * The returned pointer must be deallocated using leaflet_clustering_destroy().
+ *
+ * @param composition       lipid composition of the membrane
+ * @param cutoff            maximal distance between two heads of the same leaflet [nm]
+ *
+ * @return Pointer to leaflet_clustering_t structure. NULL in case of an error.
+ */
+leaflet_clustering_t *leaflet_clustering_create(const lipid_composition_t *composition, const float cutoff);
+
+
+/*! @brief Assigns lipid heads into leaflets based on their current positions.
+ *
+ * @paragraph Algorithm
+ * Lipid heads closer than the cutoff are connected using union-find. Neighbors are searched using
+ * a PBC-aware cell list so the assignment is performed in linear time. The two largest connected components
+ * are treated as the two membrane leaflets. Heads that do not belong to any of these two components
+ * (e.g. heads of lipids that are currently flipping) keep the leaflet they were assigned to previously.
+ *
+ * @paragraph Leaflet labels
+ * In the first frame, the leaflets are labeled based on their geometry. For planar membranes, the upper
+ * leaflet is the one located higher on the z-axis relative to the membrane center. For vesicles (and other
+ * closed membranes), the 'upper' leaflet is the outer one. In all further frames, each leaflet obtains
+ * the label that was assigned to the majority of its heads in the previous frame.
+ *
+ * @param clustering        leaflet clustering structure
+ * @param membrane_center   center of geometry of the membrane
+ * @param box               simulation box
+ *
+ * @return Zero, if successful. One, if the leaflets could not be separated. In that case, the assignment
+ * from the previous frame is kept (if available).
+ */
+int leaflet_clustering_assign(
+        leaflet_clustering_t *clustering,
+        const vec_t membrane_center,
+        const box_t box);
+
+
+/*! @brief Deallocates memory for the leaflet_clustering_t structure. */
+void leaflet_clustering_destroy(leaflet_clustering_t *clustering);
+
+
+/*! @brief Implementation of a leaflet classifier. See leaflet_classifier_classify() for more details.
+ *
+ * @paragraph Functions
+ * init() prepares the state of the classifier for all lipid heads of the composition (parameter is specific
+ * to the implementation, e.g. the clustering cutoff). prepare() is called once per frame and performs all work
+ * that is shared by all lipid heads; it returns non-zero, if the leaflets could not be identified in this frame.
+ * classify() then writes the leaflet and the distance of the heads [first, last) into the output arrays;
+ * it only reads the state, so disjoint ranges may be classified concurrently.
+ */
+typedef struct leaflet_classifier_ops {
+    const char *name;
+    void *(*init)(const lipid_composition_t *composition, const float parameter);
+    int (*prepare)(void *state, const vec_t membrane_center, const box_t box);
+    void (*classify)(const void *state, const size_t first, const size_t last, short *leaflet, float *distance);
+    void (*destroy)(void *state);
+} leaflet_classifier_ops_t;
+
+/*! @brief Leaflets from the position of lipid heads relative to the membrane center (along the z-axis). */
+extern const leaflet_classifier_ops_t LEAFLET_CLASSIFIER_MIDPLANE;
+/*! @brief Leaflets from clustering of lipid heads (parameter is the cutoff). See leaflet_clustering_assign(). */
+extern const leaflet_classifier_ops_t LEAFLET_CLASSIFIER_CLUSTERING;
+
+/*! @brief Assignment of lipid heads into leaflets shared by all analyses. See leaflet_classifier_classify() for more details. */
+typedef struct leaflet_classifier {
+    const leaflet_classifier_ops_t *ops;
+    void *state;                // state of the implementation
+    size_t n_heads;             // total number of lipid heads
+    short *leaflet;             // leaflet of each head: 1 = upper (outer) leaflet, 0 = lower (inner) leaflet
+    float *distance;            // signed distance of each head from the membrane center along the z-axis [nm]
+    int initialized;            // have the leaflets been identified at least once?
+} leaflet_classifier_t;
+
+
+/*! @brief Prepares a leaflet classifier for all lipid heads of the provided lipid composition.
+ *
+ * @paragraph Implementation
+ * If leaflet_cutoff is positive, leaflets are identified by clustering of lipid heads (LEAFLET_CLASSIFIER_CLUSTERING).
+ * Otherwise, leaflets are identified from the position of lipid heads relative to the membrane center
+ * (LEAFLET_CLASSIFIER_MIDPLANE). For systems with multiple membranes, one classifier is created for each membrane
+ * (using the lipid composition of the membrane, see membranes_detect()).
+ *
+ * @paragraph Note on deallocation
+ * The returned pointer must be deallocated using leaflet_classifier_destroy().
+ *
+ * @return Pointer to leaflet_classifier_t structure. NULL in case of an error.
+ */
+leaflet_classifier_t *leaflet_classifier_create(const lipid_composition_t *composition, const float leaflet_cutoff);
+
+
+/*! @brief Assigns all lipid heads into leaflets in the current frame.
+ *
+ * @paragraph Output
+ * The leaflet of every lipid head (ordered by lipid types, as in lipid_composition_t) is saved into classifier->leaflet
+ * and its signed distance from the membrane center along the z-axis into classifier->distance. The analyses only read
+ * these arrays, so all of them work with any implementation of the classifier. Implementations that do not identify
+ * leaflets from the position (clustering) report the distance as FLT_MAX (upper leaflet) or -FLT_MAX (lower leaflet),
+ * i.e. the lipid is always considered to be located beyond any spatial limit.
+ *
+ * @paragraph Midplane implementation
+ * z-coordinates of all heads are first gathered into a contiguous array so that the classification itself
+ * is a single branch-free loop which is vectorized by the compiler.
+ *
+ * @param classifier        leaflet classifier
+ * @param membrane_center   center of geometry of the membrane
+ * @param box               simulation box
+ *
+ * @return Zero, if successful. One, if the leaflets could not be identified (see leaflet_clustering_assign()).
+ * In that case, the assignment from the previous frame is kept; if there is none, classifier->initialized is zero.
+ */
+int leaflet_classifier_classify(
+        leaflet_classifier_t *classifier,
+        const vec_t membrane_center,
+        const box_t box);
+
+
+/*! @brief Returns the leaflet clustering used by the classifier. NULL if the classifier does not use clustering. */
+leaflet_clustering_t *leaflet_classifier_clustering(const leaflet_classifier_t *classifier);
+
+
+/*! @brief Deallocates memory for the leaflet_classifier_t structure. */
+void leaflet_classifier_destroy(leaflet_classifier_t *classifier);
+
+#endif /* LEAFLETS_H */
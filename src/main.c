@@ -6,7 +6,18 @@
 #include "composition.h"
 #include "rate.h"
 #include "flipflops.h"
+#include "dwell.h"
+#include "density.h"
 #include "positions.h"
+#include "reduce.h"
+#include "xtccheck.h"
+#include "multi.h"
+#include "batch.h"
+#include "serve.h"
+#include "threadpool.h"
+#include "profile.h"
+#include "topology.h"
+#include "general.h"
 
 const char VERSION[] = "v2022/11/28";
 
@@ -19,9 +30,42 @@ void print_usage(const char *program_name)
     printf("positions        calculates position of each lipid head in time\n");
     printf("rate             calculates percentage of scrambled lipids in time\n");
     printf("flipflops        calculates the number of flip-flop events\n");
+    printf("dwell            calculates distributions of leaflet dwell times and first-passage times\n");
+    printf("density          calculates density profiles of lipid heads and atoms along the membrane normal\n");
+    printf("multi            performs several of the above analyses in a single pass through the trajectory\n");
+    printf("batch            calculates scrambling rate and flip-flops for many replicas in parallel\n");
+    printf("reduce           writes a trajectory containing only lipid atoms or lipid heads\n");
+    printf("xtccheck         checks that the xtc decoder matches xdrfile and measures its speed\n");
+    printf("serve            runs a daemon keeping loaded systems and decoded frames in memory\n");
+    printf("client           requests composition, rate or flipflops analysis from a running daemon\n");
+    printf("\nPROFILING (all modules)\n");
+    printf("--profile        print time spent in the individual stages of the analysis, throughput and peak memory usage\n");
+    printf("--profile-trace FILE   write per-frame times of the individual stages into a CSV file (implies --profile)\n");
+    printf("\nTOPOLOGY CACHE (all modules except positions and xtccheck)\n");
+    printf("--cache          store the parsed gro file and the identified lipids in .scramblyzer_cache and reuse them in later runs\n");
+    printf("\nMULTIPLE MEMBRANES (all modules except positions, reduce, batch and xtccheck)\n");
+    printf("--single-membrane  analyze all lipids as a single membrane even if several membranes are detected\n");
     printf("\n");
 }
 
+/*! @brief Parses the number of frames to sample (--sample). NULL value means no sampling.
+ *
+ * @return Zero, if successful. Else non-zero.
+ */
+static int parse_samples(const char *value, size_t *n_samples)
+{
+    if (value == NULL) return 0;
+
+    long parsed = 0;
+    if (sscanf(value, "%ld", &parsed) != 1 || parsed < 2) {
+        fprintf(stderr, "Number of sampled frames must be at least 2.\n");
+        return 1;
+    }
+
+    *n_samples = (size_t) parsed;
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
     printf("\n");
@@ -31,6 +75,18 @@ int main(int argc, char **argv)
         return 1;
     }
 
+    // profiling options are shared by all modules
+    int profiling = extract_flag(&argc, argv, "--profile");
+    char *trace_file = extract_option(&argc, argv, "--profile-trace");
+    profile_t *profile = profile_create(profiling, trace_file);
+    if (profile == NULL) return 1;
+
+    // topology cache is shared by all modules
+    if (extract_flag(&argc, argv, "--cache")) topology_cache_enable(".scramblyzer_cache");
+
+    // systems with several membranes are split into separate membranes unless disabled
+    int single_membrane = extract_flag(&argc, argv, "--single-membrane");
+
     int return_code = 0;
 
     if (!strcmp(argv[1], "composition")) {
@@ -40,14 +96,21 @@ int main(int argc, char **argv)
         char *output_file = "composition.xvg";
         char *phosphates = "name PO4";
         float dt = 1.0;
+        int follow = extract_flag(&argc, argv, "--follow");
+        size_t n_samples = 0;
+        if (parse_samples(extract_option(&argc, argv, "--sample"), &n_samples) != 0) {
+            profile_destroy(profile);
+            return 1;
+        }
 
         if (get_arguments_composition(argc, argv, &gro_file, &xtc_file, &ndx_file, &output_file, &phosphates, &dt) != 0) {
             print_usage_composition();
+            profile_destroy(profile);
             return 1;
         }
 
         //printf("\n>>> Lipid Composition Analysis by Scramblyzer %s <<<\n\n", VERSION);
-        return_code = calc_lipid_composition(gro_file, xtc_file, ndx_file, output_file, phosphates, dt);
+        return_code = calc_lipid_composition(gro_file, xtc_file, ndx_file, output_file, phosphates, dt, n_samples, single_membrane, follow, profile);
     
     } else if (!strcmp(argv[1], "rate")) {
         char *gro_file = NULL;
@@ -56,13 +119,26 @@ int main(int argc, char **argv)
         char *output_file = "rate.xvg";
         char *phosphates = "name PO4";
         float dt = 10.0;
+        float leaflet_cutoff = 0.0;
+        char *checkpoint_file = NULL;
+        size_t max_lag = 0;
+        char *protein = NULL;
+        char *shells = "1.5";
+        int follow = extract_flag(&argc, argv, "--follow");
+        size_t n_samples = 0;
+        if (parse_samples(extract_option(&argc, argv, "--sample"), &n_samples) != 0) {
+            profile_destroy(profile);
+            return 1;
+        }
 
-        if (get_arguments_rate(argc, argv, &gro_file, &xtc_file, &ndx_file, &output_file, &phosphates, &dt) != 0) {
+        if (get_arguments_rate(argc, argv, &gro_file, &xtc_file, &ndx_file, &output_file, &phosphates, &dt, &leaflet_cutoff, &checkpoint_file, &max_lag,
+                &protein, &shells) != 0) {
             print_usage_rate();
+            profile_destroy(profile);
             return 1;
         }
 
-        return_code = calc_scrambling_rate(gro_file, xtc_file, ndx_file, output_file, phosphates, dt);
+        return_code = calc_scrambling_rate(gro_file, xtc_file, ndx_file, output_file, phosphates, dt, leaflet_cutoff, checkpoint_file, max_lag, protein, shells, n_samples, single_membrane, follow, profile);
 
     } else if (!strcmp(argv[1], "flipflops")) {
         char *gro_file = NULL;
@@ -71,14 +147,70 @@ int main(int argc, char **argv)
         char *phosphates = "name PO4";
         float spatial_limit = 1.5;
         int temporal_limit = 10;
+        float leaflet_cutoff = 0.0;
+        char *checkpoint_file = NULL;
+        char *map_prefix = NULL;
+        float grid_spacing = 0.5;
+        char *reference = NULL;
+        char *protein = NULL;
+        char *shells = "1.5";
+        int follow = extract_flag(&argc, argv, "--follow");
 
-        if (get_arguments_flipflops(argc, argv, &gro_file, &xtc_file, &ndx_file, &phosphates, &spatial_limit, &temporal_limit) != 0) {
+        if (get_arguments_flipflops(argc, argv, &gro_file, &xtc_file, &ndx_file, &phosphates, &spatial_limit, &temporal_limit, &leaflet_cutoff, &checkpoint_file,
+                &map_prefix, &grid_spacing, &reference, &protein, &shells) != 0) {
             print_usage_flipflops();
+            profile_destroy(profile);
             return 1;
         }
 
-        return_code = calc_lipid_flipflops(gro_file, xtc_file, ndx_file, phosphates, spatial_limit, temporal_limit);
+        return_code = calc_lipid_flipflops(gro_file, xtc_file, ndx_file, phosphates, spatial_limit, temporal_limit, leaflet_cutoff, checkpoint_file,
+                map_prefix, grid_spacing, reference, protein, shells, single_membrane, follow, profile);
     
+    } else if (!strcmp(argv[1], "dwell")) {
+        char *gro_file = NULL;
+        char *xtc_file = NULL;
+        char *ndx_file = "index.ndx";
+        char *output_file = "dwell.xvg";
+        char *passage_file = "first_passage.dat";
+        char *phosphates = "name PO4";
+        float spatial_limit = 1.5;
+        int temporal_limit = 10;
+        float leaflet_cutoff = 0.0;
+        float bin_width = 10.0;
+        float max_dwell = 1000.0;
+
+        if (get_arguments_dwell(argc, argv, &gro_file, &xtc_file, &ndx_file, &output_file, &passage_file, &phosphates,
+                &spatial_limit, &temporal_limit, &leaflet_cutoff, &bin_width, &max_dwell) != 0) {
+            print_usage_dwell();
+            profile_destroy(profile);
+            return 1;
+        }
+
+        return_code = calc_dwell_times(gro_file, xtc_file, ndx_file, output_file, passage_file, phosphates,
+                spatial_limit, temporal_limit, leaflet_cutoff, bin_width, max_dwell, single_membrane, profile);
+
+    } else if (!strcmp(argv[1], "density")) {
+        char *gro_file = NULL;
+        char *xtc_file = NULL;
+        char *ndx_file = "index.ndx";
+        char *output_file = "density.xvg";
+        char *phosphates = "name PO4";
+        float dt = 1.0;
+        float leaflet_cutoff = 0.0;
+        float bin_width = 0.1;
+        float range = 5.0;
+        size_t n_threads = 1;
+
+        if (get_arguments_density(argc, argv, &gro_file, &xtc_file, &ndx_file, &output_file, &phosphates,
+                &dt, &leaflet_cutoff, &bin_width, &range, &n_threads) != 0) {
+            print_usage_density();
+            profile_destroy(profile);
+            return 1;
+        }
+
+        return_code = calc_density_profiles(gro_file, xtc_file, ndx_file, output_file, phosphates,
+                dt, leaflet_cutoff, bin_width, range, n_threads, single_membrane, profile);
+
     } else if (!strcmp(argv[1], "positions")) {
         char *gro_file = NULL;
         char *xtc_file = NULL;
@@ -89,10 +221,119 @@ int main(int argc, char **argv)
 
         if (get_arguments_positions(argc, argv, &gro_file, &xtc_file, &ndx_file, &output_file, &phosphates, &dt) != 0) {
             print_usage_positions();
+            profile_destroy(profile);
+            return 1;
+        }
+
+        return_code = calc_lipid_positions(gro_file, xtc_file, ndx_file, output_file, phosphates, dt, profile);
+
+    } else if (!strcmp(argv[1], "reduce")) {
+        char *gro_file = NULL;
+        char *xtc_file = NULL;
+        char *ndx_file = "index.ndx";
+        char *output_file = "reduced.xtc";
+        char *phosphates = "name PO4";
+        float dt = 0.0;
+        int heads_only = extract_flag(&argc, argv, "--heads-only");
+
+        if (get_arguments_reduce(argc, argv, &gro_file, &xtc_file, &ndx_file, &output_file, &phosphates, &dt) != 0) {
+            print_usage_reduce();
+            profile_destroy(profile);
+            return 1;
+        }
+
+        return_code = calc_reduce(gro_file, xtc_file, ndx_file, output_file, phosphates, dt, heads_only, profile);
+
+    } else if (!strcmp(argv[1], "xtccheck")) {
+        char **xtc_files = NULL;
+        size_t n_files = 0;
+        size_t repeats = 3;
+
+        if (get_arguments_xtccheck(argc, argv, &xtc_files, &n_files, &repeats) != 0) {
+            print_usage_xtccheck();
+            profile_destroy(profile);
+            return 1;
+        }
+
+        return_code = calc_xtccheck(xtc_files, n_files, repeats);
+
+    } else if (!strcmp(argv[1], "multi")) {
+        char *gro_file = NULL;
+        char *xtc_file = NULL;
+        char *ndx_file = "index.ndx";
+        char *phosphates = "name PO4";
+        char *analyses = NULL;
+        float spatial_limit = 1.5;
+        int temporal_limit = 10;
+        float leaflet_cutoff = 0.0;
+        int follow = extract_flag(&argc, argv, "--follow");
+
+        if (get_arguments_multi(argc, argv, &gro_file, &xtc_file, &ndx_file, &phosphates, &analyses, &spatial_limit, &temporal_limit, &leaflet_cutoff) != 0) {
+            print_usage_multi();
+            profile_destroy(profile);
+            return 1;
+        }
+
+        return_code = calc_multi(gro_file, xtc_file, ndx_file, phosphates, analyses, spatial_limit, temporal_limit, leaflet_cutoff, single_membrane, follow, profile);
+
+    } else if (!strcmp(argv[1], "batch")) {
+        char *manifest_file = NULL;
+        char *output_prefix = "batch";
+        char *phosphates = "name PO4";
+        float dt = 10.0;
+        float spatial_limit = 1.5;
+        int temporal_limit = 10;
+        float leaflet_cutoff = 0.0;
+        size_t n_threads = thread_pool_default_threads();
+
+        if (get_arguments_batch(argc, argv, &manifest_file, &output_prefix, &phosphates, &dt, &spatial_limit, &temporal_limit, &leaflet_cutoff, &n_threads) != 0) {
+            print_usage_batch();
+            profile_destroy(profile);
+            return 1;
+        }
+
+        return_code = calc_batch(manifest_file, output_prefix, phosphates, dt, spatial_limit, temporal_limit, leaflet_cutoff, n_threads, profile);
+
+    } else if (!strcmp(argv[1], "serve")) {
+        char *default_socket = serve_default_socket();
+        char *socket_path = default_socket;
+        size_t memory_limit = 1024;
+
+        if (get_arguments_serve(argc, argv, &socket_path, &memory_limit) != 0) {
+            print_usage_serve();
+            free(default_socket);
+            profile_destroy(profile);
+            return 1;
+        }
+
+        return_code = serve_run(socket_path, memory_limit, single_membrane);
+        free(default_socket);
+
+    } else if (!strcmp(argv[1], "client")) {
+        char *default_socket = serve_default_socket();
+        char *socket_path = default_socket;
+        char *analysis = NULL;
+        char *gro_file = NULL;
+        char *xtc_file = NULL;
+        char *ndx_file = "index.ndx";
+        char *output_file = NULL;
+        char *phosphates = "name PO4";
+        float dt = 0.0;
+        float time = -1.0;
+        float spatial_limit = 1.5;
+        int temporal_limit = 10;
+
+        if (get_arguments_client(argc, argv, &socket_path, &analysis, &gro_file, &xtc_file, &ndx_file, &output_file, &phosphates,
+                &dt, &time, &spatial_limit, &temporal_limit) != 0) {
+            print_usage_client();
+            free(default_socket);
+            profile_destroy(profile);
             return 1;
         }
 
-        return_code = calc_lipid_positions(gro_file, xtc_file, ndx_file, output_file, phosphates, dt);
+        return_code = serve_client(socket_path, analysis, gro_file, xtc_file, ndx_file, output_file, phosphates,
+                dt, time, spatial_limit, temporal_limit);
+        free(default_socket);
 
     } else if (!strcmp(argv[1], "-h")) {
         print_usage(argv[0]);
@@ -103,6 +344,7 @@ int main(int argc, char **argv)
         return_code = 1;
     }
 
+    profile_destroy(profile);
     printf("\n");
 
     return return_code;
@@ -0,0 +1,328 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#include <float.h>
+#include "general.h"
+#include "membranes.h"
+
+/*! @brief Width of a bin of the histogram of lipid atoms along the z-axis [nm] */
+static const float MEMBRANES_BIN_WIDTH = 0.25;
+/*! @brief Minimal width of a gap between two membranes [nm] */
+static const float MEMBRANES_MIN_GAP = 1.0;
+/*! @brief Bins containing fewer atoms than this fraction of the average bin are treated as empty */
+static const float MEMBRANES_EMPTY_FRACTION = 0.05;
+/*! @brief Minimal fraction of lipid atoms a membrane must contain */
+static const float MEMBRANES_MIN_ATOMS = 0.01;
+
+/*! @brief Returns index of the membrane with the center closest to the position along the z-axis. */
+static size_t closest_membrane(const vec_t position, vec_t *centers, const size_t n_membranes, const box_t box)
+{
+    size_t closest = 0;
+    float closest_distance = FLT_MAX;
+    for (size_t m = 0; m < n_membranes; ++m) {
+        float distance = fabsf(distance1D(position, centers[m], z, box));
+        if (distance < closest_distance) {
+            closest_distance = distance;
+            closest = m;
+        }
+    }
+
+    return closest;
+}
+
+/*! @brief Finds centers of continuous stretches of lipid atoms along the z-axis separated by gaps.
+ *
+ * @return Array of centers of the membranes ordered from the bottom of the box. NULL if there are no gaps.
+ */
+static vec_t *find_membrane_centers(const atom_selection_t *atoms, const box_t box, size_t *n_membranes)
+{
+    *n_membranes = 0;
+    if (box[2] <= 0 || atoms->n_atoms == 0) return NULL;
+
+    const size_t n_bins = (size_t) (box[2] / MEMBRANES_BIN_WIDTH);
+    if (n_bins < 4) return NULL;
+    const float width = box[2] / n_bins;
+    const size_t min_gap = (size_t) ceilf(MEMBRANES_MIN_GAP / width);
+
+    // periodic histogram of lipid atoms along the z-axis
+    size_t *atom_bin = malloc(atoms->n_atoms * sizeof(size_t));
+    size_t *counts = calloc(n_bins, sizeof(size_t));
+    for (size_t a = 0; a < atoms->n_atoms; ++a) {
+        float position = atoms->atoms[a]->position[2];
+        position -= box[2] * floorf(position / box[2]);
+        size_t bin = (size_t) (position / width);
+        if (bin >= n_bins) bin = n_bins - 1;
+
+        atom_bin[a] = bin;
+        ++counts[bin];
+    }
+
+    const float threshold = MEMBRANES_EMPTY_FRACTION * (float) atoms->n_atoms / (float) n_bins;
+    short *empty = malloc(n_bins * sizeof(short));
+    size_t origin = n_bins;
+    for (size_t b = 0; b < n_bins; ++b) {
+        empty[b] = counts[b] <= threshold;
+        if (!empty[b] && origin == n_bins) origin = b;
+    }
+    free(counts);
+
+    // all bins are empty (only possible for very few lipid atoms)
+    if (origin == n_bins) {
+        free(empty);
+        free(atom_bin);
+        return NULL;
+    }
+
+    // gaps narrower than the minimal gap belong to the membrane (e.g. low density in the membrane core)
+    size_t run = 0;
+    for (size_t i = 1; i <= n_bins; ++i) {
+        size_t b = (origin + i) % n_bins;
+        if (empty[b]) {
+            ++run;
+            continue;
+        }
+
+        if (run > 0 && run < min_gap) {
+            for (size_t k = 1; k <= run; ++k) empty[(b + n_bins - k) % n_bins] = 0;
+        }
+        run = 0;
+    }
+
+    // find the first bin of some membrane (an occupied bin following an empty one)
+    origin = n_bins;
+    for (size_t b = 0; b < n_bins; ++b) {
+        if (!empty[b] && empty[(b + n_bins - 1) % n_bins]) {
+            origin = b;
+            break;
+        }
+    }
+
+    // no gaps
+    if (origin == n_bins) {
+        free(empty);
+        free(atom_bin);
+        return NULL;
+    }
+
+    // assign bins to continuous stretches of occupied bins
+    long *bin_stretch = malloc(n_bins * sizeof(long));
+    size_t n_stretches = 0;
+    float *stretch_start = NULL;
+    for (size_t i = 0; i < n_bins; ++i) {
+        size_t b = (origin + i) % n_bins;
+        if (empty[b]) {
+            bin_stretch[b] = -1;
+            continue;
+        }
+
+        if (i == 0 || empty[(b + n_bins - 1) % n_bins]) {
+            stretch_start = realloc(stretch_start, (n_stretches + 1) * sizeof(float));
+            stretch_start[n_stretches] = b * width;
+            ++n_stretches;
+        }
+
+        bin_stretch[b] = (long) n_stretches - 1;
+    }
+    free(empty);
+
+    // centers of the stretches; positions are unwrapped relative to the start of each stretch
+    double *sums = calloc(n_stretches, sizeof(double));
+    size_t *n_atoms = calloc(n_stretches, sizeof(size_t));
+    for (size_t a = 0; a < atoms->n_atoms; ++a) {
+        long stretch = bin_stretch[atom_bin[a]];
+        if (stretch < 0) continue;
+
+        float position = atoms->atoms[a]->position[2];
+        position -= box[2] * floorf(position / box[2]);
+        if (position < stretch_start[stretch]) position += box[2];
+
+        sums[stretch] += position;
+        ++n_atoms[stretch];
+    }
+    free(bin_stretch);
+    free(atom_bin);
+    free(stretch_start);
+
+    // stretches with only a few lipid atoms are not membranes
+    vec_t *centers = calloc(n_stretches, sizeof(vec_t));
+    for (size_t s = 0; s < n_stretches; ++s) {
+        if (n_atoms[s] < MEMBRANES_MIN_ATOMS * atoms->n_atoms) continue;
+
+        float center = (float) (sums[s] / n_atoms[s]);
+        center -= box[2] * floorf(center / box[2]);
+
+        // insert the membrane so that the membranes are ordered from the bottom of the box
+        size_t m = *n_membranes;
+        while (m > 0 && centers[m - 1][2] > center) {
+            memcpy(centers[m], centers[m - 1], sizeof(vec_t));
+            --m;
+        }
+        centers[m][0] = box[0] / 2;
+        centers[m][1] = box[1] / 2;
+        centers[m][2] = center;
+        ++(*n_membranes);
+    }
+    free(sums);
+    free(n_atoms);
+
+    if (*n_membranes < 2) {
+        *n_membranes = 0;
+        free(centers);
+        return NULL;
+    }
+
+    return centers;
+}
+
+/*! @brief Creates lipid composition containing only the lipids of the given membrane. */
+static lipid_composition_t *membrane_composition(
+        const lipid_composition_t *composition,
+        const membranes_t *membranes,
+        const size_t *atom_membrane,
+        const size_t membrane)
+{
+    lipid_composition_t *subset = calloc(1, sizeof(lipid_composition_t));
+
+    size_t allocated_atoms = 64;
+    subset->all_lipid_atoms = selection_create(allocated_atoms);
+    for (size_t a = 0; a < composition->all_lipid_atoms->n_atoms; ++a) {
+        if (atom_membrane[a] == membrane) selection_add_atom(&subset->all_lipid_atoms, &allocated_atoms, composition->all_lipid_atoms->atoms[a]);
+    }
+
+    subset->lipids_dictionary = dict_create();
+    size_t head_index = 0;
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        atom_selection_t *heads = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
+
+        size_t allocated_heads = 16;
+        atom_selection_t *subset_heads = selection_create(allocated_heads);
+        for (size_t j = 0; j < heads->n_atoms; ++j, ++head_index) {
+            if (membranes->membrane[head_index] == membrane) selection_add_atom(&subset_heads, &allocated_heads, heads->atoms[j]);
+        }
+
+        // lipid types that are not present in this membrane are not included
+        if (subset_heads->n_atoms == 0) {
+            free(subset_heads);
+            continue;
+        }
+
+        dict_set(subset->lipids_dictionary, composition->lipid_types[i], &subset_heads, sizeof(atom_selection_t *));
+    }
+
+    subset->n_lipid_types = dict_keys(subset->lipids_dictionary, &subset->lipid_types);
+
+    return subset;
+}
+
+membranes_t *membranes_detect(lipid_composition_t *composition, const box_t box, const int single_membrane)
+{
+    membranes_t *membranes = calloc(1, sizeof(membranes_t));
+
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        atom_selection_t *heads = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
+        membranes->n_heads += heads->n_atoms;
+    }
+
+    membranes->heads = malloc(membranes->n_heads * sizeof(atom_t *));
+    membranes->membrane = calloc(membranes->n_heads, sizeof(size_t));
+    size_t head_index = 0;
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        atom_selection_t *heads = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
+        for (size_t j = 0; j < heads->n_atoms; ++j) membranes->heads[head_index++] = heads->atoms[j];
+    }
+
+    size_t n_membranes = 0;
+    vec_t *centers = single_membrane ? NULL : find_membrane_centers(composition->all_lipid_atoms, box, &n_membranes);
+
+    // single membrane: the full composition is used directly
+    if (centers == NULL) {
+        membranes->n_membranes = 1;
+        membranes->compositions = malloc(sizeof(lipid_composition_t *));
+        membranes->compositions[0] = composition;
+        membranes->centers = calloc(1, sizeof(vec_t));
+        return membranes;
+    }
+
+    membranes->n_membranes = n_membranes;
+    membranes->centers = centers;
+    membranes->owned = 1;
+
+    // assign lipid heads and lipid atoms to the closest membranes
+    for (size_t h = 0; h < membranes->n_heads; ++h) {
+        membranes->membrane[h] = closest_membrane(membranes->heads[h]->position, centers, n_membranes, box);
+    }
+
+    size_t *atom_membrane = malloc(composition->all_lipid_atoms->n_atoms * sizeof(size_t));
+    for (size_t a = 0; a < composition->all_lipid_atoms->n_atoms; ++a) {
+        atom_membrane[a] = closest_membrane(composition->all_lipid_atoms->atoms[a]->position, centers, n_membranes, box);
+    }
+
+    membranes->compositions = malloc(n_membranes * sizeof(lipid_composition_t *));
+    for (size_t m = 0; m < n_membranes; ++m) {
+        membranes->compositions[m] = membrane_composition(composition, membranes, atom_membrane, m);
+    }
+    free(atom_membrane);
+
+    printf("Detected %zu membranes along the z-axis:\n", n_membranes);
+    for (size_t m = 0; m < n_membranes; ++m) {
+        size_t n_lipids = 0;
+        for (size_t h = 0; h < membranes->n_heads; ++h) n_lipids += membranes->membrane[h] == m;
+        printf("  membrane %zu: %zu lipids, center at z = %.3f nm\n", m + 1, n_lipids, centers[m][2]);
+    }
+    printf("Each membrane will be analyzed separately.\n\n");
+
+    return membranes;
+}
+
+size_t membranes_update(membranes_t *membranes, const box_t box)
+{
+    for (size_t m = 0; m < membranes->n_membranes; ++m) {
+        center_of_geometry(membranes->compositions[m]->all_lipid_atoms, membranes->centers[m], (float *) box);
+    }
+
+    if (membranes->n_membranes < 2) return 0;
+
+    size_t moved = 0;
+    for (size_t h = 0; h < membranes->n_heads; ++h) {
+        moved += closest_membrane(membranes->heads[h]->position, membranes->centers, membranes->n_membranes, box) != membranes->membrane[h];
+    }
+
+    if (moved > 0 && !membranes->warned) {
+        fprintf(stderr, "Warning. %zu lipid(s) are closer to another membrane than to the membrane they were assigned to.\n", moved);
+        fprintf(stderr, "Lipids are not reassigned between membranes during the analysis.\n\n");
+        membranes->warned = 1;
+    }
+
+    return moved;
+}
+
+char *membranes_file_name(const membranes_t *membranes, const char *file_name, const size_t membrane)
+{
+    if (membranes->n_membranes < 2) return strdup(file_name);
+
+    // the extension is the part after the last dot of the last path component
+    const char *extension = strrchr(file_name, '.');
+    const char *slash = strrchr(file_name, '/');
+    if (extension == NULL || (slash != NULL && extension < slash)) extension = file_name + strlen(file_name);
+
+    size_t length = strlen(file_name) + 32;
+    char *name = malloc(length);
+    snprintf(name, length, "%.*s_membrane%zu%s", (int) (extension - file_name), file_name, membrane + 1, extension);
+
+    return name;
+}
+
+void membranes_destroy(membranes_t *membranes)
+{
+    if (membranes == NULL) return;
+
+    if (membranes->owned) {
+        for (size_t m = 0; m < membranes->n_membranes; ++m) lipid_composition_destroy(membranes->compositions[m]);
+    }
+
+    free(membranes->compositions);
+    free(membranes->centers);
+    free(membranes->heads);
+    free(membranes->membrane);
+    free(membranes);
+}
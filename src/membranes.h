@@ -0,0 +1,73 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef MEMBRANES_H
+#define MEMBRANES_H
+
+#include <groan.h>
+#include "general.h"
+
+/*! @brief Membranes present in the system. See membranes_detect() for more details. */
+typedef struct membranes {
+    size_t n_membranes;                 // number of detected membranes
+    lipid_composition_t **compositions; // lipids of each membrane
+    vec_t *centers;                     // center of geometry of each membrane in the current frame
+    size_t n_heads;                     // total number of lipid heads
+    atom_t **heads;                     // all lipid heads ordered by lipid types (same order as in the full lipid composition)
+    size_t *membrane;                   // membrane of each lipid head
+    int owned;                          // are the compositions owned by this structure? (zero for a single membrane)
+    int warned;                         // has the user been warned about lipids moving between membranes?
+} membranes_t;
+
+
+/*! @brief Partitions the lipids of the system into separate membranes (e.g. two bilayers of a double-bilayer setup).
+ *
+ * @paragraph Algorithm
+ * Positions of all lipid atoms along the z-axis are binned into a periodic histogram spanning the whole box.
+ * Runs of (nearly) empty bins at least 1 nm long are gaps between membranes, so every continuous stretch
+ * of occupied bins between two gaps is a membrane. Stretches containing less than 1% of the lipid atoms
+ * (e.g. a few lipids dissolved in water) are not treated as membranes. Every lipid head and every lipid atom is then
+ * assigned to the membrane with the closest center along the z-axis. The detection is linear in the number of lipid atoms.
+ *
+ * @paragraph Single membrane
+ * If no gap is found (or the detection is disabled using single_membrane), the system contains
+ * a single membrane and compositions[0] is the provided composition itself, so all analyses behave exactly as before.
+ * Otherwise, compositions[i] contains only the lipids of the i-th membrane (ordered from the bottom of the box);
+ * its lipid heads are shared with the full composition, so lipid_composition_update() must be called
+ * for the full composition only.
+ *
+ * @param composition       lipid composition of the whole system
+ * @param box               simulation box
+ * @param single_membrane   if non-zero, the detection is skipped and all lipids form a single membrane
+ *
+ * @return Pointer to membranes_t structure. Must be deallocated using membranes_destroy().
+ */
+membranes_t *membranes_detect(lipid_composition_t *composition, const box_t box, const int single_membrane);
+
+
+/*! @brief Calculates centers of all membranes and checks that lipids have not moved between membranes.
+ *
+ * @paragraph Check
+ * Every lipid head is checked to be closer (along the z-axis) to the center of its own membrane than to the center
+ * of any other membrane. Lipids are never reassigned between membranes; the user is warned once if any lipid
+ * is closer to another membrane.
+ *
+ * @return Number of lipids that are closer to another membrane than to their own.
+ */
+size_t membranes_update(membranes_t *membranes, const box_t box);
+
+
+/*! @brief Returns the name of the output file for the membrane with the given index.
+ *
+ * @paragraph Details
+ * For a single membrane, the file name is not changed. Otherwise, '_membraneN' (N counted from 1)
+ * is inserted before the extension of the file, e.g. 'rate.xvg' -> 'rate_membrane2.xvg'.
+ * The returned string must be deallocated using free().
+ */
+char *membranes_file_name(const membranes_t *membranes, const char *file_name, const size_t membrane);
+
+
+/*! @brief Deallocates memory for the membranes_t structure. The full lipid composition is not deallocated. */
+void membranes_destroy(membranes_t *membranes);
+
+#endif /* MEMBRANES_H */
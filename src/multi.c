@@ -0,0 +1,641 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#include "general.h"
+#include "multi.h"
+#include "composition.h"
+#include "rate.h"
+#include "positions.h"
+#include "flipflops.h"
+#include "leaflets.h"
+#include "trajectory.h"
+#include "profile.h"
+#include "topology.h"
+#include "membranes.h"
+
+/*! @brief Types of analyses that can be performed by the multi module */
+typedef enum multi_type {
+    MULTI_COMPOSITION,
+    MULTI_RATE,
+    MULTI_POSITIONS,
+    MULTI_FLIPFLOPS,
+    MULTI_N_TYPES
+} multi_type_t;
+
+/*! @brief Names of the analyses as used on the command line */
+static const char *MULTI_NAMES[MULTI_N_TYPES] = {"composition", "rate", "positions", "flipflops"};
+/*! @brief Default time intervals between analyzed frames [ns] (same as in the individual modules) */
+static const float MULTI_DEFAULT_DT[MULTI_N_TYPES] = {1.0, 10.0, 1.0, 1.0};
+/*! @brief Default output files (same as in the individual modules; flipflops print into stdout by default) */
+static const char *MULTI_DEFAULT_OUTPUT[MULTI_N_TYPES] = {"composition.xvg", "rate.xvg", "positions.xvg", NULL};
+
+/*! @brief Single analysis performed by the multi module */
+typedef struct multi_analysis {
+    multi_type_t type;
+    float dt;                   // time interval between analyzed frames [ns]
+    int step;                   // time interval between analyzed frames [ps]
+    char *output_file;          // NULL for flipflops printing into stdout
+    FILE *output;
+    size_t membrane;            // index of the analyzed membrane (see membranes_detect())
+    size_t classifiers;         // index of the set of leaflet classifiers used by this analysis (see assign_classifiers())
+    void *state;                // composition_analysis_t, rate_analysis_t or flipflops_analysis_t (NULL for positions)
+} multi_analysis_t;
+
+
+/*! @brief Parses a comma-separated list of analyses in format 'name[:dt[:output]]'.
+ *
+ * @return Array of analyses (their files are not opened and their states are not created). NULL in case of an error.
+ */
+static multi_analysis_t *parse_analyses(const char *list, size_t *n_analyses)
+{
+    *n_analyses = 0;
+    char *copy = strdup(list);
+    multi_analysis_t *analyses = NULL;
+
+    char *saveptr = NULL;
+    for (char *item = strtok_r(copy, ",", &saveptr); item != NULL; item = strtok_r(NULL, ",", &saveptr)) {
+        char *name = item;
+        char *dt_string = NULL;
+        char *output_file = NULL;
+
+        // split the item into name, dt and output file
+        if ((dt_string = strchr(name, ':')) != NULL) {
+            *dt_string++ = '\0';
+            if ((output_file = strchr(dt_string, ':')) != NULL) *output_file++ = '\0';
+        }
+
+        int type = 0;
+        for (; type < MULTI_N_TYPES; ++type) {
+            if (!strcmp(name, MULTI_NAMES[type])) break;
+        }
+
+        if (type == MULTI_N_TYPES) {
+            fprintf(stderr, "Unknown analysis '%s'.\n", name);
+            goto error;
+        }
+
+        float dt = MULTI_DEFAULT_DT[type];
+        if (dt_string != NULL && *dt_string != '\0' && (sscanf(dt_string, "%f", &dt) != 1 || dt <= 0)) {
+            fprintf(stderr, "Time interval of analysis '%s' must be a positive number.\n", name);
+            goto error;
+        }
+
+        // frames are selected by their time in ps
+        if (roundf(dt * 1000) < 1) {
+            fprintf(stderr, "dt must be at least 0.001 ns.\n");
+            goto error;
+        }
+
+        if (type == MULTI_FLIPFLOPS && dt != 1.0) {
+            fprintf(stderr, "Flipflops analysis always analyzes frames every 1 ns.\n");
+            goto error;
+        }
+
+        if (output_file == NULL || *output_file == '\0') output_file = (char *) MULTI_DEFAULT_OUTPUT[type];
+
+        analyses = realloc(analyses, (*n_analyses + 1) * sizeof(multi_analysis_t));
+        multi_analysis_t *analysis = &analyses[*n_analyses];
+        memset(analysis, 0, sizeof(multi_analysis_t));
+        analysis->type = (multi_type_t) type;
+        analysis->dt = dt;
+        analysis->step = (int) roundf(dt * 1000);
+        analysis->output_file = output_file == NULL ? NULL : strdup(output_file);
+        ++(*n_analyses);
+    }
+
+    if (*n_analyses == 0) {
+        fprintf(stderr, "No analyses specified.\n");
+        goto error;
+    }
+
+    free(copy);
+    return analyses;
+
+    error:
+    for (size_t i = 0; i < *n_analyses; ++i) free(analyses[i].output_file);
+    free(analyses);
+    free(copy);
+    return NULL;
+}
+
+/*! @brief Replaces each analysis with one analysis for each membrane.
+ *
+ * @paragraph Details
+ * Output files of the membranes are named using membranes_file_name(). The positions analysis does not depend
+ * on membranes and is therefore never replicated.
+ */
+static multi_analysis_t *split_analyses(multi_analysis_t *analyses, size_t *n_analyses, const membranes_t *membranes)
+{
+    if (membranes->n_membranes < 2) return analyses;
+
+    size_t n_split = 0;
+    multi_analysis_t *split = calloc(*n_analyses * membranes->n_membranes, sizeof(multi_analysis_t));
+    for (size_t i = 0; i < *n_analyses; ++i) {
+        size_t n_copies = analyses[i].type == MULTI_POSITIONS ? 1 : membranes->n_membranes;
+        for (size_t m = 0; m < n_copies; ++m) {
+            split[n_split] = analyses[i];
+            split[n_split].membrane = m;
+            if (analyses[i].output_file != NULL) {
+                split[n_split].output_file = n_copies > 1 ? membranes_file_name(membranes, analyses[i].output_file, m) : strdup(analyses[i].output_file);
+            }
+            ++n_split;
+        }
+
+        free(analyses[i].output_file);
+    }
+
+    free(analyses);
+    *n_analyses = n_split;
+    return split;
+}
+
+/*! @brief Closes output files and deallocates the states of all analyses. */
+static void destroy_analyses(multi_analysis_t *analyses, const size_t n_analyses)
+{
+    if (analyses == NULL) return;
+
+    for (size_t i = 0; i < n_analyses; ++i) {
+        switch (analyses[i].type) {
+        case MULTI_COMPOSITION:
+            composition_analysis_destroy(analyses[i].state);
+            break;
+        case MULTI_RATE:
+            rate_analysis_destroy(analyses[i].state);
+            break;
+        case MULTI_FLIPFLOPS:
+            flipflops_analysis_destroy(analyses[i].state);
+            break;
+        default:
+            break;
+        }
+
+        if (analyses[i].output != NULL) fclose(analyses[i].output);
+        free(analyses[i].output_file);
+    }
+
+    free(analyses);
+}
+
+/*! @brief Assigns a set of leaflet classifiers (one classifier per membrane) to every analysis except positions.
+ *
+ * @paragraph Stateful classification
+ * Leaflet clustering keeps state between frames (see leaflet_clustering_assign()), so the leaflets assigned
+ * in a frame depend on the frames classified before. Analyses with different time intervals therefore use separate sets
+ * of classifiers, each of which only classifies the frames the corresponding individual module would read.
+ * Classification relative to the membrane center has no state, so a single set is shared by all analyses.
+ *
+ * @return Number of sets of classifiers.
+ */
+static size_t assign_classifiers(multi_analysis_t *analyses, const size_t n_analyses, const int stateful)
+{
+    size_t n_sets = 0;
+    for (size_t i = 0; i < n_analyses; ++i) {
+        if (analyses[i].type == MULTI_POSITIONS) continue;
+
+        // reuse the set of an earlier analysis with the same time interval
+        size_t j = 0;
+        for (; j < i; ++j) {
+            if (analyses[j].type != MULTI_POSITIONS && (!stateful || analyses[j].step == analyses[i].step)) break;
+        }
+
+        analyses[i].classifiers = j < i ? analyses[j].classifiers : n_sets++;
+    }
+
+    return n_sets;
+}
+
+/*! @brief Deallocates all leaflet classifiers. */
+static void destroy_classifiers(leaflet_classifier_t **classifiers, const size_t n_classifiers)
+{
+    for (size_t c = 0; c < n_classifiers; ++c) leaflet_classifier_destroy(classifiers[c]);
+    free(classifiers);
+}
+
+/*! @brief Prints supported flags and arguments of this module */
+void print_usage_multi(void)
+{
+    printf("\nValid OPTIONS for the multi module:\n");
+    printf("-h               print this message and exit\n");
+    printf("-c STRING        gro file to read\n");
+    printf("-f STRING        xtc file to read ('-' for stdin)\n");
+    printf("-n STRING        ndx file to read (optional, default: index.ndx)\n");
+    printf("-p STRING        selection of lipid head identifiers (default: name PO4)\n");
+    printf("-m STRING        comma-separated list of analyses to perform, each as 'name[:dt[:output]]'\n");
+    printf("                 (names: composition, rate, positions, flipflops; e.g. 'rate:10,composition:1,flipflops')\n");
+    printf("-s FLOAT         spatial limit for the flipflops analysis in nm (default: 1.5)\n");
+    printf("-t INTEGER       temporal limit for the flipflops analysis in ns (default: 10)\n");
+    printf("-l FLOAT         identify leaflets by clustering lipid heads closer than FLOAT nm (optional)\n");
+    printf("--follow         wait for new frames of a trajectory that is still being written (stop with Ctrl+C)\n");
+    printf("\n");
+}
+
+int get_arguments_multi(
+        const int argc,
+        char **argv,
+        char **gro_file,
+        char **xtc_file,
+        char **ndx_file,
+        char **phosphates,
+        char **analyses,
+        float *spatial_limit,
+        int *temporal_limit,
+        float *leaflet_cutoff)
+{
+    int gro_specified = 0, xtc_specified = 0, analyses_specified = 0;
+
+    int opt = 0;
+    while((opt = getopt(argc - 1, argv + 1, "c:f:n:p:m:s:t:l:h")) != -1) {
+        switch (opt) {
+        // help
+        case 'h':
+            return 1;
+        // gro file to read
+        case 'c':
+            *gro_file = optarg;
+            gro_specified = 1;
+            break;
+        // xtc file to read
+        case 'f':
+            *xtc_file = optarg;
+            xtc_specified = 1;
+            break;
+        // ndx file
+        case 'n':
+            *ndx_file = optarg;
+            break;
+        // phosphates identifier
+        case 'p':
+            *phosphates = optarg;
+            break;
+        // list of analyses
+        case 'm':
+            *analyses = optarg;
+            analyses_specified = 1;
+            break;
+        // spatial limit for flipflops
+        case 's':
+            sscanf(optarg, "%f", spatial_limit);
+            if (*spatial_limit < 0) {
+                fprintf(stderr, "Spatial limit must be non-negative.\n");
+                return 1;
+            }
+            break;
+        // temporal limit for flipflops
+        case 't':
+            sscanf(optarg, "%d", temporal_limit);
+            if (*temporal_limit <= 0) {
+                fprintf(stderr, "Temporal limit must be positive.\n");
+                return 1;
+            }
+            break;
+        // leaflet clustering cutoff
+        case 'l':
+            if (sscanf(optarg, "%f", leaflet_cutoff) != 1 || *leaflet_cutoff <= 0) {
+                fprintf(stderr, "Leaflet clustering cutoff must be a positive number.\n");
+                return 1;
+            }
+            break;
+        default:
+            return 1;
+        }
+    }
+
+    if (!gro_specified || !xtc_specified) {
+        fprintf(stderr, "Gro and xtc file must always be supplied.\n");
+        return 1;
+    }
+
+    if (!analyses_specified) {
+        fprintf(stderr, "List of analyses must always be supplied.\n");
+        return 1;
+    }
+    return 0;
+}
+
+/* Prints arguments that the program will use for the calculation. */
+static void print_arguments_multi(
+        const char *gro_file,
+        const char *xtc_file,
+        const char *ndx_file,
+        const char *phosphates,
+        const multi_analysis_t *analyses,
+        const size_t n_analyses,
+        const float spatial_limit,
+        const int temporal_limit,
+        const float leaflet_cutoff,
+        const int follow)
+{
+    printf("Parameters for Multi Analysis:\n");
+    printf(">>> gro file:         %s\n", gro_file);
+    printf(">>> xtc file:         %s\n", xtc_file);
+    printf(">>> ndx file:         %s\n", ndx_file);
+    printf(">>> lipid heads:      %s\n", phosphates);
+    for (size_t i = 0; i < n_analyses; ++i) {
+        printf(">>> analysis:         %-12s (time step: %f ns, output: %s)\n", MULTI_NAMES[analyses[i].type], analyses[i].dt,
+                analyses[i].output_file == NULL ? "stdout" : analyses[i].output_file);
+        if (analyses[i].type == MULTI_FLIPFLOPS) {
+            printf("                      spatial limit: %f nm, temporal limit: %d ns\n", spatial_limit, temporal_limit);
+        }
+    }
+    if (leaflet_cutoff > 0) printf(">>> leaflet cutoff:   %f nm\n", leaflet_cutoff);
+    if (follow) printf(">>> following trajectory (stop with Ctrl+C)\n");
+    printf("\n");
+}
+
+int calc_multi(
+        const char *input_gro_file,
+        const char *input_xtc_file,
+        const char *ndx_file,
+        const char *head_identifier,
+        const char *analyses_list,
+        const float spatial_limit,
+        const int temporal_limit,
+        const float leaflet_cutoff,
+        const int single_membrane,
+        const int follow,
+        profile_t *profile)
+{
+    size_t n_analyses = 0;
+    multi_analysis_t *analyses = parse_analyses(analyses_list, &n_analyses);
+    if (analyses == NULL) return 1;
+
+    print_arguments_multi(input_gro_file, input_xtc_file, ndx_file, head_identifier, analyses, n_analyses,
+            spatial_limit, temporal_limit, leaflet_cutoff, follow);
+
+    // read gro file and get lipids present in the system (possibly from the topology cache)
+    system_t *system = NULL;
+    lipid_composition_t *composition = topology_load(input_gro_file, ndx_file, head_identifier, &system);
+    if (composition == NULL) {
+        destroy_analyses(analyses, n_analyses);
+        return 1;
+    }
+
+    // read ndx file (only needed for the selection of heads for the positions analysis)
+    dict_t *ndx_groups = NULL;
+    for (size_t i = 0; i < n_analyses; ++i) {
+        if (analyses[i].type == MULTI_POSITIONS) {
+            ndx_groups = read_ndx(ndx_file, system);
+            break;
+        }
+    }
+
+    // if there are no lipids
+    if (composition->n_lipid_types < 1) {
+        fprintf(stderr, "No usable lipids detected.\n");
+        destroy_analyses(analyses, n_analyses);
+        lipid_composition_destroy(composition);
+        dict_destroy(ndx_groups);
+        free(system);
+        return 1;
+    }
+
+    // split the lipids into separate membranes, if there are several of them; each membrane is analyzed separately
+    membranes_t *membranes = membranes_detect(composition, system->box, single_membrane);
+    const size_t n_membranes = membranes->n_membranes;
+    analyses = split_analyses(analyses, &n_analyses, membranes);
+
+    // the positions analysis uses all lipid heads, not only heads of the recognized lipids (see calc_lipid_positions())
+    atom_selection_t *heads = NULL;
+    for (size_t i = 0; i < n_analyses; ++i) {
+        if (analyses[i].type != MULTI_POSITIONS || heads != NULL) continue;
+
+        atom_selection_t *all = select_system(system);
+        heads = smart_select(all, head_identifier, ndx_groups);
+        free(all);
+        if (heads == NULL || heads->n_atoms == 0) {
+            fprintf(stderr, "No lipid headgroups ('%s') found.\n", head_identifier);
+            destroy_analyses(analyses, n_analyses);
+            membranes_destroy(membranes);
+            lipid_composition_destroy(composition);
+            dict_destroy(ndx_groups);
+            free(heads);
+            free(system);
+            return 1;
+        }
+    }
+
+    dict_destroy(ndx_groups);
+
+    // open output files, write their headers and prepare the analyses
+    for (size_t i = 0; i < n_analyses; ++i) {
+        multi_analysis_t *analysis = &analyses[i];
+
+        if (analysis->output_file != NULL && (analysis->output = fopen(analysis->output_file, "w")) == NULL) {
+            fprintf(stderr, "Could not open output file %s\n", analysis->output_file);
+            destroy_analyses(analyses, n_analyses);
+            membranes_destroy(membranes);
+            lipid_composition_destroy(composition);
+            free(heads);
+            free(system);
+            return 1;
+        }
+
+        const lipid_composition_t *membrane = membranes->compositions[analysis->membrane];
+        switch (analysis->type) {
+        case MULTI_COMPOSITION:
+            composition_write_header(analysis->output, membrane, input_xtc_file);
+            analysis->state = composition_analysis_create(membrane);
+            break;
+        case MULTI_RATE:
+            analysis->state = rate_analysis_create(membrane);
+            rate_write_header(analysis->output, analysis->state, input_xtc_file);
+            break;
+        case MULTI_POSITIONS:
+            positions_write_header(analysis->output, heads, input_xtc_file);
+            break;
+        case MULTI_FLIPFLOPS:
+            analysis->state = flipflops_analysis_create(membrane, spatial_limit, temporal_limit);
+            break;
+        default:
+            break;
+        }
+    }
+
+    // prepare leaflet classification of each membrane (clustering, if requested) for each set of classifiers
+    const size_t n_sets = assign_classifiers(analyses, n_analyses, leaflet_cutoff > 0);
+    const size_t n_classifiers = n_sets * n_membranes;
+    leaflet_classifier_t **classifiers = calloc(n_classifiers, sizeof(leaflet_classifier_t *));
+    for (size_t c = 0; c < n_classifiers; ++c) {
+        if ((classifiers[c] = leaflet_classifier_create(membranes->compositions[c % n_membranes], leaflet_cutoff)) == NULL) {
+            destroy_analyses(analyses, n_analyses);
+            destroy_classifiers(classifiers, n_classifiers);
+            membranes_destroy(membranes);
+            lipid_composition_destroy(composition);
+            free(heads);
+            free(system);
+            return 1;
+        }
+    }
+
+    // open xtc file for reading
+    trajectory_t *traj = trajectory_open(input_xtc_file, system->n_atoms);
+    if (traj == NULL) {
+        fprintf(stderr, "File %s could not be read as an xtc file.\n", input_xtc_file);
+        destroy_analyses(analyses, n_analyses);
+        destroy_classifiers(classifiers, n_classifiers);
+        membranes_destroy(membranes);
+        lipid_composition_destroy(composition);
+        free(heads);
+        free(system);
+        return 1;
+    }
+
+    // check that the gro file and the xtc file match each other
+    if (!trajectory_validate(traj)) {
+        fprintf(stderr, "Number of atoms in %s does not match %s.\n", input_xtc_file, input_gro_file);
+        destroy_analyses(analyses, n_analyses);
+        destroy_classifiers(classifiers, n_classifiers);
+        membranes_destroy(membranes);
+        lipid_composition_destroy(composition);
+        free(heads);
+        free(system);
+        trajectory_close(traj);
+        return 1;
+    }
+
+    // wait for new frames at the end of the trajectory, if requested
+    if (follow && trajectory_follow(traj, input_xtc_file) != 0) {
+        destroy_analyses(analyses, n_analyses);
+        destroy_classifiers(classifiers, n_classifiers);
+        membranes_destroy(membranes);
+        lipid_composition_destroy(composition);
+        free(heads);
+        free(system);
+        trajectory_close(traj);
+        return 1;
+    }
+
+    // analyses that should be performed for the current frame
+    int *due = calloc(n_analyses, sizeof(int));
+    // sets of classifiers that should classify the current frame
+    int *sets_due = calloc(n_sets, sizeof(int));
+    // leaflets that could not be identified in the current frame by each classifier
+    int *leaflets_unavailable = calloc(n_classifiers, sizeof(int));
+    int return_code = 0;
+
+    while (trajectory_next(traj) == 0) {
+        // find out which analyses need this frame
+        int needs_frame = 0, needs_leaflets = 0;
+        memset(sets_due, 0, n_sets * sizeof(int));
+        for (size_t i = 0; i < n_analyses; ++i) {
+            due[i] = ((int) traj->time % analyses[i].step == 0);
+            needs_frame |= due[i];
+            if (due[i] && analyses[i].type != MULTI_POSITIONS) {
+                needs_leaflets = 1;
+                sets_due[analyses[i].classifiers] = 1;
+            }
+        }
+
+        // frames that are not needed by any analysis are skipped without decompression
+        if (!needs_frame) {
+            if (profile_skip(profile, traj) != 0) break;
+            continue;
+        }
+
+        if (profile_read(profile, traj, system) != 0) break;
+
+        // get center of geometry of each membrane and assign lipids to leaflets; this is shared by all analyses
+        if (needs_leaflets) {
+            profile_begin(profile);
+            lipid_composition_update(composition, system->box);
+            membranes_update(membranes, system->box);
+            profile_end(profile, PROFILE_CENTER);
+
+            for (size_t c = 0; c < n_classifiers; ++c) {
+                if (!sets_due[c / n_membranes]) continue;
+
+                // if clustering fails before the leaflets have ever been identified, leaflet-based analyses are not performed for this frame
+                profile_begin(profile);
+                int unassigned = leaflet_classifier_classify(classifiers[c], membranes->centers[c % n_membranes], system->box);
+                profile_end(profile, PROFILE_LEAFLETS);
+                leaflets_unavailable[c] = unassigned && !classifiers[c]->initialized;
+            }
+        }
+
+        for (size_t i = 0; i < n_analyses && return_code == 0; ++i) {
+            if (!due[i]) continue;
+            multi_analysis_t *analysis = &analyses[i];
+
+            if (analysis->type == MULTI_POSITIONS) {
+                profile_begin(profile);
+                positions_write_frame(analysis->output, heads, system->time);
+                if (follow) fflush(analysis->output);
+                profile_end(profile, PROFILE_OUTPUT);
+                continue;
+            }
+
+            const size_t m = analysis->membrane;
+            const size_t c = analysis->classifiers * n_membranes + m;
+            if (leaflets_unavailable[c]) {
+                // the reference frame of the rate analysis must be classified
+                if (analysis->type == MULTI_RATE && ((rate_analysis_t *) analysis->state)->frame == 0) {
+                    fprintf(stderr, "Could not identify membrane leaflets in the first analyzed frame.\n");
+                    return_code = 1;
+                }
+                continue;
+            }
+
+            profile_begin(profile);
+            switch (analysis->type) {
+            case MULTI_COMPOSITION:
+                composition_analysis_frame(analysis->state, classifiers[c], system->time);
+                break;
+            case MULTI_RATE:
+                rate_analysis_frame(analysis->state, classifiers[c], system->box, system->time);
+                break;
+            case MULTI_FLIPFLOPS:
+                return_code = flipflops_analysis_frame(analysis->state, classifiers[c], membranes->centers[m], system->box, system->time);
+                break;
+            default:
+                break;
+            }
+            profile_end(profile, PROFILE_ANALYSIS);
+
+            profile_begin(profile);
+            switch (analysis->type) {
+            case MULTI_COMPOSITION:
+                composition_write_frame(analysis->output, analysis->state);
+                break;
+            case MULTI_RATE:
+                rate_write_frame(analysis->output, analysis->state);
+                break;
+            default:
+                break;
+            }
+
+            // when following a running simulation, results should be available immediately
+            if (follow && analysis->output != NULL) fflush(analysis->output);
+            profile_end(profile, PROFILE_OUTPUT);
+        }
+
+        if (return_code != 0) break;
+    }
+
+    printf("\n");
+
+    // write results of flip-flop analyses and report written files
+    for (size_t i = 0; return_code == 0 && i < n_analyses; ++i) {
+        if (analyses[i].type == MULTI_FLIPFLOPS) {
+            if (analyses[i].output == NULL) printf("\n");
+            if (analyses[i].output == NULL && n_membranes > 1) printf("Membrane %zu\n", analyses[i].membrane + 1);
+            flipflops_write_table(analyses[i].output == NULL ? stdout : analyses[i].output, analyses[i].state);
+        }
+
+        if (analyses[i].output_file != NULL) printf("Output file %s written.\n", analyses[i].output_file);
+    }
+
+    if (return_code == 0) profile_report(profile);
+
+    free(due);
+    free(sets_due);
+    free(leaflets_unavailable);
+    destroy_analyses(analyses, n_analyses);
+    destroy_classifiers(classifiers, n_classifiers);
+    membranes_destroy(membranes);
+    lipid_composition_destroy(composition);
+    free(heads);
+    free(system);
+    trajectory_close(traj);
+
+    return return_code;
+}
@@ -0,0 +1,79 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef MULTI_H
+#define MULTI_H
+
+#include <groan.h>
+#include <unistd.h>
+#include "profile.h"
+
+/*! @brief Prints supported flags and arguments of this module */
+void print_usage_multi(void);
+
+
+/*! @brief Parses command line arguments for the multi module.
+ *
+ * @return Zero, if parsing has been successful. Else returns non-zero.
+ */
+int get_arguments_multi(
+        const int argc,
+        char **argv,
+        char **gro_file,
+        char **xtc_file,
+        char **ndx_file,
+        char **phosphates,
+        char **analyses,
+        float *spatial_limit,
+        int *temporal_limit,
+        float *leaflet_cutoff);
+
+
+/*! @brief Performs several analyses of the same trajectory in a single pass.
+ *
+ * @paragraph Specifying the analyses
+ * The analyses to perform are provided as a comma-separated list of items 'name[:dt[:output]]', where name
+ * is one of 'composition', 'rate', 'positions' and 'flipflops', dt is the time interval between analyzed frames in ns
+ * and output is the name of the output file. If dt or output is not provided, the default values of the corresponding
+ * module are used. The flipflops analysis always analyzes frames every 1 ns and prints its results into stdout,
+ * unless an output file is provided. For example: 'rate:10,composition:1:comp.xvg,flipflops'.
+ *
+ * @paragraph Single pass
+ * Each trajectory frame is only decompressed if at least one of the analyses needs it; other frames are skipped.
+ * The center of the membrane is calculated only once per frame and shared by all the analyses. The leaflet assignment
+ * is also shared, except with leaflet clustering: clustering depends on the previously classified frames, so analyses
+ * with different time intervals use separate classifiers, each seeing only the frames it analyzes.
+ * The results are thus identical to running the individual modules separately.
+ *
+ * @paragraph Multiple membranes
+ * If the system contains several membranes (see membranes_detect()), every analysis except positions is performed
+ * for each membrane separately and its output file is named using membranes_file_name().
+ *
+ * @param input_gro_file        gro file to read
+ * @param input_xtc_file        xtc file to read
+ * @param ndx_file              ndx file to read
+ * @param head_identifier       selection of lipid head identifiers
+ * @param analyses              comma-separated list of analyses to perform
+ * @param spatial_limit         spatial limit for the flipflops analysis [nm]
+ * @param temporal_limit        temporal limit for the flipflops analysis [ns]
+ * @param leaflet_cutoff        if positive, leaflets are identified by clustering of lipid heads (see leaflet_clustering_assign())
+ * @param single_membrane       analyze all lipids as a single membrane even if several membranes are detected (see membranes_detect())
+ * @param follow                wait for new frames at the end of the trajectory (see trajectory_follow())
+ * @param profile               progress reporting and profiling of the analysis (see profile_read())
+ *
+ * @return Zero, if the analysis was successful. Else non-zero.
+ */
+int calc_multi(
+        const char *input_gro_file,
+        const char *input_xtc_file,
+        const char *ndx_file,
+        const char *head_identifier,
+        const char *analyses,
+        const float spatial_limit,
+        const int temporal_limit,
+        const float leaflet_cutoff,
+        const int single_membrane,
+        const int follow,
+        profile_t *profile);
+
+#endif /* MULTI_H */
@@ -2,11 +2,11 @@
 // Copyright (c) 2022 Ladislav Bartos
 
 #include "general.h"
+#include "gro.h"
 #include "positions.h"
 #include "rate.h"
-
-// frequency of printing during the calculation
-static const int PROGRESS_FREQ = 10000;
+#include "trajectory.h"
+#include "profile.h"
 
 /*! @brief Prints supported flags and arguments of this module */
 void print_usage_positions(void)
@@ -14,7 +14,7 @@ void print_usage_positions(void)
     printf("\nValid OPTIONS for the positions module:\n");
     printf("-h               print this message and exit\n");
     printf("-c STRING        gro file to read\n");
-    printf("-f STRING        xtc file to read\n");
+    printf("-f STRING        xtc file to read ('-' for stdin)\n");
     printf("-n STRING        ndx file to read (optional, default: index.ndx)\n");
     printf("-o STRING        output file name (default: positions.xvg)\n");
     printf("-p STRING        selection of lipid head identifiers (default: name PO4)\n");
@@ -32,8 +32,8 @@ int get_arguments_positions(
         char **phosphates,
         float *dt) 
 {
-    // we can reuse the get_arguments_rate function
-    return get_arguments_rate(argc, argv, gro_file, xtc_file, ndx_file, output_file, phosphates, dt);
+    // we can reuse the get_arguments_rate function (leaflet clustering, checkpoints, lag-time averaging and distance shells are not supported)
+    return get_arguments_rate(argc, argv, gro_file, xtc_file, ndx_file, output_file, phosphates, dt, NULL, NULL, NULL, NULL, NULL);
 }
 
 void print_arguments_positions(
@@ -54,18 +54,40 @@ void print_arguments_positions(
     printf("\n");
 }
 
+void positions_write_header(FILE *output, const atom_selection_t *heads, const char *input_xtc_file)
+{
+    fprintf(output, "# Generated with Scramblyzer Positions from file %s\n", input_xtc_file);
+    fprintf(output, "@    title \"Positions of lipid heads in time\"\n");
+    fprintf(output, "@    xaxis label \"time [ns]\"\n");
+    fprintf(output, "@    yaxis label \"z-coordinate [nm]\"\n");
+    for (size_t i = 0; i < heads->n_atoms; ++i) {
+        fprintf(output, "@    s%zu legend \"index %d\"\n", i, heads->atoms[i]->atom_number);
+    }
+}
+
+void positions_write_frame(FILE *output, const atom_selection_t *heads, const float time)
+{
+    // loop through heads, get their positions and write them into output file
+    fprintf(output, "%f ", time / 1000.0);
+    for (size_t i = 0; i < heads->n_atoms; ++i) {
+        fprintf(output, "%f ", heads->atoms[i]->position[2]);
+    }
+    fprintf(output, "\n");
+}
+
 int calc_lipid_positions(
         const char *input_gro_file,
         const char *input_xtc_file,
         const char *ndx_file,
         const char *output_file,
         const char *head_identifier,
-        const float dt)
+        const float dt,
+        profile_t *profile)
 {
     print_arguments_positions(input_gro_file, input_xtc_file, ndx_file, output_file, head_identifier, dt);
 
     // read gro file
-    system_t *system = load_gro(input_gro_file);
+    system_t *system = gro_load(input_gro_file);
     if (system == NULL) return 1;
 
     atom_selection_t *all = select_system(system);
@@ -97,17 +119,11 @@ int calc_lipid_positions(
     }
 
     // write header for the output file
-    fprintf(output, "# Generated with Scramblyzer Positions from file %s\n", input_xtc_file);
-    fprintf(output, "@    title \"Positions of lipid heads in time\"\n");
-    fprintf(output, "@    xaxis label \"time [ns]\"\n");
-    fprintf(output, "@    yaxis label \"z-coordinate [nm]\"\n");
-    for (size_t i = 0; i < heads->n_atoms; ++i) {
-        fprintf(output, "@    s%zu legend \"index %d\"\n", i, heads->atoms[i]->atom_number);
-    }
+    positions_write_header(output, heads, input_xtc_file);
 
     // open xtc file for reading
-    XDRFILE *xtc = xdrfile_open(input_xtc_file, "r");
-    if (xtc == NULL) {
+    trajectory_t *traj = trajectory_open(input_xtc_file, system->n_atoms);
+    if (traj == NULL) {
         fprintf(stderr, "File %s could not be read as an xtc file.\n", input_xtc_file);
         free(heads);
         free(system);
@@ -116,37 +132,35 @@ int calc_lipid_positions(
     }
 
     // check that the gro file and the xtc file match each other
-    if (!validate_xtc(input_xtc_file, (int) system->n_atoms)) {
+    if (!trajectory_validate(traj)) {
         fprintf(stderr, "Number of atoms in %s does not match %s.\n", input_xtc_file, input_gro_file);
         free(heads);
         free(system);
-        xdrfile_close(xtc);
+        trajectory_close(traj);
         fclose(output);
         return 1;
     }
 
-    while (read_xtc_step(xtc, system) == 0) {
-        // print info about the progress of reading and writing
-        if ((int) system->time % PROGRESS_FREQ == 0) {
-            printf("Step: %d. Time: %.0f ps\r", system->step, system->time);
-            fflush(stdout);
-        }
-
-        if ((int) system->time % (int) roundf((dt * 1000)) != 0) {
+    while (trajectory_next(traj) == 0) {
+        // frames that are not analyzed are skipped without decompression
+        if ((int) traj->time % (int) roundf((dt * 1000)) != 0) {
+            if (profile_skip(profile, traj) != 0) break;
             continue;
         }
 
-        // loop through heads, get their positions and write them into output file
-        fprintf(output, "%f ", system->time / 1000.0);
-        for (size_t i = 0; i < heads->n_atoms; ++i) {
-            fprintf(output, "%f ", heads->atoms[i]->position[2]);
-        }
-        fprintf(output, "\n");
+        if (profile_read(profile, traj, system) != 0) break;
+
+        profile_begin(profile);
+        positions_write_frame(output, heads, system->time);
+        profile_end(profile, PROFILE_OUTPUT);
     }
 
+    printf("\nOutput file %s written.\n", output_file);
+    profile_report(profile);
+
     free(heads);
     free(system);
-    xdrfile_close(xtc);
+    trajectory_close(traj);
     fclose(output);
     return 0;
-}
\ No newline at end of file
+}
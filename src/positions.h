@@ -6,6 +6,7 @@
 
 #include <groan.h>
 #include <unistd.h>
+#include "profile.h"
 
 /*! @brief Parses command line arguments for the positions module.
  * 
@@ -36,6 +37,12 @@ void print_arguments_positions(
         const char *phosphates,
         const float timestep);
 
+/*! @brief Writes header of the xvg output file. */
+void positions_write_header(FILE *output, const atom_selection_t *heads, const char *input_xtc_file);
+
+/*! @brief Writes z-coordinates of all lipid heads in the current frame into the xvg output file. */
+void positions_write_frame(FILE *output, const atom_selection_t *heads, const float time);
+
 /*! @brief Analyzes and prints the positions of lipid heads during the simulation. */
 int calc_lipid_positions(
         const char *input_gro_file,
@@ -43,6 +50,7 @@ int calc_lipid_positions(
         const char *ndx_file,
         const char *output_file,
         const char *head_identifier,
-        const float dt);
+        const float dt,
+        profile_t *profile);
 
 #endif /* POSITIONS_H */
\ No newline at end of file
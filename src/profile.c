@@ -0,0 +1,181 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#include <sys/resource.h>
+#include <time.h>
+#include "profile.h"
+
+/*! @brief Minimal interval between two progress reports [s] */
+static const double PROGRESS_INTERVAL = 1.0;
+
+/*! @brief Names of the stages used in reports and in the trace */
+static const char *STAGE_NAMES[PROFILE_N_STAGES] = {"decode", "skip", "center", "leaflets", "analysis", "output"};
+
+double profile_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec * 1e-9;
+}
+
+profile_t *profile_create(int enabled, const char *trace_file)
+{
+    profile_t *profile = calloc(1, sizeof(profile_t));
+    profile->enabled = enabled || trace_file != NULL;
+    profile->progress = 1;
+    profile->start = profile_now();
+    profile->last_progress = profile->start;
+
+    if (trace_file != NULL) {
+        profile->trace = fopen(trace_file, "w");
+        if (profile->trace == NULL) {
+            fprintf(stderr, "Could not open trace file %s\n", trace_file);
+            free(profile);
+            return NULL;
+        }
+
+        fprintf(profile->trace, "frame,step,time_ps");
+        for (int i = 0; i < PROFILE_N_STAGES; ++i) fprintf(profile->trace, ",%s_ms", STAGE_NAMES[i]);
+        fprintf(profile->trace, "\n");
+    }
+
+    return profile;
+}
+
+/*! @brief Prints the progress of the analysis. */
+static void print_progress(const profile_t *profile, const trajectory_t *traj, const double now)
+{
+    printf("Step: %d. Time: %.0f ps", traj->step, traj->time);
+
+    // remaining time can only be estimated if the file does not grow
+    off_t read = traj->offset + traj->frame_size;
+    if (!traj->follow && traj->file_size > 0 && read > 0) {
+        double fraction = (double) read / traj->file_size;
+        int remaining = (int) ((now - profile->start) * (1.0 - fraction) / fraction);
+        printf(". Read: %5.1f %%. ETA: %02d:%02d:%02d", 100.0 * fraction, remaining / 3600, (remaining / 60) % 60, remaining % 60);
+    }
+
+    // overwrite leftovers of longer previous reports
+    printf("    \r");
+    fflush(stdout);
+}
+
+/*! @brief Writes the stage times of the last decoded frame into the trace and resets the stage times of the current frame. */
+static void finish_frame(profile_t *profile)
+{
+    if (profile->trace != NULL && profile->pending) {
+        fprintf(profile->trace, "%zu,%d,%.3f", profile->pending_frame, profile->pending_step, profile->pending_time);
+        for (int i = 0; i < PROFILE_N_STAGES; ++i) fprintf(profile->trace, ",%.4f", profile->stage_frame[i] * 1000.0);
+        fprintf(profile->trace, "\n");
+    }
+
+    profile->pending = 0;
+    memset(profile->stage_frame, 0, sizeof(profile->stage_frame));
+}
+
+/*! @brief Counts the frame and prints progress if enough time has passed since the last report. */
+static void record_frame(profile_t *profile, const trajectory_t *traj)
+{
+    profile->bytes = (size_t) traj->bytes_read;
+
+    if (!profile->progress) return;
+
+    // checking the clock for every frame is cheap compared to reading the frame
+    double now = profile_now();
+    if (now - profile->last_progress < PROGRESS_INTERVAL) return;
+
+    profile->last_progress = now;
+    print_progress(profile, traj, now);
+}
+
+int profile_read(profile_t *profile, trajectory_t *traj, system_t *system)
+{
+    if (profile == NULL) return trajectory_read(traj, system);
+
+    finish_frame(profile);
+
+    profile_begin(profile);
+    int return_code = trajectory_read(traj, system);
+    profile_end(profile, PROFILE_DECODE);
+    if (return_code != 0) return return_code;
+
+    profile->pending = 1;
+    profile->pending_step = traj->step;
+    profile->pending_time = traj->time;
+    profile->pending_frame = profile->decoded_frames + profile->skipped_frames;
+    ++profile->decoded_frames;
+
+    record_frame(profile, traj);
+    return 0;
+}
+
+int profile_skip(profile_t *profile, trajectory_t *traj)
+{
+    if (profile == NULL) return trajectory_skip(traj);
+
+    finish_frame(profile);
+
+    profile_begin(profile);
+    int return_code = trajectory_skip(traj);
+    profile_end(profile, PROFILE_SKIP);
+    if (return_code != 0) return return_code;
+
+    ++profile->skipped_frames;
+
+    record_frame(profile, traj);
+    return 0;
+}
+
+void profile_merge(profile_t *total, const profile_t *part)
+{
+    for (int i = 0; i < PROFILE_N_STAGES; ++i) total->stage_total[i] += part->stage_total[i];
+    total->decoded_frames += part->decoded_frames;
+    total->skipped_frames += part->skipped_frames;
+    total->bytes += part->bytes;
+}
+
+void profile_report(profile_t *profile)
+{
+    if (profile == NULL || !profile->enabled) return;
+
+    finish_frame(profile);
+
+    double wall = profile_now() - profile->start;
+    size_t frames = profile->decoded_frames + profile->skipped_frames;
+    double megabytes = profile->bytes / (1024.0 * 1024.0);
+
+    // maximum resident set size is reported in kilobytes on Linux
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    double staged = 0.0;
+    for (int i = 0; i < PROFILE_N_STAGES; ++i) staged += profile->stage_total[i];
+
+    printf("\nProfile:\n");
+    printf(">>> wall time:        %.3f s\n", wall);
+    printf(">>> frames:           %zu (decoded: %zu, skipped: %zu)\n", frames, profile->decoded_frames, profile->skipped_frames);
+    // offsets of frames are not known for streamed trajectories
+    if (profile->bytes == 0 && frames > 0) {
+        printf(">>> read:             unknown (streamed trajectory)\n");
+        printf(">>> throughput:       %.1f frames/s\n", wall > 0 ? frames / wall : 0.0);
+    } else {
+        printf(">>> read:             %.2f MB\n", megabytes);
+        printf(">>> throughput:       %.1f frames/s, %.2f MB/s\n", wall > 0 ? frames / wall : 0.0, wall > 0 ? megabytes / wall : 0.0);
+    }
+    printf(">>> peak memory:      %.1f MB\n", usage.ru_maxrss / 1024.0);
+    printf(">>> stages:\n");
+    for (int i = 0; i < PROFILE_N_STAGES; ++i) {
+        printf("    %-10s %10.3f s  %5.1f %%\n", STAGE_NAMES[i], profile->stage_total[i], wall > 0 ? 100.0 * profile->stage_total[i] / wall : 0.0);
+    }
+    printf("    %-10s %10.3f s  %5.1f %%\n", "other", wall - staged > 0 ? wall - staged : 0.0, wall > 0 && wall > staged ? 100.0 * (wall - staged) / wall : 0.0);
+}
+
+void profile_destroy(profile_t *profile)
+{
+    if (profile == NULL) return;
+    if (profile->trace != NULL) {
+        finish_frame(profile);
+        fclose(profile->trace);
+    }
+    free(profile);
+}
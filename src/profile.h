@@ -0,0 +1,116 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include "trajectory.h"
+
+/*! @brief Stages of the analysis of a trajectory frame that are timed separately */
+typedef enum profile_stage {
+    PROFILE_DECODE,             // reading and decompressing analyzed frames
+    PROFILE_SKIP,               // skipping frames that are not analyzed
+    PROFILE_CENTER,             // calculating the center of the membrane
+    PROFILE_LEAFLETS,           // assigning lipids to leaflets (see leaflet_classifier_classify())
+    PROFILE_ANALYSIS,           // the analysis itself
+    PROFILE_OUTPUT,             // formatting and writing the output
+    PROFILE_N_STAGES
+} profile_stage_t;
+
+/*! @brief Progress reporting and (optional) profiling of a trajectory analysis. See profile_read() for more details. */
+typedef struct profile {
+    int enabled;                                // time the individual stages (--profile)
+    int progress;                               // print progress of the analysis
+    FILE *trace;                                // per-frame CSV trace (NULL if not requested)
+    double start;                               // wall-clock time at the start of the analysis [s]
+    double stage_start;                         // wall-clock time at the start of the current stage [s]
+    double stage_total[PROFILE_N_STAGES];       // total time spent in each stage [s]
+    double stage_frame[PROFILE_N_STAGES];       // time spent in each stage for the current frame [s]
+    size_t decoded_frames;
+    size_t skipped_frames;
+    size_t bytes;                               // bytes of the trajectory read
+    double last_progress;                       // wall-clock time of the last progress report [s]
+    int pending;                                // the last decoded frame has not been written into the trace yet
+    int pending_step;
+    float pending_time;
+    size_t pending_frame;
+} profile_t;
+
+
+/*! @brief Creates a profile_t structure.
+ *
+ * @paragraph Note on deallocation
+ * The returned pointer must be deallocated using profile_destroy().
+ *
+ * @param enabled           if non-zero, the individual stages of the analysis are timed and a report is printed by profile_report()
+ * @param trace_file        if not NULL, the times of the stages for every decoded frame are written into this CSV file (implies enabled)
+ *
+ * @return Pointer to profile_t structure. NULL, if the trace file could not be opened.
+ */
+profile_t *profile_create(int enabled, const char *trace_file);
+
+
+/*! @brief Returns the current value of the monotonic clock in seconds. */
+double profile_now(void);
+
+
+/*! @brief Starts timing a stage. Does nothing if profiling is disabled. */
+static inline void profile_begin(profile_t *profile)
+{
+    if (profile != NULL && profile->enabled) profile->stage_start = profile_now();
+}
+
+
+/*! @brief Stops timing a stage started by profile_begin(). Does nothing if profiling is disabled. */
+static inline void profile_end(profile_t *profile, const profile_stage_t stage)
+{
+    if (profile == NULL || !profile->enabled) return;
+
+    double elapsed = profile_now() - profile->stage_start;
+    profile->stage_total[stage] += elapsed;
+    profile->stage_frame[stage] += elapsed;
+}
+
+
+/*! @brief Reads the box and coordinates of the current frame (see trajectory_read()) and records the frame.
+ *
+ * @paragraph Counting frames
+ * Every frame of the trajectory must be either read using profile_read() or skipped using profile_skip().
+ * Reading is timed as the 'decode' stage and skipping as the 'skip' stage. The number of bytes read is obtained
+ * from the offset of the frame in the file.
+ *
+ * @paragraph Progress
+ * Progress of the analysis (step, time, percentage of the file read and estimated time remaining) is printed
+ * at most once per second of wall-clock time, independently of the time step of the trajectory.
+ * Remaining time is not estimated in follow mode.
+ *
+ * @paragraph Trace
+ * If a trace file has been requested, a line with the times of all stages is written into it for every decoded frame.
+ * The line is written once the next frame is processed (or when the report is printed), so all stages
+ * of the analysis of the frame are included.
+ *
+ * @return Zero, if successful. Else non-zero.
+ */
+int profile_read(profile_t *profile, trajectory_t *traj, system_t *system);
+
+
+/*! @brief Skips the current frame (see trajectory_skip()) and records the frame. See profile_read() for more details.
+ *
+ * @return Zero, if successful. Else non-zero.
+ */
+int profile_skip(profile_t *profile, trajectory_t *traj);
+
+
+/*! @brief Adds the counters and stage times of 'part' into 'total' (e.g. to combine profiles of several trajectories). */
+void profile_merge(profile_t *total, const profile_t *part);
+
+
+/*! @brief Prints the report of the profiling (frames/s, MB/s, peak memory usage and time spent in each stage). Does nothing if profiling is disabled. */
+void profile_report(profile_t *profile);
+
+
+/*! @brief Closes the trace file and deallocates memory for the profile_t structure. */
+void profile_destroy(profile_t *profile);
+
+#endif /* PROFILE_H */
@@ -0,0 +1,150 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#include <float.h>
+#include "proximity.h"
+
+/*! @brief Parses a comma-separated list of increasing positive shell edges.
+ *
+ * @return Number of parsed edges. Zero, if the list is invalid.
+ */
+static size_t parse_edges(const char *shells, float **edges)
+{
+    size_t n_edges = 0;
+    size_t allocated = 4;
+    *edges = malloc(allocated * sizeof(float));
+
+    const char *current = shells;
+    while (*current != '\0') {
+        char *end = NULL;
+        float edge = strtof(current, &end);
+
+        if (end == current || edge <= 0 || (n_edges > 0 && edge <= (*edges)[n_edges - 1]) || (*end != ',' && *end != '\0')) {
+            fprintf(stderr, "Could not read distance shells '%s' (expected increasing positive numbers separated by commas).\n", shells);
+            free(*edges);
+            *edges = NULL;
+            return 0;
+        }
+
+        if (n_edges >= allocated) {
+            allocated *= 2;
+            *edges = realloc(*edges, allocated * sizeof(float));
+        }
+        (*edges)[n_edges++] = edge;
+
+        current = (*end == ',') ? end + 1 : end;
+    }
+
+    if (n_edges == 0) {
+        fprintf(stderr, "No distance shells provided.\n");
+        free(*edges);
+        *edges = NULL;
+    }
+
+    return n_edges;
+}
+
+proximity_t *proximity_create(const lipid_composition_t *composition, atom_selection_t *protein, const char *shells)
+{
+    float *edges = NULL;
+    size_t n_edges = parse_edges(shells, &edges);
+    if (n_edges == 0) return NULL;
+
+    proximity_t *proximity = calloc(1, sizeof(proximity_t));
+    proximity->protein = protein;
+    proximity->n_shells = n_edges + 1;
+    proximity->edges = edges;
+
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        atom_selection_t *selection = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
+        proximity->n_heads += selection->n_atoms;
+    }
+
+    proximity->heads = malloc(proximity->n_heads * sizeof(atom_t *));
+    proximity->positions = malloc(protein->n_atoms * sizeof(vec_t));
+    proximity->cells = cell_list_create();
+    proximity->distance = malloc(proximity->n_heads * sizeof(float));
+    proximity->shell = calloc(proximity->n_heads, sizeof(short));
+
+    // flatten heads of all lipid types into a single array
+    size_t index = 0;
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        atom_selection_t *selection = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
+        for (size_t j = 0; j < selection->n_atoms; ++j) {
+            proximity->heads[index++] = selection->atoms[j];
+        }
+    }
+
+    return proximity;
+}
+
+int proximity_update(proximity_t *proximity, const box_t box)
+{
+    const float cutoff = proximity->edges[proximity->n_shells - 2];
+    const size_t bulk = proximity->n_shells - 1;
+
+    for (size_t i = 0; i < proximity->protein->n_atoms; ++i) {
+        memcpy(proximity->positions[i], proximity->protein->atoms[i]->position, sizeof(vec_t));
+    }
+
+    if (cell_list_build(proximity->cells, (const vec_t *) proximity->positions, proximity->protein->n_atoms, box, cutoff, 1) != 0) {
+        for (size_t i = 0; i < proximity->n_heads; ++i) {
+            proximity->distance[i] = FLT_MAX;
+            proximity->shell[i] = (short) bulk;
+        }
+        return 1;
+    }
+
+    const cell_list_t *cells = proximity->cells;
+    const float cutoff2 = cutoff * cutoff;
+    size_t neighbors[27] = {0};
+
+    for (size_t i = 0; i < proximity->n_heads; ++i) {
+        const float *head = proximity->heads[i]->position;
+
+        // only protein atoms closer than the last edge are relevant; all of them are in the neighboring cells
+        float min_distance2 = FLT_MAX;
+        size_t n_neighbors = cell_list_neighbors(cells, cell_list_locate(cells, head, box), neighbors);
+        for (size_t n = 0; n < n_neighbors; ++n) {
+            for (size_t k = cells->cell_start[neighbors[n]]; k < cells->cell_start[neighbors[n] + 1]; ++k) {
+                float distance2 = distance_squared_pbc(head, proximity->positions[cells->sorted[k]], box, 1);
+                if (distance2 < min_distance2) min_distance2 = distance2;
+            }
+        }
+
+        if (min_distance2 >= cutoff2) {
+            proximity->distance[i] = FLT_MAX;
+            proximity->shell[i] = (short) bulk;
+            continue;
+        }
+
+        proximity->distance[i] = sqrtf(min_distance2);
+
+        size_t shell = 0;
+        while (shell < bulk && proximity->distance[i] >= proximity->edges[shell]) ++shell;
+        proximity->shell[i] = (short) shell;
+    }
+
+    return 0;
+}
+
+void proximity_shell_label(const proximity_t *proximity, const size_t shell, char *label, const size_t length)
+{
+    if (shell == 0) snprintf(label, length, "< %.2f nm", proximity->edges[0]);
+    else if (shell == proximity->n_shells - 1) snprintf(label, length, "> %.2f nm", proximity->edges[shell - 1]);
+    else snprintf(label, length, "%.2f-%.2f nm", proximity->edges[shell - 1], proximity->edges[shell]);
+}
+
+void proximity_destroy(proximity_t *proximity)
+{
+    if (proximity == NULL) return;
+
+    free(proximity->protein);
+    free(proximity->edges);
+    free(proximity->heads);
+    free(proximity->positions);
+    cell_list_destroy(proximity->cells);
+    free(proximity->distance);
+    free(proximity->shell);
+    free(proximity);
+}
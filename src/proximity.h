@@ -0,0 +1,60 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef PROXIMITY_H
+#define PROXIMITY_H
+
+#include <groan.h>
+#include "general.h"
+#include "celllist.h"
+
+/*! @brief Assignment of lipids into shells based on their distance from a protein. See proximity_update() for more details. */
+typedef struct proximity {
+    atom_selection_t *protein;  // selection from which the distances are calculated
+    size_t n_shells;            // number of shells (the last shell contains all lipids further than the last edge)
+    float *edges;               // outer edges of the shells (n_shells - 1 items, increasing) [nm]
+    size_t n_heads;             // number of lipid heads
+    atom_t **heads;             // lipid heads ordered by lipid types
+    vec_t *positions;           // positions of the protein atoms in the current frame
+    cell_list_t *cells;         // cell list of the protein atoms
+    float *distance;            // minimal xy distance of each lipid head from the protein (FLT_MAX if further than the last edge) [nm]
+    short *shell;               // shell of each lipid head in the current frame
+} proximity_t;
+
+
+/*! @brief Prepares the assignment of lipids into distance shells. Must be deallocated using proximity_destroy().
+ *
+ * @paragraph Shells
+ * Shells are defined by a comma-separated list of their outer edges in nm, e.g. "1.5,3.0" defines three shells:
+ * lipids closer than 1.5 nm to the protein, lipids between 1.5 and 3.0 nm and lipids further than 3.0 nm (bulk).
+ *
+ * @param composition   lipid composition of the membrane
+ * @param protein       selection of the protein atoms; the selection is owned by the returned structure (unless NULL is returned)
+ * @param shells        comma-separated list of the outer edges of the shells [nm]
+ *
+ * @return Pointer to proximity_t structure, if successful. NULL if the shells could not be parsed.
+ */
+proximity_t *proximity_create(const lipid_composition_t *composition, atom_selection_t *protein, const char *shells);
+
+
+/*! @brief Calculates the minimal xy distance of each lipid head from the protein and assigns the heads into shells.
+ *
+ * @paragraph Neighbor search
+ * Protein atoms are sorted into a planar cell list (see cell_list_build()) with cells at least as large as the last edge.
+ * Only protein atoms in the cell of a lipid head and in the neighboring cells are then searched, so the cost
+ * is linear in the number of lipid heads and protein atoms. Distances are calculated in the xy-plane
+ * using the minimum image convention.
+ *
+ * @return Zero, if successful. Else non-zero (all lipids are then assigned to the last shell).
+ */
+int proximity_update(proximity_t *proximity, const box_t box);
+
+
+/*! @brief Writes a human-readable description of the shell (e.g. "1.50-3.00 nm") into 'label'. */
+void proximity_shell_label(const proximity_t *proximity, const size_t shell, char *label, const size_t length);
+
+
+/*! @brief Deallocates memory for the proximity_t structure (including the protein selection). */
+void proximity_destroy(proximity_t *proximity);
+
+#endif /* PROXIMITY_H */
@@ -2,18 +2,21 @@
 // Copyright (c) 2022 Ladislav Bartos
 
 #include "general.h"
-#include "composition.h"
-
-// frequency of printing during the calculation
-static const int PROGRESS_FREQ = 10000;
-
-/*! @brief Assign lipids into individual leaflets and save this information into a dictionary. */
+#include "rate.h"
+#include "leaflets.h"
+#include "trajectory.h"
+#include "profile.h"
+#include "topology.h"
+#include "membranes.h"
+#include "checkpoint.h"
+
+/*! @brief Saves the current leaflet assignment of lipids into a dictionary. */
 static dict_t *create_reference(
         const lipid_composition_t *composition,
-        const vec_t membrane_center,
-        const box_t box)
+        const leaflet_classifier_t *leaflets)
 {
     dict_t *classified_lipids = dict_create();    
+    size_t head_index = 0;
     // loop through all available lipid names
     for (size_t i = 0; i < composition->n_lipid_types; ++i) {
         atom_selection_t *selection = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
@@ -23,11 +26,8 @@ static dict_t *create_reference(
         short *selection_ul = calloc(selection->n_atoms, sizeof(short));
 
         // loop through the heads of the selection
-        for (size_t j = 0; j < selection->n_atoms; ++j) {
-            if (distance1D(selection->atoms[j]->position, membrane_center, z, box) > 0) {
-                selection_ul[j] = 1;
-            // else 0, but that is already in the array via calloc
-            }
+        for (size_t j = 0; j < selection->n_atoms; ++j, ++head_index) {
+            selection_ul[j] = leaflets->leaflet[head_index];
         }
 
         // assign selection_ul to the dictionary
@@ -37,14 +37,19 @@ static dict_t *create_reference(
     return classified_lipids;
 }
 
-/*! @brief Decide how many lipids have been scrambled by comparing their current positions with the reference. Print this information. */
+/*! @brief Decide how many lipids have been scrambled by comparing their current positions with the reference.
+ *
+ * @paragraph Output
+ * Percentage of scrambled lipids of each lipid type is saved into 'scrambled'. Percentage of all scrambled lipids
+ * is saved at the index n_lipid_types.
+ */
 static void classify_lipids(
-        FILE *file,
         const lipid_composition_t *composition,
         const dict_t *reference,
-        const vec_t membrane_center,
-        const box_t box)
+        const leaflet_classifier_t *leaflets,
+        float *scrambled_percentage)
 {
+    size_t head_index = 0;
     // loop through lipid types
     size_t total_scrambled = 0;
     size_t total_lipids = 0;
@@ -54,8 +59,8 @@ static void classify_lipids(
 
         size_t scrambled = 0;
         // loop through all lipids, calculate their position and compare it with their reference position
-        for (size_t j = 0; j < selection->n_atoms; ++j) {
-            register float dist = distance1D(selection->atoms[j]->position, membrane_center, z, box);
+        for (size_t j = 0; j < selection->n_atoms; ++j, ++head_index) {
+            register float dist = leaflets->distance[head_index];
 
             // lipid was in the lower leaflet, now is in the upper leaflet
             if (reference_pos[j] == 0 && dist > 0) ++scrambled;
@@ -63,19 +68,461 @@ static void classify_lipids(
             if (reference_pos[j] == 1 && dist < 0) ++scrambled;
         }
 
-        fprintf(file, "%f     ", 100.0 * (float) scrambled / selection->n_atoms);
+        scrambled_percentage[i] = 100.0 * (float) scrambled / selection->n_atoms;
 
         total_scrambled += scrambled;
         total_lipids += selection->n_atoms;
     }
 
-    if (composition->n_lipid_types > 1) {
-        fprintf(file, "%f     ", 100.0 * (float) total_scrambled / total_lipids);
+    scrambled_percentage[composition->n_lipid_types] = 100.0 * (float) total_scrambled / total_lipids;
+}
+
+
+/*! @brief Calculates the percentage of scrambled lipids (of all types) in each distance shell.
+ *
+ * @paragraph Shells
+ * Lipids are assigned into shells based on 'proximity->shell' which must be updated for the current frame.
+ * If there are no lipids in a shell, zero is saved for it.
+ */
+static void classify_shells(
+        const lipid_composition_t *composition,
+        const dict_t *reference,
+        const leaflet_classifier_t *leaflets,
+        const proximity_t *proximity,
+        float *shell_percentage)
+{
+    size_t *scrambled = calloc(proximity->n_shells, sizeof(size_t));
+    size_t *lipids = calloc(proximity->n_shells, sizeof(size_t));
+
+    size_t head_index = 0;
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        atom_selection_t *selection = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
+        short *reference_pos = *((short **) dict_get(reference, composition->lipid_types[i]));
+
+        for (size_t j = 0; j < selection->n_atoms; ++j, ++head_index) {
+            short upper = leaflets->leaflet[head_index];
+            short shell = proximity->shell[head_index];
+            ++lipids[shell];
+            if (reference_pos[j] != upper) ++scrambled[shell];
+        }
+    }
+
+    for (size_t s = 0; s < proximity->n_shells; ++s) {
+        shell_percentage[s] = lipids[s] > 0 ? 100.0 * (float) scrambled[s] / lipids[s] : 0.0;
+    }
+
+    free(scrambled);
+    free(lipids);
+}
+
+
+/*! @brief Deallocates memory for the reference dictionary created in create_reference(). */
+static void destroy_reference(dict_t *reference, const lipid_composition_t *composition)
+{
+    if (reference == NULL) return;
+
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        short *reference_pos = *((short **) dict_get(reference, composition->lipid_types[i]));
+        free(reference_pos);
+    }
+
+    dict_destroy(reference);
+}
+
+rate_analysis_t *rate_analysis_create(const lipid_composition_t *composition)
+{
+    rate_analysis_t *analysis = calloc(1, sizeof(rate_analysis_t));
+    analysis->composition = composition;
+    analysis->scrambled = calloc(composition->n_lipid_types + 1, sizeof(float));
+    analysis->statistics = calloc(composition->n_lipid_types + 1, sizeof(blocking_t));
+    analysis->fits = calloc(composition->n_lipid_types + 1, sizeof(sample_fit_t));
+
+    return analysis;
+}
+
+void rate_proximity_attach(rate_analysis_t *analysis, proximity_t *proximity)
+{
+    analysis->proximity = proximity;
+    analysis->shell_scrambled = calloc(proximity->n_shells, sizeof(float));
+}
+
+void rate_analysis_frame(
+        rate_analysis_t *analysis,
+        const leaflet_classifier_t *leaflets,
+        const box_t box,
+        const float time)
+{
+    analysis->time = time;
+
+    // if this is the first analyzed frame, create reference classification of lipids
+    if (analysis->frame == 0) {
+        analysis->reference = create_reference(analysis->composition, leaflets);
+        analysis->reference_time = time;
+        memset(analysis->scrambled, 0, (analysis->composition->n_lipid_types + 1) * sizeof(float));
+        if (analysis->proximity != NULL) memset(analysis->shell_scrambled, 0, analysis->proximity->n_shells * sizeof(float));
+    } else {
+        classify_lipids(analysis->composition, analysis->reference, leaflets, analysis->scrambled);
+        for (size_t i = 0; i < analysis->composition->n_lipid_types + 1; ++i) {
+            blocking_add(&analysis->statistics[i], analysis->scrambled[i]);
+            // time in us
+            sample_fit_add(&analysis->fits[i], (time - analysis->reference_time) / 1000000.0, analysis->scrambled[i]);
+        }
+
+        // if the shells could not be calculated, all lipids are in the bulk shell (reported by proximity_update())
+        if (analysis->proximity != NULL) {
+            proximity_update(analysis->proximity, box);
+            classify_shells(analysis->composition, analysis->reference, leaflets, analysis->proximity, analysis->shell_scrambled);
+        }
+    }
+
+    ++analysis->frame;
+}
+
+void rate_write_header(FILE *output, const rate_analysis_t *analysis, const char *input_xtc_file)
+{
+    const lipid_composition_t *composition = analysis->composition;
+
+    fprintf(output, "# Generated with Scramblyzer Rate from file %s\n", input_xtc_file);
+    fprintf(output, "@    title \"Percentage of scrambled lipids in time\"\n");
+    fprintf(output, "@    xaxis label \"time [ns]\"\n");
+    fprintf(output, "@    yaxis label \"scrambled lipids [%%]\"\n");
+    for (size_t i = 0; i < composition->n_lipid_types + 1; ++i) {
+        // don't print TOTAL if there is only one lipid species
+        if (composition->n_lipid_types < 2 && i == composition->n_lipid_types) break; 
+
+        char *name = NULL;
+        if (i < composition->n_lipid_types) {
+            name = composition->lipid_types[i];
+        } else {
+            name = "TOTAL";
+        }
+
+        fprintf(output, "@    s%zu legend \"%s\"\n", i, name);
+    }
+
+    // scrambling in distance shells follows the lipid types
+    if (analysis->proximity != NULL) {
+        size_t first = composition->n_lipid_types < 2 ? composition->n_lipid_types : composition->n_lipid_types + 1;
+        for (size_t s = 0; s < analysis->proximity->n_shells; ++s) {
+            char label[64] = {0};
+            proximity_shell_label(analysis->proximity, s, label, sizeof(label));
+            fprintf(output, "@    s%zu legend \"%s\"\n", first + s, label);
+        }
+    }
+
+    fprintf(output, "@TYPE xy\n");
+}
+
+void rate_write_frame(FILE *output, const rate_analysis_t *analysis)
+{
+    size_t n_lipid_types = analysis->composition->n_lipid_types;
+
+    fprintf(output, "%f     ", analysis->time / 1000.0);
+
+    // reference frame
+    if (analysis->frame == 1) {
+        for (size_t i = 0; i < n_lipid_types; ++i) {
+            fprintf(output, "0.0        ");
+        }
+        // total number of scrambled lipids
+        if (n_lipid_types > 1) fprintf(output, "0.0");
+        for (size_t s = 0; analysis->proximity != NULL && s < analysis->proximity->n_shells; ++s) {
+            fprintf(output, "        0.0");
+        }
+        fprintf(output, "\n");
+        return;
+    }
+
+    for (size_t i = 0; i < n_lipid_types; ++i) {
+        fprintf(output, "%f     ", analysis->scrambled[i]);
+    }
+
+    if (n_lipid_types > 1) {
+        fprintf(output, "%f     ", analysis->scrambled[n_lipid_types]);
+    }
+
+    for (size_t s = 0; analysis->proximity != NULL && s < analysis->proximity->n_shells; ++s) {
+        fprintf(output, "%f     ", analysis->shell_scrambled[s]);
+    }
+
+    fprintf(output, "\n");
+}
+
+void rate_write_statistics(FILE *output, const rate_analysis_t *analysis)
+{
+    size_t n_lipid_types = analysis->composition->n_lipid_types;
+    int converged = 1;
+
+    fprintf(output, "Lipid | Mean [%%]  | Std. error [%%] | Inefficiency | Frames \n");
+    for (size_t i = 0; i < n_lipid_types + 1; ++i) {
+        // don't print TOTAL if there is only one lipid species
+        if (n_lipid_types < 2 && i == n_lipid_types) break;
+        if (i == n_lipid_types) fprintf(output, "------------------------------------------------------\n");
+
+        blocking_estimate_t estimate = blocking_estimate(&analysis->statistics[i]);
+        converged &= estimate.converged;
+        fprintf(output, "%-5s | %-9.3f | %-13.3f%s | %-12.1f | %-6llu\n", i < n_lipid_types ? analysis->composition->lipid_types[i] : "TOTAL",
+                estimate.mean, estimate.std_error, estimate.converged ? " " : "*", estimate.inefficiency, (unsigned long long) estimate.n_samples);
+    }
+
+    if (!converged) fprintf(output, "* the trajectory is too short for a reliable error estimate; the standard error is a lower bound\n");
+}
+
+void rate_write_sampled(FILE *output, const rate_analysis_t *analysis)
+{
+    size_t n_lipid_types = analysis->composition->n_lipid_types;
+
+    fprintf(output, "Lipid | Rate [%%/us] (95%% CI)        | Last [%%]  | Frames \n");
+    for (size_t i = 0; i < n_lipid_types + 1; ++i) {
+        // don't print TOTAL if there is only one lipid species
+        if (n_lipid_types < 2 && i == n_lipid_types) break;
+        if (i == n_lipid_types) fprintf(output, "------------------------------------------------------\n");
+
+        double slope = 0.0, half_width = 0.0;
+        int failed = sample_fit_estimate(&analysis->fits[i], &slope, &half_width);
+        const char *name = i < n_lipid_types ? analysis->composition->lipid_types[i] : "TOTAL";
+        if (failed) {
+            fprintf(output, "%-5s | %-28s | %-9s | %-6llu\n", name, "not available", "-", (unsigned long long) analysis->fits[i].n_points);
+            continue;
+        }
+
+        fprintf(output, "%-5s | %12.4f +- %-12.4f | %-9.3f | %-6llu\n", name,
+                slope, half_width, analysis->scrambled[i], (unsigned long long) analysis->fits[i].n_points);
+    }
+}
+
+void rate_analysis_destroy(rate_analysis_t *analysis)
+{
+    if (analysis == NULL) return;
+
+    destroy_reference(analysis->reference, analysis->composition);
+    free(analysis->scrambled);
+    free(analysis->statistics);
+    free(analysis->fits);
+    proximity_destroy(analysis->proximity);
+    free(analysis->shell_scrambled);
+    free(analysis);
+}
+
+rate_lag_t *rate_lag_create(const lipid_composition_t *composition, const size_t max_lag)
+{
+    rate_lag_t *lag = calloc(1, sizeof(rate_lag_t));
+    lag->composition = composition;
+    lag->max_lag = max_lag;
+
+    // each lipid type starts at a new word so that lipid types can be counted separately
+    lag->type_offset = calloc(composition->n_lipid_types + 1, sizeof(size_t));
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        atom_selection_t *selection = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
+        lag->type_offset[i + 1] = lag->type_offset[i] + (selection->n_atoms + 63) / 64;
+    }
+    lag->n_words = lag->type_offset[composition->n_lipid_types];
+
+    lag->history = calloc((max_lag + 1) * lag->n_words, sizeof(uint64_t));
+    lag->scrambled = calloc((max_lag + 1) * composition->n_lipid_types, sizeof(uint64_t));
+    lag->origins = calloc(max_lag + 1, sizeof(uint64_t));
+
+    return lag;
+}
+
+void rate_lag_frame(rate_lag_t *lag, const leaflet_classifier_t *leaflets)
+{
+    const lipid_composition_t *composition = lag->composition;
+    const size_t n_slots = lag->max_lag + 1;
+
+    // pack the current leaflet assignment (1 = upper leaflet) into the oldest slot of the ring buffer
+    uint64_t *current = lag->history + (lag->frame % n_slots) * lag->n_words;
+    memset(current, 0, lag->n_words * sizeof(uint64_t));
+
+    size_t head_index = 0;
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        atom_selection_t *selection = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
+        uint64_t *words = current + lag->type_offset[i];
+
+        for (size_t j = 0; j < selection->n_atoms; ++j, ++head_index) {
+            if (leaflets->leaflet[head_index]) words[j / 64] |= (uint64_t) 1 << (j % 64);
+        }
+    }
+
+    // the current frame is the lag 0 of itself
+    ++lag->origins[0];
+
+    // compare the current frame with all stored previous frames
+    size_t available = lag->frame < lag->max_lag ? lag->frame : lag->max_lag;
+    for (size_t tau = 1; tau <= available; ++tau) {
+        const uint64_t *past = lag->history + ((lag->frame - tau) % n_slots) * lag->n_words;
+        uint64_t *scrambled = lag->scrambled + tau * composition->n_lipid_types;
+
+        for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+            uint64_t count = 0;
+            for (size_t w = lag->type_offset[i]; w < lag->type_offset[i + 1]; ++w) {
+                count += __builtin_popcountll(current[w] ^ past[w]);
+            }
+            scrambled[i] += count;
+        }
+
+        ++lag->origins[tau];
     }
 
-    fprintf(file, "\n");
+    ++lag->frame;
 }
 
+void rate_lag_write(FILE *output, const rate_lag_t *lag, const float dt, const char *input_xtc_file)
+{
+    const lipid_composition_t *composition = lag->composition;
+    size_t n_lipid_types = composition->n_lipid_types;
+
+    fprintf(output, "# Generated with Scramblyzer Rate from file %s\n", input_xtc_file);
+    fprintf(output, "# Averaged over all time origins; the number of origins for a lag of N frames is (analyzed frames - N).\n");
+    fprintf(output, "@    title \"Lag-time averaged percentage of scrambled lipids\"\n");
+    fprintf(output, "@    xaxis label \"lag time [ns]\"\n");
+    fprintf(output, "@    yaxis label \"scrambled lipids [%%]\"\n");
+    for (size_t i = 0; i < n_lipid_types; ++i) {
+        fprintf(output, "@    s%zu legend \"%s\"\n", i, composition->lipid_types[i]);
+    }
+    // don't print TOTAL if there is only one lipid species
+    if (n_lipid_types > 1) fprintf(output, "@    s%zu legend \"TOTAL\"\n", n_lipid_types);
+    fprintf(output, "@TYPE xy\n");
+
+    for (size_t tau = 0; tau <= lag->max_lag && lag->origins[tau] > 0; ++tau) {
+        const uint64_t *scrambled = lag->scrambled + tau * n_lipid_types;
+
+        fprintf(output, "%f     ", tau * dt);
+
+        uint64_t total_scrambled = 0;
+        size_t total_lipids = 0;
+        for (size_t i = 0; i < n_lipid_types; ++i) {
+            atom_selection_t *selection = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
+            fprintf(output, "%f     ", 100.0 * (double) scrambled[i] / ((double) lag->origins[tau] * selection->n_atoms));
+
+            total_scrambled += scrambled[i];
+            total_lipids += selection->n_atoms;
+        }
+
+        if (n_lipid_types > 1) {
+            fprintf(output, "%f     ", 100.0 * (double) total_scrambled / ((double) lag->origins[tau] * total_lipids));
+        }
+
+        fprintf(output, "\n");
+    }
+}
+
+void rate_lag_destroy(rate_lag_t *lag)
+{
+    if (lag == NULL) return;
+
+    free(lag->type_offset);
+    free(lag->history);
+    free(lag->scrambled);
+    free(lag->origins);
+    free(lag);
+}
+
+/*! @brief Saves the state of the analysis (reference leaflet assignment, number of analyzed frames, time of the last frame
+ * and time interval between analyzed frames in ps) into a checkpoint. */
+static int save_checkpoint_rate(
+        const char *checkpoint_file,
+        const rate_analysis_t *analysis,
+        const leaflet_clustering_t *clustering,
+        const float last_time,
+        const int step)
+{
+    const lipid_composition_t *composition = analysis->composition;
+
+    FILE *file = checkpoint_open_write(checkpoint_file, "rate", composition);
+    if (file == NULL) return 1;
+
+    int failed = checkpoint_write(file, &analysis->frame, sizeof(int), 1);
+    failed |= checkpoint_write(file, &last_time, sizeof(float), 1);
+
+    // reference assignment exists only if at least one frame has been analyzed
+    for (size_t i = 0; analysis->frame > 0 && i < composition->n_lipid_types; ++i) {
+        atom_selection_t *selection = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
+        short *reference_pos = *((short **) dict_get(analysis->reference, composition->lipid_types[i]));
+        failed |= checkpoint_write(file, reference_pos, sizeof(short), selection->n_atoms);
+    }
+
+    // leaflet assignment from clustering
+    int clustered = (clustering != NULL);
+    failed |= checkpoint_write(file, &clustered, sizeof(int), 1);
+    if (clustered) {
+        failed |= checkpoint_write(file, &clustering->initialized, sizeof(int), 1);
+        failed |= checkpoint_write(file, clustering->leaflet, sizeof(short), clustering->n_heads);
+    }
+
+    // streaming statistics of the percentage of scrambled lipids
+    failed |= checkpoint_write(file, analysis->statistics, sizeof(blocking_t), composition->n_lipid_types + 1);
+
+    // time interval between analyzed frames
+    failed |= checkpoint_write(file, &step, sizeof(int), 1);
+
+    return checkpoint_close_write(file, checkpoint_file, failed);
+}
+
+/*! @brief Loads the state of the analysis from a checkpoint written by save_checkpoint_rate().
+ * Fails if the checkpoint was written with a different time interval between analyzed frames (step, in ps). */
+static int load_checkpoint_rate(
+        const char *checkpoint_file,
+        rate_analysis_t *analysis,
+        leaflet_clustering_t *clustering,
+        float *last_time,
+        const int step)
+{
+    const lipid_composition_t *composition = analysis->composition;
+
+    FILE *file = checkpoint_open_read(checkpoint_file, "rate", composition);
+    if (file == NULL) return 1;
+
+    int failed = checkpoint_read(file, &analysis->frame, sizeof(int), 1);
+    failed |= checkpoint_read(file, last_time, sizeof(float), 1);
+
+    if (!failed && analysis->frame > 0) {
+        analysis->reference = dict_create();
+        for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+            atom_selection_t *selection = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
+            short *reference_pos = calloc(selection->n_atoms, sizeof(short));
+            failed |= checkpoint_read(file, reference_pos, sizeof(short), selection->n_atoms);
+            dict_set(analysis->reference, composition->lipid_types[i], &reference_pos, sizeof(short *));
+        }
+    }
+
+    int clustered = 0;
+    failed |= checkpoint_read(file, &clustered, sizeof(int), 1);
+    if (!failed && clustered != (clustering != NULL)) {
+        fprintf(stderr, "Leaflet identification method does not match the method used in checkpoint %s.\n", checkpoint_file);
+        failed = 1;
+    }
+
+    if (!failed && clustered) {
+        failed |= checkpoint_read(file, &clustering->initialized, sizeof(int), 1);
+        failed |= checkpoint_read(file, clustering->leaflet, sizeof(short), clustering->n_heads);
+    }
+
+    // streaming statistics of the percentage of scrambled lipids
+    failed |= checkpoint_read(file, analysis->statistics, sizeof(blocking_t), composition->n_lipid_types + 1);
+
+    // resuming with a different time interval would mix two sampling intervals in one output
+    int saved_step = 0;
+    failed |= checkpoint_read(file, &saved_step, sizeof(int), 1);
+
+    // the checkpoint must end exactly after the time interval
+    failed |= (fgetc(file) != EOF);
+
+    if (!failed && saved_step != step) {
+        fprintf(stderr, "Time interval between analyzed frames (%.3f ns) does not match the interval used in checkpoint %s (%.3f ns).\n",
+                step / 1000.0, checkpoint_file, saved_step / 1000.0);
+        failed = 1;
+    }
+
+    fclose(file);
+
+    if (failed) {
+        fprintf(stderr, "Could not read checkpoint file %s.\n", checkpoint_file);
+        return 1;
+    }
+
+    return 0;
+}
 
 /*! @brief Prints supported flags and arguments of this module */
 void print_usage_rate(void)
@@ -83,11 +530,18 @@ void print_usage_rate(void)
     printf("\nValid OPTIONS for the rate module:\n");
     printf("-h               print this message and exit\n");
     printf("-c STRING        gro file to read\n");
-    printf("-f STRING        xtc file to read\n");
+    printf("-f STRING        xtc file to read ('-' for stdin)\n");
     printf("-n STRING        ndx file to read (optional, default: index.ndx)\n");
     printf("-o STRING        output file name (default: rate.xvg)\n");
     printf("-p STRING        selection of lipid head identifiers (default: name PO4)\n");
     printf("-t FLOAT         time interval between analyzed trajectory frames in ns (default: 10.0)\n");
+    printf("-l FLOAT         identify leaflets by clustering lipid heads closer than FLOAT nm (optional)\n");
+    printf("-k STRING        checkpoint file to resume the analysis from and to save its state into (optional)\n");
+    printf("-L INTEGER       average scrambling over all time origins for lags of up to INTEGER analyzed frames (optional)\n");
+    printf("-P STRING        resolve scrambling by the xy distance of lipids from this selection, e.g. a protein (optional)\n");
+    printf("-d STRING        comma-separated outer edges of the distance shells [in nm] (default: 1.5)\n");
+    printf("--follow         wait for new frames of a trajectory that is still being written (stop with Ctrl+C)\n");
+    printf("--sample INTEGER analyze only the first frame and INTEGER frames sampled randomly from the whole trajectory (optional)\n");
     printf("\n");
 }
 
@@ -99,12 +553,17 @@ int get_arguments_rate(
         char **ndx_file,
         char **output_file,
         char **phosphates,
-        float *dt) 
+        float *dt,
+        float *leaflet_cutoff,
+        char **checkpoint_file,
+        size_t *max_lag,
+        char **protein,
+        char **shells) 
 {
     int gro_specified = 0, xtc_specified = 0;
 
     int opt = 0;
-    while((opt = getopt(argc - 1, argv + 1, "c:f:n:o:p:t:h")) != -1) {
+    while((opt = getopt(argc - 1, argv + 1, "c:f:n:o:p:t:l:k:L:P:d:h")) != -1) {
         switch (opt) {
         // help
         case 'h':
@@ -139,6 +598,37 @@ int get_arguments_rate(
                 return 1;
             }
             break;
+        // leaflet clustering cutoff (not supported if leaflet_cutoff is NULL)
+        case 'l':
+            if (leaflet_cutoff == NULL) return 1;
+            if (sscanf(optarg, "%f", leaflet_cutoff) != 1 || *leaflet_cutoff <= 0) {
+                fprintf(stderr, "Leaflet clustering cutoff must be a positive number.\n");
+                return 1;
+            }
+            break;
+        // checkpoint file (not supported if checkpoint_file is NULL)
+        case 'k':
+            if (checkpoint_file == NULL) return 1;
+            *checkpoint_file = optarg;
+            break;
+        // maximal lag for lag-time averaging (not supported if max_lag is NULL)
+        case 'L':
+            if (max_lag == NULL) return 1;
+            if (sscanf(optarg, "%zu", max_lag) != 1 || *max_lag < 1 || optarg[0] == '-') {
+                fprintf(stderr, "Maximal lag must be a positive integer.\n");
+                return 1;
+            }
+            break;
+        // selection for the distance shells (not supported if protein is NULL)
+        case 'P':
+            if (protein == NULL) return 1;
+            *protein = optarg;
+            break;
+        // edges of the distance shells (not supported if shells is NULL)
+        case 'd':
+            if (shells == NULL) return 1;
+            *shells = optarg;
+            break;
         default:
             //fprintf(stderr, "Unknown command line option: %c.\n", opt);
             return 1;
@@ -149,6 +639,16 @@ int get_arguments_rate(
         fprintf(stderr, "Gro and xtc file must always be supplied.\n");
         return 1;
     }
+
+    if (max_lag != NULL && *max_lag > 0 && checkpoint_file != NULL && *checkpoint_file != NULL) {
+        fprintf(stderr, "Lag-time averaging can not be combined with checkpoints.\n");
+        return 1;
+    }
+
+    if (max_lag != NULL && *max_lag > 0 && protein != NULL && *protein != NULL) {
+        fprintf(stderr, "Lag-time averaging can not be combined with distance shells.\n");
+        return 1;
+    }
     return 0;
 }
 
@@ -159,7 +659,14 @@ void print_arguments_rate(
         const char *ndx_file,
         const char *output_file,
         const char *phosphates,
-        const float timestep)
+        const float timestep,
+        const float leaflet_cutoff,
+        const char *checkpoint_file,
+        const size_t max_lag,
+        const char *protein,
+        const char *shells,
+        const size_t n_samples,
+        const int follow)
 {
     printf("Parameters for Scrambling Rate Analysis:\n");
     printf(">>> gro file:         %s\n", gro_file);
@@ -168,144 +675,309 @@ void print_arguments_rate(
     printf(">>> output file:      %s\n", output_file);
     printf(">>> lipid heads:      %s\n", phosphates);
     printf(">>> time step:        %f ns\n", timestep);
+    if (leaflet_cutoff > 0) printf(">>> leaflet cutoff:   %f nm\n", leaflet_cutoff);
+    if (checkpoint_file != NULL) printf(">>> checkpoint file:  %s\n", checkpoint_file);
+    if (max_lag > 0) printf(">>> maximal lag:      %zu frames (%f ns)\n", max_lag, max_lag * timestep);
+    if (protein != NULL) {
+        printf(">>> protein:          %s\n", protein);
+        printf(">>> distance shells:  %s nm\n", shells);
+    }
+    if (n_samples > 0) printf(">>> sampled frames:   %zu (time step is not used)\n", n_samples);
+    if (follow) printf(">>> following trajectory (stop with Ctrl+C)\n");
     printf("\n");
 }
 
+/*! @brief Deallocates the analyses and leaflet classifiers of all membranes, closes their output files and deallocates the membranes. */
+static void rate_destroy_membranes(rate_analysis_t **analyses, leaflet_classifier_t **classifiers, FILE **outputs, membranes_t *membranes)
+{
+    for (size_t m = 0; m < membranes->n_membranes; ++m) {
+        rate_analysis_destroy(analyses[m]);
+        leaflet_classifier_destroy(classifiers[m]);
+        if (outputs[m] != NULL) fclose(outputs[m]);
+    }
+
+    free(analyses);
+    free(classifiers);
+    free(outputs);
+    membranes_destroy(membranes);
+}
+
 int calc_scrambling_rate(
         const char *input_gro_file,
         const char *input_xtc_file,
         const char *ndx_file,
         const char *output_file,
         const char *head_identifier,
-        const float dt)
+        const float dt,
+        const float leaflet_cutoff,
+        const char *checkpoint_file,
+        const size_t max_lag,
+        const char *protein,
+        const char *shells,
+        const size_t n_samples,
+        const int single_membrane,
+        const int follow,
+        profile_t *profile)
 {
-    print_arguments_rate(input_gro_file, input_xtc_file, ndx_file, output_file, head_identifier, dt);
-
-    // read gro file
-    system_t *system = load_gro(input_gro_file);
-    if (system == NULL) return 1;
+    print_arguments_rate(input_gro_file, input_xtc_file, ndx_file, output_file, head_identifier, dt, leaflet_cutoff, checkpoint_file, max_lag, protein, shells, n_samples, follow);
 
-    // read ndx file
-    dict_t *ndx_groups = read_ndx(ndx_file, system);
-
-    // get lipids present in the system
-    lipid_composition_t *composition = get_lipid_composition(system, head_identifier, ndx_groups);
-    if (composition == NULL) {
-        free(system);
-        dict_destroy(ndx_groups);
+    // sampled frames are located using their offsets in the file
+    if (n_samples > 0 && (checkpoint_file != NULL || max_lag > 0 || follow || !strcmp(input_xtc_file, "-"))) {
+        fprintf(stderr, "Sampling can not be combined with checkpoints, lag-time averaging, follow mode or streamed trajectories.\n");
         return 1;
     }
 
+    // read gro file and get lipids present in the system (possibly from the topology cache)
+    system_t *system = NULL;
+    lipid_composition_t *composition = topology_load(input_gro_file, ndx_file, head_identifier, &system);
+    if (composition == NULL) return 1;
+
+    // read ndx file (only needed for further selections)
+    dict_t *ndx_groups = NULL;
+    if (protein != NULL) ndx_groups = read_ndx(ndx_file, system);
+
+    // select the protein for the distance shells, if requested
+    atom_selection_t *protein_atoms = NULL;
+    if (protein != NULL) {
+        atom_selection_t *all = select_system(system);
+        protein_atoms = smart_select(all, protein, ndx_groups);
+        free(all);
+
+        if (protein_atoms == NULL || protein_atoms->n_atoms == 0) {
+            fprintf(stderr, "No atoms corresponding to protein selection ('%s') found.\n", protein);
+            free(protein_atoms);
+            lipid_composition_destroy(composition);
+            free(system);
+            dict_destroy(ndx_groups);
+            return 1;
+        }
+    }
+
     dict_destroy(ndx_groups);
 
     // if there are no lipids
     if (composition->n_lipid_types < 1) {
         fprintf(stderr, "No usable lipids detected.\n");
+        free(protein_atoms);
         lipid_composition_destroy(composition);
         free(system);
         return 1;
     }
 
-    // open output file
-    FILE *output = fopen(output_file, "w");
-    if (output == NULL) {
-        fprintf(stderr, "Could not open output file %s\n", output_file);
+    // split the lipids into separate membranes, if there are several of them; each membrane is analyzed separately
+    membranes_t *membranes = membranes_detect(composition, system->box, single_membrane);
+    const size_t n_membranes = membranes->n_membranes;
+
+    if (n_membranes > 1 && (checkpoint_file != NULL || max_lag > 0 || protein_atoms != NULL)) {
+        fprintf(stderr, "Checkpoints, lag-time averaging and distance shells are not supported for systems with multiple membranes.\n");
+        fprintf(stderr, "Use --single-membrane to analyze all lipids as a single membrane.\n");
+        free(protein_atoms);
+        membranes_destroy(membranes);
         lipid_composition_destroy(composition);
         free(system);
         return 1;
     }
 
-    // write header for the output file
-    fprintf(output, "# Generated with Scramblyzer Rate from file %s\n", input_xtc_file);
-    fprintf(output, "@    title \"Percentage of scrambled lipids in time\"\n");
-    fprintf(output, "@    xaxis label \"time [ns]\"\n");
-    fprintf(output, "@    yaxis label \"scrambled lipids [%%]\"\n");
-    for (size_t i = 0; i < composition->n_lipid_types + 1; ++i) {
-        // don't print TOTAL if there is only one lipid species
-        if (composition->n_lipid_types < 2 && i == composition->n_lipid_types) break; 
+    rate_analysis_t **analyses = calloc(n_membranes, sizeof(rate_analysis_t *));
+    leaflet_classifier_t **classifiers = calloc(n_membranes, sizeof(leaflet_classifier_t *));
+    FILE **outputs = calloc(n_membranes, sizeof(FILE *));
+
+    // prepare leaflet classification (clustering, if requested)
+    for (size_t m = 0; m < n_membranes; ++m) {
+        if ((classifiers[m] = leaflet_classifier_create(membranes->compositions[m], leaflet_cutoff)) == NULL) {
+            free(protein_atoms);
+            rate_destroy_membranes(analyses, classifiers, outputs, membranes);
+            lipid_composition_destroy(composition);
+            free(system);
+            return 1;
+        }
+    }
 
-        char *name = NULL;
-        if (i < composition->n_lipid_types) {
-            name = composition->lipid_types[i];
-        } else {
-            name = "TOTAL";
+    // prepare distance shells, if requested; the protein selection is then owned by the shells
+    proximity_t *proximity = NULL;
+    if (protein_atoms != NULL && (proximity = proximity_create(composition, protein_atoms, shells)) == NULL) {
+        free(protein_atoms);
+        rate_destroy_membranes(analyses, classifiers, outputs, membranes);
+        lipid_composition_destroy(composition);
+        free(system);
+        return 1;
+    }
+
+    for (size_t m = 0; m < n_membranes; ++m) analyses[m] = rate_analysis_create(membranes->compositions[m]);
+    if (proximity != NULL) rate_proximity_attach(analyses[0], proximity);
+    // lag-time averaging replaces the analysis relative to the first frame
+    rate_lag_t *lag = max_lag > 0 ? rate_lag_create(composition, max_lag) : NULL;
+
+    // resume the analysis from checkpoint, if it exists (only available for a single membrane)
+    float last_time = -1.0;
+    int resumed = 0;
+    if (checkpoint_file != NULL && checkpoint_exists(checkpoint_file)) {
+        if (load_checkpoint_rate(checkpoint_file, analyses[0], leaflet_classifier_clustering(classifiers[0]), &last_time, (int) roundf(dt * 1000)) != 0) {
+            rate_destroy_membranes(analyses, classifiers, outputs, membranes);
+            rate_lag_destroy(lag);
+            lipid_composition_destroy(composition);
+            free(system);
+            return 1;
         }
 
-        fprintf(output, "@    s%zu legend \"%s\"\n", i, name);
+        resumed = 1;
+        printf("Resuming analysis from checkpoint %s (last frame: %.0f ps).\n\n", checkpoint_file, last_time);
     }
 
-    fprintf(output, "@TYPE xy\n");
+    // open output files; when resuming, new results are appended to the existing output
+    for (size_t m = 0; m < n_membranes; ++m) {
+        char *membrane_file = membranes_file_name(membranes, output_file, m);
+        outputs[m] = fopen(membrane_file, resumed ? "a" : "w");
+        if (outputs[m] == NULL) {
+            fprintf(stderr, "Could not open output file %s\n", membrane_file);
+            free(membrane_file);
+            rate_destroy_membranes(analyses, classifiers, outputs, membranes);
+            rate_lag_destroy(lag);
+            lipid_composition_destroy(composition);
+            free(system);
+            return 1;
+        }
+        free(membrane_file);
+
+        // write header for the output file
+        if (!resumed && lag == NULL) rate_write_header(outputs[m], analyses[m], input_xtc_file);
+    }
 
     // open xtc file for reading
-    XDRFILE *xtc = xdrfile_open(input_xtc_file, "r");
-    if (xtc == NULL) {
+    trajectory_t *traj = trajectory_open(input_xtc_file, system->n_atoms);
+    if (traj == NULL) {
         fprintf(stderr, "File %s could not be read as an xtc file.\n", input_xtc_file);
+        rate_destroy_membranes(analyses, classifiers, outputs, membranes);
+        rate_lag_destroy(lag);
         lipid_composition_destroy(composition);
         free(system);
-        fclose(output);
         return 1;
     }
 
     // check that the gro file and the xtc file match each other
-    if (!validate_xtc(input_xtc_file, (int) system->n_atoms)) {
+    if (!trajectory_validate(traj)) {
         fprintf(stderr, "Number of atoms in %s does not match %s.\n", input_xtc_file, input_gro_file);
+        rate_destroy_membranes(analyses, classifiers, outputs, membranes);
+        rate_lag_destroy(lag);
         lipid_composition_destroy(composition);
         free(system);
-        xdrfile_close(xtc);
-        fclose(output);
+        trajectory_close(traj);
         return 1;
     }
 
-    int frame = 0;
-    dict_t *reference = NULL;
-    while (read_xtc_step(xtc, system) == 0) {
-        // print info about the progress of reading and writing
-        if ((int) system->time % PROGRESS_FREQ == 0) {
-            printf("Step: %d. Time: %.0f ps\r", system->step, system->time);
-            fflush(stdout);
-        }
+    // wait for new frames at the end of the trajectory, if requested
+    if (follow && trajectory_follow(traj, input_xtc_file) != 0) {
+        rate_destroy_membranes(analyses, classifiers, outputs, membranes);
+        rate_lag_destroy(lag);
+        lipid_composition_destroy(composition);
+        free(system);
+        trajectory_close(traj);
+        return 1;
+    }
+
+    // select frames by stratified sampling, if requested
+    frame_sampler_t *sampler = NULL;
+    if (n_samples > 0 && (sampler = frame_sampler_create(traj, n_samples, 1)) == NULL) {
+        rate_destroy_membranes(analyses, classifiers, outputs, membranes);
+        rate_lag_destroy(lag);
+        lipid_composition_destroy(composition);
+        free(system);
+        trajectory_close(traj);
+        return 1;
+    }
 
-        if ((int) system->time % (int) roundf((dt * 1000)) != 0) {
+    while ((sampler != NULL ? frame_sampler_next(sampler, traj) : trajectory_next(traj)) == 0) {
+        // frames that are not analyzed or that have been analyzed before the checkpoint are skipped without decompression
+        if (sampler == NULL && ((int) traj->time % (int) roundf((dt * 1000)) != 0 || traj->time <= last_time)) {
+            if (profile_skip(profile, traj) != 0) break;
             continue;
         }
 
-        // get center of geometry of the membrane
-        vec_t membrane_center = {0.0};
-        center_of_geometry(composition->all_lipid_atoms, membrane_center, system->box);
+        if (profile_read(profile, traj, system) != 0) break;
+        last_time = system->time;
+
+        // get center of geometry of each membrane
+        profile_begin(profile);
+        lipid_composition_update(composition, system->box);
+        membranes_update(membranes, system->box);
+        profile_end(profile, PROFILE_CENTER);
+
+        for (size_t m = 0; m < n_membranes; ++m) {
+            // assign lipids to leaflets
+            profile_begin(profile);
+            int unassigned = leaflet_classifier_classify(classifiers[m], membranes->centers[m], system->box);
+            profile_end(profile, PROFILE_LEAFLETS);
+            if (unassigned && (lag != NULL ? lag->frame : (size_t) analyses[m]->frame) == 0) {
+                fprintf(stderr, "Could not identify membrane leaflets in the first analyzed frame.\n");
+                rate_destroy_membranes(analyses, classifiers, outputs, membranes);
+                rate_lag_destroy(lag);
+                lipid_composition_destroy(composition);
+                free(system);
+                trajectory_close(traj);
+                free(sampler);
+                return 1;
+            }
 
-        // if this is the first frame of the trajectory, create reference classification of lipids
-        fprintf(output, "%f     ", system->time / 1000.0);
-        if (frame == 0) {
-            reference = create_reference(composition, membrane_center, system->box);
-            for (size_t i = 0; i < composition->n_lipid_types; ++i) {
-                fprintf(output, "0.0        ");
+            if (lag != NULL) {
+                profile_begin(profile);
+                rate_lag_frame(lag, classifiers[m]);
+                profile_end(profile, PROFILE_ANALYSIS);
+                continue;
             }
-            // total number of scrambled lipids
-            if (composition->n_lipid_types > 1) fprintf(output, "0.0");
-            fprintf(output, "\n");
-            ++frame;
-            continue;
+
+            // classify lipids in the current frame (the first analyzed frame is used as reference)
+            profile_begin(profile);
+            rate_analysis_frame(analyses[m], classifiers[m], system->box, system->time);
+            profile_end(profile, PROFILE_ANALYSIS);
+
+            profile_begin(profile);
+            rate_write_frame(outputs[m], analyses[m]);
+            // when following a running simulation, results should be available immediately
+            if (follow) fflush(outputs[m]);
+            profile_end(profile, PROFILE_OUTPUT);
         }
+    }
 
-        // classify lipids in the current frame
-        classify_lipids(output, composition, reference, membrane_center, system->box);
-        ++frame;
+    // lag-time averaged results are only available once the whole trajectory has been read
+    if (lag != NULL) {
+        profile_begin(profile);
+        rate_lag_write(outputs[0], lag, dt, input_xtc_file);
+        profile_end(profile, PROFILE_OUTPUT);
     }
 
-    printf("\nOutput file %s written.\n", output_file);
+    // mean percentages of scrambled lipids with error estimates (not available for lag-time averaging)
+    for (size_t m = 0; lag == NULL && sampler == NULL && m < n_membranes; ++m) {
+        if (n_membranes > 1) printf("\nMembrane %zu", m + 1);
+        printf("\nScrambled lipids (reference frame excluded):\n");
+        rate_write_statistics(stdout, analyses[m]);
+    }
 
-    // deallocate memory for the reference dictionary
-    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
-        short *reference_pos = *((short **) dict_get(reference, composition->lipid_types[i]));
-        free(reference_pos);
+    // rates estimated from the sampled frames
+    for (size_t m = 0; sampler != NULL && m < n_membranes; ++m) {
+        if (n_membranes > 1) printf("\nMembrane %zu", m + 1);
+        printf("\nScrambling rate (%zu of %zu requested frames sampled after the reference frame):\n", sampler->n_sampled > 0 ? sampler->n_sampled - 1 : 0, n_samples);
+        rate_write_sampled(stdout, analyses[m]);
     }
 
-    dict_destroy(reference);
+    for (size_t m = 0; m < n_membranes; ++m) {
+        char *membrane_file = membranes_file_name(membranes, output_file, m);
+        printf("%sOutput file %s written.\n", m == 0 ? "\n" : "", membrane_file);
+        free(membrane_file);
+    }
+    profile_report(profile);
+
+    int return_code = 0;
+    if (checkpoint_file != NULL) {
+        return_code = save_checkpoint_rate(checkpoint_file, analyses[0], leaflet_classifier_clustering(classifiers[0]), last_time, (int) roundf(dt * 1000));
+        if (return_code == 0) printf("Checkpoint file %s written.\n", checkpoint_file);
+    }
+
+    rate_destroy_membranes(analyses, classifiers, outputs, membranes);
+    rate_lag_destroy(lag);
     lipid_composition_destroy(composition);
     free(system);
-    fclose(output);
-    xdrfile_close(xtc);
-
+    trajectory_close(traj);
+    free(sampler);
 
-    return 0;
-}
+    return return_code;
+}
\ No newline at end of file
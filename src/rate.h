@@ -5,7 +5,40 @@
 #define RATE_H
 
 #include <groan.h>
+#include <stdint.h>
 #include <unistd.h>
+#include "general.h"
+#include "blocking.h"
+#include "profile.h"
+#include "leaflets.h"
+#include "proximity.h"
+#include "sample.h"
+
+/*! @brief State of the scrambling rate analysis. See rate_analysis_frame() for more details. */
+typedef struct rate_analysis {
+    const lipid_composition_t *composition;
+    dict_t *reference;          // reference leaflet assignment of lipids (NULL until the first frame is analyzed)
+    int frame;                  // number of analyzed frames
+    float time;                 // time of the last analyzed frame [ps]
+    float *scrambled;           // percentage of scrambled lipids of each lipid type (and of all lipids at index n_lipid_types) in the last analyzed frame
+    proximity_t *proximity;     // distance shells around a protein (NULL if not requested)
+    float *shell_scrambled;     // percentage of scrambled lipids in each distance shell in the last analyzed frame
+    blocking_t *statistics;     // streaming statistics of the percentage of scrambled lipids of each lipid type (and of all lipids)
+    float reference_time;       // time of the reference frame [ps]
+    sample_fit_t *fits;         // fits of the percentage of scrambled lipids against the time since the reference frame (same order as statistics)
+} rate_analysis_t;
+
+/*! @brief State of the lag-time averaged scrambling analysis. See rate_lag_frame() for more details. */
+typedef struct rate_lag {
+    const lipid_composition_t *composition;
+    size_t max_lag;             // maximal lag in analyzed frames
+    size_t n_words;             // number of 64-bit words of a packed leaflet state
+    size_t *type_offset;        // index of the first word of each lipid type in the packed state (n_lipid_types + 1 items)
+    uint64_t *history;          // packed leaflet states of the last max_lag + 1 analyzed frames (ring buffer)
+    size_t frame;               // number of analyzed frames
+    uint64_t *scrambled;        // number of scrambled lipids of each lipid type for each lag, summed over all time origins
+    uint64_t *origins;          // number of time origins for each lag
+} rate_lag_t;
 
 /*! @brief Prints information about the supported command line arguments for this module. */
 void print_usage_rate(void);
@@ -23,7 +56,120 @@ int get_arguments_rate(
         char **ndx_file,
         char **output_file,
         char **phosphates,
-        float *dt);
+        float *dt,
+        float *leaflet_cutoff,
+        char **checkpoint_file,
+        size_t *max_lag,
+        char **protein,
+        char **shells);
+
+
+/*! @brief Prepares the scrambling rate analysis. Must be deallocated using rate_analysis_destroy(). */
+rate_analysis_t *rate_analysis_create(const lipid_composition_t *composition);
+
+
+/*! @brief Resolves the scrambling by the distance of lipids from a protein. The proximity is deallocated by rate_analysis_destroy().
+ *
+ * @paragraph Distance shells
+ * In every analyzed frame, lipids are assigned into distance shells (see proximity_update()) and the percentage
+ * of scrambled lipids (of all types) is calculated separately for each shell. Lipids are assigned into shells based
+ * on their current position, so the same lipid may contribute to different shells in different frames.
+ * If there are no lipids in a shell, zero is reported for it.
+ */
+void rate_proximity_attach(rate_analysis_t *analysis, proximity_t *proximity);
+
+
+/*! @brief Analyzes a single trajectory frame.
+ *
+ * @paragraph Reference frame
+ * In the first analyzed frame, the lipids are assigned into leaflets and this assignment is used as reference.
+ * In all further frames, the current assignment of lipids is compared with the reference and the percentage
+ * of scrambled lipids is saved into analysis->scrambled.
+ *
+ * @paragraph Statistics
+ * The percentages of scrambled lipids of all frames except for the reference frame are also added
+ * into analysis->statistics (see blocking_add()), so their mean and its standard error are available at any time
+ * without storing the time series. The percentages are also fitted by a line going through the origin
+ * against the time elapsed since the reference frame (see rate_write_sampled()).
+ *
+ * @param analysis          state of the analysis
+ * @param leaflets          leaflet assignment of lipid heads in the current frame (see leaflet_classifier_classify())
+ * @param box               simulation box
+ * @param time              time of the frame [ps]
+ */
+void rate_analysis_frame(
+        rate_analysis_t *analysis,
+        const leaflet_classifier_t *leaflets,
+        const box_t box,
+        const float time);
+
+
+/*! @brief Writes header of the xvg output file. */
+void rate_write_header(FILE *output, const rate_analysis_t *analysis, const char *input_xtc_file);
+
+
+/*! @brief Writes results for the last analyzed frame into the xvg output file. */
+void rate_write_frame(FILE *output, const rate_analysis_t *analysis);
+
+
+/*! @brief Writes the mean percentage of scrambled lipids of each lipid type with its standard error
+ * and statistical inefficiency (see blocking_estimate()) into output.
+ */
+void rate_write_statistics(FILE *output, const rate_analysis_t *analysis);
+
+
+/*! @brief Writes the scrambling rate of each lipid type estimated from sampled frames with its 95% confidence interval into output.
+ *
+ * @paragraph Rate
+ * The rate is the slope of the percentage of scrambled lipids against the time elapsed since the reference frame [%/us]
+ * (see sample_fit_estimate()). This assumes that the scrambling is still far from equilibrium (i.e. well below 50 %).
+ * The percentage in the last sampled frame is also written.
+ */
+void rate_write_sampled(FILE *output, const rate_analysis_t *analysis);
+
+
+/*! @brief Deallocates memory for the rate_analysis_t structure. */
+void rate_analysis_destroy(rate_analysis_t *analysis);
+
+
+/*! @brief Prepares the lag-time averaged scrambling analysis. Must be deallocated using rate_lag_destroy().
+ *
+ * @param composition       lipid composition of the membrane
+ * @param max_lag           maximal lag in analyzed frames
+ */
+rate_lag_t *rate_lag_create(const lipid_composition_t *composition, const size_t max_lag);
+
+
+/*! @brief Analyzes a single trajectory frame for the lag-time averaged scrambling.
+ *
+ * @paragraph Time origins
+ * Every analyzed frame is used as a time origin. For each lag tau (up to max_lag analyzed frames), the leaflet
+ * assignment of lipids in the current frame is compared with the assignment tau frames ago and the number
+ * of lipids in a different leaflet is added to the sum for this lag.
+ *
+ * @paragraph Packed states
+ * The leaflet assignment of every frame is stored as one bit per lipid (each lipid type starting at a new 64-bit word)
+ * in a ring buffer of the last max_lag + 1 frames. Comparing two frames is then a XOR and a population count per word,
+ * so the memory requirements are O(max_lag * lipids / 8) bytes and the cost per frame is O(max_lag * lipids / 64).
+ *
+ * @param lag               state of the analysis
+ * @param leaflets          leaflet assignment of lipid heads in the current frame (see leaflet_classifier_classify())
+ */
+void rate_lag_frame(rate_lag_t *lag, const leaflet_classifier_t *leaflets);
+
+
+/*! @brief Writes the percentage of scrambled lipids averaged over all time origins for each lag into the xvg output file.
+ *
+ * @param output            output file
+ * @param lag               state of the analysis
+ * @param dt                time interval between analyzed frames in ns
+ * @param input_xtc_file    analyzed xtc file (written into the header)
+ */
+void rate_lag_write(FILE *output, const rate_lag_t *lag, const float dt, const char *input_xtc_file);
+
+
+/*! @brief Deallocates memory for the rate_lag_t structure. */
+void rate_lag_destroy(rate_lag_t *lag);
 
 
 /*! @brief Calculates scrambling rate for different lipid types.
@@ -39,11 +185,51 @@ int get_arguments_rate(
  * into "lipids.txt" file and placing this file in a directory from which scramblyzer is being run.
  * "lipids.txt" must contain only one lipid type per line. Comments must start with '#'.
  * 
+ * @paragraph Leaflet clustering
+ * If leaflet_cutoff is positive, lipids are assigned to leaflets by clustering their heads (see leaflet_clustering_assign())
+ * instead of comparing their position with the membrane center. This allows analyzing vesicles and curved membranes.
+ * 
+ * @paragraph Checkpoints
+ * If checkpoint_file is not NULL, the state of the analysis is saved into this file at the end of the run.
+ * If the checkpoint file already exists, the analysis is resumed from it: trajectory frames up to the time
+ * of the last frame read in the previous run are skipped (without decompression) and the results
+ * are appended to the existing output file. The results are identical to analyzing the full trajectory at once.
+ * 
+ * @paragraph Lag-time averaging
+ * If max_lag is positive, the scrambling is not calculated relative to the first analyzed frame. Instead, the percentage
+ * of scrambled lipids is averaged over all time origins for each lag of up to max_lag analyzed frames (see rate_lag_frame())
+ * and written into the output file at the end of the analysis. Can not be combined with checkpoints.
+ * 
+ * @paragraph Distance shells
+ * If protein is not NULL, lipids are assigned into distance shells around the selected atoms in every analyzed frame
+ * (see rate_proximity_attach()) and the percentage of scrambled lipids in each shell is written into additional
+ * columns of the output file. Can not be combined with lag-time averaging.
+ * 
+ * @paragraph Follow mode
+ * If follow is non-zero, the trajectory is expected to be still written into. At the end of the file,
+ * the function waits for new frames (see trajectory_follow()) and results for each new frame are immediately
+ * written into the output file. The analysis is stopped using Ctrl+C.
+ * 
+ * @paragraph Sampling
+ * If n_samples is positive, dt is ignored and only the first frame (used as reference) and n_samples frames selected
+ * by stratified random sampling (see frame_sampler_next()) are read; the rest of the trajectory is never touched.
+ * The scrambling rate is then reported with its 95% confidence interval (see rate_write_sampled()).
+ * Can not be combined with checkpoints, lag-time averaging, follow mode or streamed trajectories.
+ * 
  * @param input_gro_file        gro file to read
  * @param input_xtc_file        xtc_file_to_read (not used if NULL)
  * @param output_file           output file (not used if input_xtc_file is NULL)
  * @param head_identifier       name of the atom identifying lipid phosphate/head
  * @param dt                    time interval between analyzed trajectory frames in ns
+ * @param leaflet_cutoff        cutoff for leaflet clustering in nm (clustering is not used if not positive)
+ * @param checkpoint_file       checkpoint file to resume from and to write (not used if NULL)
+ * @param max_lag               maximal lag (in analyzed frames) for the lag-time averaged scrambling (not used if zero)
+ * @param protein               selection of the protein for the distance shells (not used if NULL)
+ * @param shells                comma-separated outer edges of the distance shells in nm
+ * @param n_samples             number of frames to sample (all frames every dt are analyzed if zero)
+ * @param single_membrane       analyze all lipids as a single membrane even if several membranes are detected (see membranes_detect())
+ * @param follow                wait for new frames at the end of the trajectory
+ * @param profile               progress reporting and profiling of the analysis (see profile_read())
  * 
  * @return Zero, if the analysis was successful. Else non-zero.
  * 
@@ -54,7 +240,16 @@ int calc_scrambling_rate(
         const char *ndx_file,
         const char *output_file,
         const char *head_identifier,
-        const float dt);
+        const float dt,
+        const float leaflet_cutoff,
+        const char *checkpoint_file,
+        const size_t max_lag,
+        const char *protein,
+        const char *shells,
+        const size_t n_samples,
+        const int single_membrane,
+        const int follow,
+        profile_t *profile);
 
 
-#endif /* COMPOSITION_H */
\ No newline at end of file
+#endif /* RATE_H */
\ No newline at end of file
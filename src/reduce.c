@@ -0,0 +1,466 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#include <pthread.h>
+#include "general.h"
+#include "reduce.h"
+#include "trajectory.h"
+#include "profile.h"
+#include "topology.h"
+
+/*! @brief Maximal number of reduced frames waiting to be compressed */
+#define REDUCE_QUEUE_LENGTH 4
+/*! @brief Precision used if the precision of the input trajectory is not known */
+static const float REDUCE_DEFAULT_PRECISION = 1000.0f;
+
+/*! @brief Reduced frame waiting to be compressed and written. */
+typedef struct reduced_frame {
+    int step;
+    float time;
+    float precision;
+    matrix box;
+    rvec *coordinates;
+} reduced_frame_t;
+
+/*! @brief Queue of reduced frames shared by the reading thread and the writing thread. */
+typedef struct reduce_writer {
+    XDRFILE *xtc;
+    int n_atoms;                // number of atoms in the reduced frames
+    reduced_frame_t frames[REDUCE_QUEUE_LENGTH];
+    size_t first;               // index of the oldest queued frame
+    size_t queued;              // number of queued frames
+    int finished;               // no more frames will be queued
+    int failed;                 // writing of a frame has failed
+    int threaded;               // are the frames written by a separate thread?
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;     // signalled whenever a frame is queued or written
+} reduce_writer_t;
+
+void print_usage_reduce(void)
+{
+    printf("\nValid OPTIONS for the reduce module:\n");
+    printf("-h               print this message and exit\n");
+    printf("-c STRING        gro file to read\n");
+    printf("-f STRING        xtc file to read ('-' for stdin)\n");
+    printf("-n STRING        ndx file to read (optional, default: index.ndx)\n");
+    printf("-o STRING        output xtc file; the gro file is written with the extension .gro (default: reduced.xtc)\n");
+    printf("-p STRING        selection of lipid head identifiers (default: name PO4)\n");
+    printf("-t FLOAT         time interval between written trajectory frames in ns (default: all frames)\n");
+    printf("--heads-only     write only the lipid head atoms (default: all lipid atoms)\n");
+    printf("\n");
+}
+
+int get_arguments_reduce(
+        const int argc,
+        char **argv,
+        char **gro_file,
+        char **xtc_file,
+        char **ndx_file,
+        char **output_file,
+        char **phosphates,
+        float *dt)
+{
+    int gro_specified = 0, xtc_specified = 0;
+
+    int opt = 0;
+    while((opt = getopt(argc - 1, argv + 1, "c:f:n:o:p:t:h")) != -1) {
+        switch (opt) {
+        // help
+        case 'h':
+            return 1;
+        // gro file to read
+        case 'c':
+            *gro_file = optarg;
+            gro_specified = 1;
+            break;
+        // xtc file to read
+        case 'f':
+            *xtc_file = optarg;
+            xtc_specified = 1;
+            break;
+        // ndx file
+        case 'n':
+            *ndx_file = optarg;
+            break;
+        // output file name
+        case 'o':
+            *output_file = optarg;
+            break;
+        // phosphates identifier
+        case 'p':
+            *phosphates = optarg;
+            break;
+        // dt (time interval between written frames)
+        case 't':
+            if (sscanf(optarg, "%f", dt) != 1 || *dt <= 0) {
+                fprintf(stderr, "dt must be positive.\n");
+                return 1;
+            }
+            break;
+        default:
+            return 1;
+        }
+    }
+
+    if (!gro_specified || !xtc_specified) {
+        fprintf(stderr, "Gro file and xtc file must always be supplied.\n");
+        return 1;
+    }
+
+    // frames are selected by their time in ps
+    if (*dt > 0 && roundf(*dt * 1000) < 1) {
+        fprintf(stderr, "dt must be at least 0.001 ns.\n");
+        return 1;
+    }
+    return 0;
+}
+
+/*! @brief Prints arguments that the program will use for the calculation. */
+static void print_arguments_reduce(
+        const char *gro_file,
+        const char *xtc_file,
+        const char *ndx_file,
+        const char *output_file,
+        const char *output_gro_file,
+        const char *phosphates,
+        const float dt,
+        const int heads_only)
+{
+    printf("Parameters for Trajectory Reduction:\n");
+    printf(">>> gro file:         %s\n", gro_file);
+    printf(">>> xtc file:         %s\n", xtc_file);
+    printf(">>> ndx file:         %s\n", ndx_file);
+    printf(">>> output xtc file:  %s\n", output_file);
+    printf(">>> output gro file:  %s\n", output_gro_file);
+    printf(">>> lipid heads:      %s\n", phosphates);
+    if (dt > 0) printf(">>> time step:        %f ns\n", dt);
+    else printf(">>> time step:        all frames\n");
+    printf(">>> written atoms:    %s\n", heads_only ? "lipid heads" : "lipid atoms");
+    printf("\n");
+}
+
+/*! @brief Returns the name of the output file with its extension replaced by '.gro'. Must be deallocated using free(). */
+static char *gro_file_name(const char *file_name)
+{
+    // the extension is the part after the last dot of the last path component
+    const char *extension = strrchr(file_name, '.');
+    const char *slash = strrchr(file_name, '/');
+    if (extension == NULL || (slash != NULL && extension < slash)) extension = file_name + strlen(file_name);
+
+    size_t length = strlen(file_name) + 8;
+    char *name = malloc(length);
+    snprintf(name, length, "%.*s.gro", (int) (extension - file_name), file_name);
+
+    return name;
+}
+
+/*! @brief Compares two atom indices. */
+static int compare_indices(const void *a, const void *b)
+{
+    size_t first = *((const size_t *) a);
+    size_t second = *((const size_t *) b);
+    return (first > second) - (first < second);
+}
+
+/*! @brief Gets sorted indices of the written atoms (all lipid atoms or the original head atoms). Must be deallocated using free(). */
+static size_t *selected_indices(const lipid_composition_t *composition, const system_t *system, const int heads_only, size_t *n_selected)
+{
+    size_t allocated = composition->all_lipid_atoms->n_atoms + 1;
+    if (heads_only && composition->n_centers > 0) allocated = composition->center_start[composition->n_centers] + 1;
+    else if (heads_only) {
+        allocated = 1;
+        for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+            atom_selection_t *selection = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
+            allocated += selection->n_atoms;
+        }
+    }
+
+    size_t *indices = malloc(allocated * sizeof(size_t));
+    size_t n = 0;
+
+    if (!heads_only) {
+        for (size_t i = 0; i < composition->all_lipid_atoms->n_atoms; ++i) {
+            indices[n++] = (size_t) (composition->all_lipid_atoms->atoms[i] - system->atoms);
+        }
+    } else if (composition->n_centers > 0) {
+        // heads consisting of several atoms are written as the individual atoms, not as their centers
+        for (size_t i = 0; i < composition->center_start[composition->n_centers]; ++i) {
+            indices[n++] = (size_t) (composition->center_atoms[i] - system->atoms);
+        }
+    } else {
+        for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+            atom_selection_t *selection = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[i]));
+            for (size_t j = 0; j < selection->n_atoms; ++j) {
+                indices[n++] = (size_t) (selection->atoms[j] - system->atoms);
+            }
+        }
+    }
+
+    // atoms keep their original order; every atom is written only once
+    qsort(indices, n, sizeof(size_t), compare_indices);
+    size_t unique = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (unique == 0 || indices[unique - 1] != indices[i]) indices[unique++] = indices[i];
+    }
+
+    *n_selected = unique;
+    return indices;
+}
+
+/*! @brief Writes the selected atoms of the system into a gro file. Returns zero if successful, else non-zero. */
+static int write_reduced_gro(const char *filename, const system_t *system, const size_t *indices, const size_t n_selected, const char *input_gro_file)
+{
+    FILE *gro = fopen(filename, "w");
+    if (gro == NULL) {
+        fprintf(stderr, "Could not open output file %s\n", filename);
+        return 1;
+    }
+
+    fprintf(gro, "Reduced by Scramblyzer from %s\n", input_gro_file);
+    fprintf(gro, "%zu\n", n_selected);
+    for (size_t i = 0; i < n_selected; ++i) {
+        const atom_t *atom = &system->atoms[indices[i]];
+        fprintf(gro, "%5d%-5s%5s%5d%8.3f%8.3f%8.3f\n", atom->residue_number % 100000, atom->residue_name, atom->atom_name,
+                atom->atom_number % 100000, atom->position[0], atom->position[1], atom->position[2]);
+    }
+    fprintf(gro, "%10.5f%10.5f%10.5f\n", system->box[0], system->box[1], system->box[2]);
+
+    if (fclose(gro) != 0) {
+        fprintf(stderr, "Could not write output file %s\n", filename);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*! @brief Compresses and writes a single reduced frame. Returns zero if successful, else non-zero. */
+static int write_reduced_frame(reduce_writer_t *writer, reduced_frame_t *frame)
+{
+    return write_xtc(writer->xtc, writer->n_atoms, frame->step, frame->time, frame->box, frame->coordinates, frame->precision) != 0;
+}
+
+/*! @brief Writes queued frames until the queue is finished (body of the writing thread). */
+static void *writer_run(void *data)
+{
+    reduce_writer_t *writer = data;
+
+    pthread_mutex_lock(&writer->lock);
+    while (1) {
+        while (writer->queued == 0 && !writer->finished) pthread_cond_wait(&writer->changed, &writer->lock);
+        if (writer->queued == 0) break;
+
+        // the frame is owned by this thread until it is removed from the queue
+        reduced_frame_t *frame = &writer->frames[writer->first];
+        pthread_mutex_unlock(&writer->lock);
+        int failed = write_reduced_frame(writer, frame);
+        pthread_mutex_lock(&writer->lock);
+
+        writer->failed |= failed;
+        writer->first = (writer->first + 1) % REDUCE_QUEUE_LENGTH;
+        --writer->queued;
+        pthread_cond_broadcast(&writer->changed);
+
+        if (writer->failed) break;
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    return NULL;
+}
+
+/*! @brief Prepares the queue of reduced frames and starts the writing thread. Must be finished using writer_finish(). */
+static reduce_writer_t *writer_create(XDRFILE *xtc, const size_t n_atoms)
+{
+    reduce_writer_t *writer = calloc(1, sizeof(reduce_writer_t));
+    writer->xtc = xtc;
+    writer->n_atoms = (int) n_atoms;
+
+    for (size_t i = 0; i < REDUCE_QUEUE_LENGTH; ++i) {
+        writer->frames[i].coordinates = malloc((n_atoms + 1) * sizeof(rvec));
+        if (writer->frames[i].coordinates == NULL) writer->failed = 1;
+    }
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->changed, NULL);
+
+    // if the thread could not be created, frames are written by the reading thread
+    writer->threaded = !writer->failed && pthread_create(&writer->thread, NULL, writer_run, writer) == 0;
+
+    return writer;
+}
+
+/*! @brief Returns the next free frame of the queue (waits until a frame is written, if the queue is full). NULL if writing has failed. */
+static reduced_frame_t *writer_slot(reduce_writer_t *writer)
+{
+    pthread_mutex_lock(&writer->lock);
+    while (writer->threaded && writer->queued == REDUCE_QUEUE_LENGTH && !writer->failed) pthread_cond_wait(&writer->changed, &writer->lock);
+    reduced_frame_t *frame = writer->failed ? NULL : &writer->frames[(writer->first + writer->queued) % REDUCE_QUEUE_LENGTH];
+    pthread_mutex_unlock(&writer->lock);
+
+    return frame;
+}
+
+/*! @brief Queues the frame obtained using writer_slot() for writing. */
+static void writer_push(reduce_writer_t *writer, reduced_frame_t *frame)
+{
+    if (!writer->threaded) {
+        writer->failed |= write_reduced_frame(writer, frame);
+        return;
+    }
+
+    pthread_mutex_lock(&writer->lock);
+    ++writer->queued;
+    pthread_cond_broadcast(&writer->changed);
+    pthread_mutex_unlock(&writer->lock);
+}
+
+/*! @brief Waits until all queued frames are written and deallocates the queue. Returns zero if all frames were written, else non-zero. */
+static int writer_finish(reduce_writer_t *writer)
+{
+    if (writer->threaded) {
+        pthread_mutex_lock(&writer->lock);
+        writer->finished = 1;
+        pthread_cond_broadcast(&writer->changed);
+        pthread_mutex_unlock(&writer->lock);
+        pthread_join(writer->thread, NULL);
+    }
+
+    int failed = writer->failed;
+
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->changed);
+    for (size_t i = 0; i < REDUCE_QUEUE_LENGTH; ++i) free(writer->frames[i].coordinates);
+    free(writer);
+
+    return failed;
+}
+
+int calc_reduce(
+        const char *input_gro_file,
+        const char *input_xtc_file,
+        const char *ndx_file,
+        const char *output_file,
+        const char *head_identifier,
+        const float dt,
+        const int heads_only,
+        profile_t *profile)
+{
+    char *output_gro_file = gro_file_name(output_file);
+    print_arguments_reduce(input_gro_file, input_xtc_file, ndx_file, output_file, output_gro_file, head_identifier, dt, heads_only);
+
+    // read gro file and get lipids present in the system (possibly from the topology cache)
+    system_t *system = NULL;
+    lipid_composition_t *composition = topology_load(input_gro_file, ndx_file, head_identifier, &system);
+    if (composition == NULL) {
+        free(output_gro_file);
+        return 1;
+    }
+
+    // if there are no lipids
+    if (composition->n_lipid_types < 1) {
+        fprintf(stderr, "No usable lipids detected.\n");
+        lipid_composition_destroy(composition);
+        free(system);
+        free(output_gro_file);
+        return 1;
+    }
+
+    size_t n_selected = 0;
+    size_t *indices = selected_indices(composition, system, heads_only, &n_selected);
+    lipid_composition_destroy(composition);
+
+    if (write_reduced_gro(output_gro_file, system, indices, n_selected, input_gro_file) != 0) {
+        free(indices);
+        free(system);
+        free(output_gro_file);
+        return 1;
+    }
+
+    // open xtc file for reading
+    trajectory_t *traj = trajectory_open(input_xtc_file, system->n_atoms);
+    if (traj == NULL) {
+        fprintf(stderr, "File %s could not be read as an xtc file.\n", input_xtc_file);
+        free(indices);
+        free(system);
+        free(output_gro_file);
+        return 1;
+    }
+
+    // check that the gro file and the xtc file match each other
+    if (!trajectory_validate(traj)) {
+        fprintf(stderr, "Number of atoms in %s does not match %s.\n", input_xtc_file, input_gro_file);
+        free(indices);
+        free(system);
+        free(output_gro_file);
+        trajectory_close(traj);
+        return 1;
+    }
+
+    XDRFILE *output = xdrfile_open(output_file, "w");
+    if (output == NULL) {
+        fprintf(stderr, "Could not open output file %s\n", output_file);
+        free(indices);
+        free(system);
+        free(output_gro_file);
+        trajectory_close(traj);
+        return 1;
+    }
+
+    reduce_writer_t *writer = writer_create(output, n_selected);
+    size_t n_written = 0;
+    // time interval between written frames [ps]; zero if all frames are written
+    const int step = dt > 0 ? (int) roundf(dt * 1000) : 0;
+
+    while (trajectory_next(traj) == 0) {
+        // frames that are not written are skipped without decompression
+        if (step > 0 && (int) traj->time % step != 0) {
+            if (profile_skip(profile, traj) != 0) break;
+            continue;
+        }
+
+        if (profile_read(profile, traj, system) != 0) break;
+
+        // gather the selected atoms into the next free frame of the queue; it is compressed by the writing thread
+        profile_begin(profile);
+        reduced_frame_t *frame = writer_slot(writer);
+        if (frame == NULL) {
+            profile_end(profile, PROFILE_OUTPUT);
+            break;
+        }
+
+        for (size_t i = 0; i < n_selected; ++i) {
+            memcpy(frame->coordinates[i], system->atoms[indices[i]].position, sizeof(rvec));
+        }
+
+        memset(frame->box, 0, sizeof(matrix));
+        for (int dim = 0; dim < 3; ++dim) frame->box[dim][dim] = system->box[dim];
+        frame->step = system->step;
+        frame->time = system->time;
+        frame->precision = system->precision > 0 ? system->precision : REDUCE_DEFAULT_PRECISION;
+
+        writer_push(writer, frame);
+        ++n_written;
+        profile_end(profile, PROFILE_OUTPUT);
+    }
+
+    // wait for the writing thread to compress the remaining frames
+    profile_begin(profile);
+    int failed = writer_finish(writer);
+    xdrfile_close(output);
+    profile_end(profile, PROFILE_OUTPUT);
+
+    if (failed) {
+        fprintf(stderr, "Could not write output file %s\n", output_file);
+    } else {
+        printf("\nWritten %zu frames containing %zu of %zu atoms.\n", n_written, n_selected, system->n_atoms);
+        printf("Output files %s and %s written.\n", output_file, output_gro_file);
+    }
+    profile_report(profile);
+
+    free(indices);
+    free(system);
+    free(output_gro_file);
+    trajectory_close(traj);
+
+    return failed;
+}
@@ -0,0 +1,60 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef REDUCE_H
+#define REDUCE_H
+
+#include <groan.h>
+#include <unistd.h>
+#include "profile.h"
+
+/*! @brief Prints supported flags and arguments of this module */
+void print_usage_reduce(void);
+
+
+/*! @brief Parses command line arguments for the reduce module.
+ *
+ * @return Zero, if parsing has been successful. Else returns non-zero.
+ */
+int get_arguments_reduce(
+        const int argc,
+        char **argv,
+        char **gro_file,
+        char **xtc_file,
+        char **ndx_file,
+        char **output_file,
+        char **phosphates,
+        float *dt);
+
+
+/*! @brief Writes a reduced trajectory containing only lipid atoms (or only lipid head atoms).
+ *
+ * @paragraph Output
+ * The reduced trajectory is written into output_file (xtc) and the matching structure into a gro file of the same name
+ * with the extension '.gro'. Atoms keep their order, names and numbers, so the reduced files can be analyzed
+ * by scramblyzer (and by other tools) instead of the full files. Coordinates are compressed with the precision
+ * of the input trajectory.
+ *
+ * @paragraph Selecting frames
+ * If dt is positive, only frames every dt ns are written. Other frames are skipped without decompression.
+ * If dt is zero, all frames are written.
+ *
+ * @paragraph Pipelining
+ * Frames are compressed and written by a separate thread while the next frames are read and decompressed.
+ * Up to a few reduced frames are queued between the two threads.
+ *
+ * @param heads_only        if non-zero, only the lipid head atoms are written; else all lipid atoms are written
+ *
+ * @return Zero, if successful. Else non-zero.
+ */
+int calc_reduce(
+        const char *input_gro_file,
+        const char *input_xtc_file,
+        const char *ndx_file,
+        const char *output_file,
+        const char *head_identifier,
+        const float dt,
+        const int heads_only,
+        profile_t *profile);
+
+#endif /* REDUCE_H */
@@ -0,0 +1,118 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#include <math.h>
+#include "sample.h"
+
+/*! @brief Seed of the random number generator used to select the frames */
+static const uint64_t SAMPLE_SEED = 0x5eed5c7a3b1e2022ULL;
+
+/*! @brief 97.5% quantiles of the Student's t-distribution for 1 to 30 degrees of freedom */
+static const double T_QUANTILES[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+
+/*! @brief 97.5% quantile of the standard normal distribution */
+static const double Z_QUANTILE = 1.959964;
+
+/*! @brief Returns the next pseudo-random number (splitmix64). */
+static inline uint64_t next_random(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+frame_sampler_t *frame_sampler_create(trajectory_t *traj, const size_t n_samples, const int include_first)
+{
+    // also determines the size of the file
+    if (trajectory_seek(traj, 0) != 0) return NULL;
+
+    frame_sampler_t *sampler = calloc(1, sizeof(frame_sampler_t));
+    sampler->n_strata = n_samples;
+    sampler->first_pending = include_first;
+    sampler->file_size = traj->file_size;
+    sampler->last_offset = -1;
+    sampler->state = SAMPLE_SEED;
+
+    return sampler;
+}
+
+int frame_sampler_next(frame_sampler_t *sampler, trajectory_t *traj)
+{
+    while (sampler->first_pending || sampler->next_stratum < sampler->n_strata) {
+        off_t target = 0;
+
+        if (sampler->first_pending) {
+            sampler->first_pending = 0;
+        } else {
+            // random offset inside the stratum
+            off_t begin = (off_t) ((double) sampler->file_size * sampler->next_stratum / sampler->n_strata);
+            off_t end = (off_t) ((double) sampler->file_size * (sampler->next_stratum + 1) / sampler->n_strata);
+            ++sampler->next_stratum;
+            target = end > begin ? begin + (off_t) (next_random(&sampler->state) % (uint64_t) (end - begin)) : begin;
+        }
+
+        if (trajectory_seek(traj, target) != 0) return -1;
+
+        int return_code = trajectory_next(traj);
+        if (return_code < 0) return return_code;
+        // no complete frame after the offset or the frame has already been sampled
+        if (return_code > 0 || traj->offset <= sampler->last_offset) continue;
+
+        sampler->last_offset = traj->offset;
+        ++sampler->n_sampled;
+        return 0;
+    }
+
+    return 1;
+}
+
+double sample_t_quantile(const size_t degrees_of_freedom)
+{
+    const size_t n_tabulated = sizeof(T_QUANTILES) / sizeof(T_QUANTILES[0]);
+
+    if (degrees_of_freedom == 0) return 0.0;
+    if (degrees_of_freedom <= n_tabulated) return T_QUANTILES[degrees_of_freedom - 1];
+
+    double z = Z_QUANTILE;
+    double df = (double) degrees_of_freedom;
+    return z + (z * z * z + z) / (4.0 * df) + (5.0 * pow(z, 5) + 16.0 * z * z * z + 3.0 * z) / (96.0 * df * df);
+}
+
+double sample_mean_interval(const blocking_t *statistics)
+{
+    blocking_estimate_t estimate = blocking_estimate(statistics);
+    if (estimate.n_samples < 2) return 0.0;
+
+    return sample_t_quantile(estimate.n_samples - 1) * estimate.std_dev / sqrt((double) estimate.n_samples);
+}
+
+void sample_fit_add(sample_fit_t *fit, const double x, const double y)
+{
+    ++fit->n_points;
+    fit->sxx += x * x;
+    fit->sxy += x * y;
+    fit->syy += y * y;
+}
+
+int sample_fit_estimate(const sample_fit_t *fit, double *slope, double *half_width)
+{
+    *slope = 0.0;
+    *half_width = 0.0;
+    if (fit->n_points == 0 || fit->sxx <= 0.0) return 1;
+
+    *slope = fit->sxy / fit->sxx;
+    if (fit->n_points < 2) return 0;
+
+    // residual sum of squares can be slightly negative due to rounding
+    double residual = fit->syy - *slope * fit->sxy;
+    if (residual < 0.0) residual = 0.0;
+
+    size_t degrees_of_freedom = fit->n_points - 1;
+    *half_width = sample_t_quantile(degrees_of_freedom) * sqrt(residual / degrees_of_freedom / fit->sxx);
+    return 0;
+}
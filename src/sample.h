@@ -0,0 +1,106 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "blocking.h"
+#include "trajectory.h"
+
+/*! @brief Stratified random selection of trajectory frames. See frame_sampler_next() for more details. */
+typedef struct frame_sampler {
+    size_t n_strata;            // number of strata the file is divided into
+    size_t next_stratum;        // index of the next stratum to sample
+    int first_pending;          // the first frame of the trajectory has been requested and not yet read
+    off_t file_size;            // size of the trajectory file when the sampling started
+    off_t last_offset;          // offset of the last sampled frame (-1 if no frame has been sampled yet)
+    uint64_t state;             // state of the random number generator
+    size_t n_sampled;           // number of frames sampled so far
+} frame_sampler_t;
+
+/*! @brief Least-squares fit of a line going through the origin (y = slope * x). See sample_fit_estimate() for more details. */
+typedef struct sample_fit {
+    uint64_t n_points;
+    double sxx;                 // sum of x^2
+    double sxy;                 // sum of x * y
+    double syy;                 // sum of y^2
+} sample_fit_t;
+
+
+/*! @brief Prepares stratified sampling of n_samples frames of the trajectory.
+ *
+ * @paragraph Strata
+ * The trajectory file is divided into n_samples strata of (almost) equal size in bytes and a single frame is sampled
+ * from every stratum, so the sampled frames are spread over the whole trajectory, even if the individual frames
+ * are compressed to different sizes. The random number generator is seeded with a fixed seed, so repeated runs
+ * analyze the same frames.
+ *
+ * @paragraph Note on deallocation
+ * The returned pointer must be deallocated using free().
+ *
+ * @param traj              opened trajectory (must not be a stream)
+ * @param n_samples         number of strata (frames) to sample
+ * @param include_first     if non-zero, the first frame of the trajectory is sampled before all strata
+ *                          (e.g. as a reference frame); it is not counted in n_samples
+ *
+ * @return Pointer to frame_sampler_t structure. NULL, if the trajectory can not be read in random order.
+ */
+frame_sampler_t *frame_sampler_create(trajectory_t *traj, const size_t n_samples, const int include_first);
+
+
+/*! @brief Moves the trajectory to the next sampled frame and reads its header.
+ *
+ * @paragraph Locating frames
+ * A random byte offset is drawn uniformly from the next stratum and the first complete frame starting at or after this offset
+ * is located (see trajectory_seek()), so no frames preceding it have to be read or decompressed. A frame is sampled
+ * with a probability proportional to the size of the preceding frame, which is nearly uniform for xtc trajectories.
+ * If the located frame has already been sampled (strata smaller than frames) or there is no frame after the offset
+ * (the last stratum), the stratum is skipped, so fewer frames than requested may be sampled. Frames are always
+ * sampled in the order of increasing time.
+ *
+ * @paragraph Reading frames
+ * As with trajectory_next(), the frame must then be read using trajectory_read() (or profile_read()).
+ *
+ * @return Zero, if a frame has been sampled. One, if all strata have been sampled. Negative number in case of an error.
+ */
+int frame_sampler_next(frame_sampler_t *sampler, trajectory_t *traj);
+
+
+/*! @brief Returns the 97.5% quantile of the Student's t-distribution with the given number of degrees of freedom
+ * (multiplier of the standard error for a two-sided 95% confidence interval). Tabulated for up to 30 degrees of freedom,
+ * Cornish-Fisher expansion is used for more. Returns zero for zero degrees of freedom.
+ */
+double sample_t_quantile(const size_t degrees_of_freedom);
+
+
+/*! @brief Calculates the half-width of the 95% confidence interval of the mean of sampled values.
+ *
+ * @paragraph Independent samples
+ * The frames selected by frame_sampler_next() are far apart, so they are treated as independent samples and the interval
+ * is t * std_dev / sqrt(n) with n - 1 degrees of freedom. The statistical inefficiency estimated from the blocking analysis
+ * is not used, as there are usually too few samples for it. Since every stratum contributes a single frame,
+ * the interval is slightly conservative.
+ *
+ * @return Half-width of the interval. Zero, if there are fewer than two samples.
+ */
+double sample_mean_interval(const blocking_t *statistics);
+
+
+/*! @brief Adds a point (x, y) into the fit. */
+void sample_fit_add(sample_fit_t *fit, const double x, const double y);
+
+
+/*! @brief Calculates the slope of the line y = slope * x and the half-width of its 95% confidence interval.
+ *
+ * @paragraph Confidence interval
+ * Residuals are assumed to be independent with a constant variance estimated as (syy - slope * sxy) / (n - 1)
+ * and the half-width of the interval is t * sqrt(variance / sxx) with n - 1 degrees of freedom.
+ *
+ * @return Zero, if successful. Non-zero, if the slope can not be calculated (no points or all x are zero).
+ * If there is a single point, the slope is calculated but the half-width is zero.
+ */
+int sample_fit_estimate(const sample_fit_t *fit, double *slope, double *half_width);
+
+#endif /* SAMPLE_H */
@@ -0,0 +1,175 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#include "scramblyzer.h"
+#include "general.h"
+#include "composition.h"
+#include "rate.h"
+#include "flipflops.h"
+#include "leaflets.h"
+
+struct scramblyzer {
+    system_t *system;
+    scramblyzer_options_t options;
+    lipid_composition_t *composition;
+    leaflet_classifier_t *leaflets;             // assignment of lipids to leaflets (clustering or membrane center)
+    composition_analysis_t *composition_analysis;
+    rate_analysis_t *rate;
+    flipflops_analysis_t *flipflops;
+    size_t n_frames;                            // number of pushed frames
+    scramblyzer_result_t result;
+};
+
+void scramblyzer_options_default(scramblyzer_options_t *options)
+{
+    options->analyses = SCRAMBLYZER_COMPOSITION | SCRAMBLYZER_RATE | SCRAMBLYZER_FLIPFLOPS;
+    options->leaflet_cutoff = 0.0;
+    options->spatial_limit = 1.5;
+    options->temporal_limit = 10;
+    options->callback = NULL;
+    options->user_data = NULL;
+}
+
+scramblyzer_t *scramblyzer_create(
+        system_t *system,
+        const char *head_identifier,
+        dict_t *ndx_groups,
+        const scramblyzer_options_t *options)
+{
+    if (system == NULL) {
+        fprintf(stderr, "No system provided.\n");
+        return NULL;
+    }
+
+    scramblyzer_t *context = calloc(1, sizeof(scramblyzer_t));
+    context->system = system;
+    if (options != NULL) context->options = *options;
+    else scramblyzer_options_default(&context->options);
+
+    context->composition = get_lipid_composition(system, head_identifier == NULL ? "name PO4" : head_identifier, ndx_groups);
+    if (context->composition == NULL) {
+        free(context);
+        return NULL;
+    }
+
+    if (context->composition->n_lipid_types < 1) {
+        fprintf(stderr, "No usable lipids detected.\n");
+        scramblyzer_destroy(context);
+        return NULL;
+    }
+
+    if ((context->leaflets = leaflet_classifier_create(context->composition, context->options.leaflet_cutoff)) == NULL) {
+        scramblyzer_destroy(context);
+        return NULL;
+    }
+
+    scramblyzer_result_t *result = &context->result;
+    result->n_lipid_types = context->composition->n_lipid_types;
+    result->lipid_types = (const char *const *) context->composition->lipid_types;
+
+    if (context->options.analyses & SCRAMBLYZER_COMPOSITION) {
+        context->composition_analysis = composition_analysis_create(context->composition);
+        result->upper = context->composition_analysis->upper;
+        result->lower = context->composition_analysis->lower;
+    }
+
+    if (context->options.analyses & SCRAMBLYZER_RATE) {
+        context->rate = rate_analysis_create(context->composition);
+        result->scrambled = context->rate->scrambled;
+    }
+
+    if (context->options.analyses & SCRAMBLYZER_FLIPFLOPS) {
+        context->flipflops = flipflops_analysis_create(context->composition, context->options.spatial_limit, context->options.temporal_limit);
+        result->upper_lower = context->flipflops->upper_lower;
+        result->lower_upper = context->flipflops->lower_upper;
+    }
+
+    return context;
+}
+
+int scramblyzer_push_frame(
+        scramblyzer_t *context,
+        const float *coordinates,
+        const float box[3],
+        const float time,
+        const scramblyzer_result_t **result)
+{
+    system_t *system = context->system;
+
+    if (coordinates != NULL) {
+        for (size_t i = 0; i < system->n_atoms; ++i) {
+            memcpy(system->atoms[i].position, coordinates + 3 * i, 3 * sizeof(float));
+        }
+    }
+
+    if (box != NULL) {
+        system->box[0] = box[0];
+        system->box[1] = box[1];
+        system->box[2] = box[2];
+    }
+
+    system->time = time;
+
+    scramblyzer_result_t *frame_result = &context->result;
+    frame_result->frame = context->n_frames;
+    frame_result->time = time;
+    frame_result->analyzed = 0;
+
+    vec_t membrane_center = {0.0};
+    lipid_composition_update(context->composition, system->box);
+    center_of_geometry(context->composition->all_lipid_atoms, membrane_center, system->box);
+
+    // if clustering fails before the leaflets have ever been identified, the frame is not analyzed
+    const leaflet_classifier_t *leaflets = context->leaflets;
+    int leaflets_unavailable = 0;
+    if (leaflet_classifier_classify(context->leaflets, membrane_center, system->box) != 0 && !leaflets->initialized) {
+        // the reference frame of the rate analysis must be classified
+        if (context->rate != NULL && context->rate->frame == 0) {
+            fprintf(stderr, "Could not identify membrane leaflets in the first analyzed frame.\n");
+            return 1;
+        }
+        leaflets_unavailable = 1;
+    }
+
+    if (!leaflets_unavailable) {
+        if (context->composition_analysis != NULL) {
+            composition_analysis_frame(context->composition_analysis, leaflets, time);
+            frame_result->analyzed |= SCRAMBLYZER_COMPOSITION;
+        }
+
+        if (context->rate != NULL) {
+            rate_analysis_frame(context->rate, leaflets, system->box, time);
+            frame_result->analyzed |= SCRAMBLYZER_RATE;
+        }
+
+        // flip-flops are always analyzed every nanosecond
+        if (context->flipflops != NULL && (int) time % 1000 == 0) {
+            if (flipflops_analysis_frame(context->flipflops, leaflets, membrane_center, system->box, time) != 0) return 1;
+            frame_result->analyzed |= SCRAMBLYZER_FLIPFLOPS;
+        }
+    }
+
+    ++context->n_frames;
+
+    if (context->options.callback != NULL) context->options.callback(frame_result, context->options.user_data);
+    if (result != NULL) *result = frame_result;
+
+    return 0;
+}
+
+const scramblyzer_result_t *scramblyzer_result(const scramblyzer_t *context)
+{
+    return &context->result;
+}
+
+void scramblyzer_destroy(scramblyzer_t *context)
+{
+    if (context == NULL) return;
+
+    composition_analysis_destroy(context->composition_analysis);
+    rate_analysis_destroy(context->rate);
+    flipflops_analysis_destroy(context->flipflops);
+    leaflet_classifier_destroy(context->leaflets);
+    lipid_composition_destroy(context->composition);
+    free(context);
+}
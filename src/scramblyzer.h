@@ -0,0 +1,127 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef SCRAMBLYZER_H
+#define SCRAMBLYZER_H
+
+#include <stddef.h>
+#include <groan.h>
+
+/*! @brief Analyses that can be performed by a scramblyzer context. Can be combined using bitwise OR. */
+enum scramblyzer_analysis {
+    SCRAMBLYZER_COMPOSITION = 1 << 0,       // number of lipids of each type in each leaflet
+    SCRAMBLYZER_RATE        = 1 << 1,       // percentage of scrambled lipids relative to the first pushed frame
+    SCRAMBLYZER_FLIPFLOPS   = 1 << 2,       // cumulative number of flip-flop events
+};
+
+/*! @brief Results of the analysis of a single frame. See scramblyzer_push_frame() for more details.
+ *
+ * @paragraph Arrays
+ * All arrays are indexed by lipid types (in the order of 'lipid_types'). Arrays 'upper', 'lower' and 'scrambled'
+ * contain one more item (index n_lipid_types) corresponding to all lipids. Arrays of analyses that have not been
+ * requested are NULL. All pointers are owned by the context and remain valid until the context is destroyed;
+ * their content is overwritten by the next pushed frame.
+ */
+typedef struct scramblyzer_result {
+    size_t frame;                       // index of the frame (counted from 0 for the first pushed frame)
+    float time;                         // time of the frame [ps]
+    unsigned analyzed;                  // analyses that have been performed for this frame (see enum scramblyzer_analysis)
+    size_t n_lipid_types;
+    const char *const *lipid_types;     // residue names of the analyzed lipid types
+    const size_t *upper;                // composition: number of lipids in the upper leaflet
+    const size_t *lower;                // composition: number of lipids in the lower leaflet
+    const float *scrambled;             // rate: percentage of scrambled lipids
+    const size_t *upper_lower;          // flipflops: number of upper->lower flip-flops detected so far
+    const size_t *lower_upper;          // flipflops: number of lower->upper flip-flops detected so far
+} scramblyzer_result_t;
+
+/*! @brief Function called with the results of every pushed frame. */
+typedef void (*scramblyzer_callback_t)(const scramblyzer_result_t *result, void *user_data);
+
+/*! @brief Options of a scramblyzer context. Initialize using scramblyzer_options_default(). */
+typedef struct scramblyzer_options {
+    unsigned analyses;                  // analyses to perform (see enum scramblyzer_analysis)
+    float leaflet_cutoff;               // if positive, leaflets are identified by clustering of lipid heads [nm]
+    float spatial_limit;                // spatial limit for the flip-flop analysis [nm]
+    int temporal_limit;                 // temporal limit for the flip-flop analysis [ns]
+    scramblyzer_callback_t callback;    // called after every pushed frame (not used if NULL)
+    void *user_data;                    // passed to the callback
+} scramblyzer_options_t;
+
+/*! @brief Opaque analysis context. */
+typedef struct scramblyzer scramblyzer_t;
+
+
+/*! @brief Sets the default options: all analyses, leaflets from the membrane center, spatial limit of 1.5 nm,
+ * temporal limit of 10 ns, no callback. These are the same defaults as used by the command line tool.
+ */
+void scramblyzer_options_default(scramblyzer_options_t *options);
+
+
+/*! @brief Creates an analysis context for a system.
+ *
+ * @paragraph System
+ * The system (e.g. loaded using load_gro()) is owned by the caller and must stay allocated until the context
+ * is destroyed. The positions of its atoms and its box are overwritten by scramblyzer_push_frame().
+ * Lipids are identified in the same way as by the command line tool (including the file 'lipids.txt'
+ * in the current working directory).
+ *
+ * @paragraph Output
+ * Nothing is written into stdout. Errors and warnings are written into stderr.
+ *
+ * @paragraph Note on deallocation
+ * The returned pointer must be deallocated using scramblyzer_destroy().
+ *
+ * @param system            system to analyze
+ * @param head_identifier   selection of lipid head identifiers (if NULL, 'name PO4' is used)
+ * @param ndx_groups        groups from an ndx file used in the selection (may be NULL)
+ * @param options           options of the analysis (if NULL, default options are used)
+ *
+ * @return Pointer to the context. NULL in case of an error.
+ */
+scramblyzer_t *scramblyzer_create(
+        system_t *system,
+        const char *head_identifier,
+        dict_t *ndx_groups,
+        const scramblyzer_options_t *options);
+
+
+/*! @brief Analyzes a single frame.
+ *
+ * @paragraph Frames
+ * Frames can be pushed from any source; the caller decides which frames are analyzed. The first pushed frame
+ * is the reference frame of the rate analysis. The flip-flop analysis is only performed for frames with time
+ * divisible by 1 ns and these frames must not be more than 1 ns apart (as in the command line tool).
+ *
+ * @paragraph Leaflet clustering
+ * If leaflet clustering is used and the leaflets can not be identified before they have ever been identified,
+ * no analysis is performed for the frame ('analyzed' is zero). This is an error if the rate analysis
+ * has been requested and no frame has been analyzed yet.
+ *
+ * @paragraph Results
+ * Results are passed to the callback (if set) and, if 'result' is not NULL, a pointer to them is stored into 'result'.
+ *
+ * @param context       analysis context
+ * @param coordinates   coordinates of all atoms of the system (x, y, z for each atom) [nm]; if NULL, the current positions of atoms of the system are used
+ * @param box           dimensions of the rectangular simulation box [nm]; if NULL, the current box of the system is used
+ * @param time          time of the frame [ps]
+ * @param result        pointer to store the pointer to the results into (may be NULL)
+ *
+ * @return Zero, if successful. Else non-zero.
+ */
+int scramblyzer_push_frame(
+        scramblyzer_t *context,
+        const float *coordinates,
+        const float box[3],
+        const float time,
+        const scramblyzer_result_t **result);
+
+
+/*! @brief Returns the results of the last pushed frame. Cumulative results (flip-flops) thus correspond to all frames pushed so far. */
+const scramblyzer_result_t *scramblyzer_result(const scramblyzer_t *context);
+
+
+/*! @brief Deallocates memory for the analysis context. Does not deallocate the system. */
+void scramblyzer_destroy(scramblyzer_t *context);
+
+#endif /* SCRAMBLYZER_H */
@@ -0,0 +1,1203 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "general.h"
+#include "serve.h"
+#include "composition.h"
+#include "rate.h"
+#include "flipflops.h"
+#include "membranes.h"
+#include "trajectory.h"
+#include "profile.h"
+#include "topology.h"
+
+/*! @brief Maximal length of a request [bytes] */
+static const size_t SERVE_MAX_REQUEST = 16384;
+/*! @brief Maximal number of fields of a request */
+#define SERVE_MAX_FIELDS 16
+/*! @brief Maximal length of an error message sent to the client */
+#define SERVE_MAX_ERROR 512
+/*! @brief Time for which the daemon waits for a client to send its request or to accept the response [s] */
+#define SERVE_TIMEOUT 10
+
+/*! @brief Set by the signal handler when the daemon should stop */
+static volatile sig_atomic_t serve_interrupted = 0;
+
+/*! @brief Analyses that can be requested from the daemon */
+typedef enum serve_type {
+    SERVE_COMPOSITION,
+    SERVE_RATE,
+    SERVE_FLIPFLOPS,
+    SERVE_STATS,
+    SERVE_SHUTDOWN,
+    SERVE_N_TYPES
+} serve_type_t;
+
+/*! @brief Names of the analyses as used in the requests */
+static const char *SERVE_NAMES[SERVE_N_TYPES] = {"composition", "rate", "flipflops", "stats", "shutdown"};
+
+struct serve_dataset;
+
+/*! @brief Data of a single decoded trajectory frame needed by the analyses. */
+typedef struct serve_frame {
+    struct serve_dataset *dataset;
+    size_t index;               // index of the frame in the trajectory
+    float time;                 // time of the frame [ps]
+    box_t box;
+    vec_t *centers;             // center of each membrane
+    vec_t *heads;               // position of each lipid head (ordered as membranes_t.heads)
+    size_t bytes;               // memory used by the frame
+    struct serve_frame *newer;  // neighbors in the least-recently-used list
+    struct serve_frame *older;
+} serve_frame_t;
+
+/*! @brief System, lipids and cached frames for a single combination of input files and head identifier. */
+typedef struct serve_dataset {
+    char *key;                  // working directory, input files and head identifier
+    char *xtc_file;             // absolute path of the xtc file
+    time_t gro_mtime;
+    off_t gro_size;
+    time_t xtc_mtime;
+    off_t xtc_size;
+    system_t *system;
+    lipid_composition_t *composition;
+    membranes_t *membranes;
+    leaflet_classifier_t **classifiers; // leaflet classifier of each membrane
+    size_t n_frames;            // number of indexed frames
+    size_t allocated_frames;
+    float *times;               // time of each indexed frame [ps]
+    serve_frame_t **frames;     // cached frames (NULL if the frame is not cached)
+    size_t n_cached;            // number of cached frames
+    int indexed;                // have all frames of the trajectory been indexed?
+    size_t bytes;               // memory used by the data set (without the cached frames)
+    unsigned long last_used;
+    struct serve_dataset *next;
+} serve_dataset_t;
+
+/*! @brief State of the daemon. */
+typedef struct serve_state {
+    serve_dataset_t *datasets;
+    serve_frame_t *newest;      // most recently used frame
+    serve_frame_t *oldest;      // least recently used frame
+    size_t bytes;               // memory used by all data sets and frames
+    size_t limit;               // memory budget [bytes]
+    unsigned long clock;        // counter used to order the data sets by their last use
+    size_t hits;                // frames served from the cache
+    size_t misses;              // frames decoded from the trajectory
+    size_t evictions;           // evicted frames and data sets
+    int single_membrane;        // analyze all lipids as a single membrane (see membranes_detect())
+} serve_state_t;
+
+/*! @brief Parsed request. Keys and values point into the request line. */
+typedef struct serve_request {
+    size_t n_fields;
+    char *keys[SERVE_MAX_FIELDS];
+    char *values[SERVE_MAX_FIELDS];
+} serve_request_t;
+
+/*! @brief Frames requested by an analysis. */
+typedef struct serve_selection {
+    int step;                   // analyze frames with time divisible by step [ps]
+    float time;                 // if non-negative, only the frame with this time is analyzed [ps]
+} serve_selection_t;
+
+/*! @brief Reader of the trajectory of a data set. */
+typedef struct serve_reader {
+    trajectory_t *traj;
+    size_t current;             // index of the frame whose header has been read last (SIZE_MAX if none)
+    int consumed;               // have the coordinates of the current frame been read or skipped?
+} serve_reader_t;
+
+/*! @brief Analysis performed for a single request. */
+typedef struct serve_job {
+    serve_type_t type;
+    int single;                 // composition of a single frame
+    size_t n_membranes;
+    void **states;              // analysis of each membrane
+    FILE **outputs;             // results of each membrane
+    char **buffers;
+    size_t *sizes;
+    size_t analyzed;            // number of analyzed frames
+} serve_job_t;
+
+/*! @brief Handles SIGINT and SIGTERM. */
+static void serve_interrupt_handler(int signal)
+{
+    (void) signal;
+    serve_interrupted = 1;
+}
+
+char *serve_default_socket(void)
+{
+    char *path = malloc(64);
+    snprintf(path, 64, "/tmp/scramblyzer-%u.sock", (unsigned) getuid());
+    return path;
+}
+
+/*! @brief Removes the frame from the least-recently-used list. */
+static void lru_unlink(serve_state_t *state, serve_frame_t *frame)
+{
+    if (frame->newer != NULL) frame->newer->older = frame->older;
+    else state->newest = frame->older;
+
+    if (frame->older != NULL) frame->older->newer = frame->newer;
+    else state->oldest = frame->newer;
+
+    frame->newer = NULL;
+    frame->older = NULL;
+}
+
+/*! @brief Inserts the frame at the start of the least-recently-used list (as the most recently used frame). */
+static void lru_push(serve_state_t *state, serve_frame_t *frame)
+{
+    frame->older = state->newest;
+    frame->newer = NULL;
+    if (state->newest != NULL) state->newest->newer = frame;
+    state->newest = frame;
+    if (state->oldest == NULL) state->oldest = frame;
+}
+
+/*! @brief Removes the frame from the cache and deallocates it. */
+static void frame_destroy(serve_state_t *state, serve_frame_t *frame)
+{
+    lru_unlink(state, frame);
+    frame->dataset->frames[frame->index] = NULL;
+    frame->dataset->n_cached--;
+    state->bytes -= frame->bytes;
+
+    free(frame->centers);
+    free(frame->heads);
+    free(frame);
+}
+
+/*! @brief Removes the data set (including its cached frames) from the daemon and deallocates it. */
+static void dataset_destroy(serve_state_t *state, serve_dataset_t *dataset)
+{
+    for (size_t i = 0; i < dataset->n_frames; ++i) {
+        if (dataset->frames[i] != NULL) frame_destroy(state, dataset->frames[i]);
+    }
+
+    serve_dataset_t **link = &state->datasets;
+    while (*link != NULL && *link != dataset) link = &(*link)->next;
+    if (*link != NULL) *link = dataset->next;
+
+    state->bytes -= dataset->bytes;
+
+    for (size_t m = 0; dataset->membranes != NULL && m < dataset->membranes->n_membranes; ++m) {
+        leaflet_classifier_destroy(dataset->classifiers[m]);
+    }
+    free(dataset->classifiers);
+    membranes_destroy(dataset->membranes);
+    lipid_composition_destroy(dataset->composition);
+    free(dataset->system);
+    free(dataset->times);
+    free(dataset->frames);
+    free(dataset->key);
+    free(dataset->xtc_file);
+    free(dataset);
+}
+
+/*! @brief Evicts the least recently used frames (and then data sets) until the memory budget is met.
+ * The data set of the current request and the frame being used are never evicted.
+ */
+static void serve_evict(serve_state_t *state, const serve_dataset_t *current, const serve_frame_t *keep)
+{
+    while (state->bytes > state->limit) {
+        serve_frame_t *victim = state->oldest;
+        if (victim != NULL && victim != keep) {
+            frame_destroy(state, victim);
+            state->evictions++;
+            continue;
+        }
+
+        serve_dataset_t *lru = NULL;
+        for (serve_dataset_t *dataset = state->datasets; dataset != NULL; dataset = dataset->next) {
+            if (dataset != current && (lru == NULL || dataset->last_used < lru->last_used)) lru = dataset;
+        }
+
+        if (lru == NULL) break;
+        dataset_destroy(state, lru);
+        state->evictions++;
+    }
+}
+
+/*! @brief Returns the value of the field of the request. NULL if the field is not present. */
+static const char *request_get(const serve_request_t *request, const char *key)
+{
+    for (size_t i = 0; i < request->n_fields; ++i) {
+        if (!strcmp(request->keys[i], key)) return request->values[i];
+    }
+
+    return NULL;
+}
+
+/*! @brief Splits the request line into 'key=value' fields.
+ *
+ * @return Zero, if successful. Else non-zero.
+ */
+static int request_parse(char *line, serve_request_t *request)
+{
+    request->n_fields = 0;
+    line[strcspn(line, "\n")] = '\0';
+
+    char *saveptr = NULL;
+    for (char *field = strtok_r(line, "\t", &saveptr); field != NULL; field = strtok_r(NULL, "\t", &saveptr)) {
+        char *value = strchr(field, '=');
+        if (value == NULL || request->n_fields >= SERVE_MAX_FIELDS) return 1;
+
+        *value++ = '\0';
+        request->keys[request->n_fields] = field;
+        request->values[request->n_fields] = value;
+        request->n_fields++;
+    }
+
+    return 0;
+}
+
+/*! @brief Adds the time of a newly indexed frame to the index of the data set. */
+static void dataset_index_frame(serve_dataset_t *dataset, const float time)
+{
+    if (dataset->n_frames >= dataset->allocated_frames) {
+        size_t allocated = dataset->allocated_frames == 0 ? 1024 : 2 * dataset->allocated_frames;
+        dataset->times = realloc(dataset->times, allocated * sizeof(float));
+        dataset->frames = realloc(dataset->frames, allocated * sizeof(serve_frame_t *));
+        for (size_t i = dataset->allocated_frames; i < allocated; ++i) dataset->frames[i] = NULL;
+        dataset->bytes += (allocated - dataset->allocated_frames) * (sizeof(float) + sizeof(serve_frame_t *));
+        dataset->allocated_frames = allocated;
+    }
+
+    dataset->times[dataset->n_frames++] = time;
+}
+
+/*! @brief Returns the data set for the request, loading it if it is not cached (or if its files have changed).
+ *
+ * @return Pointer to the data set. NULL in case of an error (described in 'error').
+ */
+static serve_dataset_t *dataset_get(
+        serve_state_t *state,
+        const char *cwd,
+        const char *gro_file,
+        const char *xtc_file,
+        const char *ndx_file,
+        const char *head_identifier,
+        char *error)
+{
+    struct stat gro_stat, xtc_stat;
+    if (stat(gro_file, &gro_stat) != 0) {
+        snprintf(error, SERVE_MAX_ERROR, "File %s could not be read.", gro_file);
+        return NULL;
+    }
+
+    if (stat(xtc_file, &xtc_stat) != 0) {
+        snprintf(error, SERVE_MAX_ERROR, "File %s could not be read.", xtc_file);
+        return NULL;
+    }
+
+    size_t length = strlen(cwd) + strlen(gro_file) + strlen(xtc_file) + strlen(ndx_file) + strlen(head_identifier) + 8;
+    char *key = malloc(length);
+    snprintf(key, length, "%s\t%s\t%s\t%s\t%s", cwd, gro_file, xtc_file, ndx_file, head_identifier);
+
+    serve_dataset_t *dataset = state->datasets;
+    while (dataset != NULL && strcmp(dataset->key, key)) dataset = dataset->next;
+
+    if (dataset != NULL) {
+        int gro_changed = dataset->gro_mtime != gro_stat.st_mtime || dataset->gro_size != gro_stat.st_size;
+        int xtc_rewritten = xtc_stat.st_size < dataset->xtc_size ||
+                (xtc_stat.st_size == dataset->xtc_size && xtc_stat.st_mtime != dataset->xtc_mtime);
+
+        if (!gro_changed && !xtc_rewritten) {
+            // new frames have been appended to the trajectory
+            if (xtc_stat.st_size > dataset->xtc_size) dataset->indexed = 0;
+            dataset->xtc_size = xtc_stat.st_size;
+            dataset->xtc_mtime = xtc_stat.st_mtime;
+            dataset->last_used = ++state->clock;
+            free(key);
+            return dataset;
+        }
+
+        printf("Input files of %s have changed. Reloading.\n", xtc_file);
+        dataset_destroy(state, dataset);
+    }
+
+    system_t *system = NULL;
+    lipid_composition_t *composition = topology_load(gro_file, ndx_file, head_identifier, &system);
+    if (composition == NULL) {
+        snprintf(error, SERVE_MAX_ERROR, "Could not identify lipids in %s.", gro_file);
+        free(key);
+        return NULL;
+    }
+
+    if (composition->n_lipid_types < 1) {
+        snprintf(error, SERVE_MAX_ERROR, "No usable lipids detected.");
+        lipid_composition_destroy(composition);
+        free(system);
+        free(key);
+        return NULL;
+    }
+
+    if (!validate_xtc(xtc_file, (int) system->n_atoms)) {
+        snprintf(error, SERVE_MAX_ERROR, "Number of atoms in %s does not match %s.", xtc_file, gro_file);
+        lipid_composition_destroy(composition);
+        free(system);
+        free(key);
+        return NULL;
+    }
+
+    dataset = calloc(1, sizeof(serve_dataset_t));
+    dataset->key = key;
+    dataset->xtc_file = malloc(strlen(cwd) + strlen(xtc_file) + 2);
+    if (xtc_file[0] == '/') strcpy(dataset->xtc_file, xtc_file);
+    else sprintf(dataset->xtc_file, "%s/%s", cwd, xtc_file);
+    dataset->gro_mtime = gro_stat.st_mtime;
+    dataset->gro_size = gro_stat.st_size;
+    dataset->xtc_mtime = xtc_stat.st_mtime;
+    dataset->xtc_size = xtc_stat.st_size;
+    dataset->system = system;
+    dataset->composition = composition;
+    dataset->membranes = membranes_detect(composition, system->box, state->single_membrane);
+    dataset->classifiers = calloc(dataset->membranes->n_membranes, sizeof(leaflet_classifier_t *));
+    for (size_t m = 0; m < dataset->membranes->n_membranes; ++m) {
+        dataset->classifiers[m] = leaflet_classifier_create(dataset->membranes->compositions[m], 0.0);
+    }
+
+    dataset->bytes = sizeof(serve_dataset_t) + length + sizeof(system_t) + system->n_atoms * sizeof(atom_t) +
+            composition->all_lipid_atoms->n_atoms * 2 * sizeof(atom_t *) +
+            dataset->membranes->n_heads * (3 * sizeof(atom_t *) + sizeof(size_t) + 2 * sizeof(float) + sizeof(short));
+    dataset->last_used = ++state->clock;
+
+    dataset->next = state->datasets;
+    state->datasets = dataset;
+    state->bytes += dataset->bytes;
+
+    return dataset;
+}
+
+/*! @brief Moves the reader to the frame with the given index (its header is read, its coordinates are not).
+ * Frames read for the first time are added to the index of the data set.
+ *
+ * @return Zero, if successful. One, if the end of the trajectory has been reached. Negative number in case of an error.
+ */
+static int reader_advance(serve_reader_t *reader, serve_dataset_t *dataset, const size_t index)
+{
+    if (reader->traj == NULL) {
+        reader->traj = trajectory_open(dataset->xtc_file, dataset->system->n_atoms);
+        if (reader->traj == NULL) return -1;
+        reader->current = SIZE_MAX;
+        reader->consumed = 1;
+    }
+
+    while (reader->current == SIZE_MAX || reader->current < index) {
+        if (!reader->consumed && trajectory_skip(reader->traj) != 0) return -1;
+
+        int return_code = trajectory_next(reader->traj);
+        if (return_code != 0) return return_code;
+
+        reader->current = reader->current == SIZE_MAX ? 0 : reader->current + 1;
+        reader->consumed = 0;
+
+        if (reader->current == dataset->n_frames) dataset_index_frame(dataset, reader->traj->time);
+    }
+
+    return 0;
+}
+
+/*! @brief Decodes the frame with the given index, extracts the data needed by the analyses and caches them.
+ *
+ * @return Pointer to the cached frame. NULL in case of an error.
+ */
+static serve_frame_t *frame_decode(serve_state_t *state, serve_dataset_t *dataset, serve_reader_t *reader, const size_t index)
+{
+    if (reader_advance(reader, dataset, index) != 0) return NULL;
+    if (trajectory_read(reader->traj, dataset->system) != 0) return NULL;
+    reader->consumed = 1;
+
+    system_t *system = dataset->system;
+    membranes_t *membranes = dataset->membranes;
+    lipid_composition_update(dataset->composition, system->box);
+    membranes_update(membranes, system->box);
+
+    serve_frame_t *frame = calloc(1, sizeof(serve_frame_t));
+    frame->dataset = dataset;
+    frame->index = index;
+    frame->time = system->time;
+    memcpy(frame->box, system->box, sizeof(box_t));
+
+    frame->centers = malloc(membranes->n_membranes * sizeof(vec_t));
+    memcpy(frame->centers, membranes->centers, membranes->n_membranes * sizeof(vec_t));
+
+    frame->heads = malloc(membranes->n_heads * sizeof(vec_t));
+    for (size_t h = 0; h < membranes->n_heads; ++h) {
+        memcpy(frame->heads[h], membranes->heads[h]->position, sizeof(vec_t));
+    }
+
+    frame->bytes = sizeof(serve_frame_t) + (membranes->n_membranes + membranes->n_heads) * sizeof(vec_t);
+
+    dataset->frames[index] = frame;
+    dataset->n_cached++;
+    state->bytes += frame->bytes;
+    state->misses++;
+    lru_push(state, frame);
+    serve_evict(state, dataset, frame);
+
+    return frame;
+}
+
+/*! @brief Loads the cached data of the frame into the system of the data set. */
+static void frame_apply(serve_dataset_t *dataset, const serve_frame_t *frame)
+{
+    const membranes_t *membranes = dataset->membranes;
+    for (size_t h = 0; h < membranes->n_heads; ++h) {
+        memcpy(membranes->heads[h]->position, frame->heads[h], sizeof(vec_t));
+    }
+
+    memcpy(dataset->system->box, frame->box, sizeof(box_t));
+    dataset->system->time = frame->time;
+}
+
+/*! @brief Returns non-zero, if the frame with the given time is requested. */
+static inline int frame_needed(const serve_selection_t *selection, const float time)
+{
+    if (selection->time >= 0) return time == selection->time;
+    return (int) time % selection->step == 0;
+}
+
+/*! @brief Analyzes a single frame for all membranes.
+ *
+ * @return Zero, if successful. Else non-zero.
+ */
+static int job_frame(serve_job_t *job, serve_dataset_t *dataset, const serve_frame_t *frame)
+{
+    frame_apply(dataset, frame);
+
+    for (size_t m = 0; m < job->n_membranes; ++m) {
+        leaflet_classifier_t *leaflets = dataset->classifiers[m];
+        leaflet_classifier_classify(leaflets, frame->centers[m], frame->box);
+
+        switch (job->type) {
+        case SERVE_COMPOSITION:
+            composition_analysis_frame(job->states[m], leaflets, frame->time);
+            if (!job->single) composition_write_frame(job->outputs[m], job->states[m]);
+            break;
+        case SERVE_RATE:
+            rate_analysis_frame(job->states[m], leaflets, frame->box, frame->time);
+            rate_write_frame(job->outputs[m], job->states[m]);
+            break;
+        case SERVE_FLIPFLOPS:
+            if (flipflops_analysis_frame(job->states[m], leaflets, frame->centers[m], frame->box, frame->time) != 0) return 1;
+            break;
+        default:
+            break;
+        }
+    }
+
+    job->analyzed++;
+    return 0;
+}
+
+/*! @brief Analyzes all requested frames of the data set. Cached frames are used directly; other frames are decoded
+ * from the trajectory, which is only opened if needed.
+ *
+ * @return Zero, if successful. Else non-zero.
+ */
+static int job_run(serve_state_t *state, serve_dataset_t *dataset, const serve_selection_t *selection, serve_job_t *job)
+{
+    serve_reader_t reader = { .traj = NULL, .current = SIZE_MAX, .consumed = 1 };
+    int return_code = 0;
+
+    for (size_t i = 0; return_code == 0; ++i) {
+        // frames beyond the end of the index are indexed from the trajectory
+        if (i >= dataset->n_frames) {
+            if (dataset->indexed) break;
+
+            int advanced = reader_advance(&reader, dataset, i);
+            if (advanced == 1) {
+                dataset->indexed = 1;
+                break;
+            }
+            if (advanced != 0) {
+                return_code = 1;
+                break;
+            }
+        }
+
+        if (!frame_needed(selection, dataset->times[i])) continue;
+
+        serve_frame_t *frame = dataset->frames[i];
+        if (frame != NULL) {
+            state->hits++;
+            lru_unlink(state, frame);
+            lru_push(state, frame);
+        } else if ((frame = frame_decode(state, dataset, &reader, i)) == NULL) {
+            return_code = 1;
+            break;
+        }
+
+        return_code = job_frame(job, dataset, frame);
+
+        // only a single frame is requested
+        if (selection->time >= 0) break;
+    }
+
+    trajectory_close(reader.traj);
+    return return_code;
+}
+
+/*! @brief Prepares the analyses of all membranes of the data set and writes the headers of their results. */
+static void job_create(serve_job_t *job, const serve_dataset_t *dataset, const float spatial_limit, const int temporal_limit)
+{
+    const membranes_t *membranes = dataset->membranes;
+    job->n_membranes = membranes->n_membranes;
+    job->states = calloc(job->n_membranes, sizeof(void *));
+    job->outputs = calloc(job->n_membranes, sizeof(FILE *));
+    job->buffers = calloc(job->n_membranes, sizeof(char *));
+    job->sizes = calloc(job->n_membranes, sizeof(size_t));
+
+    for (size_t m = 0; m < job->n_membranes; ++m) {
+        const lipid_composition_t *composition = membranes->compositions[m];
+        job->outputs[m] = open_memstream(&job->buffers[m], &job->sizes[m]);
+
+        switch (job->type) {
+        case SERVE_COMPOSITION:
+            job->states[m] = composition_analysis_create(composition);
+            if (!job->single) composition_write_header(job->outputs[m], composition, dataset->xtc_file);
+            break;
+        case SERVE_RATE:
+            job->states[m] = rate_analysis_create(composition);
+            rate_write_header(job->outputs[m], job->states[m], dataset->xtc_file);
+            break;
+        case SERVE_FLIPFLOPS:
+            job->states[m] = flipflops_analysis_create(composition, spatial_limit, temporal_limit);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+/*! @brief Writes the results of all membranes into the response. */
+static void job_write(serve_job_t *job, const serve_dataset_t *dataset, FILE *response)
+{
+    for (size_t m = 0; m < job->n_membranes; ++m) {
+        const lipid_composition_t *composition = dataset->membranes->compositions[m];
+
+        if (job->type == SERVE_COMPOSITION && job->single) {
+            const composition_analysis_t *analysis = job->states[m];
+            fprintf(job->outputs[m], "Lipid | Upper | Lower | Full \n");
+            for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+                fprintf(job->outputs[m], "%-5s | %-5zu | %-5zu | %-5zu\n", composition->lipid_types[i],
+                        analysis->upper[i], analysis->lower[i], analysis->upper[i] + analysis->lower[i]);
+            }
+            // if there are 2 or more lipid types, also print TOTAL number of lipids
+            if (composition->n_lipid_types > 1) {
+                size_t total_upper = analysis->upper[composition->n_lipid_types];
+                size_t total_lower = analysis->lower[composition->n_lipid_types];
+                fprintf(job->outputs[m], "-----------------------------\n");
+                fprintf(job->outputs[m], "%-5s | %-5zu | %-5zu | %-5zu\n", "TOTAL", total_upper, total_lower, total_upper + total_lower);
+            }
+        }
+
+        if (job->type == SERVE_FLIPFLOPS) flipflops_write_table(job->outputs[m], job->states[m]);
+
+        fflush(job->outputs[m]);
+        if (job->n_membranes > 1) {
+            if (job->type == SERVE_COMPOSITION && !job->single) fprintf(response, "# Membrane %zu\n", m + 1);
+            else if (job->type == SERVE_RATE) fprintf(response, "# Membrane %zu\n", m + 1);
+            else fprintf(response, "%sMembrane %zu\n", m > 0 ? "\n" : "", m + 1);
+        }
+        fwrite(job->buffers[m], 1, job->sizes[m], response);
+    }
+}
+
+/*! @brief Deallocates the analyses and results of all membranes. */
+static void job_destroy(serve_job_t *job)
+{
+    for (size_t m = 0; m < job->n_membranes; ++m) {
+        switch (job->type) {
+        case SERVE_COMPOSITION:
+            composition_analysis_destroy(job->states[m]);
+            break;
+        case SERVE_RATE:
+            rate_analysis_destroy(job->states[m]);
+            break;
+        case SERVE_FLIPFLOPS:
+            flipflops_analysis_destroy(job->states[m]);
+            break;
+        default:
+            break;
+        }
+
+        if (job->outputs[m] != NULL) fclose(job->outputs[m]);
+        free(job->buffers[m]);
+    }
+
+    free(job->states);
+    free(job->outputs);
+    free(job->buffers);
+    free(job->sizes);
+}
+
+/*! @brief Writes statistics of the caches into the response. */
+static void write_stats(const serve_state_t *state, FILE *response)
+{
+    fprintf(response, "Memory used:      %.1f MB of %.1f MB\n", state->bytes / 1048576.0, state->limit / 1048576.0);
+    fprintf(response, "Frames decoded:   %zu\n", state->misses);
+    fprintf(response, "Frames from cache: %zu\n", state->hits);
+    fprintf(response, "Evictions:        %zu\n", state->evictions);
+    fprintf(response, "Data sets:\n");
+    for (serve_dataset_t *dataset = state->datasets; dataset != NULL; dataset = dataset->next) {
+        fprintf(response, "  %s: %zu lipids in %zu membrane(s), %zu frames indexed%s, %zu frames cached\n",
+                dataset->xtc_file, dataset->membranes->n_heads, dataset->membranes->n_membranes,
+                dataset->n_frames, dataset->indexed ? "" : " (incomplete)", dataset->n_cached);
+    }
+}
+
+/*! @brief Performs a single request.
+ *
+ * @return Zero, if successful. One, if the request failed (described in 'error'). Two, if the daemon should stop.
+ */
+static int handle_request(serve_state_t *state, char *line, FILE *response, char *error)
+{
+    serve_request_t request = {0};
+    if (request_parse(line, &request) != 0) {
+        snprintf(error, SERVE_MAX_ERROR, "Malformed request.");
+        return 1;
+    }
+
+    const char *name = request_get(&request, "analysis");
+    int type = 0;
+    for (; name != NULL && type < SERVE_N_TYPES; ++type) {
+        if (!strcmp(name, SERVE_NAMES[type])) break;
+    }
+
+    if (name == NULL || type == SERVE_N_TYPES) {
+        snprintf(error, SERVE_MAX_ERROR, "Unknown analysis '%s'.", name == NULL ? "" : name);
+        return 1;
+    }
+
+    if (type == SERVE_SHUTDOWN) {
+        fprintf(response, "Daemon stopped.\n");
+        return 2;
+    }
+
+    if (type == SERVE_STATS) {
+        write_stats(state, response);
+        return 0;
+    }
+
+    const char *cwd = request_get(&request, "cwd");
+    const char *gro_file = request_get(&request, "gro");
+    const char *xtc_file = request_get(&request, "xtc");
+    const char *ndx_file = request_get(&request, "ndx");
+    const char *head_identifier = request_get(&request, "heads");
+    const char *dt_string = request_get(&request, "dt");
+    const char *time_string = request_get(&request, "time");
+    const char *spatial_string = request_get(&request, "spatial");
+    const char *temporal_string = request_get(&request, "temporal");
+
+    if (cwd == NULL || gro_file == NULL || xtc_file == NULL || ndx_file == NULL || head_identifier == NULL) {
+        snprintf(error, SERVE_MAX_ERROR, "Incomplete request.");
+        return 1;
+    }
+
+    float dt = type == SERVE_RATE ? 10.0 : 1.0;
+    float time = -1.0;
+    float spatial_limit = 1.5;
+    int temporal_limit = 10;
+    if (dt_string != NULL) sscanf(dt_string, "%f", &dt);
+    if (time_string != NULL) sscanf(time_string, "%f", &time);
+    if (spatial_string != NULL) sscanf(spatial_string, "%f", &spatial_limit);
+    if (temporal_string != NULL) sscanf(temporal_string, "%d", &temporal_limit);
+
+    if (dt <= 0 || spatial_limit < 0 || temporal_limit <= 0) {
+        snprintf(error, SERVE_MAX_ERROR, "Invalid parameters of the analysis.");
+        return 1;
+    }
+
+    // flip-flops are always analyzed every nanosecond
+    serve_selection_t selection = {0};
+    selection.step = type == SERVE_FLIPFLOPS ? 1000 : (int) roundf(dt * 1000);
+    selection.time = type == SERVE_COMPOSITION && time >= 0 ? time * 1000 : -1.0;
+
+    if (selection.step < 1) {
+        snprintf(error, SERVE_MAX_ERROR, "Time interval between analyzed frames must be at least 1 ps.");
+        return 1;
+    }
+
+    // requests are processed in the working directory of the client
+    if (cwd[0] != '/' || chdir(cwd) != 0) {
+        snprintf(error, SERVE_MAX_ERROR, "Could not enter directory %s.", cwd);
+        return 1;
+    }
+
+    serve_dataset_t *dataset = dataset_get(state, cwd, gro_file, xtc_file, ndx_file, head_identifier, error);
+    if (dataset == NULL) return 1;
+
+    serve_job_t job = {0};
+    job.type = (serve_type_t) type;
+    job.single = selection.time >= 0;
+    job_create(&job, dataset, spatial_limit, temporal_limit);
+
+    if (job_run(state, dataset, &selection, &job) != 0) {
+        snprintf(error, SERVE_MAX_ERROR, "Analysis of %s failed.", xtc_file);
+        job_destroy(&job);
+        return 1;
+    }
+
+    if (job.single && job.analyzed == 0) {
+        snprintf(error, SERVE_MAX_ERROR, "No frame at time %f ns found in %s.", time, xtc_file);
+        job_destroy(&job);
+        return 1;
+    }
+
+    job_write(&job, dataset, response);
+    job_destroy(&job);
+
+    // the budget may be exceeded by the data set of the last request
+    serve_evict(state, NULL, NULL);
+
+    return 0;
+}
+
+/*! @brief Reads the request line from the client.
+ *
+ * @return Request line (must be deallocated using free()). NULL in case of an error, if the request
+ * is incomplete or if the client has not sent it within SERVE_TIMEOUT seconds.
+ */
+static char *read_request(const int client)
+{
+    char *line = calloc(SERVE_MAX_REQUEST + 1, 1);
+    size_t length = 0;
+
+    while (length < SERVE_MAX_REQUEST && memchr(line, '\n', length) == NULL) {
+        ssize_t n_read = read(client, line + length, SERVE_MAX_REQUEST - length);
+        if (n_read < 0 && errno == EINTR) continue;
+        if (n_read <= 0) break;
+        length += (size_t) n_read;
+    }
+
+    if (memchr(line, '\n', length) == NULL) {
+        free(line);
+        return NULL;
+    }
+
+    return line;
+}
+
+/*! @brief Writes all bytes into the socket.
+ *
+ * @return Zero, if successful. Else non-zero.
+ */
+static int write_all(const int fd, const char *data, size_t length)
+{
+    while (length > 0) {
+        ssize_t n_written = write(fd, data, length);
+        if (n_written < 0 && errno == EINTR) continue;
+        if (n_written <= 0) return 1;
+        data += n_written;
+        length -= (size_t) n_written;
+    }
+
+    return 0;
+}
+
+int serve_run(const char *socket_path, const size_t memory_limit, const int single_membrane)
+{
+    struct sockaddr_un address = {0};
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path %s is too long.\n", socket_path);
+        return 1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0) {
+        fprintf(stderr, "Could not create socket.\n");
+        return 1;
+    }
+
+    // replace a socket left behind by a daemon that has not been stopped properly
+    unlink(socket_path);
+    // only the owner of the daemon may submit requests (these are processed with the permissions of the daemon)
+    if (bind(server, (struct sockaddr *) &address, sizeof(address)) != 0 || chmod(socket_path, S_IRUSR | S_IWUSR) != 0
+            || listen(server, 16) != 0) {
+        fprintf(stderr, "Could not listen on socket %s.\n", socket_path);
+        close(server);
+        return 1;
+    }
+
+    // accept() is interrupted by the signals so that the daemon can stop
+    struct sigaction action = {0};
+    action.sa_handler = serve_interrupt_handler;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    char *home = getcwd(NULL, 0);
+
+    serve_state_t state = {0};
+    state.limit = memory_limit * 1024 * 1024;
+    state.single_membrane = single_membrane;
+
+    printf("Scramblyzer daemon listening on %s (memory budget: %zu MB). Stop with Ctrl+C.\n\n", socket_path, memory_limit);
+    fflush(stdout);
+
+    int stop = 0;
+    while (!stop && !serve_interrupted) {
+        int client = accept(server, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Could not accept connection.\n");
+            break;
+        }
+
+        // a stalled client must not block the daemon
+        struct timeval timeout = {SERVE_TIMEOUT, 0};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        char *line = read_request(client);
+        if (line == NULL) {
+            fprintf(stderr, "Incomplete request received or the client timed out.\n");
+            close(client);
+            continue;
+        }
+
+        char *body = NULL;
+        size_t body_size = 0;
+        FILE *response = open_memstream(&body, &body_size);
+        char error[SERVE_MAX_ERROR] = {0};
+
+        double start = profile_now();
+        int result = handle_request(&state, line, response, error);
+        fclose(response);
+
+        char status[SERVE_MAX_ERROR + 16];
+        if (result == 1) snprintf(status, sizeof(status), "ERROR %s\n", error);
+        else snprintf(status, sizeof(status), "OK\n");
+
+        if (write_all(client, status, strlen(status)) == 0 && result != 1) write_all(client, body, body_size);
+
+        printf("Request served in %.1f ms (%s).\n", 1000.0 * (profile_now() - start), result == 1 ? error : "OK");
+        fflush(stdout);
+
+        stop = result == 2;
+        free(body);
+        free(line);
+        close(client);
+
+        if (home != NULL && chdir(home) != 0) fprintf(stderr, "Could not return to directory %s.\n", home);
+    }
+
+    while (state.datasets != NULL) dataset_destroy(&state, state.datasets);
+
+    close(server);
+    unlink(socket_path);
+    free(home);
+
+    printf("\nScramblyzer daemon stopped.\n");
+    return 0;
+}
+
+int serve_client(
+        const char *socket_path,
+        const char *analysis,
+        const char *gro_file,
+        const char *xtc_file,
+        const char *ndx_file,
+        const char *output_file,
+        const char *head_identifier,
+        const float dt,
+        const float time,
+        const float spatial_limit,
+        const int temporal_limit)
+{
+    int type = 0;
+    for (; type < SERVE_N_TYPES; ++type) {
+        if (!strcmp(analysis, SERVE_NAMES[type])) break;
+    }
+
+    if (type == SERVE_N_TYPES) {
+        fprintf(stderr, "Unknown analysis '%s'.\n", analysis);
+        return 1;
+    }
+
+    int needs_files = type != SERVE_STATS && type != SERVE_SHUTDOWN;
+    if (needs_files && (gro_file == NULL || xtc_file == NULL)) {
+        fprintf(stderr, "Gro file and xtc file must be supplied for analysis '%s'.\n", analysis);
+        return 1;
+    }
+
+    // fields are separated by tabs and the request by a newline
+    const char *values[] = {gro_file, xtc_file, ndx_file, head_identifier};
+    for (size_t i = 0; needs_files && i < sizeof(values) / sizeof(values[0]); ++i) {
+        if (strpbrk(values[i], "\t\n") != NULL) {
+            fprintf(stderr, "File names and selections may not contain tabs or newlines.\n");
+            return 1;
+        }
+    }
+
+    char *cwd = getcwd(NULL, 0);
+    if (cwd == NULL) {
+        fprintf(stderr, "Could not get the working directory.\n");
+        return 1;
+    }
+
+    char *request = NULL;
+    size_t request_size = 0;
+    FILE *stream = open_memstream(&request, &request_size);
+    fprintf(stream, "analysis=%s\tcwd=%s", analysis, cwd);
+    if (needs_files) {
+        fprintf(stream, "\tgro=%s\txtc=%s\tndx=%s\theads=%s", gro_file, xtc_file, ndx_file, head_identifier);
+        if (dt > 0) fprintf(stream, "\tdt=%f", dt);
+        if (time >= 0) fprintf(stream, "\ttime=%f", time);
+        fprintf(stream, "\tspatial=%f\ttemporal=%d", spatial_limit, temporal_limit);
+    }
+    fprintf(stream, "\n");
+    fclose(stream);
+    free(cwd);
+
+    if (request_size > SERVE_MAX_REQUEST) {
+        fprintf(stderr, "Request is too long.\n");
+        free(request);
+        return 1;
+    }
+
+    struct sockaddr_un address = {0};
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path %s is too long.\n", socket_path);
+        free(request);
+        return 1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    double start = profile_now();
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0 || connect(server, (struct sockaddr *) &address, sizeof(address)) != 0) {
+        fprintf(stderr, "Could not connect to the daemon at %s. Is 'scramblyzer serve' running?\n", socket_path);
+        if (server >= 0) close(server);
+        free(request);
+        return 1;
+    }
+
+    if (write_all(server, request, request_size) != 0) {
+        fprintf(stderr, "Could not send the request to the daemon.\n");
+        close(server);
+        free(request);
+        return 1;
+    }
+    shutdown(server, SHUT_WR);
+    free(request);
+
+    // read the complete response
+    size_t allocated = 4096, length = 0;
+    char *response = malloc(allocated + 1);
+    ssize_t n_read = 0;
+    while ((n_read = read(server, response + length, allocated - length)) != 0) {
+        if (n_read < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        length += (size_t) n_read;
+        if (length == allocated) {
+            allocated *= 2;
+            response = realloc(response, allocated + 1);
+        }
+    }
+    response[length] = '\0';
+    close(server);
+
+    char *body = strchr(response, '\n');
+    if (body == NULL) {
+        fprintf(stderr, "Invalid response from the daemon.\n");
+        free(response);
+        return 1;
+    }
+    *body++ = '\0';
+
+    if (strcmp(response, "OK")) {
+        fprintf(stderr, "%s\n", strncmp(response, "ERROR ", 6) ? response : response + 6);
+        free(response);
+        return 1;
+    }
+
+    size_t body_length = length - (size_t) (body - response);
+    if (output_file == NULL) {
+        fwrite(body, 1, body_length, stdout);
+    } else {
+        FILE *output = fopen(output_file, "w");
+        if (output == NULL) {
+            fprintf(stderr, "Could not open output file %s\n", output_file);
+            free(response);
+            return 1;
+        }
+
+        fwrite(body, 1, body_length, output);
+        fclose(output);
+        printf("Output file %s written (%.1f ms).\n", output_file, 1000.0 * (profile_now() - start));
+    }
+
+    free(response);
+    return 0;
+}
+
+void print_usage_serve(void)
+{
+    printf("\nValid OPTIONS for the serve module:\n");
+    printf("-h               print this message and exit\n");
+    printf("-S STRING        Unix domain socket to listen on (default: /tmp/scramblyzer-UID.sock)\n");
+    printf("-m INTEGER       memory budget for cached data in MB (default: 1024)\n");
+    printf("\n");
+}
+
+void print_usage_client(void)
+{
+    printf("\nValid OPTIONS for the client module:\n");
+    printf("-h               print this message and exit\n");
+    printf("-S STRING        Unix domain socket of the daemon (default: /tmp/scramblyzer-UID.sock)\n");
+    printf("-a STRING        analysis to request: composition, rate, flipflops, stats or shutdown\n");
+    printf("-c STRING        gro file to read\n");
+    printf("-f STRING        xtc file to read\n");
+    printf("-n STRING        ndx file to read (optional, default: index.ndx)\n");
+    printf("-o STRING        output file name (default: stdout)\n");
+    printf("-p STRING        selection of lipid head identifiers (default: name PO4)\n");
+    printf("-d FLOAT         time interval between analyzed frames in ns (default: 1.0 for composition, 10.0 for rate)\n");
+    printf("-T FLOAT         composition only: analyze the single frame at this time in ns (optional)\n");
+    printf("-s FLOAT         flipflops only: spatial limit in nm (default: 1.5)\n");
+    printf("-t INTEGER       flipflops only: temporal limit in ns (default: 10)\n");
+    printf("\n");
+}
+
+int get_arguments_serve(
+        const int argc,
+        char **argv,
+        char **socket_path,
+        size_t *memory_limit)
+{
+    int opt = 0;
+    while((opt = getopt(argc - 1, argv + 1, "S:m:h")) != -1) {
+        switch (opt) {
+        // help
+        case 'h':
+            return 1;
+        // socket
+        case 'S':
+            *socket_path = optarg;
+            break;
+        // memory budget
+        case 'm':
+            if (sscanf(optarg, "%zu", memory_limit) != 1 || *memory_limit < 1 || optarg[0] == '-') {
+                fprintf(stderr, "Memory budget must be a positive integer.\n");
+                return 1;
+            }
+            break;
+        default:
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int get_arguments_client(
+        const int argc,
+        char **argv,
+        char **socket_path,
+        char **analysis,
+        char **gro_file,
+        char **xtc_file,
+        char **ndx_file,
+        char **output_file,
+        char **phosphates,
+        float *dt,
+        float *time,
+        float *spatial_limit,
+        int *temporal_limit)
+{
+    int analysis_specified = 0;
+
+    int opt = 0;
+    while((opt = getopt(argc - 1, argv + 1, "S:a:c:f:n:o:p:d:T:s:t:h")) != -1) {
+        switch (opt) {
+        // help
+        case 'h':
+            return 1;
+        // socket
+        case 'S':
+            *socket_path = optarg;
+            break;
+        // requested analysis
+        case 'a':
+            *analysis = optarg;
+            analysis_specified = 1;
+            break;
+        // gro file to read
+        case 'c':
+            *gro_file = optarg;
+            break;
+        // xtc file to read
+        case 'f':
+            *xtc_file = optarg;
+            break;
+        // ndx file
+        case 'n':
+            *ndx_file = optarg;
+            break;
+        // output file name
+        case 'o':
+            *output_file = optarg;
+            break;
+        // phosphates identifier
+        case 'p':
+            *phosphates = optarg;
+            break;
+        // dt (time precision of the analysis)
+        case 'd':
+            if (sscanf(optarg, "%f", dt) != 1 || *dt <= 0) {
+                fprintf(stderr, "dt must be positive.\n");
+                return 1;
+            }
+            break;
+        // time of the analyzed frame
+        case 'T':
+            if (sscanf(optarg, "%f", time) != 1 || *time < 0) {
+                fprintf(stderr, "Time must be non-negative.\n");
+                return 1;
+            }
+            break;
+        // spatial limit for flipflops
+        case 's':
+            if (sscanf(optarg, "%f", spatial_limit) != 1 || *spatial_limit < 0) {
+                fprintf(stderr, "Spatial limit must be non-negative.\n");
+                return 1;
+            }
+            break;
+        // temporal limit for flipflops
+        case 't':
+            if (sscanf(optarg, "%d", temporal_limit) != 1 || *temporal_limit <= 0) {
+                fprintf(stderr, "Temporal limit must be positive.\n");
+                return 1;
+            }
+            break;
+        default:
+            return 1;
+        }
+    }
+
+    if (!analysis_specified) {
+        fprintf(stderr, "Analysis to request must always be supplied.\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,103 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <groan.h>
+#include <unistd.h>
+
+/*! @brief Prints supported flags and arguments of the serve module */
+void print_usage_serve(void);
+
+
+/*! @brief Prints supported flags and arguments of the client module */
+void print_usage_client(void);
+
+
+/*! @brief Returns the default path of the socket of the daemon (/tmp/scramblyzer-UID.sock). Must be deallocated using free(). */
+char *serve_default_socket(void);
+
+
+/*! @brief Parses command line arguments for the serve module.
+ *
+ * @return Zero, if parsing has been successful. Else returns non-zero.
+ */
+int get_arguments_serve(
+        const int argc,
+        char **argv,
+        char **socket_path,
+        size_t *memory_limit);
+
+
+/*! @brief Parses command line arguments for the client module.
+ *
+ * @return Zero, if parsing has been successful. Else returns non-zero.
+ */
+int get_arguments_client(
+        const int argc,
+        char **argv,
+        char **socket_path,
+        char **analysis,
+        char **gro_file,
+        char **xtc_file,
+        char **ndx_file,
+        char **output_file,
+        char **phosphates,
+        float *dt,
+        float *time,
+        float *spatial_limit,
+        int *temporal_limit);
+
+
+/*! @brief Runs the analysis daemon listening on a Unix domain socket.
+ *
+ * @paragraph Requests
+ * Every connection carries a single request: one line of tab-separated 'key=value' fields sent by serve_client().
+ * The daemon answers with a status line ('OK' or 'ERROR message') followed by the results and closes the connection.
+ * Requests are processed one after another in the working directory of the client, so relative paths and 'lipids.txt'
+ * are resolved the same way as when running the module directly.
+ *
+ * @paragraph Caches
+ * Loaded systems, identified lipids and detected membranes are kept for every combination of input files
+ * and head identifier (a data set) and reused until the gro or xtc file changes. The times of all trajectory frames
+ * are indexed once. For every decoded frame, only the box, the positions of lipid heads and the centers of the membranes
+ * are kept. Frames that have been decoded before are never decompressed again; if all frames needed by a request
+ * are cached, the trajectory is not read at all.
+ *
+ * @paragraph Memory budget
+ * Cached frames are kept in a least-recently-used list. When the memory used by data sets and frames exceeds
+ * memory_limit, the least recently used frames are evicted first, then the least recently used data sets.
+ *
+ * @param socket_path       path of the Unix domain socket (an existing socket file is replaced)
+ * @param memory_limit      memory budget for cached data [MB]
+ * @param single_membrane   analyze all lipids of every data set as a single membrane (see membranes_detect())
+ *
+ * @return Zero, if the daemon has been stopped normally (by a 'shutdown' request or by SIGINT/SIGTERM). Else non-zero.
+ */
+int serve_run(const char *socket_path, const size_t memory_limit, const int single_membrane);
+
+
+/*! @brief Submits a request to the analysis daemon and writes the results into output_file (stdout if NULL).
+ *
+ * @paragraph Analyses
+ * 'composition' (every dt ns, or a single frame at the given time if time is non-negative), 'rate' (every dt ns)
+ * and 'flipflops' (with the given spatial and temporal limits) produce the same results as the corresponding modules.
+ * 'stats' reports the content of the caches and 'shutdown' stops the daemon.
+ *
+ * @return Zero, if the request was successful. Else non-zero.
+ */
+int serve_client(
+        const char *socket_path,
+        const char *analysis,
+        const char *gro_file,
+        const char *xtc_file,
+        const char *ndx_file,
+        const char *output_file,
+        const char *head_identifier,
+        const float dt,
+        const float time,
+        const float spatial_limit,
+        const int temporal_limit);
+
+#endif /* SERVE_H */
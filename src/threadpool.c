@@ -0,0 +1,291 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "threadpool.h"
+
+/*! @brief Tasks assigned to a single thread. The owner takes tasks from the head, thieves from the tail. */
+typedef struct task_queue {
+    pthread_mutex_t lock;
+    size_t *tasks;
+    size_t head;
+    size_t tail;                // one past the last remaining task
+} task_queue_t;
+
+/*! @brief Threads of the pool and the state shared by them. */
+struct thread_pool {
+    size_t n_threads;           // number of threads (queues) of the pool
+    size_t n_started;           // number of threads that have actually been created
+    pthread_t *threads;
+    struct worker *workers;
+    task_queue_t *queues;       // one queue per thread
+    size_t capacity;            // number of tasks each queue can hold
+    thread_pool_task_t task;    // function performing the tasks of the current run
+    void *data;                 // data of the current run
+    pthread_mutex_t lock;       // protects the fields below
+    pthread_cond_t start;       // signaled when a new run starts or when the pool is destroyed
+    pthread_cond_t done;        // signaled when the last thread finishes its tasks of the current run
+    size_t generation;          // number of started runs
+    size_t n_active;            // number of threads still performing tasks of the current run
+    int stop;                   // set when the pool is being destroyed
+};
+
+/*! @brief Arguments of a single worker thread. */
+typedef struct worker {
+    thread_pool_t *pool;
+    size_t id;
+} worker_t;
+
+size_t thread_pool_default_threads(void)
+{
+    long n_processors = sysconf(_SC_NPROCESSORS_ONLN);
+    return n_processors > 0 ? (size_t) n_processors : 1;
+}
+
+/*! @brief Takes the next task from the head of the queue. Returns 1 if a task was taken, else 0. */
+static int queue_pop(task_queue_t *queue, size_t *task)
+{
+    int found = 0;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->head < queue->tail) {
+        *task = queue->tasks[queue->head++];
+        found = 1;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+/*! @brief Takes the last task from the tail of the queue. Returns 1 if a task was taken, else 0. */
+static int queue_steal(task_queue_t *queue, size_t *task)
+{
+    int found = 0;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->head < queue->tail) {
+        *task = queue->tasks[--queue->tail];
+        found = 1;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+/*! @brief Performs tasks of its own queue and then steals tasks from other queues until no tasks remain. */
+static void worker_run(const worker_t *worker)
+{
+    thread_pool_t *pool = worker->pool;
+
+    size_t task = 0;
+    for (;;) {
+        if (queue_pop(&pool->queues[worker->id], &task)) {
+            pool->task(task, worker->id, pool->data);
+            continue;
+        }
+
+        // own queue is empty; try to steal from other threads
+        int stolen = 0;
+        for (size_t i = 1; i < pool->n_threads && !stolen; ++i) {
+            stolen = queue_steal(&pool->queues[(worker->id + i) % pool->n_threads], &task);
+        }
+
+        // no tasks remain anywhere (tasks are never added after the start)
+        if (!stolen) break;
+        pool->task(task, worker->id, pool->data);
+    }
+}
+
+/*! @brief Waits for runs of the pool and performs their tasks until the pool is destroyed. */
+static void *worker_loop(void *arg)
+{
+    worker_t *worker = (worker_t *) arg;
+    thread_pool_t *pool = worker->pool;
+
+    size_t generation = 0;
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->stop && pool->generation == generation) pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->stop) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        generation = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        worker_run(worker);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->n_active == 0) pthread_cond_signal(&pool->done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return NULL;
+}
+
+/*! @brief Task index with its weight; sorted without any shared state, so that the pool can be run concurrently. */
+typedef struct weighted_task {
+    size_t index;
+    size_t weight;
+} weighted_task_t;
+
+/*! @brief Sorts tasks from the heaviest to the lightest task. */
+static int compare_tasks(const void *a, const void *b)
+{
+    const weighted_task_t *task_a = (const weighted_task_t *) a;
+    const weighted_task_t *task_b = (const weighted_task_t *) b;
+    if (task_a->weight != task_b->weight) return task_a->weight < task_b->weight ? 1 : -1;
+
+    // keep the original order of tasks with the same weight
+    return task_a->index < task_b->index ? -1 : 1;
+}
+
+thread_pool_t *thread_pool_create(size_t n_threads)
+{
+    if (n_threads < 1) n_threads = 1;
+
+    thread_pool_t *pool = calloc(1, sizeof(thread_pool_t));
+    pool->n_threads = n_threads;
+    pool->queues = calloc(n_threads, sizeof(task_queue_t));
+    for (size_t i = 0; i < n_threads; ++i) pthread_mutex_init(&pool->queues[i].lock, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    // a single thread performs the tasks in the calling thread
+    if (n_threads == 1) return pool;
+
+    pool->threads = calloc(n_threads, sizeof(pthread_t));
+    pool->workers = calloc(n_threads, sizeof(worker_t));
+    for (size_t i = 0; i < n_threads; ++i) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].id = i;
+        if (pthread_create(&pool->threads[i], NULL, worker_loop, &pool->workers[i]) != 0) {
+            fprintf(stderr, "Warning. Could not create thread %zu. Its tasks will be performed by other threads.\n", i);
+            break;
+        }
+        ++pool->n_started;
+    }
+
+    return pool;
+}
+
+int thread_pool_execute(
+        thread_pool_t *pool,
+        const size_t n_tasks,
+        const size_t *weights,
+        thread_pool_task_t task,
+        void *data)
+{
+    if (n_tasks == 0) return 0;
+
+    // order the tasks from the heaviest to the lightest
+    size_t *order = malloc(n_tasks * sizeof(size_t));
+    for (size_t i = 0; i < n_tasks; ++i) order[i] = i;
+    if (weights != NULL) {
+        weighted_task_t *sorted = malloc(n_tasks * sizeof(weighted_task_t));
+        for (size_t i = 0; i < n_tasks; ++i) {
+            sorted[i].index = i;
+            sorted[i].weight = weights[i];
+        }
+
+        qsort(sorted, n_tasks, sizeof(weighted_task_t), compare_tasks);
+        for (size_t i = 0; i < n_tasks; ++i) order[i] = sorted[i].index;
+        free(sorted);
+    }
+
+    if (pool->n_threads == 1) {
+        for (size_t i = 0; i < n_tasks; ++i) task(order[i], 0, data);
+        free(order);
+        return 0;
+    }
+
+    if (n_tasks > pool->capacity) {
+        for (size_t i = 0; i < pool->n_threads; ++i) {
+            free(pool->queues[i].tasks);
+            pool->queues[i].tasks = malloc(n_tasks * sizeof(size_t));
+        }
+        pool->capacity = n_tasks;
+    }
+
+    for (size_t i = 0; i < pool->n_threads; ++i) pool->queues[i].head = pool->queues[i].tail = 0;
+
+    // assign each task to the thread with the lowest total weight so far
+    size_t *load = calloc(pool->n_threads, sizeof(size_t));
+    for (size_t i = 0; i < n_tasks; ++i) {
+        size_t lightest = 0;
+        for (size_t j = 1; j < pool->n_threads; ++j) {
+            if (load[j] < load[lightest]) lightest = j;
+        }
+
+        task_queue_t *queue = &pool->queues[lightest];
+        queue->tasks[queue->tail++] = order[i];
+        load[lightest] += weights != NULL ? weights[order[i]] : 1;
+    }
+
+    free(load);
+    free(order);
+
+    pool->task = task;
+    pool->data = data;
+
+    // if some threads could not be created, the started threads steal their tasks
+    // if no thread could be created, all tasks are performed by the calling thread
+    if (pool->n_started == 0) {
+        worker_t worker = { .pool = pool, .id = 0 };
+        worker_run(&worker);
+        return 0;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->n_active = pool->n_started;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    while (pool->n_active > 0) pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+
+    return 0;
+}
+
+void thread_pool_destroy(thread_pool_t *pool)
+{
+    if (pool == NULL) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < pool->n_started; ++i) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    for (size_t i = 0; i < pool->n_threads; ++i) {
+        pthread_mutex_destroy(&pool->queues[i].lock);
+        free(pool->queues[i].tasks);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+
+    free(pool->queues);
+    free(pool->threads);
+    free(pool->workers);
+    free(pool);
+}
+
+int thread_pool_run(
+        size_t n_threads,
+        const size_t n_tasks,
+        const size_t *weights,
+        thread_pool_task_t task,
+        void *data)
+{
+    if (n_tasks == 0) return 0;
+    if (n_threads > n_tasks) n_threads = n_tasks;
+
+    thread_pool_t *pool = thread_pool_create(n_threads);
+    int result = thread_pool_execute(pool, n_tasks, weights, task, data);
+    thread_pool_destroy(pool);
+
+    return result;
+}
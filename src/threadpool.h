@@ -0,0 +1,91 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <stdlib.h>
+
+/*! @brief Function performing a single task. 'index' is the index of the task, 'thread' is the index of the thread performing it. */
+typedef void (*thread_pool_task_t)(size_t index, size_t thread, void *data);
+
+
+/*! @brief Returns the number of available processors (at least 1). */
+size_t thread_pool_default_threads(void);
+
+
+/*! @brief Pool of threads that are created once and perform the tasks of repeated runs (see thread_pool_execute()). */
+typedef struct thread_pool thread_pool_t;
+
+
+/*! @brief Creates a pool of n_threads threads waiting for tasks.
+ *
+ * @paragraph Single thread
+ * If n_threads is 1, no thread is created and the tasks are performed in the calling thread.
+ *
+ * @paragraph Note on deallocation
+ * The returned pointer must be deallocated using thread_pool_destroy().
+ *
+ * @return Pointer to the created pool.
+ */
+thread_pool_t *thread_pool_create(size_t n_threads);
+
+
+/*! @brief Performs n_tasks tasks using the threads of the pool and waits for all of them to finish.
+ *
+ * @paragraph Reuse of threads
+ * The threads of the pool are reused by all runs, so running short batches of tasks (e.g. once per trajectory frame)
+ * does not pay for creating and joining threads. Tasks are scheduled as in thread_pool_run(). Only one run
+ * of the same pool may be in progress at a time.
+ *
+ * @param pool              pool created by thread_pool_create()
+ * @param n_tasks           number of tasks to perform
+ * @param weights           estimated cost of each task (if NULL, all tasks have the same cost)
+ * @param task              function performing a single task ('thread' is smaller than the number of threads of the pool)
+ * @param data              data passed to every call of the task function
+ *
+ * @return Zero.
+ */
+int thread_pool_execute(
+        thread_pool_t *pool,
+        const size_t n_tasks,
+        const size_t *weights,
+        thread_pool_task_t task,
+        void *data);
+
+
+/*! @brief Stops the threads of the pool and deallocates it. */
+void thread_pool_destroy(thread_pool_t *pool);
+
+
+/*! @brief Performs n_tasks tasks using a temporary pool of n_threads threads and waits for all of them to finish.
+ *
+ * @paragraph Scheduling
+ * Each task has a weight (e.g. the size of the file it reads) that is used to estimate its cost.
+ * Tasks are distributed between the threads before the start so that the total weight of tasks
+ * of each thread is as balanced as possible (the heaviest tasks are distributed first). Each thread then
+ * performs its own tasks from the heaviest to the lightest. A thread that runs out of its own tasks
+ * steals the lightest remaining task of another thread, so no thread is idle while tasks remain.
+ *
+ * @paragraph Single thread
+ * If n_threads is 1, the tasks are performed in the calling thread from the heaviest to the lightest.
+ *
+ * @param n_threads         number of threads to use
+ * @param n_tasks           number of tasks to perform
+ * @param weights           estimated cost of each task (if NULL, all tasks have the same cost)
+ * @param task              function performing a single task
+ * @param data              data passed to every call of the task function
+ *
+ * @paragraph Failure to create threads
+ * If some threads could not be created, their tasks are stolen by the other threads. All tasks are always performed.
+ *
+ * @return Zero.
+ */
+int thread_pool_run(
+        size_t n_threads,
+        const size_t n_tasks,
+        const size_t *weights,
+        thread_pool_task_t task,
+        void *data);
+
+#endif /* THREADPOOL_H */
@@ -0,0 +1,380 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "gro.h"
+#include "topology.h"
+
+/*! @brief Identifier at the start of every topology cache file */
+static const char TOPOLOGY_MAGIC[8] = "SCRMBTOP";
+/*! @brief Version of the topology cache format (part of the cache key) */
+static const uint32_t TOPOLOGY_VERSION = 1;
+/*! @brief Length of the lipid names in the cache file */
+#define TOPOLOGY_NAME_LENGTH 16
+/*! @brief File with user-defined lipids (see read_lipid_names()) */
+static const char LIPIDS_TXT[] = "lipids.txt";
+/*! @brief File with lipid-specific head identifiers (see read_head_identifiers()) */
+static const char HEADS_TXT[] = "heads.txt";
+
+/*! @brief Directory with the cache files (NULL if the cache is disabled) */
+static const char *cache_directory = NULL;
+
+/*! @brief Header of the topology cache file. All following data are aligned to 8 bytes. */
+typedef struct topology_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t atom_size;         // sizeof(atom_t) of the program that wrote the cache
+    uint64_t key;               // hash of the input files (see topology_key())
+    uint64_t system_size;       // size of the stored system_t structure including padding [bytes]
+    uint64_t n_atoms;
+    uint64_t n_lipid_atoms;
+    uint64_t n_lipid_types;
+} topology_header_t;
+
+void topology_cache_enable(const char *directory)
+{
+    cache_directory = directory;
+}
+
+/*! @brief Updates a 64-bit FNV-1a hash with the provided data. */
+static uint64_t hash_update(uint64_t hash, const void *data, const size_t length)
+{
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+/*! @brief Updates the hash with the contents of a file. A missing file is hashed differently than an empty file. */
+static uint64_t hash_file(uint64_t hash, const char *filename)
+{
+    FILE *file = fopen(filename, "rb");
+    unsigned char present = (file != NULL);
+    hash = hash_update(hash, &present, 1);
+    if (file == NULL) return hash;
+
+    unsigned char buffer[65536];
+    size_t read = 0;
+    uint64_t total = 0;
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        hash = hash_update(hash, buffer, read);
+        total += read;
+    }
+
+    fclose(file);
+    // length separates the contents of consecutive files
+    return hash_update(hash, &total, sizeof(uint64_t));
+}
+
+/*! @brief Calculates the cache key from the contents of all input files (including heads.txt) and from the head identifier. */
+static uint64_t topology_key(const char *gro_file, const char *ndx_file, const char *head_identifier)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    hash = hash_update(hash, &TOPOLOGY_VERSION, sizeof(uint32_t));
+    hash = hash_update(hash, head_identifier, strlen(head_identifier) + 1);
+    hash = hash_file(hash, gro_file);
+    hash = hash_file(hash, ndx_file);
+    hash = hash_file(hash, LIPIDS_TXT);
+    hash = hash_file(hash, HEADS_TXT);
+
+    return hash;
+}
+
+/*! @brief Size of the system_t structure with n_atoms atoms, padded to 8 bytes. */
+static size_t system_size(const size_t n_atoms)
+{
+    size_t size = sizeof(system_t) + n_atoms * sizeof(atom_t);
+    return (size + 7) / 8 * 8;
+}
+
+/*! @brief Gets the name of the cache file for the given key. Must be deallocated using free(). */
+static char *cache_file_name(const uint64_t key)
+{
+    size_t length = strlen(cache_directory) + 32;
+    char *name = calloc(length, 1);
+    snprintf(name, length, "%s/%016llx", cache_directory, (unsigned long long) key);
+    return name;
+}
+
+/*! @brief Reads the system and identifies the lipids without using the cache. */
+static lipid_composition_t *load_uncached(
+        const char *gro_file,
+        const char *ndx_file,
+        const char *head_identifier,
+        system_t **system)
+{
+    // read gro file
+    *system = gro_load(gro_file);
+    if (*system == NULL) return NULL;
+
+    // read ndx file
+    dict_t *ndx_groups = read_ndx(ndx_file, *system);
+
+    // get lipids present in the system
+    lipid_composition_t *composition = get_lipid_composition(*system, head_identifier, ndx_groups);
+    dict_destroy(ndx_groups);
+
+    if (composition == NULL) {
+        free(*system);
+        *system = NULL;
+    }
+
+    return composition;
+}
+
+/*! @brief Gets indices of the head atoms of a lipid type in the system (the original atoms, also if the heads are centers). */
+static uint64_t *head_indices(const lipid_composition_t *composition, const system_t *system, const size_t type, uint64_t *n_heads)
+{
+    atom_selection_t *selection = *((atom_selection_t **) dict_get(composition->lipids_dictionary, composition->lipid_types[type]));
+
+    if (composition->n_centers == 0) {
+        *n_heads = selection->n_atoms;
+        uint64_t *indices = malloc((selection->n_atoms + 1) * sizeof(uint64_t));
+        for (size_t i = 0; i < selection->n_atoms; ++i) {
+            indices[i] = (uint64_t) (selection->atoms[i] - system->atoms);
+        }
+        return indices;
+    }
+
+    *n_heads = 0;
+    for (size_t i = 0; i < selection->n_atoms; ++i) {
+        size_t center = (size_t) (selection->atoms[i] - composition->centers);
+        *n_heads += composition->center_start[center + 1] - composition->center_start[center];
+    }
+
+    uint64_t *indices = malloc((*n_heads + 1) * sizeof(uint64_t));
+    size_t index = 0;
+    for (size_t i = 0; i < selection->n_atoms; ++i) {
+        size_t center = (size_t) (selection->atoms[i] - composition->centers);
+        for (size_t a = composition->center_start[center]; a < composition->center_start[center + 1]; ++a) {
+            indices[index++] = (uint64_t) (composition->center_atoms[a] - system->atoms);
+        }
+    }
+
+    return indices;
+}
+
+/*! @brief Writes the system and the lipid composition into the cache file. The file is written atomically. */
+static int write_cache(const char *filename, const uint64_t key, const system_t *system, const lipid_composition_t *composition)
+{
+    if (mkdir(cache_directory, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Warning. Could not create topology cache directory %s.\n", cache_directory);
+        return 1;
+    }
+
+    size_t tmp_length = strlen(filename) + 8;
+    char *tmp_name = calloc(tmp_length, 1);
+    snprintf(tmp_name, tmp_length, "%s.tmp", filename);
+
+    FILE *file = fopen(tmp_name, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Warning. Could not write topology cache file %s.\n", filename);
+        free(tmp_name);
+        return 1;
+    }
+
+    topology_header_t header = {0};
+    memcpy(header.magic, TOPOLOGY_MAGIC, sizeof(TOPOLOGY_MAGIC));
+    header.version = TOPOLOGY_VERSION;
+    header.atom_size = sizeof(atom_t);
+    header.key = key;
+    header.system_size = system_size(system->n_atoms);
+    header.n_atoms = system->n_atoms;
+    header.n_lipid_atoms = composition->all_lipid_atoms->n_atoms;
+    header.n_lipid_types = composition->n_lipid_types;
+
+    int failed = fwrite(&header, sizeof(topology_header_t), 1, file) != 1;
+
+    // system including padding
+    size_t unpadded = sizeof(system_t) + system->n_atoms * sizeof(atom_t);
+    char padding[8] = {0};
+    failed |= fwrite(system, 1, unpadded, file) != unpadded;
+    failed |= fwrite(padding, 1, header.system_size - unpadded, file) != header.system_size - unpadded;
+
+    // lipid atoms
+    for (size_t i = 0; i < composition->all_lipid_atoms->n_atoms && !failed; ++i) {
+        uint64_t index = (uint64_t) (composition->all_lipid_atoms->atoms[i] - system->atoms);
+        failed |= fwrite(&index, sizeof(uint64_t), 1, file) != 1;
+    }
+
+    // heads of the individual lipid types
+    for (size_t i = 0; i < composition->n_lipid_types && !failed; ++i) {
+        char name[TOPOLOGY_NAME_LENGTH] = {0};
+        strncpy(name, composition->lipid_types[i], TOPOLOGY_NAME_LENGTH - 1);
+
+        uint64_t n_heads = 0;
+        uint64_t *indices = head_indices(composition, system, i, &n_heads);
+
+        failed |= fwrite(name, 1, TOPOLOGY_NAME_LENGTH, file) != TOPOLOGY_NAME_LENGTH;
+        failed |= fwrite(&n_heads, sizeof(uint64_t), 1, file) != 1;
+        failed |= fwrite(indices, sizeof(uint64_t), n_heads, file) != n_heads;
+        free(indices);
+    }
+
+    failed |= (fclose(file) != 0);
+
+    if (failed || rename(tmp_name, filename) != 0) {
+        fprintf(stderr, "Warning. Could not write topology cache file %s.\n", filename);
+        remove(tmp_name);
+        free(tmp_name);
+        return 1;
+    }
+
+    free(tmp_name);
+    return 0;
+}
+
+/*! @brief Reorders lipid types of the composition to match the order in which they were stored in the cache. */
+static void reorder_lipid_types(lipid_composition_t *composition, char **cached_names)
+{
+    for (size_t i = 0; i < composition->n_lipid_types; ++i) {
+        for (size_t j = i; j < composition->n_lipid_types; ++j) {
+            if (strncmp(composition->lipid_types[j], cached_names[i], TOPOLOGY_NAME_LENGTH - 1)) continue;
+
+            char *swap = composition->lipid_types[i];
+            composition->lipid_types[i] = composition->lipid_types[j];
+            composition->lipid_types[j] = swap;
+            break;
+        }
+    }
+}
+
+/*! @brief Restores the system and the lipid composition from a memory-mapped cache file.
+ *
+ * @return Pointer to the lipid composition. NULL if the cache file is missing or invalid.
+ */
+static lipid_composition_t *read_cache(const char *filename, const uint64_t key, system_t **system)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat file_stat = {0};
+    if (fstat(fd, &file_stat) != 0 || (size_t) file_stat.st_size < sizeof(topology_header_t)) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t file_size = (size_t) file_stat.st_size;
+    void *map = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    const char *data = map;
+    const char *end = data + file_size;
+    const topology_header_t *header = map;
+
+    if (memcmp(header->magic, TOPOLOGY_MAGIC, sizeof(TOPOLOGY_MAGIC)) || header->version != TOPOLOGY_VERSION ||
+        header->atom_size != sizeof(atom_t) || header->key != key || header->system_size != system_size(header->n_atoms) ||
+        (size_t) (end - data) < sizeof(topology_header_t) + header->system_size + header->n_lipid_atoms * sizeof(uint64_t)) {
+        fprintf(stderr, "Warning. Topology cache file %s is invalid and will be replaced.\n", filename);
+        munmap(map, file_size);
+        return NULL;
+    }
+
+    data += sizeof(topology_header_t);
+
+    // the system is copied in a single block, so it can be deallocated using free()
+    *system = malloc(header->system_size);
+    memcpy(*system, data, header->system_size);
+    data += header->system_size;
+    const size_t n_atoms = (*system)->n_atoms;
+    int failed = (n_atoms != header->n_atoms);
+
+    lipid_composition_t *composition = calloc(1, sizeof(lipid_composition_t));
+
+    const uint64_t *lipid_atoms = (const uint64_t *) data;
+    size_t allocated = header->n_lipid_atoms > 0 ? header->n_lipid_atoms : 1;
+    composition->all_lipid_atoms = selection_create(allocated);
+    for (size_t i = 0; i < header->n_lipid_atoms && !failed; ++i) {
+        if (lipid_atoms[i] >= n_atoms) failed = 1;
+        else selection_add_atom(&composition->all_lipid_atoms, &allocated, &(*system)->atoms[lipid_atoms[i]]);
+    }
+    data += header->n_lipid_atoms * sizeof(uint64_t);
+
+    composition->lipids_dictionary = dict_create();
+    char **cached_names = calloc(header->n_lipid_types, sizeof(char *));
+    for (size_t i = 0; i < header->n_lipid_types && !failed; ++i) {
+        if ((size_t) (end - data) < TOPOLOGY_NAME_LENGTH + sizeof(uint64_t)) {
+            failed = 1;
+            break;
+        }
+
+        cached_names[i] = calloc(TOPOLOGY_NAME_LENGTH, 1);
+        memcpy(cached_names[i], data, TOPOLOGY_NAME_LENGTH - 1);
+        data += TOPOLOGY_NAME_LENGTH;
+
+        uint64_t n_heads = *((const uint64_t *) data);
+        data += sizeof(uint64_t);
+        if ((size_t) (end - data) < n_heads * sizeof(uint64_t)) {
+            failed = 1;
+            break;
+        }
+
+        const uint64_t *heads = (const uint64_t *) data;
+        size_t allocated_heads = n_heads > 0 ? n_heads : 1;
+        atom_selection_t *selection = selection_create(allocated_heads);
+        for (size_t j = 0; j < n_heads; ++j) {
+            if (heads[j] >= n_atoms) failed = 1;
+            else selection_add_atom(&selection, &allocated_heads, &(*system)->atoms[heads[j]]);
+        }
+        data += n_heads * sizeof(uint64_t);
+
+        dict_set(composition->lipids_dictionary, cached_names[i], &selection, sizeof(atom_selection_t *));
+    }
+
+    munmap(map, file_size);
+
+    composition->n_lipid_types = dict_keys(composition->lipids_dictionary, &composition->lipid_types);
+    if (!failed) {
+        reorder_lipid_types(composition, cached_names);
+        // heads consisting of multiple atoms are grouped in the same way as without the cache
+        lipid_composition_prepare_centers(composition, (*system)->box);
+    }
+
+    lipid_names_destroy(cached_names, header->n_lipid_types);
+
+    if (failed) {
+        fprintf(stderr, "Warning. Topology cache file %s is invalid and will be replaced.\n", filename);
+        lipid_composition_destroy(composition);
+        free(*system);
+        *system = NULL;
+        return NULL;
+    }
+
+    return composition;
+}
+
+lipid_composition_t *topology_load(
+        const char *gro_file,
+        const char *ndx_file,
+        const char *head_identifier,
+        system_t **system)
+{
+    if (cache_directory == NULL) return load_uncached(gro_file, ndx_file, head_identifier, system);
+
+    uint64_t key = topology_key(gro_file, ndx_file, head_identifier);
+    char *cache_file = cache_file_name(key);
+
+    lipid_composition_t *composition = read_cache(cache_file, key, system);
+    if (composition != NULL) {
+        printf("Topology loaded from cache %s.\n\n", cache_file);
+        free(cache_file);
+        return composition;
+    }
+
+    composition = load_uncached(gro_file, ndx_file, head_identifier, system);
+    if (composition != NULL && write_cache(cache_file, key, *system, composition) == 0) {
+        printf("Topology cache %s written.\n\n", cache_file);
+    }
+
+    free(cache_file);
+    return composition;
+}
@@ -0,0 +1,43 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <groan.h>
+#include "general.h"
+
+/*! @brief Enables the binary topology cache. See topology_load() for more details.
+ *
+ * @param directory     directory into which the cache files are written (created if it does not exist)
+ */
+void topology_cache_enable(const char *directory);
+
+
+/*! @brief Reads the system from a gro file and identifies the lipids (see get_lipid_composition()).
+ *
+ * @paragraph Topology cache
+ * If the cache is enabled (see topology_cache_enable()), the result of reading the gro file and of identifying
+ * the lipids is stored in a binary cache file. The name of the file is derived from a hash of the contents of the gro file,
+ * of the ndx file, of 'lipids.txt', of 'heads.txt' and of the head identifier, so the cache is never used for different inputs.
+ * If a matching cache file exists, it is memory-mapped and the system and the lipid composition are restored
+ * from it without parsing any text files.
+ *
+ * @paragraph Cache file
+ * The cache file contains the complete system_t structure followed by the indices of all lipid atoms
+ * and the indices of the head atoms of each lipid type. Cache files are only valid on the machine they were written on.
+ *
+ * @param gro_file          gro file to read
+ * @param ndx_file          ndx file to read (may not exist)
+ * @param head_identifier   selection of the lipid head identifiers
+ * @param system            pointer to which the loaded system is saved (must be deallocated using free())
+ *
+ * @return Pointer to the lipid composition (must be deallocated using lipid_composition_destroy()). NULL in case of an error.
+ */
+lipid_composition_t *topology_load(
+        const char *gro_file,
+        const char *ndx_file,
+        const char *head_identifier,
+        system_t **system);
+
+#endif /* TOPOLOGY_H */
@@ -0,0 +1,423 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "trajectory.h"
+#include "xtc.h"
+
+/*! @brief How long to wait for the file to grow before checking the interrupt flag again [ms] */
+static const int FOLLOW_WAIT_MS = 500;
+
+/*! @brief Path used to read the trajectory from the standard input ('-f -') */
+static const char STDIN_PATH[] = "/dev/stdin";
+
+/*! @brief Number of bytes read at once when searching for the start of a frame after trajectory_seek() */
+static const size_t RESYNC_CHUNK_SIZE = 65536;
+
+/*! @brief Set by the SIGINT handler when following should stop */
+static volatile sig_atomic_t follow_interrupted = 0;
+
+/*! @brief Handles SIGINT in follow mode. */
+static void follow_interrupt_handler(int signal)
+{
+    (void) signal;
+    follow_interrupted = 1;
+}
+
+trajectory_t *trajectory_open(const char *filename, const size_t n_atoms)
+{
+    // anything that is not a regular file (stdin, pipes) can only be read sequentially
+    struct stat file_stat;
+    int stream = !strcmp(filename, "-") || (stat(filename, &file_stat) == 0 && !S_ISREG(file_stat.st_mode));
+    if (!strcmp(filename, "-")) filename = STDIN_PATH;
+
+    trajectory_t *traj = calloc(1, sizeof(trajectory_t));
+    traj->n_atoms = (int) n_atoms;
+    traj->stream = stream;
+    traj->fd = -1;
+    traj->inotify_fd = -1;
+
+    // frames of regular files are read directly from their offsets; streams are read through the xdr library
+    if (stream) {
+        traj->xtc = xdrfile_open(filename, "r");
+    } else {
+        traj->fd = open(filename, O_RDONLY);
+    }
+
+    if (traj->xtc == NULL && traj->fd < 0) {
+        trajectory_close(traj);
+        return NULL;
+    }
+
+    traj->coordinates = malloc(3 * n_atoms * sizeof(float));
+    if (traj->coordinates == NULL) {
+        fprintf(stderr, "Could not allocate memory for reading the trajectory.\n");
+        trajectory_close(traj);
+        return NULL;
+    }
+
+    return traj;
+}
+
+int trajectory_follow(trajectory_t *traj, const char *filename)
+{
+    // inotify is optional; if it is not available, the file size is polled (streams just wait for data)
+    traj->inotify_fd = traj->stream ? -1 : inotify_init1(IN_NONBLOCK);
+    if (traj->inotify_fd >= 0 && inotify_add_watch(traj->inotify_fd, filename, IN_MODIFY | IN_CLOSE_WRITE) < 0) {
+        close(traj->inotify_fd);
+        traj->inotify_fd = -1;
+    }
+
+    struct sigaction action = {0};
+    action.sa_handler = follow_interrupt_handler;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+
+    traj->follow = 1;
+    return 0;
+}
+
+int trajectory_validate(trajectory_t *traj)
+{
+    int header[2] = {0};
+
+    if (traj->stream) {
+        // the header is consumed, so trajectory_next() must not read it again
+        if (xdrfile_read_int(header, 2, traj->xtc) != 2) return 0;
+        traj->header_pending = 1;
+    } else {
+        unsigned char bytes[8] = {0};
+        if (pread(traj->fd, bytes, sizeof(bytes), 0) != sizeof(bytes)) return 0;
+        header[0] = xtc_int(bytes);
+        header[1] = xtc_int(bytes + 4);
+    }
+
+    return header[0] == XTC_MAGIC && header[1] == traj->n_atoms;
+}
+
+/*! @brief Determines the size of the frame starting at the given offset from its raw bytes.
+ *
+ * @return Size of the frame in bytes if it is complete, zero if it is not (yet) complete, negative number if there is no valid frame at the offset.
+ */
+static off_t frame_size_at(const trajectory_t *traj, const off_t offset)
+{
+    unsigned char header[XTC_HEADER_SIZE + XTC_COMPRESSED_HEADER_SIZE] = {0};
+    ssize_t n_read = pread(traj->fd, header, sizeof(header), offset);
+    if (n_read < 0) return -1;
+
+    off_t size = xtc_frame_size(header, (size_t) n_read);
+    if (size > 0 && offset + size > traj->file_size) return 0;
+    return size;
+}
+
+/*! @brief Checks whether the frame starting at the current offset has been completely written.
+ *
+ * @return Size of the frame in bytes if it is complete, zero if it is not (yet) complete, negative number in case of an error.
+ */
+static off_t complete_frame_size(trajectory_t *traj)
+{
+    struct stat file_stat;
+    if (fstat(traj->fd, &file_stat) != 0) return -1;
+    traj->file_size = file_stat.st_size;
+
+    return frame_size_at(traj, traj->offset);
+}
+
+/*! @brief Waits until the followed file is modified or until FOLLOW_WAIT_MS passes. */
+static void wait_for_growth(const trajectory_t *traj)
+{
+    if (traj->inotify_fd >= 0) {
+        struct pollfd descriptor = { .fd = traj->inotify_fd, .events = POLLIN, .revents = 0 };
+        if (poll(&descriptor, 1, FOLLOW_WAIT_MS) > 0) {
+            // drain the pending events; only the fact that the file changed is important
+            char events[4096];
+            while (read(traj->inotify_fd, events, sizeof(events)) > 0);
+        }
+        return;
+    }
+
+    struct timespec wait = { .tv_sec = FOLLOW_WAIT_MS / 1000, .tv_nsec = (FOLLOW_WAIT_MS % 1000) * 1000000L };
+    nanosleep(&wait, NULL);
+}
+
+/*! @brief Checks the magic number and the number of atoms of the frame and reads the rest of its header (step and time). */
+static int read_header(trajectory_t *traj, const int magic, const int n_atoms)
+{
+    if (magic != XTC_MAGIC) {
+        fprintf(stderr, "Invalid xtc frame (magic number %d).\n", magic);
+        return -1;
+    }
+
+    if (xdrfile_read_int(&traj->step, 1, traj->xtc) != 1 ||
+        xdrfile_read_float(&traj->time, 1, traj->xtc) != 1) {
+        fprintf(stderr, "Could not read header of an xtc frame.\n");
+        return -1;
+    }
+
+    if (n_atoms != traj->n_atoms) {
+        fprintf(stderr, "Number of atoms in an xtc frame (%d) does not match the expected number of atoms (%d).\n", n_atoms, traj->n_atoms);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*! @brief Reads the magic number and the number of atoms of the next frame of a stream.
+ * Sizes of frames are not known in advance, so a truncated frame at the end of a stream is reported as an error
+ * once its coordinates are read.
+ *
+ * @return Zero, if successful. One, if the end of the stream has been reached (or reading was interrupted by Ctrl+C).
+ */
+static int stream_next(trajectory_t *traj, int *magic, int *n_atoms)
+{
+    if (traj->header_pending) {
+        traj->header_pending = 0;
+        *magic = XTC_MAGIC;
+        *n_atoms = traj->n_atoms;
+        return 0;
+    }
+
+    if (follow_interrupted) return 1;
+    if (xdrfile_read_int(magic, 1, traj->xtc) != 1) return 1;
+    if (xdrfile_read_int(n_atoms, 1, traj->xtc) != 1) return 1;
+
+    return 0;
+}
+
+/*! @brief Checks whether a complete frame of the trajectory starts at the given offset and is followed either by the end of the file
+ * or by the start of another frame. The coordinates of the frame are not checked. */
+static int is_frame_start(const trajectory_t *traj, const off_t offset)
+{
+    off_t size = frame_size_at(traj, offset);
+    if (size <= 0) return 0;
+    if (offset + size == traj->file_size) return 1;
+
+    unsigned char next[8] = {0};
+    if (pread(traj->fd, next, sizeof(next), offset + size) != sizeof(next)) return 0;
+    return xtc_int(next) == XTC_MAGIC && xtc_int(next + 4) == traj->n_atoms;
+}
+
+/*! @brief Searches for the first frame starting at or after the current offset.
+ *
+ * @paragraph Resynchronization
+ * All xtc items are 4 bytes long, so frames always start at offsets divisible by 4. The file is scanned for the magic number
+ * followed by the number of atoms at these offsets and every candidate is then checked using is_frame_start(),
+ * so coordinates that happen to contain the magic number are not mistaken for the start of a frame.
+ *
+ * @return Zero, if a frame has been found. One, if there is no frame after the offset.
+ */
+static int resync(trajectory_t *traj)
+{
+    unsigned char *chunk = malloc(RESYNC_CHUNK_SIZE);
+    if (chunk == NULL) return 1;
+
+    off_t position = (traj->offset + 3) / 4 * 4;
+    while (position + XTC_HEADER_SIZE <= traj->file_size) {
+        ssize_t n_read = pread(traj->fd, chunk, RESYNC_CHUNK_SIZE, position);
+        if (n_read < 8) break;
+
+        for (ssize_t i = 0; i + 8 <= n_read; i += 4) {
+            if (xtc_int(chunk + i) != XTC_MAGIC || xtc_int(chunk + i + 4) != traj->n_atoms) continue;
+            if (!is_frame_start(traj, position + i)) continue;
+
+            traj->offset = position + i;
+            traj->bytes_read += i;
+            free(chunk);
+            return 0;
+        }
+
+        // consecutive chunks overlap, so the magic number and the number of atoms are never split between them
+        off_t advance = (n_read - 4) / 4 * 4;
+        traj->bytes_read += advance;
+        position += advance;
+    }
+
+    free(chunk);
+    return 1;
+}
+
+/*! @brief Reads the header of the next frame of a regular file. */
+static int file_next(trajectory_t *traj)
+{
+    if (traj->resync) {
+        traj->resync = 0;
+        traj->frame_size = 0;
+        if (resync(traj) != 0) return 1;
+    } else {
+        traj->offset += traj->frame_size;
+        traj->frame_size = 0;
+    }
+
+    // at the end of the file, wait until the next frame is completely written in follow mode
+    off_t size = 0;
+    while ((size = complete_frame_size(traj)) == 0) {
+        if (!traj->follow || follow_interrupted) return 1;
+        wait_for_growth(traj);
+    }
+
+    if (size < 0) {
+        fprintf(stderr, "Invalid xtc frame at offset %lld.\n", (long long) traj->offset);
+        return -1;
+    }
+
+    unsigned char header[XTC_HEADER_SIZE] = {0};
+    if (pread(traj->fd, header, XTC_HEADER_SIZE, traj->offset) != XTC_HEADER_SIZE) {
+        fprintf(stderr, "Could not read header of an xtc frame.\n");
+        return -1;
+    }
+
+    int n_atoms = xtc_int(header + 4);
+    if (n_atoms != traj->n_atoms) {
+        fprintf(stderr, "Number of atoms in an xtc frame (%d) does not match the expected number of atoms (%d).\n", n_atoms, traj->n_atoms);
+        return -1;
+    }
+
+    traj->frame_size = size;
+    traj->bytes_read += size;
+    traj->step = xtc_int(header + 8);
+    traj->time = xtc_float(header + 12);
+
+    return 0;
+}
+
+int trajectory_seek(trajectory_t *traj, const off_t offset)
+{
+    if (traj->stream) {
+        fprintf(stderr, "Streamed trajectories can not be read in random order.\n");
+        return 1;
+    }
+
+    struct stat file_stat;
+    if (fstat(traj->fd, &file_stat) != 0) return 1;
+    traj->file_size = file_stat.st_size;
+
+    traj->resync = 1;
+    traj->offset = offset < 0 ? 0 : offset;
+    traj->frame_size = 0;
+
+    return 0;
+}
+
+int trajectory_next(trajectory_t *traj)
+{
+    if (!traj->stream) return file_next(traj);
+
+    int magic = 0, n_atoms = 0;
+    if (stream_next(traj, &magic, &n_atoms) != 0) return 1;
+    return read_header(traj, magic, n_atoms);
+}
+
+/*! @brief Makes sure that the buffer of the trajectory can hold at least size bytes. Returns zero if successful. */
+static int reserve_buffer(trajectory_t *traj, const size_t size)
+{
+    if (size <= traj->buffer_size) return 0;
+
+    char *new_buffer = realloc(traj->buffer, size);
+    if (new_buffer == NULL) return 1;
+    traj->buffer = new_buffer;
+    traj->buffer_size = size;
+    return 0;
+}
+
+/*! @brief Reads the box and the coordinates of the current frame of a stream. The compressed coordinates are only
+ * decoded (using xtc_decode_coordinates()) if decode is non-zero; otherwise they are just consumed.
+ */
+static int read_stream_frame(trajectory_t *traj, float box[9], const int decode, float *precision)
+{
+    int n_atoms = 0;
+    if (xdrfile_read_float(box, 9, traj->xtc) != 9) return 1;
+    if (xdrfile_read_int(&n_atoms, 1, traj->xtc) != 1 || n_atoms != traj->n_atoms) return 1;
+
+    // small systems are not compressed (see xtc_decode_coordinates())
+    if (n_atoms <= XTC_UNCOMPRESSED_LIMIT) {
+        *precision = -1.0f;
+        return xdrfile_read_float(traj->coordinates, 3 * n_atoms, traj->xtc) != 3 * n_atoms;
+    }
+
+    // precision, minimal and maximal integer coordinates, smallidx and the number of bytes of the compressed data
+    float stored_precision = 0.0;
+    int integers[9] = {0};
+    if (xdrfile_read_float(&stored_precision, 1, traj->xtc) != 1) return 1;
+    if (xdrfile_read_int(integers + 1, 8, traj->xtc) != 8) return 1;
+    memcpy(&integers[0], &stored_precision, sizeof(float));
+
+    int n_bytes = integers[8];
+    if (n_bytes < 0 || reserve_buffer(traj, XTC_COMPRESSED_HEADER_SIZE + (size_t) n_bytes) != 0) return 1;
+
+    // the compressed header is stored in the buffer in its original (big-endian) form, followed by the compressed data
+    for (int i = 0; i < 9; ++i) {
+        uint32_t value = htonl((uint32_t) integers[i]);
+        memcpy(traj->buffer + 4 * i, &value, sizeof(uint32_t));
+    }
+
+    if (n_bytes > 0 && xdrfile_read_opaque(traj->buffer + XTC_COMPRESSED_HEADER_SIZE, n_bytes, traj->xtc) != n_bytes) return 1;
+    if (!decode) return 0;
+
+    return xtc_decode_coordinates((const unsigned char *) traj->buffer, XTC_COMPRESSED_HEADER_SIZE + (size_t) n_bytes,
+            traj->n_atoms, precision, traj->coordinates);
+}
+
+/*! @brief Reads the whole current frame of a regular file into the buffer and decodes it in memory. */
+static int read_file_frame(trajectory_t *traj, float box[9], float *precision)
+{
+    if (reserve_buffer(traj, (size_t) traj->frame_size) != 0) return 1;
+    if (pread(traj->fd, traj->buffer, traj->frame_size, traj->offset) != traj->frame_size) return 1;
+
+    xtc_header_t header;
+    if (xtc_decode((const unsigned char *) traj->buffer, traj->frame_size, traj->n_atoms, &header, precision, traj->coordinates) != 0) return 1;
+
+    memcpy(box, header.box, 9 * sizeof(float));
+    return 0;
+}
+
+int trajectory_read(trajectory_t *traj, system_t *system)
+{
+    float box[9] = {0.0};
+    float precision = 0.0;
+
+    int return_code = traj->stream ? read_stream_frame(traj, box, 1, &precision) : read_file_frame(traj, box, &precision);
+    if (return_code != 0) return 1;
+
+    for (int i = 0; i < traj->n_atoms; ++i) {
+        memcpy(system->atoms[i].position, traj->coordinates + 3 * i, 3 * sizeof(float));
+    }
+
+    // only rectangular boxes are supported
+    system->box[0] = box[0];
+    system->box[1] = box[4];
+    system->box[2] = box[8];
+
+    system->step = traj->step;
+    system->time = traj->time;
+    system->precision = precision;
+
+    return 0;
+}
+
+int trajectory_skip(trajectory_t *traj)
+{
+    // frames of regular files are located using their offsets, so there is nothing to skip
+    if (!traj->stream) return 0;
+
+    float box[9] = {0.0};
+    return read_stream_frame(traj, box, 0, NULL);
+}
+
+void trajectory_close(trajectory_t *traj)
+{
+    if (traj == NULL) return;
+    if (traj->xtc != NULL) xdrfile_close(traj->xtc);
+    if (traj->fd >= 0) close(traj->fd);
+    if (traj->inotify_fd >= 0) close(traj->inotify_fd);
+    free(traj->coordinates);
+    free(traj->buffer);
+    free(traj);
+}
@@ -0,0 +1,137 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <groan.h>
+#include <sys/types.h>
+
+/*! @brief Xtc trajectory opened for frame-by-frame reading. See trajectory_next() for more details. */
+typedef struct trajectory {
+    XDRFILE *xtc;               // xdr stream (streams only)
+    int n_atoms;                // number of atoms expected in every frame
+    int step;                   // simulation step of the current frame
+    float time;                 // simulation time of the current frame [ps]
+    float *coordinates;         // buffer for decompressed coordinates
+    char *buffer;               // buffer for the raw bytes of the current frame
+    size_t buffer_size;
+    int follow;                 // wait for new frames when the end of the file is reached
+    int fd;                     // raw file descriptor used to read frames (-1 for streams)
+    int inotify_fd;             // inotify descriptor watching the file (follow mode only; -1 if not available)
+    off_t offset;               // offset of the current frame in the file
+    off_t frame_size;           // size of the current frame in bytes
+    off_t file_size;            // size of the file when the current frame was read
+    int stream;                 // trajectory is read from a non-seekable stream (stdin or a pipe)
+    int header_pending;         // magic number and number of atoms of the next frame have already been read (streams only)
+    int resync;                 // the next frame must be searched for starting at offset (see trajectory_seek())
+    off_t bytes_read;           // number of bytes of the file read so far (zero for streams)
+} trajectory_t;
+
+
+/*! @brief Opens an xtc file for reading.
+ *
+ * @paragraph Decoding
+ * Frames of regular files are read directly from their offsets in the file (using pread) and decoded in memory
+ * by scramblyzer's own decoder (see xtc_decode()), which produces coordinates identical to the xdrfile library.
+ *
+ * @paragraph Streams
+ * If filename is '-', the trajectory is read from the standard input. Named pipes (FIFOs) and other files
+ * that are not regular files are also read as streams. Streams are read strictly sequentially through
+ * the buffered reader of the xdr library (the compressed coordinates are still decoded by xtc_decode_coordinates()), so e.g. the output of 'gmx trjconv' can be analyzed without writing
+ * it to disk. Offsets and sizes of frames are not known for streams (traj->offset and traj->frame_size stay zero),
+ * and the number of atoms must be checked using trajectory_validate() instead of validate_xtc().
+ *
+ * @paragraph Note on deallocation
+ * The returned pointer must be closed using trajectory_close().
+ *
+ * @param filename          xtc file to read
+ * @param n_atoms           number of atoms expected in every frame of the trajectory
+ *
+ * @return Pointer to trajectory_t structure. NULL, if the file could not be opened.
+ */
+trajectory_t *trajectory_open(const char *filename, const size_t n_atoms);
+
+
+/*! @brief Checks that the trajectory contains the expected number of atoms.
+ *
+ * @paragraph Details
+ * The number of atoms is read from the header of the first frame. Unlike validate_xtc(), the file is not opened again,
+ * so this also works for streams: the header of the first frame is consumed and then reused by trajectory_next().
+ * Must be called before the first call to trajectory_next().
+ *
+ * @return Non-zero, if the first frame contains the expected number of atoms. Else zero (also for an empty trajectory).
+ */
+int trajectory_validate(trajectory_t *traj);
+
+
+/*! @brief Switches the trajectory into follow mode.
+ *
+ * @paragraph Follow mode
+ * In follow mode, the trajectory is expected to be still written into (e.g. by a running simulation).
+ * When the end of the file is reached, trajectory_next() waits for the file to grow instead of returning.
+ * The file is watched using inotify; if inotify is not available, the file size is polled.
+ * Frames are only read once they have been completely written, so truncated trailing frames are never read.
+ * Following is stopped (and trajectory_next() reports the end of the file) when the user interrupts
+ * the program using Ctrl+C (SIGINT). Streams always wait for new frames, so for streams, only the handling
+ * of Ctrl+C is enabled.
+ *
+ * @param traj              trajectory to follow
+ * @param filename          name of the xtc file (the same as used in trajectory_open())
+ *
+ * @return Zero, if successful. Else non-zero.
+ */
+int trajectory_follow(trajectory_t *traj, const char *filename);
+
+
+/*! @brief Moves the trajectory to the first frame starting at or after the given byte offset.
+ *
+ * @paragraph Random access
+ * The next call to trajectory_next() searches the file for the start of the first complete frame at or after the offset
+ * (using the magic number of xtc frames and the number of atoms, see resync()). Following frames can then be read
+ * using trajectory_next() as usual. The trajectory can be moved repeatedly, in any direction.
+ * Streams do not support random access.
+ *
+ * @return Zero, if successful. Else non-zero.
+ */
+int trajectory_seek(trajectory_t *traj, const off_t offset);
+
+
+/*! @brief Reads the header of the next trajectory frame.
+ *
+ * @paragraph Frame offsets
+ * Before the header is read, the size of the frame is determined from its raw bytes, so the offset
+ * and the size of every frame are always known (e.g. for reporting progress). A truncated frame at the end
+ * of the file is treated as the end of the file.
+ *
+ * @paragraph Reading frames
+ * Only the header of the frame (step and time) is read by this function. The rest of the frame
+ * must then be either read using trajectory_read() or skipped using trajectory_skip().
+ * Skipping a frame does not involve decompressing its coordinates and is therefore much faster than reading it.
+ *
+ * @return Zero, if the header has been read. One, if the end of the file has been reached. Negative number in case of an error.
+ */
+int trajectory_next(trajectory_t *traj);
+
+
+/*! @brief Reads the box and coordinates of the current frame into the system.
+ *
+ * @paragraph Note
+ * Must be called after trajectory_next(). Also sets the step and time of the system.
+ *
+ * @return Zero, if successful. Else non-zero.
+ */
+int trajectory_read(trajectory_t *traj, system_t *system);
+
+
+/*! @brief Skips the box and coordinates of the current frame without decompressing them.
+ *
+ * @return Zero, if successful. Else non-zero.
+ */
+int trajectory_skip(trajectory_t *traj);
+
+
+/*! @brief Closes the trajectory and deallocates memory for the trajectory_t structure. */
+void trajectory_close(trajectory_t *traj);
+
+#endif /* TRAJECTORY_H */
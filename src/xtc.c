@@ -0,0 +1,436 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__SSE2__) || defined(__AVX__)
+#include <immintrin.h>
+#endif
+#include "xtc.h"
+
+/*! @brief Sizes of the small integers of the xtc compression (the same table as in xdrfile) */
+static const int MAGICINTS[] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 8, 10, 12, 16, 20, 25, 32, 40, 50, 64,
+    80, 101, 128, 161, 203, 256, 322, 406, 512, 645, 812, 1024, 1290,
+    1625, 2048, 2580, 3250, 4096, 5060, 6501, 8192, 10321, 13003,
+    16384, 20642, 26007, 32768, 41285, 52015, 65536, 82570, 104031,
+    131072, 165140, 208063, 262144, 330280, 416127, 524287, 660561,
+    832255, 1048576, 1321122, 1664510, 2097152, 2642245, 3329021,
+    4194304, 5284491, 6658042, 8388607, 10568983, 13316085, 16777216
+};
+
+/*! @brief First usable index of MAGICINTS */
+static const int FIRSTIDX = 9;
+/*! @brief Number of items in MAGICINTS */
+static const int LASTIDX = (int) (sizeof(MAGICINTS) / sizeof(MAGICINTS[0]));
+
+/*! @brief Number of atoms whose integer coordinates are collected before they are converted to floats at once */
+#define BLOCK_ATOMS 1024
+
+/*! @brief Maximal number of atoms decoded in a single step (one atom followed by a run of up to 10 atoms) */
+#define MAX_STEP_ATOMS 11
+
+/*! @brief Reader of the compressed bit stream (bits are stored from the most significant bit of every byte).
+ * Bits are loaded into a 64-bit buffer a whole word at a time, so most reads are just a shift and a mask.
+ */
+typedef struct bit_reader {
+    const unsigned char *data;
+    size_t size;                // number of bytes of the compressed data
+    size_t position;            // index of the next byte to load into the buffer
+    uint64_t buffer;            // the lowest 'available' bits are the next bits of the stream
+    int available;              // number of bits in the buffer that have not been read yet
+    int overflow;               // set if the reader tried to read beyond the compressed data
+} bit_reader_t;
+
+int xtc_int(const unsigned char *bytes)
+{
+    uint32_t value = 0;
+    memcpy(&value, bytes, sizeof(uint32_t));
+    return (int) ntohl(value);
+}
+
+float xtc_float(const unsigned char *bytes)
+{
+    uint32_t value = (uint32_t) xtc_int(bytes);
+    float result = 0.0f;
+    memcpy(&result, &value, sizeof(float));
+    return result;
+}
+
+off_t xtc_frame_size(const unsigned char *data, const size_t available)
+{
+    if (available < XTC_HEADER_SIZE) return 0;
+    if (xtc_int(data) != XTC_MAGIC) return -1;
+
+    int n_atoms = xtc_int(data + 4);
+    if (n_atoms < 0 || xtc_int(data + XTC_HEADER_SIZE - 4) != n_atoms) return -1;
+
+    if (n_atoms <= XTC_UNCOMPRESSED_LIMIT) return XTC_HEADER_SIZE + 3 * n_atoms * (off_t) sizeof(float);
+
+    if (available < XTC_HEADER_SIZE + XTC_COMPRESSED_HEADER_SIZE) return 0;
+
+    int n_bytes = xtc_int(data + XTC_HEADER_SIZE + XTC_COMPRESSED_HEADER_SIZE - 4);
+    if (n_bytes < 0) return -1;
+
+    // compressed data are padded to a multiple of 4 bytes
+    return XTC_HEADER_SIZE + XTC_COMPRESSED_HEADER_SIZE + ((off_t) n_bytes + 3) / 4 * 4;
+}
+
+/*! @brief Loads a big-endian 64-bit word. */
+static inline uint64_t load_word(const unsigned char *bytes)
+{
+    uint64_t word = 0;
+    memcpy(&word, bytes, sizeof(uint64_t));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return word;
+#else
+    return __builtin_bswap64(word);
+#endif
+}
+
+/*! @brief Fills the buffer of the reader with as many whole bytes as fit into it. */
+static inline void refill(bit_reader_t *reader)
+{
+    int n_bytes = (64 - reader->available) / 8;
+
+    // whole word at once, if the data are long enough
+    if (reader->position + sizeof(uint64_t) <= reader->size) {
+        uint64_t word = load_word(reader->data + reader->position);
+        reader->buffer = n_bytes == 8 ? word : (reader->buffer << (8 * n_bytes)) | (word >> (64 - 8 * n_bytes));
+        reader->available += 8 * n_bytes;
+        reader->position += n_bytes;
+        return;
+    }
+
+    // the last few bytes
+    for (; n_bytes > 0 && reader->position < reader->size; --n_bytes) {
+        reader->buffer = (reader->buffer << 8) | reader->data[reader->position++];
+        reader->available += 8;
+    }
+}
+
+/*! @brief Reads an unsigned integer stored in the next num_of_bits (at most 32) bits (receivebits() of xdrfile).
+ * Reading beyond the end of the data returns zero and sets the overflow flag.
+ */
+static inline unsigned int receive_bits(bit_reader_t *reader, const int num_of_bits)
+{
+    if (reader->available < num_of_bits) {
+        refill(reader);
+        if (reader->available < num_of_bits) {
+            reader->overflow = 1;
+            reader->available = 0;
+            return 0;
+        }
+    }
+
+    reader->available -= num_of_bits;
+    return (unsigned int) ((reader->buffer >> reader->available) & ((UINT64_C(1) << num_of_bits) - 1));
+}
+
+/*! @brief Reads three integers packed into more than 64 bits (only possible for large coordinate ranges).
+ * Byte-by-byte long division of receiveints() of xdrfile.
+ */
+static void receive_long_ints(bit_reader_t *reader, int num_of_bits, const unsigned int sizes[3], int nums[3])
+{
+    int bytes[32] = {0};
+    int num_of_bytes = 0;
+
+    // larger numbers can not be produced by the encoder
+    if (num_of_bits > 8 * 30) {
+        reader->overflow = 1;
+        return;
+    }
+
+    while (num_of_bits > 8) {
+        bytes[num_of_bytes++] = (int) receive_bits(reader, 8);
+        num_of_bits -= 8;
+    }
+    if (num_of_bits > 0) bytes[num_of_bytes++] = (int) receive_bits(reader, num_of_bits);
+
+    for (int i = 2; i > 0; --i) {
+        unsigned int num = 0;
+        for (int j = num_of_bytes - 1; j >= 0; --j) {
+            num = (num << 8) | (unsigned int) bytes[j];
+            unsigned int p = num / sizes[i];
+            bytes[j] = (int) p;
+            num -= p * sizes[i];
+        }
+        nums[i] = (int) num;
+    }
+
+    nums[0] = (int) ((unsigned int) bytes[0] | ((unsigned int) bytes[1] << 8) | ((unsigned int) bytes[2] << 16) | ((unsigned int) bytes[3] << 24));
+}
+
+/*! @brief Reads three integers packed into num_of_bits bits as a single number in mixed radix 'sizes' (receiveints() of xdrfile).
+ *
+ * @paragraph Byte order
+ * The number is stored as a sequence of bytes starting with the least significant byte (the last byte may be shorter),
+ * but the bits of every byte are stored from the most significant bit. Up to four bytes are therefore read at once
+ * and reversed. Numbers of up to 64 bits (all numbers except for very large coordinate ranges) are then split
+ * into the three integers using native 64-bit (or 32-bit, if the number is small enough) divisions instead of
+ * the byte-by-byte long division of xdrfile. The results are identical.
+ */
+static inline void receive_ints(bit_reader_t *reader, const int num_of_bits, const unsigned int sizes[3], int nums[3])
+{
+    if (num_of_bits > 64) {
+        receive_long_ints(reader, num_of_bits, sizes, nums);
+        return;
+    }
+
+    // the last byte contains 1 to 8 bits
+    int full_bytes = (num_of_bits - 1) / 8;
+    uint64_t value = 0;
+    int shift = 0;
+
+    while (full_bytes > 0) {
+        int n_bytes = full_bytes < 4 ? full_bytes : 4;
+        uint32_t chunk = receive_bits(reader, 8 * n_bytes);
+        value |= (uint64_t) (__builtin_bswap32(chunk) >> (32 - 8 * n_bytes)) << shift;
+        shift += 8 * n_bytes;
+        full_bytes -= n_bytes;
+    }
+    value |= (uint64_t) receive_bits(reader, num_of_bits - shift) << shift;
+
+    if (value >> 32 == 0) {
+        uint32_t small = (uint32_t) value;
+        nums[2] = (int) (small % sizes[2]);
+        small /= sizes[2];
+        nums[1] = (int) (small % sizes[1]);
+        nums[0] = (int) (small / sizes[1]);
+        return;
+    }
+
+    nums[2] = (int) (value % sizes[2]);
+    value /= sizes[2];
+    nums[1] = (int) (value % sizes[1]);
+    nums[0] = (int) (uint32_t) (value / sizes[1]);
+}
+
+/*! @brief Converts integer coordinates to floats (multiplied by inv_precision). The same operations as in xdrfile
+ * are performed (conversion with rounding to nearest and a single-precision multiplication), only for several
+ * coordinates at once, so the results are bit-for-bit identical.
+ */
+static inline void convert_coordinates(const int32_t *integers, float *coordinates, const size_t n, const float inv_precision)
+{
+    size_t i = 0;
+
+#if defined(__AVX__)
+    const __m256 scale8 = _mm256_set1_ps(inv_precision);
+    for (; i + 8 <= n; i += 8) {
+        __m256i values = _mm256_loadu_si256((const __m256i *) (const void *) (integers + i));
+        _mm256_storeu_ps(coordinates + i, _mm256_mul_ps(_mm256_cvtepi32_ps(values), scale8));
+    }
+#endif
+
+#if defined(__SSE2__)
+    const __m128 scale4 = _mm_set1_ps(inv_precision);
+    for (; i + 4 <= n; i += 4) {
+        __m128i values = _mm_loadu_si128((const __m128i *) (const void *) (integers + i));
+        _mm_storeu_ps(coordinates + i, _mm_mul_ps(_mm_cvtepi32_ps(values), scale4));
+    }
+#endif
+
+    for (; i < n; ++i) coordinates[i] = (float) integers[i] * inv_precision;
+}
+
+/*! @brief Returns the number of bits needed to store integers up to size (sizeofint() of xdrfile). */
+static int size_of_int(const unsigned int size)
+{
+    unsigned int num = 1;
+    int num_of_bits = 0;
+
+    while (size >= num && num_of_bits < 32) {
+        ++num_of_bits;
+        num <<= 1;
+    }
+
+    return num_of_bits;
+}
+
+/*! @brief Returns the number of bits needed to store three integers in mixed radix 'sizes' (sizeofints() of xdrfile). */
+static int size_of_ints(const unsigned int sizes[3])
+{
+    unsigned int bytes[32] = {0};
+    unsigned int num_of_bytes = 1;
+    bytes[0] = 1;
+
+    for (int i = 0; i < 3; ++i) {
+        unsigned int tmp = 0;
+        unsigned int bytecnt = 0;
+        for (bytecnt = 0; bytecnt < num_of_bytes; ++bytecnt) {
+            tmp = bytes[bytecnt] * sizes[i] + tmp;
+            bytes[bytecnt] = tmp & 0xff;
+            tmp >>= 8;
+        }
+        while (tmp != 0) {
+            bytes[bytecnt++] = tmp & 0xff;
+            tmp >>= 8;
+        }
+        num_of_bytes = bytecnt;
+    }
+
+    unsigned int num = 1;
+    int num_of_bits = 0;
+    --num_of_bytes;
+    while (bytes[num_of_bytes] >= num) {
+        ++num_of_bits;
+        num *= 2;
+    }
+
+    return num_of_bits + (int) num_of_bytes * 8;
+}
+
+/*! @brief Decompresses the coordinates of a frame (xdrfile_decompress_coord_float() of xdrfile). Returns zero if successful. */
+static int decompress_coordinates(const unsigned char *data, const size_t size, const int n_atoms, float *precision, float *coordinates)
+{
+    if (size < XTC_COMPRESSED_HEADER_SIZE) return 1;
+
+    *precision = xtc_float(data);
+    int minint[3] = { xtc_int(data + 4), xtc_int(data + 8), xtc_int(data + 12) };
+    int maxint[3] = { xtc_int(data + 16), xtc_int(data + 20), xtc_int(data + 24) };
+    int smallidx = xtc_int(data + 28);
+    int n_bytes = xtc_int(data + 32);
+
+    if (n_bytes < 0 || (size_t) n_bytes > size - XTC_COMPRESSED_HEADER_SIZE) return 1;
+    if (smallidx < FIRSTIDX || smallidx >= LASTIDX) return 1;
+
+    unsigned int sizeint[3] = {0}, bitsizeint[3] = {0}, sizesmall[3] = {0};
+    for (int d = 0; d < 3; ++d) sizeint[d] = (unsigned int) maxint[d] - (unsigned int) minint[d] + 1;
+
+    // sizes too large to be multiplied are stored separately
+    int bitsize = 0;
+    if ((sizeint[0] | sizeint[1] | sizeint[2]) > 0xffffff) {
+        for (int d = 0; d < 3; ++d) bitsizeint[d] = (unsigned int) size_of_int(sizeint[d]);
+    } else {
+        bitsize = size_of_ints(sizeint);
+    }
+
+    int tmp = smallidx - 1 > FIRSTIDX ? smallidx - 1 : FIRSTIDX;
+    int smaller = MAGICINTS[tmp] / 2;
+    int smallnum = MAGICINTS[smallidx] / 2;
+    sizesmall[0] = sizesmall[1] = sizesmall[2] = (unsigned int) MAGICINTS[smallidx];
+
+    bit_reader_t reader = { .data = data + XTC_COMPRESSED_HEADER_SIZE, .size = (size_t) n_bytes };
+
+    // integer coordinates are collected in blocks and converted to floats at once
+    int32_t block[3 * BLOCK_ATOMS];
+    size_t filled = 0;
+    const float inv_precision = (float) (1.0 / *precision);
+    float *output = coordinates;
+    int run = 0;
+    int i = 0;
+
+    while (i < n_atoms) {
+        if (filled + 3 * MAX_STEP_ATOMS > 3 * BLOCK_ATOMS) {
+            convert_coordinates(block, output, filled, inv_precision);
+            output += filled;
+            filled = 0;
+        }
+
+        int thiscoord[3] = {0};
+        int prevcoord[3] = {0};
+
+        if (bitsize == 0) {
+            for (int d = 0; d < 3; ++d) thiscoord[d] = (int) receive_bits(&reader, (int) bitsizeint[d]);
+        } else {
+            receive_ints(&reader, bitsize, sizeint, thiscoord);
+        }
+
+        ++i;
+        for (int d = 0; d < 3; ++d) {
+            thiscoord[d] += minint[d];
+            prevcoord[d] = thiscoord[d];
+        }
+
+        // the run length is only stored when it changes
+        int is_smaller = 0;
+        if (receive_bits(&reader, 1) == 1) {
+            run = (int) receive_bits(&reader, 5);
+            is_smaller = run % 3;
+            run -= is_smaller;
+            --is_smaller;
+        }
+
+        if (reader.overflow || i + run / 3 > n_atoms) return 1;
+
+        if (run > 0) {
+            // atoms of a run are stored as small differences from the previous atom
+            for (int k = 0; k < run; k += 3) {
+                receive_ints(&reader, smallidx, sizesmall, thiscoord);
+                ++i;
+                for (int d = 0; d < 3; ++d) thiscoord[d] += prevcoord[d] - smallnum;
+
+                if (k == 0) {
+                    // the first two atoms of a run are interchanged (better compression of water molecules)
+                    for (int d = 0; d < 3; ++d) {
+                        int swap = thiscoord[d];
+                        thiscoord[d] = prevcoord[d];
+                        prevcoord[d] = swap;
+                    }
+                    for (int d = 0; d < 3; ++d) block[filled++] = prevcoord[d];
+                } else {
+                    for (int d = 0; d < 3; ++d) prevcoord[d] = thiscoord[d];
+                }
+
+                for (int d = 0; d < 3; ++d) block[filled++] = thiscoord[d];
+            }
+        } else {
+            for (int d = 0; d < 3; ++d) block[filled++] = thiscoord[d];
+        }
+
+        smallidx += is_smaller;
+        if (smallidx < FIRSTIDX || smallidx >= LASTIDX) return 1;
+
+        if (is_smaller < 0) {
+            smallnum = smaller;
+            smaller = smallidx > FIRSTIDX ? MAGICINTS[smallidx - 1] / 2 : 0;
+        } else if (is_smaller > 0) {
+            smaller = smallnum;
+            smallnum = MAGICINTS[smallidx] / 2;
+        }
+        sizesmall[0] = sizesmall[1] = sizesmall[2] = (unsigned int) MAGICINTS[smallidx];
+    }
+
+    convert_coordinates(block, output, filled, inv_precision);
+    return reader.overflow;
+}
+
+int xtc_decode(
+        const unsigned char *data,
+        const size_t size,
+        const int n_atoms,
+        xtc_header_t *header,
+        float *precision,
+        float *coordinates)
+{
+    off_t frame_size = xtc_frame_size(data, size);
+    if (frame_size <= 0 || (size_t) frame_size > size) return 1;
+
+    header->n_atoms = xtc_int(data + 4);
+    header->step = xtc_int(data + 8);
+    header->time = xtc_float(data + 12);
+    for (int i = 0; i < 9; ++i) header->box[i] = xtc_float(data + 16 + 4 * i);
+
+    if (header->n_atoms != n_atoms) return 1;
+
+    return xtc_decode_coordinates(data + XTC_HEADER_SIZE, (size_t) frame_size - XTC_HEADER_SIZE, n_atoms, precision, coordinates);
+}
+
+int xtc_decode_coordinates(
+        const unsigned char *data,
+        const size_t size,
+        const int n_atoms,
+        float *precision,
+        float *coordinates)
+{
+    // small systems are not compressed; xdrfile reports their precision as -1
+    if (n_atoms <= XTC_UNCOMPRESSED_LIMIT) {
+        if (size < 3 * (size_t) n_atoms * sizeof(float)) return 1;
+        *precision = -1.0f;
+        for (int i = 0; i < 3 * n_atoms; ++i) coordinates[i] = xtc_float(data + 4 * i);
+        return 0;
+    }
+
+    return decompress_coordinates(data, size, n_atoms, precision, coordinates);
+}
@@ -0,0 +1,102 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef XTC_H
+#define XTC_H
+
+#include <stdlib.h>
+#include <sys/types.h>
+
+/*! @brief Magic number at the start of every xtc frame */
+#define XTC_MAGIC 1995
+
+/*! @brief Size of the xtc frame header (magic, natoms, step, time), box and the second natoms in bytes */
+#define XTC_HEADER_SIZE 56
+
+/*! @brief Size of the compressed coordinates header (precision, minint, maxint, smallidx, byte count) in bytes */
+#define XTC_COMPRESSED_HEADER_SIZE 36
+
+/*! @brief Up to this number of atoms, coordinates in xtc frames are not compressed */
+#define XTC_UNCOMPRESSED_LIMIT 9
+
+/*! @brief Header of a single xtc frame. */
+typedef struct xtc_header {
+    int n_atoms;
+    int step;
+    float time;                 // [ps]
+    float box[9];               // box vectors [nm]
+} xtc_header_t;
+
+
+/*! @brief Reads a big-endian (xdr) integer from the provided bytes. */
+int xtc_int(const unsigned char *bytes);
+
+
+/*! @brief Reads a big-endian (xdr) float from the provided bytes. */
+float xtc_float(const unsigned char *bytes);
+
+
+/*! @brief Calculates the size of an xtc frame from its first bytes.
+ *
+ * @param data          bytes of the frame (at least XTC_HEADER_SIZE + XTC_COMPRESSED_HEADER_SIZE bytes
+ *                      or the whole frame, whichever is shorter)
+ * @param available     number of available bytes
+ *
+ * @return Size of the frame in bytes. Zero if more bytes are needed to determine the size. Negative number if the data
+ * do not start with a valid xtc frame.
+ */
+off_t xtc_frame_size(const unsigned char *data, const size_t available);
+
+
+/*! @brief Decodes a complete xtc frame stored in memory.
+ *
+ * @paragraph Decoder
+ * This is an independent implementation of the xtc decompression algorithm of the xdrfile library
+ * (xdrfile_decompress_coord_float()) working directly on a memory buffer, so a frame can be read from any offset
+ * of the file without the xdr stream. The decoded coordinates are bit-for-bit identical to those decoded by xdrfile
+ * (this can be verified for any trajectory using the xtccheck module). All reads are bounds-checked,
+ * so corrupted frames are reported as errors.
+ *
+ * @paragraph Performance
+ * The compressed bits are read from a 64-bit buffer that is refilled a whole word at a time, packed integers
+ * are split using native 64-bit divisions instead of byte-by-byte long division, and integer coordinates
+ * (including whole runs of small differences) are collected in blocks that are converted to floats using
+ * SSE2/AVX instructions, if available. The bit stream itself can only be decoded sequentially.
+ *
+ * @param data          bytes of the frame (xtc_frame_size() bytes)
+ * @param size          number of bytes of the frame
+ * @param n_atoms       expected number of atoms
+ * @param header        pointer to which the header of the frame is saved
+ * @param precision     pointer to which the precision of the coordinates is saved (-1 for uncompressed frames, as in xdrfile)
+ * @param coordinates   array of 3 * n_atoms floats into which the coordinates are decoded
+ *
+ * @return Zero, if successful. Else non-zero.
+ */
+int xtc_decode(
+        const unsigned char *data,
+        const size_t size,
+        const int n_atoms,
+        xtc_header_t *header,
+        float *precision,
+        float *coordinates);
+
+
+/*! @brief Decodes the coordinates of an xtc frame stored in memory (the part of the frame following the header).
+ *
+ * @param data          bytes of the frame following the second number of atoms (for compressed frames,
+ *                      the compressed header followed by the compressed data)
+ * @param size          number of available bytes
+ * @param n_atoms       number of atoms of the frame
+ * @param precision     pointer to which the precision of the coordinates is saved (-1 for uncompressed frames, as in xdrfile)
+ * @param coordinates   array of 3 * n_atoms floats into which the coordinates are decoded
+ *
+ * @return Zero, if successful. Else non-zero.
+ */
+int xtc_decode_coordinates(
+        const unsigned char *data,
+        const size_t size,
+        const int n_atoms,
+        float *precision,
+        float *coordinates);
+
+#endif /* XTC_H */
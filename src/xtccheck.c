@@ -0,0 +1,255 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#include <fcntl.h>
+#include "general.h"
+#include "xtccheck.h"
+#include "xtc.h"
+#include "profile.h"
+
+/*! @brief Results of checking a single xtc file. */
+typedef struct xtccheck_result {
+    size_t n_frames;            // number of checked frames
+    size_t n_identical;         // number of frames decoded identically by both decoders
+    double bytes;               // size of the checked frames in bytes
+    double time;                // time spent in xtc_decode() [s]
+    double reference_time;      // time spent in read_xtc() [s]
+    size_t repeats;             // number of times each frame was decoded by xtc_decode()
+} xtccheck_result_t;
+
+void print_usage_xtccheck(void)
+{
+    printf("\nUsage: scramblyzer xtccheck [OPTIONS] FILE.xtc [FILE.xtc ...]\n");
+    printf("\nValid OPTIONS for the xtccheck module:\n");
+    printf("-h               print this message and exit\n");
+    printf("-r INTEGER       number of times each frame is decoded for the benchmark (default: 3)\n");
+    printf("\n");
+}
+
+int get_arguments_xtccheck(
+        const int argc,
+        char **argv,
+        char ***xtc_files,
+        size_t *n_files,
+        size_t *repeats)
+{
+    int opt = 0;
+    while((opt = getopt(argc - 1, argv + 1, "r:h")) != -1) {
+        switch (opt) {
+        // help
+        case 'h':
+            return 1;
+        // number of repeats of the benchmark
+        case 'r': {
+            long parsed = 0;
+            if (sscanf(optarg, "%ld", &parsed) != 1 || parsed < 1) {
+                fprintf(stderr, "Number of repeats must be positive.\n");
+                return 1;
+            }
+            *repeats = (size_t) parsed;
+            break;
+        }
+        default:
+            return 1;
+        }
+    }
+
+    // all remaining arguments are xtc files
+    if (optind >= argc - 1) {
+        fprintf(stderr, "At least one xtc file must be supplied.\n");
+        return 1;
+    }
+
+    *xtc_files = argv + 1 + optind;
+    *n_files = (size_t) (argc - 1 - optind);
+    return 0;
+}
+
+/*! @brief Reports the first difference between the frame decoded by xdrfile and the frame decoded by xtc_decode(). */
+static void report_difference(
+        const char *xtc_file,
+        const size_t frame,
+        const int step,
+        const float time,
+        matrix box,
+        const float precision,
+        rvec *reference,
+        const xtc_header_t *header,
+        const float own_precision,
+        const float *coordinates,
+        const int n_atoms)
+{
+    fprintf(stderr, "Frame %zu (step %d) of %s differs:", frame, step, xtc_file);
+
+    if (header->step != step) fprintf(stderr, " step %d vs %d", step, header->step);
+    if (memcmp(&header->time, &time, sizeof(float))) fprintf(stderr, " time %.9g vs %.9g", time, header->time);
+    if (memcmp(header->box, box, 9 * sizeof(float))) fprintf(stderr, " box");
+    if (memcmp(&own_precision, &precision, sizeof(float))) fprintf(stderr, " precision %.9g vs %.9g", precision, own_precision);
+
+    for (int i = 0; i < 3 * n_atoms; ++i) {
+        const float *expected = &reference[i / 3][i % 3];
+        if (memcmp(expected, coordinates + i, sizeof(float))) {
+            fprintf(stderr, " atom %d, coordinate %d: %.9g vs %.9g", i / 3 + 1, i % 3, *expected, coordinates[i]);
+            break;
+        }
+    }
+
+    fprintf(stderr, "\n");
+}
+
+/*! @brief Decodes all frames of a file using both decoders and compares them. Returns zero if all frames could be read. */
+static int check_file(char *xtc_file, xtccheck_result_t *result)
+{
+    int n_atoms = 0;
+    if (read_xtc_natoms(xtc_file, &n_atoms) != exdrOK || n_atoms <= 0) {
+        fprintf(stderr, "File %s could not be read as an xtc file.\n", xtc_file);
+        return 1;
+    }
+
+    XDRFILE *xdr = xdrfile_open(xtc_file, "r");
+    int fd = open(xtc_file, O_RDONLY);
+    rvec *reference = malloc(n_atoms * sizeof(rvec));
+    float *coordinates = malloc(3 * n_atoms * sizeof(float));
+    unsigned char *buffer = NULL;
+    size_t buffer_size = 0;
+
+    if (xdr == NULL || fd < 0 || reference == NULL || coordinates == NULL) {
+        fprintf(stderr, "File %s could not be read as an xtc file.\n", xtc_file);
+        if (xdr != NULL) xdrfile_close(xdr);
+        if (fd >= 0) close(fd);
+        free(reference);
+        free(coordinates);
+        return 1;
+    }
+
+    int failed = 0;
+    off_t offset = 0;
+    while (1) {
+        int step = 0;
+        float time = 0.0f, precision = 0.0f;
+        matrix box = {{0.0f}};
+
+        double start = profile_now();
+        int status = read_xtc(xdr, n_atoms, &step, &time, box, reference, &precision);
+        result->reference_time += profile_now() - start;
+
+        // raw bytes of the same frame
+        unsigned char header[XTC_HEADER_SIZE + XTC_COMPRESSED_HEADER_SIZE] = {0};
+        ssize_t n_read = pread(fd, header, sizeof(header), offset);
+        off_t frame_size = n_read > 0 ? xtc_frame_size(header, (size_t) n_read) : 0;
+
+        if (status != exdrOK) {
+            if (n_read != 0) {
+                fprintf(stderr, "Frame %zu of %s could not be read by xdrfile (error %d); the rest of the file is not checked.\n", result->n_frames, xtc_file, status);
+                failed = 1;
+            }
+            break;
+        }
+
+        if (frame_size <= 0) {
+            fprintf(stderr, "Could not determine the size of frame %zu of %s.\n", result->n_frames, xtc_file);
+            failed = 1;
+            break;
+        }
+
+        if ((size_t) frame_size > buffer_size) {
+            unsigned char *new_buffer = realloc(buffer, frame_size);
+            if (new_buffer == NULL) {
+                fprintf(stderr, "Could not allocate memory for frame %zu of %s.\n", result->n_frames, xtc_file);
+                failed = 1;
+                break;
+            }
+            buffer = new_buffer;
+            buffer_size = frame_size;
+        }
+
+        if (pread(fd, buffer, frame_size, offset) != frame_size) {
+            fprintf(stderr, "Could not read frame %zu of %s.\n", result->n_frames, xtc_file);
+            failed = 1;
+            break;
+        }
+
+        xtc_header_t own_header = {0};
+        float own_precision = 0.0f;
+        int decode_status = 0;
+
+        start = profile_now();
+        for (size_t r = 0; r < result->repeats; ++r) {
+            decode_status |= xtc_decode(buffer, frame_size, n_atoms, &own_header, &own_precision, coordinates);
+        }
+        result->time += profile_now() - start;
+
+        if (decode_status != 0) {
+            fprintf(stderr, "Frame %zu of %s could not be decoded by scramblyzer.\n", result->n_frames, xtc_file);
+        } else if (own_header.step == step &&
+                   !memcmp(&own_header.time, &time, sizeof(float)) &&
+                   !memcmp(own_header.box, box, 9 * sizeof(float)) &&
+                   !memcmp(&own_precision, &precision, sizeof(float)) &&
+                   !memcmp(coordinates, reference, 3 * n_atoms * sizeof(float))) {
+            ++result->n_identical;
+        } else if (result->n_identical == result->n_frames) {
+            // only the first difference is reported
+            report_difference(xtc_file, result->n_frames, step, time, box, precision, reference, &own_header, own_precision, coordinates, n_atoms);
+        }
+
+        ++result->n_frames;
+        result->bytes += frame_size;
+        offset += frame_size;
+    }
+
+    xdrfile_close(xdr);
+    close(fd);
+    free(reference);
+    free(coordinates);
+    free(buffer);
+
+    return failed;
+}
+
+/*! @brief Prints the results of a check. */
+static void print_result(const xtccheck_result_t *result)
+{
+    double megabytes = result->bytes / (1024.0 * 1024.0);
+
+    printf(">>> frames:           %zu (%.2f MB compressed)\n", result->n_frames, megabytes);
+    printf(">>> identical frames: %zu%s\n", result->n_identical, result->n_identical == result->n_frames ? "" : " (DIFFERENCES FOUND)");
+    if (result->time > 0.0) printf(">>> scramblyzer:      %.1f MB/s per thread\n", megabytes * result->repeats / result->time);
+    if (result->reference_time > 0.0) printf(">>> xdrfile:          %.1f MB/s per thread (including reading)\n", megabytes / result->reference_time);
+    if (result->time > 0.0 && result->reference_time > 0.0) {
+        printf(">>> speedup:          %.2fx\n", (result->reference_time * result->repeats) / result->time);
+    }
+}
+
+int calc_xtccheck(char **xtc_files, const size_t n_files, const size_t repeats)
+{
+    xtccheck_result_t total = {0};
+    total.repeats = repeats;
+    int failed = 0;
+
+    for (size_t f = 0; f < n_files; ++f) {
+        xtccheck_result_t result = {0};
+        result.repeats = repeats;
+
+        printf("%sFile %s:\n", f > 0 ? "\n" : "", xtc_files[f]);
+        failed |= check_file(xtc_files[f], &result);
+        print_result(&result);
+
+        total.n_frames += result.n_frames;
+        total.n_identical += result.n_identical;
+        total.bytes += result.bytes;
+        total.time += result.time;
+        total.reference_time += result.reference_time;
+    }
+
+    if (n_files > 1) {
+        printf("\nAll %zu files:\n", n_files);
+        print_result(&total);
+    }
+
+    if (total.n_identical != total.n_frames) {
+        fprintf(stderr, "\nDecoded frames differ from xdrfile.\n");
+        return 1;
+    }
+
+    return failed;
+}
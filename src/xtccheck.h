@@ -0,0 +1,46 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef XTCCHECK_H
+#define XTCCHECK_H
+
+#include <groan.h>
+#include <unistd.h>
+
+/*! @brief Prints supported flags and arguments of this module */
+void print_usage_xtccheck(void);
+
+
+/*! @brief Parses command line arguments for the xtccheck module. Xtc files to check are all arguments that are not options.
+ *
+ * @return Zero, if parsing has been successful. Else returns non-zero.
+ */
+int get_arguments_xtccheck(
+        const int argc,
+        char **argv,
+        char ***xtc_files,
+        size_t *n_files,
+        size_t *repeats);
+
+
+/*! @brief Checks that scramblyzer's xtc decoder reproduces the xdrfile library and measures the speed of both decoders.
+ *
+ * @paragraph Verification
+ * Every frame of every file is decoded both by the xdrfile library (read_xtc()) and by xtc_decode(). Step, time,
+ * box, precision and all coordinates must be bit-for-bit identical; the first difference in each file is reported.
+ *
+ * @paragraph Benchmark
+ * The throughput of both decoders is reported in MB of compressed input per second of a single thread.
+ * The frames are decoded by xtc_decode() from memory (repeats times), so only the decoding is timed.
+ * xdrfile can only decode frames from a file, so its time also includes its buffered reading of the file
+ * (from the page cache, as the file has just been read).
+ *
+ * @param xtc_files         xtc files to check
+ * @param n_files           number of xtc files
+ * @param repeats           number of times each frame is decoded by xtc_decode() for the benchmark
+ *
+ * @return Zero, if all frames of all files are identical. Else non-zero.
+ */
+int calc_xtccheck(char **xtc_files, const size_t n_files, const size_t repeats);
+
+#endif /* XTCCHECK_H */